@@ -2,6 +2,7 @@
 #include <mysql++/mysql++.h>
 #include <string>
 #include "log.h"
+#include "coroutine/coscheduler.h"
 #include "yamlutil.h"
 #include "threadpool/threadpool.h"
 
@@ -206,24 +207,45 @@ _Connection::_Connection()
     Config();
 }
 
+/*
+ * Queries are made by CoScheduler::Blocking(), parking the calling
+ * coroutine rather than the worker.
+ */
+
 int Insert(DBItem &_row) {
     _row.OnDataPrepared();
-    return _Connection::Instance().Insert(_row);
+    int ret = -1;
+    CoScheduler::Blocking([&] {
+        ret = _Connection::Instance().Insert(_row);
+    });
+    return ret;
 }
 
 int Update(DBItem &_o, DBItem &_n) {
     _o.OnDataPrepared();
     _n.OnDataPrepared();
-    return _Connection::Instance().Update(_o, _n);
+    int ret = -1;
+    CoScheduler::Blocking([&] {
+        ret = _Connection::Instance().Update(_o, _n);
+    });
+    return ret;
 }
 
 int Query(const char *_sql, std::vector<std::string> &_res) {
-    return _Connection::Instance().Query(_sql, _res);
+    int ret = -1;
+    CoScheduler::Blocking([&] {
+        ret = _Connection::Instance().Query(_sql, _res);
+    });
+    return ret;
 }
 
 int QueryExist(DBItem &_row, bool &_exist) {
     _row.OnDataPrepared();
-    return _Connection::Instance().QueryExist(_row, _exist);
+    int ret = -1;
+    CoScheduler::Blocking([&] {
+        ret = _Connection::Instance().QueryExist(_row, _exist);
+    });
+    return ret;
 }
 
 bool IsConnected() { return _Connection::Instance().IsConnected(); }
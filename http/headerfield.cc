@@ -1,6 +1,7 @@
 #include "headerfield.h"
 #include "log.h"
 #include <cstring>
+#include <strings.h>
 #include "strutil.h"
 
 
@@ -99,6 +100,9 @@ std::map<std::string, std::string> &HeaderField::AsMap() { return header_fields_
 bool HeaderField::ParseFromString(std::string &_from) {
     std::vector<std::string> headers;
     str::split(_from, "\r\n", headers);
+    if (headers.empty() && !_from.empty()) {
+        headers.push_back(_from);   // a single header.
+    }
     for (auto & header_str : headers) {
         std::vector<std::string> header_pair;
         str::split(header_str, ": ", header_pair);
@@ -124,7 +128,8 @@ void HeaderField::AppendToBuffer(AutoBuffer &_out_buff) {
 bool HeaderField::__IsConnection(const char *_value) const {
     const char *connection = Get(kConnection);
     if (connection) {
-        return 0 == strcmp(connection, _value);
+        // Tokens are case-insensitive, e.g. "Keep-Alive".
+        return 0 == strcasecmp(connection, _value);
     }
     return false;
 }
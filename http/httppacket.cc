@@ -29,17 +29,35 @@ size_t http::HttpPacket::ContentLength() const {
     return content_len;
 }
 
+http::THttpVersion http::HttpPacket::Version() const {
+    return kUnknownVer;
+}
+
+bool http::HttpPacket::IsKeepAlive() const {
+    if (Version() == kHTTP_1_1) {
+        return !headers_.IsConnectionClose();
+    }
+    return headers_.IsKeepAlive();
+}
+
+bool http::HttpPacket::Recycle() {
+    headers_.Reset();
+    body_.ResetAndShrink(kMaxRetainedBuffer);
+    return true;
+}
+
 http::HttpPacket::~HttpPacket() = default;
 
-void http::HttpPacket::SetBody(char *_ptr, size_t _length) {
-    body_.ShallowCopyFrom(_ptr, _length);
+void http::HttpPacket::SetBody(const char *_ptr, size_t _length) {
+    body_.Reset();
+    body_.Write(_ptr, _length);
 }
 
 
 http::HttpParser::HttpParser(const http::HttpPacket::Ptr& _http_packet,
                              AutoBuffer *_buff)
         : ApplicationProtocolParser(_http_packet, _buff)
-        , http_packet_(_http_packet)
+        , http_packet_(_http_packet.get())
         , position_(TPosition::kNone)
         , headers_(http_packet_->Headers())
         , resolved_len_(0)
@@ -49,12 +67,41 @@ http::HttpParser::HttpParser(const http::HttpPacket::Ptr& _http_packet,
     assert(headers_ && buffer_);
 }
 
+void http::HttpParser::OnApplicationPacketChanged(
+        const ApplicationPacket::Ptr& _new) {
+    http_packet_ = static_cast<http::HttpPacket *>(_new.get());
+    assert(http_packet_);
+    headers_ = http_packet_->Headers();
+}
+
+bool http::HttpParser::Recycle() {
+    position_ = kNone;
+    first_line_len_ = 0;
+    header_len_ = 0;
+    resolved_len_ = 0;
+    application_packet_ = nullptr;
+    http_packet_ = nullptr;
+    headers_ = nullptr;
+    return true;
+}
+
 http::HttpParser::~HttpParser() = default;
 
 bool http::HttpParser::IsEnd() const { return position_ == kEnd; }
 
 bool http::HttpParser::IsErr() const { return position_ == kError; }
 
+bool http::HttpParser::IsHeaderDone() const { return position_ == kBody || position_ == kEnd; }
+
+void http::HttpParser::Reset() {
+    position_ = kNone;
+    first_line_len_ = 0;
+    header_len_ = 0;
+    resolved_len_ = 0;
+}
+
+size_t http::HttpParser::PacketLength() const { return resolved_len_; }
+
 
 
 http::HttpParser::TPosition http::HttpParser::GetPosition() const { return position_; }
@@ -62,17 +109,18 @@ http::HttpParser::TPosition http::HttpParser::GetPosition() const { return posit
 
 bool http::HttpParser::_ResolveHeaders() {
     LogI("Resolve Headers")
-    char *ret = str::strnstr(buffer_->Ptr(resolved_len_),
-                             "\r\n\r\n", buffer_->Length() - resolved_len_);
+    char *begin = buffer_->Ptr(resolved_len_);
+    // From the CRLF ending the first line, in case there are no headers.
+    char *ret = str::strnstr(begin - 2, "\r\n\r\n",
+                             buffer_->Length() - resolved_len_ + 2);
     if (!ret) {
         return false;
     }
     
-    std::string headers_str(buffer_->Ptr(resolved_len_),
-                            ret - buffer_->Ptr(resolved_len_));
+    std::string headers_str(begin, ret > begin ? ret - begin : 0);
     
     if (headers_->ParseFromString(headers_str)) {
-        resolved_len_ += ret - buffer_->Ptr(resolved_len_) + 4;  // 4 for \r\n\r\n
+        resolved_len_ = ret - buffer_->Ptr() + 4;  // 4 for \r\n\r\n
         header_len_ = resolved_len_ - first_line_len_;
         position_ = kBody;
         return true;
@@ -86,25 +134,15 @@ bool http::HttpParser::_ResolveHeaders() {
 
 bool http::HttpParser::_ResolveBody() {
     uint64_t content_length = headers_->ContentLength();
-    if (content_length == 0) {
-        LogI("content_length = 0")
-        position_ = kError;
+    size_t header_end = first_line_len_ + header_len_;
+    if (buffer_->Length() - header_end < content_length) {
         return false;
     }
-    resolved_len_ = buffer_->Length();
-    
-    size_t curr_body_len = buffer_->Length() - first_line_len_ - header_len_;
-    if (content_length < curr_body_len) {
-        LogI("recv more bytes than Content-Length(%llu)", content_length)
-        position_ = kError;
-        return false;
-    } else if (content_length == curr_body_len) {
-        position_ = kEnd;
-        http_packet_->SetBody(buffer_->Ptr(buffer_->Length()
-                    - content_length), content_length);
-        return true;
-    }
-    return false;
+    // Bytes after belong to the next pipelined packet.
+    position_ = kEnd;
+    resolved_len_ = header_end + content_length;
+    http_packet_->SetBody(buffer_->Ptr(header_end), content_length);
+    return true;
 }
 
 int http::HttpParser::DoParse() {
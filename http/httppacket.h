@@ -13,7 +13,7 @@ class HttpParser;
 
 class HttpPacket : public ApplicationPacket {
   public:
-    using Ptr = std::shared_ptr<HttpPacket>;
+    using Ptr = IntrusivePtr<HttpPacket>;
     
     HttpPacket();
     
@@ -23,11 +23,25 @@ class HttpPacket : public ApplicationPacket {
     
     virtual size_t ContentLength() const;
     
+    virtual THttpVersion Version() const;
+    
+    /**
+     * Persistent by default since HTTP/1.1,
+     * HTTP/1.0 opting in by "Connection: keep-alive".
+     */
+    bool IsKeepAlive() const override;
+    
     http::HeaderField *Headers();
     
-    void SetBody(char *_ptr, size_t _length);
+    /**
+     * Copies the body, for the byte array it is
+     * parsed from moves on to the next packet.
+     */
+    void SetBody(const char *_ptr, size_t _length);
     
     virtual AutoBuffer *Body();
+    
+    bool Recycle() override;
 
   protected:
     http::HeaderField   headers_;
@@ -60,8 +74,19 @@ class HttpParser : public ApplicationProtocolParser {
     
     bool IsErr() const override;
     
+    bool IsHeaderDone() const override;
+    
+    void Reset() override;
+    
+    size_t PacketLength() const override;
+    
     TPosition GetPosition() const;
     
+    void OnApplicationPacketChanged(
+            const ApplicationPacket::Ptr& _new) override;
+    
+    bool Recycle() override;
+    
   protected:
     virtual bool _ResolveFirstLine() = 0;
     
@@ -71,7 +96,7 @@ class HttpParser : public ApplicationProtocolParser {
     
   protected:
     TPosition                               position_;
-    http::HttpPacket::Ptr                   http_packet_;
+    http::HttpPacket                      * http_packet_;     // held by application_packet_.
     http::HeaderField                     * headers_;
     size_t                                  first_line_len_;
     size_t                                  header_len_;
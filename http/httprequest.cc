@@ -50,6 +50,17 @@ Parser::Parser(AutoBuffer *_buff, const http::request::HttpRequest::Ptr& _http_r
 
 Parser::~Parser() = default;
 
+void Parser::OnApplicationPacketChanged(const ApplicationPacket::Ptr& _new) {
+    http::HttpParser::OnApplicationPacketChanged(_new);
+    request_line_ = static_cast<HttpRequest *>(http_packet_)->GetRequestLine();
+}
+
+bool Parser::Recycle() {
+    request_line_ = nullptr;
+    is_upgrade_to_ws_ = false;
+    return http::HttpParser::Recycle();
+}
+
 bool Parser::IsUpgradeProtocol() const {
     return is_upgrade_to_ws_;
 }
@@ -95,11 +106,7 @@ bool Parser::_ResolveHeaders() {
 
 bool Parser::_ResolveBody() {
     if (request_line_->GetMethod() == http::THttpMethod::kGET) {
-        if (buffer_->Length() - resolved_len_ > 0) {
-            LogI("GET request has body")
-            position_ = kError;
-            return false;
-        }
+        // Bytes after the headers belong to the next pipelined request.
         position_ = kEnd;
         return true;
     }
@@ -140,6 +147,15 @@ THttpVersion HttpRequest::Version() const { return request_line_.GetVersion(); }
 
 http::RequestLine *HttpRequest::GetRequestLine() { return &request_line_; }
 
+ApplicationPacket::Ptr HttpRequest::AllocNewPacket() {
+    return New<HttpRequest>(Pool());
+}
+
+bool HttpRequest::Recycle() {
+    request_line_ = http::RequestLine();
+    return http::HttpPacket::Recycle();
+}
+
 HttpRequest::~HttpRequest() = default;
 
 }}
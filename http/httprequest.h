@@ -14,7 +14,7 @@ void Pack(const std::string &_host, const std::string &_url,
 
 class HttpRequest : public http::HttpPacket {
   public:
-    using Ptr = std::shared_ptr<HttpRequest>;
+    using Ptr = IntrusivePtr<HttpRequest>;
     
     HttpRequest();
     
@@ -32,7 +32,11 @@ class HttpRequest : public http::HttpPacket {
     
     bool IsMethodPost() const;
     
-    THttpVersion Version() const;
+    THttpVersion Version() const override;
+    
+    ApplicationPacket::Ptr AllocNewPacket() override;
+    
+    bool Recycle() override;
     
   private:
     http::RequestLine   request_line_;
@@ -49,6 +53,11 @@ class Parser : public http::HttpParser {
     bool IsUpgradeProtocol() const override;
     
     TApplicationProtocol ProtocolUpgradeTo() override;
+    
+    void OnApplicationPacketChanged(
+            const ApplicationPacket::Ptr& _new) override;
+    
+    bool Recycle() override;
 
   protected:
     bool _ResolveFirstLine() override;
@@ -39,6 +39,29 @@ void Pack(http::THttpVersion _http_ver, int _resp_code, const char *_status_desc
 
 }
 
+void PackHeaders(http::THttpVersion _http_ver, int _resp_code, const char *_status_desc,
+                 std::map<std::string, std::string> *_headers,
+                 AutoBuffer &_out_buff, size_t _content_length) {
+    
+    _out_buff.Reset();
+    
+    http::StatusLine status_line;
+    status_line.SetStatusCode(_resp_code);
+    status_line.SetStatusDesc(_status_desc);
+    status_line.SetVersion(_http_ver);
+    status_line.AppendToBuffer(_out_buff);
+    
+    HeaderField header_field;
+    if (_headers) {
+        for (auto & header : *_headers) {
+            header_field.InsertOrUpdate(header.first, header.second);
+        }
+    }
+    header_field.InsertOrUpdate(HeaderField::kContentLength,
+                                std::to_string(_content_length));
+    header_field.AppendToBuffer(_out_buff);
+}
+
 
 
 Parser::Parser(AutoBuffer *_buff, const HttpResponse::Ptr& _http_resp)
@@ -50,6 +73,16 @@ Parser::Parser(AutoBuffer *_buff, const HttpResponse::Ptr& _http_resp)
 
 Parser::~Parser() = default;
 
+void Parser::OnApplicationPacketChanged(const ApplicationPacket::Ptr& _new) {
+    http::HttpParser::OnApplicationPacketChanged(_new);
+    status_line_ = static_cast<HttpResponse *>(http_packet_)->getStatusLine();
+}
+
+bool Parser::Recycle() {
+    status_line_ = nullptr;
+    return http::HttpParser::Recycle();
+}
+
 bool Parser::_ResolveFirstLine() {
     LogI("Resolve Status Line")
     char *start = buffer_->Ptr();
@@ -85,8 +118,17 @@ int HttpResponse::StatusCode() const { return status_line_.StatusCode(); }
 
 THttpVersion HttpResponse::Version() const { return status_line_.GetVersion(); }
 
+ApplicationPacket::Ptr HttpResponse::AllocNewPacket() {
+    return New<HttpResponse>(Pool());
+}
+
 std::string &HttpResponse::StatusDesc() { return status_line_.StatusDesc(); }
 
+bool HttpResponse::Recycle() {
+    status_line_ = http::StatusLine();
+    return http::HttpPacket::Recycle();
+}
+
 HttpResponse::~HttpResponse() = default;
 
 
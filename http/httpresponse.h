@@ -11,10 +11,18 @@ void Pack(http::THttpVersion _http_ver, int _resp_code, const char *_status_desc
           std::map<std::string, std::string> *_headers,
           AutoBuffer &_out_buff, std::string *_send_body = nullptr);
 
+/**
+ * Packs the status line and headers only, the body of
+ * @param{_content_length} bytes being sent separately, e.g. by sendfile(2).
+ */
+void PackHeaders(http::THttpVersion _http_ver, int _resp_code, const char *_status_desc,
+                 std::map<std::string, std::string> *_headers,
+                 AutoBuffer &_out_buff, size_t _content_length);
+
 
 class HttpResponse : public http::HttpPacket {
   public:
-    using Ptr = std::shared_ptr<HttpResponse>;
+    using Ptr = IntrusivePtr<HttpResponse>;
     
     HttpResponse();
     
@@ -24,10 +32,14 @@ class HttpResponse : public http::HttpPacket {
     
     int StatusCode() const;
     
-    THttpVersion Version() const;
+    THttpVersion Version() const override;
     
     std::string &StatusDesc();
     
+    ApplicationPacket::Ptr AllocNewPacket() override;
+    
+    bool Recycle() override;
+    
   private:
     http::StatusLine    status_line_;
 };
@@ -39,6 +51,11 @@ class Parser : public http::HttpParser {
     Parser(AutoBuffer *_buff, const HttpResponse::Ptr& _http_resp);
     
     ~Parser() override;
+    
+    void OnApplicationPacketChanged(
+            const ApplicationPacket::Ptr& _new) override;
+    
+    bool Recycle() override;
 
   protected:
     bool _ResolveFirstLine() override;
@@ -1,5 +1,6 @@
 #include "websocketpacket.h"
 #include <cassert>
+#include <algorithm>
 #include "log.h"
 #include "messagedigest.h"
 #include "base64.h"
@@ -210,11 +211,25 @@ void WebSocketPacket::Reset() {
 }
 
 ApplicationPacket::Ptr WebSocketPacket::AllocNewPacket() {
-    auto neo = std::make_shared<WebSocketPacket>();
+    auto neo = New<WebSocketPacket>(Pool());
     neo->is_hand_shaken_ = true;
     return neo;
 }
 
+bool WebSocketPacket::Recycle() {
+    Reset();
+    first_byte_ = 0x81;
+    fin_ = false;
+    op_code_ = 0;
+    is_hand_shaken_ = false;
+    handshake_req_.Reset();
+    handshake_resp_.Reset();
+    if (payload_.capacity() > kMaxRetainedBuffer) {
+        std::string().swap(payload_);
+    }
+    return true;
+}
+
 
 WebSocketParser::WebSocketParser(AutoBuffer *_buff,
                                  const WebSocketPacket::Ptr& _packet,
@@ -224,7 +239,7 @@ WebSocketParser::WebSocketParser(AutoBuffer *_buff,
         , position_(kNone)
         , resolved_len_(0) {
     
-    ws_packet_ = std::dynamic_pointer_cast<ws::WebSocketPacket>(application_packet_);
+    ws_packet_ = _packet.get();
     ws_packet_->SetHandShakeReqHeader(_handshake_req);
 }
 
@@ -282,7 +297,7 @@ bool WebSocketParser::IsEnd() const { return position_ == kEnd; }
 
 void WebSocketParser::OnApplicationPacketChanged(
         const ApplicationPacket::Ptr& _neo) {
-    ws_packet_ = std::dynamic_pointer_cast<ws::WebSocketPacket>(_neo);
+    ws_packet_ = static_cast<ws::WebSocketPacket *>(_neo.get());
     assert(ws_packet_);
 }
 
@@ -336,9 +351,8 @@ bool WebSocketParser::_ResolveExtendedPayloadLen() {
         }
         size_t extended_payload_len = 0;
         for (int i = 0; i < 8; ++i) {
-            int shift = (7 - i) * 8;
             uint8_t c = *buffer_->Ptr(resolved_len_++);
-            extended_payload_len += (c << shift) & (0xff << shift);
+            extended_payload_len = (extended_payload_len << 8) | c;
         }
         ws_packet_->SetExtendedPayloadLen(extended_payload_len);
         
@@ -367,19 +381,29 @@ bool WebSocketParser::_ResolveMaskingKey() {
 }
 
 bool WebSocketParser::_ResolvePayload() {
-    size_t unresolved_len = buffer_->Length() - resolved_len_;
+    size_t payload_len = ws_packet_->PayloadLen();
+    if (payload_len >= 126) {
+        payload_len = ws_packet_->ExtendedPayloadLen();
+    }
+    std::string &payload = ws_packet_->Payload();
+    
+    // Takes this frame only, those after stay in the byte array.
+    size_t unresolved_len = std::min(buffer_->Length() - resolved_len_,
+                                     payload_len - payload.size());
     if (unresolved_len <= 0) {
+        if (payload_len == 0) {
+            position_ = kEnd;
+        }
         return false;
     }
-    size_t payload_len = ws_packet_->PayloadLen();
-    std::string &payload = ws_packet_->Payload();
     
     bool mask = ws_packet_->IsMasked();
     uint8_t *masking_key = ws_packet_->MaskingKey();
     
-    for (int i = 0; i < unresolved_len; ++i) {
+    size_t offset = payload.size();
+    for (size_t i = 0; i < unresolved_len; ++i) {
         uint8_t raw = *buffer_->Ptr(resolved_len_ + i);
-        uint8_t decoded = mask ? raw ^ masking_key[i % 4] : raw;
+        uint8_t decoded = mask ? raw ^ masking_key[(offset + i) % 4] : raw;
         payload += (char) decoded;
     }
     
@@ -397,9 +421,10 @@ void WebSocketParser::Reset() {
     LogI("reset ws parser")
     position_ = kNone;
     resolved_len_ = 0;
-    buffer_->Reset();
 }
 
+size_t WebSocketParser::PacketLength() const { return resolved_len_; }
+
 WebSocketParser::~WebSocketParser() = default;
 
 }
@@ -10,7 +10,7 @@ void Pack(std::string &_content, AutoBuffer &_out);
 
 class WebSocketPacket : public ApplicationPacket {
   public:
-    using Ptr = std::shared_ptr<WebSocketPacket>;
+    using Ptr = IntrusivePtr<WebSocketPacket>;
     
     static const char *const    kHandShakeMagicKey;
     static const uint8_t        kOpcodeText;
@@ -94,6 +94,11 @@ class WebSocketPacket : public ApplicationPacket {
     
     ApplicationPacket::Ptr AllocNewPacket() override;
     
+    /**
+     * Back to before the hand shake.
+     */
+    bool Recycle() override;
+    
   private:
     bool                        is_hand_shaken_;
     http::HeaderField           handshake_req_;
@@ -168,8 +173,17 @@ class WebSocketParser : public ApplicationProtocolParser {
     
     bool IsEnd() const override;
     
+    /**
+     * Keeps the byte array, the bytes after
+     * the frame parsed being the next frames.
+     */
     void Reset() override;
     
+    /**
+     * @return: bytes of the frame parsed.
+     */
+    size_t PacketLength() const override;
+    
     void OnApplicationPacketChanged(
             const ApplicationPacket::Ptr&) override;
 
@@ -185,7 +199,7 @@ class WebSocketParser : public ApplicationProtocolParser {
     bool _ResolvePayload();
 
   private:
-    WebSocketPacket::Ptr        ws_packet_;
+    WebSocketPacket           * ws_packet_;     // held by application_packet_.
     TPosition                   position_;
     size_t                      resolved_len_;
 };
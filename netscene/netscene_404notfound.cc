@@ -5,7 +5,7 @@
 #include "log.h"
 
 
-std::string NetScene404NotFound::k404Resp;
+file::FileRegion NetScene404NotFound::k404Resp;
 
 NetScene404NotFound::NetScene404NotFound()
         : NetSceneCustom() {
@@ -13,8 +13,9 @@ NetScene404NotFound::NetScene404NotFound()
         std::string curr(__FILE__);
         std::string path404 = curr.substr(0, curr.rfind('/')) + "/res/404.html";
         
-        if (!file::ReadFile(path404.c_str(), k404Resp)) {
-            LogE("read 404.html failed")
+        k404Resp = file::FileRegion(file::CachedFile::Open(path404));
+        if (!k404Resp.file) {
+            LogE("open 404.html failed")
             assert(false);
         }
     NETSCENE_INIT_END
@@ -38,11 +39,15 @@ const char *NetScene404NotFound::ContentType() {
 }
 
 void *NetScene404NotFound::Data() {
-    return (void *) k404Resp.data();
+    return nullptr;
 }
 
 size_t NetScene404NotFound::Length() {
-    return k404Resp.size();
+    return 0;
+}
+
+const file::FileRegion *NetScene404NotFound::FileBody() {
+    return k404Resp.file ? &k404Resp : nullptr;
 }
 
 const char *NetScene404NotFound::Route() {
@@ -18,12 +18,14 @@ class NetScene404NotFound : public NetSceneCustom {
     
     size_t Length() override;
     
+    const file::FileRegion *FileBody() override;
+    
     const char *Route() override;
     
     const char *ContentType() override;
 
 private:
-    static std::string  k404Resp;
+    static file::FileRegion     k404Resp;
     
 };
 
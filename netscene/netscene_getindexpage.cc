@@ -122,7 +122,7 @@ DBItemVisit::~DBItemVisit() = default;
 
 
 const char *const NetSceneGetFavIcon::kUrlRoute = "/favicon.ico";
-std::string NetSceneGetFavIcon::kFavIconData;
+file::FileRegion NetSceneGetFavIcon::kFavIcon;
 
 NetSceneGetFavIcon::NetSceneGetFavIcon()
         : NetSceneCustom() {
@@ -130,8 +130,9 @@ NetSceneGetFavIcon::NetSceneGetFavIcon()
         std::string curr(__FILE__);
         std::string path404 = curr.substr(0, curr.rfind('/')) + "/res/favicon.png";
         
-        if (!file::ReadFile(path404.c_str(), kFavIconData)) {
-            LogE("read favicon.jpeg failed")
+        kFavIcon = file::FileRegion(file::CachedFile::Open(path404));
+        if (!kFavIcon.file) {
+            LogE("open favicon.png failed")
             assert(false);
         }
     NETSCENE_INIT_END
@@ -146,9 +147,13 @@ int NetSceneGetFavIcon::DoSceneImpl(const std::string &_in_buffer) {
     return 0;
 }
 
-void *NetSceneGetFavIcon::Data() { return (void *) kFavIconData.data(); }
+void *NetSceneGetFavIcon::Data() { return nullptr; }
 
-size_t NetSceneGetFavIcon::Length() { return kFavIconData.size(); }
+size_t NetSceneGetFavIcon::Length() { return 0; }
+
+const file::FileRegion *NetSceneGetFavIcon::FileBody() {
+    return kFavIcon.file ? &kFavIcon : nullptr;
+}
 
 const char *NetSceneGetFavIcon::Route() { return kUrlRoute; }
 
@@ -76,12 +76,14 @@ class NetSceneGetFavIcon : public NetSceneCustom {
     
     size_t Length() override;
     
+    const file::FileRegion *FileBody() override;
+    
     const char *Route() override;
     
     const char *ContentType() override;
 
   private:
     static const char *const    kUrlRoute;
-    static std::string          kFavIconData;
+    static file::FileRegion     kFavIcon;
     
 };
\ No newline at end of file
@@ -19,6 +19,8 @@ void NetSceneBase::__ShowHttpHeader(AutoBuffer &_out) {
 
 std::string &NetSceneBase::GetRespBuffer() { return resp_buffer_; }
 
+const file::FileRegion *NetSceneBase::FileBody() { return nullptr; }
+
 
 void NetSceneBase::CustomHttpHeaders(std::map<std::string, std::string> &_headers) {
     // implement if needed.
@@ -4,6 +4,7 @@
 #include <map>
 #include "socket/unixsocket.h"
 #include "autobuffer.h"
+#include "fileutil.h"
 #include <atomic>
 
 #define NETSCENE_INIT_START     static std::atomic_flag has_init = ATOMIC_FLAG_INIT; \
@@ -66,6 +67,15 @@ class NetSceneBase {
     
     virtual size_t Length() = 0;
     
+    /**
+     * Instead of Data() and Length(), a NetScene serving a file
+     * can return which part of it to send, which the framework sends
+     * by sendfile(2) without reading the file into user space.
+     *
+     * @return: nullptr by default, sending Data() as usual.
+     */
+    virtual const file::FileRegion *FileBody();
+    
     
     /**
      * A NetSceneCustom can choose to bind a url route.
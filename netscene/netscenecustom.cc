@@ -11,7 +11,9 @@ bool NetSceneCustom::IsUseProtobuf() {
 
 int NetSceneCustom::DoScene(const std::string &_in_buffer) {
     int ret = DoSceneImpl(_in_buffer);
-    resp_buffer_ = std::string((const char *) Data(), Length());
+    if (!FileBody()) {
+        resp_buffer_ = std::string((const char *) Data(), Length());
+    }
 //    __ShowHttpHeader(out_buff);
     return ret;
 }
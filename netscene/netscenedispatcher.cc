@@ -97,8 +97,8 @@ void NetSceneDispatcher::NetSceneWorker::HandleImpl(tcp::RecvContext::Ptr _recv_
 void NetSceneDispatcher::NetSceneWorker::HandleHttp(
                         const tcp::RecvContext::Ptr &_recv_ctx) {
     /* Handle Http */
-    auto http_request = std::dynamic_pointer_cast<http::request::HttpRequest>(
-            _recv_ctx->application_packet);
+    auto *http_request = static_cast<http::request::HttpRequest *>(
+            _recv_ctx->application_packet.get());
     
     SOCKET fd = _recv_ctx->fd;
     AutoBuffer *http_body = http_request->Body();
@@ -151,7 +151,7 @@ void NetSceneDispatcher::NetSceneWorker::HandleHttp(
         uint64_t cost = ::gettickcount() - start;
         LogI("fd(%d) type(%d), cost %llu ms", fd, type, cost)
     
-        PackHttpRespPacket(net_scene, _recv_ctx->return_packet->buffer);
+        PackHttpRespPacket(net_scene, _recv_ctx->return_packet);
         
     } catch (std::exception &ex) {
         LogE("fd(%d), type: %d, exception occurs during handling net scene: %s",
@@ -181,11 +181,13 @@ void NetSceneDispatcher::NetSceneWorker::HandleOverload(tcp::RecvContext::Ptr _r
     base_resp.SerializeToString(&resp);
     
     if (app_proto == kHttp1_1) {
-        auto http_request = std::dynamic_pointer_cast<http::request::HttpRequest>(
-                _recv_ctx->application_packet);
+        auto *http_request = static_cast<http::request::HttpRequest *>(
+                _recv_ctx->application_packet.get());
         int resp_code = 200;
         
         std::map<std::string, std::string> headers;
+        headers[http::HeaderField::kConnection] = _recv_ctx->return_packet->is_connection_close
+                ? http::HeaderField::kConnectionClose : http::HeaderField::kKeepAlive;
     
         if (http_request->IsMethodPost()) {
             headers[http::HeaderField::kContentType] = http::HeaderField::kOctetStream;
@@ -205,8 +207,8 @@ void NetSceneDispatcher::NetSceneWorker::HandleOverload(tcp::RecvContext::Ptr _r
 void NetSceneDispatcher::NetSceneWorker::HandleWebSocket(
             const tcp::RecvContext::Ptr& _recv_ctx) {
     assert(_recv_ctx->application_packet->Protocol() == kWebSocket);
-    auto ws_packet = std::dynamic_pointer_cast<ws::WebSocketPacket>(
-                _recv_ctx->application_packet);
+    auto *ws_packet = static_cast<ws::WebSocketPacket *>(
+                _recv_ctx->application_packet.get());
     
     if (!ws_packet->IsHandShaken()) {
         bool success = ws_packet->DoHandShake();
@@ -235,6 +237,8 @@ void NetSceneDispatcher::NetSceneWorker::HandleNetSceneException(
             const tcp::RecvContext::Ptr &_recv_ctx) {
     std::map<std::string, std::string> headers;
     headers[http::HeaderField::kConnection] = http::HeaderField::kConnectionClose;
+    // Requests pipelined after it are not answered.
+    _recv_ctx->return_packet->is_connection_close = true;
     
     AutoBuffer &http_resp_msg = _recv_ctx->return_packet->buffer;
     std::string resp("Unixtar encounters an exception during handling net scene.");
@@ -260,7 +264,7 @@ void NetSceneDispatcher::NetSceneWorker::WriteFakeWsResp(
 }
 
 void NetSceneDispatcher::NetSceneWorker::PackHttpRespPacket(
-        NetSceneBase *_net_scene, AutoBuffer &_http_msg) {
+        NetSceneBase *_net_scene, const tcp::SendContext::Ptr &_send_ctx) {
     
     std::map<std::string, std::string> headers;
     
@@ -271,12 +275,20 @@ void NetSceneDispatcher::NetSceneWorker::PackHttpRespPacket(
     } else {
         headers[http::HeaderField::kContentType] = _net_scene->ContentType();
     }
-    headers[http::HeaderField::kConnection] = http::HeaderField::kConnectionClose;
+    headers[http::HeaderField::kConnection] = _send_ctx->is_connection_close
+            ? http::HeaderField::kConnectionClose : http::HeaderField::kKeepAlive;
     
     int resp_code = 200;
     
+    if (const file::FileRegion *file_body = _net_scene->FileBody()) {
+        // Only the headers are copied, the file is sent by sendfile(2).
+        http::response::PackHeaders(http::kHTTP_1_1, resp_code, http::StatusLine::kStatusDescOk,
+                                    &headers, _send_ctx->buffer, file_body->length);
+        _send_ctx->file_body = *file_body;
+        return;
+    }
     http::response::Pack(http::kHTTP_1_1, resp_code, http::StatusLine::kStatusDescOk,
-                         &headers, _http_msg, &_net_scene->GetRespBuffer());
+                         &headers, _send_ctx->buffer, &_net_scene->GetRespBuffer());
     
 }
 
@@ -61,7 +61,7 @@ class NetSceneDispatcher final {
 
       private:
         static void PackHttpRespPacket(NetSceneBase *_net_scene,
-                                         AutoBuffer &_http_msg);
+                                       const tcp::SendContext::Ptr &_send_ctx);
     };
     
   private:
@@ -13,6 +13,10 @@ void ApplicationProtocolParser::SetPacketToParse(ApplicationPacket::Ptr _packet)
     OnApplicationPacketChanged(application_packet_);
 }
 
+bool ApplicationProtocolParser::IsHeaderDone() const {
+    return IsEnd();
+}
+
 bool ApplicationProtocolParser::IsUpgradeProtocol() const {
     return false;
 }
@@ -28,17 +32,48 @@ void ApplicationProtocolParser::OnApplicationPacketChanged(
 }
 
 void ApplicationProtocolParser::Reset() {
-    // Implemented by longlink application protocol,
-    // because longlink protocol reuse parser to parse all packets.
+    // Implemented by protocols parsing more than one packet
+    // per connection, e.g. longlink and persistent http.
+}
+
+size_t ApplicationProtocolParser::PacketLength() const {
+    return buffer_->Length();
+}
+
+bool ApplicationProtocolParser::Recycle() {
+    return false;
 }
 
 ApplicationProtocolParser::~ApplicationProtocolParser() = default;
 
 
-ApplicationPacket::ApplicationPacket() = default;
+const size_t ApplicationPacket::kMaxRetainedBuffer = 64 * 1024;
+
+ApplicationPacket::ApplicationPacket()
+        : ref_cnt_(0)
+        , pool_(nullptr)
+        , next_(nullptr) {
+}
 
 ApplicationPacket::~ApplicationPacket() = default;
 
+void ApplicationPacket::AddRef() {
+    ref_cnt_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ApplicationPacket::Release() {
+    if (ref_cnt_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (pool_ && Recycle()) {
+        pool_->__Release(this);
+    } else {
+        delete this;
+    }
+}
+
+ApplicationPacketPool *ApplicationPacket::Pool() const { return pool_; }
+
 bool ApplicationPacket::IsLongLink() const {
     TApplicationProtocol proto = Protocol();
     if (proto == kWebSocket) {
@@ -50,7 +85,8 @@ bool ApplicationPacket::IsLongLink() const {
 
 ApplicationPacket::Ptr ApplicationPacket::AllocNewPacket() {
     /**
-     * Implemented by long link application protocol,
+     * Implemented by protocols parsing more than one packet
+     * per connection, e.g. long link and persistent http,
      * because we cannot reuse the Packet object in such a condition:
      *
      *      The new packet has been parsed successfully while the
@@ -62,3 +98,78 @@ ApplicationPacket::Ptr ApplicationPacket::AllocNewPacket() {
     return nullptr;
 }
 
+bool ApplicationPacket::IsKeepAlive() const {
+    return false;
+}
+
+bool ApplicationPacket::Recycle() {
+    return false;
+}
+
+
+ApplicationPacketPool::ApplicationPacketPool()
+        : released_(nullptr)
+        , allocated_(0) {
+}
+
+ApplicationPacket *ApplicationPacketPool::__Pop(const std::type_info &_type) {
+    FreeList *free = __FreeListOf(_type);
+    if (!free->head) {
+        // Sorts those released by other threads meanwhile by type.
+        ApplicationPacket *packet = released_.exchange(nullptr, std::memory_order_acquire);
+        while (packet) {
+            ApplicationPacket *next = packet->next_;
+            FreeList *to = __FreeListOf(typeid(*packet));
+            packet->next_ = to->head;
+            to->head = packet;
+            packet = next;
+        }
+        free = __FreeListOf(_type);     // moved if free_ grew.
+    }
+    ApplicationPacket *packet = free->head;
+    if (packet) {
+        free->head = packet->next_;
+        packet->next_ = nullptr;
+    }
+    return packet;
+}
+
+ApplicationPacketPool::FreeList *ApplicationPacketPool::__FreeListOf(
+                                        const std::type_info &_type) {
+    // A few protocols at most.
+    for (auto &free : free_) {
+        if (*free.type == _type) {
+            return &free;
+        }
+    }
+    free_.push_back(FreeList{&_type, nullptr});
+    return &free_.back();
+}
+
+void ApplicationPacketPool::__Release(ApplicationPacket *_packet) {
+    ApplicationPacket *head = released_.load(std::memory_order_relaxed);
+    do {
+        _packet->next_ = head;
+    } while (!released_.compare_exchange_weak(head, _packet,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+}
+
+size_t ApplicationPacketPool::Allocated() const {
+    return allocated_.load(std::memory_order_relaxed);
+}
+
+ApplicationPacketPool::~ApplicationPacketPool() {
+    std::vector<ApplicationPacket *> lists;
+    for (auto &free : free_) {
+        lists.push_back(free.head);
+    }
+    lists.push_back(released_.exchange(nullptr));
+    for (ApplicationPacket *packet : lists) {
+        while (packet) {
+            ApplicationPacket *next = packet->next_;
+            delete packet;
+            packet = next;
+        }
+    }
+}
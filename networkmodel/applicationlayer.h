@@ -1,6 +1,9 @@
 #pragma once
 #include "autobuffer.h"
-#include <memory>
+#include "intrusiveptr.h"
+#include <atomic>
+#include <typeinfo>
+#include <vector>
 
 
 enum TApplicationProtocol {
@@ -21,26 +24,136 @@ const char *const ApplicationProtoToString[kProtocolsMax] = {
 };
 
 
+class ApplicationPacketPool;
+
+
 /**
  * Base class for all application protocol packet.
  */
 class ApplicationPacket {
   public:
-    using Ptr = std::shared_ptr<ApplicationPacket>;
+    using Ptr = IntrusivePtr<ApplicationPacket>;
     
     ApplicationPacket();
     
     virtual ~ApplicationPacket();
     
+    /**
+     * @return: a packet from @param{_pool}, or allocated if nullptr.
+     */
+    template<class Packet>
+    static IntrusivePtr<Packet> New(ApplicationPacketPool *_pool);
+    
+    void AddRef();
+    
+    /**
+     * Goes back to its pool once unreferenced if it
+     * supports Recycle(), may be called from any thread.
+     */
+    void Release();
+    
     bool IsLongLink() const;
     
     virtual TApplicationProtocol Protocol() const = 0;
     
     virtual Ptr AllocNewPacket();
     
+    /**
+     * @return: whether the connection is to go on after this packet,
+     *          e.g. HTTP/1.1 unless "Connection: close".
+     */
+    virtual bool IsKeepAlive() const;
+    
+    /**
+     * Clears the packet, so that it is reused by the next
+     * connection taking over its connection object.
+     *
+     * @return: false if not supported, in which case it is dropped.
+     */
+    virtual bool Recycle();
+    
+    /* Buffers of a recycled packet larger are freed. */
+    static const size_t             kMaxRetainedBuffer;
+    
+  protected:
+    /**
+     * Where AllocNewPacket() takes the next packet from.
+     */
+    ApplicationPacketPool *Pool() const;
+
+  private:
+    friend class ApplicationPacketPool;
+    std::atomic<uint32_t>           ref_cnt_;
+    ApplicationPacketPool         * pool_;
+    ApplicationPacket             * next_;     // of the free lists of the pool.
 };
 
 
+/**
+ * Packets of a NetThread, recycled once neither the parser nor
+ * the worker refers to them, so that parsing a request allocates
+ * nothing in steady state. Kept apart by type, as each protocol
+ * allocates its own.
+ *
+ * Acquire() on the loop only. Packets released by other threads are
+ * pushed onto a lock-free stack, which the loop takes over as a whole
+ * once a free list runs out, so there is no ABA problem.
+ *
+ * Outlives the packets it hands out.
+ */
+class ApplicationPacketPool {
+  public:
+    
+    ApplicationPacketPool();
+    
+    ~ApplicationPacketPool();
+    
+    template<class Packet>
+    IntrusivePtr<Packet> Acquire() {
+        ApplicationPacket *packet = __Pop(typeid(Packet));
+        if (!packet) {
+            packet = new Packet();
+            packet->pool_ = this;
+            allocated_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return IntrusivePtr<Packet>(static_cast<Packet *>(packet));
+    }
+    
+    /**
+     * @return: packets ever allocated.
+     */
+    size_t Allocated() const;
+
+  private:
+    friend class ApplicationPacket;
+    
+    ApplicationPacket *__Pop(const std::type_info &_type);
+    
+    void __Release(ApplicationPacket *_packet);
+    
+    struct FreeList {
+        const std::type_info      * type;
+        ApplicationPacket         * head;
+    };
+    
+    FreeList *__FreeListOf(const std::type_info &_type);
+    
+  private:
+    std::vector<FreeList>               free_;
+    std::atomic<ApplicationPacket *>    released_;
+    std::atomic<size_t>                 allocated_;
+};
+
+
+template<class Packet>
+IntrusivePtr<Packet> ApplicationPacket::New(ApplicationPacketPool *_pool) {
+    if (_pool) {
+        return _pool->Acquire<Packet>();
+    }
+    return IntrusivePtr<Packet>(new Packet());
+}
+
+
 /**
  * Base class for all application protocol parser.
  */
@@ -64,6 +177,12 @@ class ApplicationProtocolParser {
     
     virtual bool IsEnd() const = 0;
     
+    /**
+     * @return: whether the headers of the packet are parsed,
+     *          used to tell header read from body read deadline.
+     */
+    virtual bool IsHeaderDone() const;
+    
     virtual bool IsUpgradeProtocol() const;
     
     virtual TApplicationProtocol ProtocolUpgradeTo();
@@ -71,8 +190,27 @@ class ApplicationProtocolParser {
     virtual void OnApplicationPacketChanged(
             const ApplicationPacket::Ptr& _new);
     
+    /**
+     * Clears the parse state to parse the next packet
+     * on the same connection, the packet is kept.
+     */
     virtual void Reset();
     
+    /**
+     * @return: bytes of the byte array taken by the packet parsed,
+     *          those after belong to the next (pipelined) packet.
+     */
+    virtual size_t PacketLength() const;
+    
+    /**
+     * Clears the parse state and lets go of the packet, the counterpart
+     * of {@link ApplicationPacket::Recycle}. A recycled parser resumes
+     * parsing after {@link SetPacketToParse}.
+     *
+     * @return: false if not supported, in which case it is dropped.
+     */
+    virtual bool Recycle();
+    
   protected:
     ApplicationPacket::Ptr      application_packet_;
     AutoBuffer                * buffer_;
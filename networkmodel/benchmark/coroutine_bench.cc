@@ -0,0 +1,201 @@
+/**
+ * Requests per second of workers whose NetScene waits for a slow mock
+ * database, with 1, 2, 4, 8 and 16 workers taking requests from one
+ * RecvQueue, the way WorkerThread::Run() does:
+ *
+ *      threads: one request at a time, the query blocking the worker;
+ *      coroutines: each request a coroutine, at most kMaxCoroutines in
+ *          flight per worker, the query made by CoScheduler::Blocking()
+ *          on kBlockingThreads threads, as dao does;
+ *      coroutines, async: the query awaited by CoScheduler::Sleep(), as
+ *          with a non-blocking database client, no thread held.
+ *
+ * Usage: coroutine_bench [requests per run] [query latency in millis]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "utils/ringqueue.h"
+#include "utils/coroutine/coscheduler.h"
+
+
+static const size_t kMaxBacklog = 4096;
+static const size_t kBatchSize = 16;
+static const size_t kMaxCoroutines = 1024;
+static const size_t kBlockingThreads = 64;
+
+enum TMode {
+    kThreads,
+    kCoroutines,
+    kCoroutinesAsync,
+};
+
+using RecvQueue = MessageQueue::BoundedRingQueue<size_t,
+                        MessageQueue::kSingle, MessageQueue::kMulti>;
+
+static uint64_t query_millis = 2;
+
+
+/**
+ * As WorkerThread::co_wakeup_, woken by the producer while all the
+ * coroutines are parked, see WorkerThread::WakeForRequests().
+ */
+struct Wakeup {
+    Wakeup() : is_taking(false) {}
+
+    bool WakeForRequests() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return is_taking.load(std::memory_order_relaxed) && event_count.Notify();
+    }
+
+    EventCount          event_count;
+    std::atomic<bool>   is_taking;
+};
+
+
+/**
+ * Parses the request, queries the database, and packs the response.
+ */
+static size_t DoScene(TMode _mode, size_t _request) {
+    size_t hash = _request;
+    for (int i = 0; i < 1000; ++i) {
+        hash = hash * 31 + i;
+    }
+    asm volatile("" : : "r"(hash));     // not optimized out.
+    if (_mode == kCoroutinesAsync) {
+        CoScheduler::Sleep(query_millis);
+    } else {
+        size_t row = 0;
+        CoScheduler::Blocking([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(query_millis));
+            row = _request;
+        });
+        _request = row;
+    }
+    return _request;
+}
+
+static void Work(TMode _mode, RecvQueue &_recv_queue, Wakeup &_wakeup,
+                 std::atomic<size_t> &_answered, std::atomic<size_t> &_checksum) {
+    std::vector<size_t> requests;
+    size_t sum = 0;
+
+    if (_mode == kThreads) {
+        while (true) {
+            requests.clear();
+            if (_recv_queue.pop_up_to(kBatchSize, requests) == 0) {
+                break;  // terminated.
+            }
+            for (size_t request : requests) {
+                sum += DoScene(_mode, request);
+                _answered.fetch_add(1);
+            }
+        }
+        _checksum.fetch_add(sum);
+        return;
+    }
+
+    CoScheduler scheduler(SeparateStackProfile::kDefaultStackSize, &_wakeup.event_count);
+    bool is_terminated = false;
+    while (!is_terminated || scheduler.InFlight() > 0) {
+        size_t room = kMaxCoroutines - scheduler.InFlight();
+        requests.clear();
+        if (room > 0 && !is_terminated) {
+            _recv_queue.pop_up_to(std::min(room, kBatchSize), requests,
+                                  scheduler.InFlight() == 0);
+            is_terminated = requests.empty() && _recv_queue.IsTerminated();
+        }
+        for (size_t request : requests) {
+            scheduler.Spawn([_mode, request, &sum, &_answered] {
+                sum += DoScene(_mode, request);
+                _answered.fetch_add(1);
+            });
+        }
+        scheduler.RunReady();
+        if (requests.empty() && scheduler.InFlight() > 0) {
+            if (room > 0 && !is_terminated) {
+                _wakeup.is_taking.store(true, std::memory_order_seq_cst);
+                scheduler.WaitReady(CoScheduler::Deadline::max(), [&] {
+                    return _recv_queue.approx_size() > 0 || _recv_queue.IsTerminated();
+                });
+                _wakeup.is_taking.store(false, std::memory_order_relaxed);
+            } else {
+                scheduler.WaitReady(CoScheduler::Deadline::max());
+            }
+        }
+    }
+    _checksum.fetch_add(sum);
+}
+
+static double Run(TMode _mode, int _workers, size_t _requests) {
+    RecvQueue recv_queue(kMaxBacklog * 2);
+    std::atomic<size_t> answered(0);
+    std::atomic<size_t> checksum(0);
+
+    std::vector<Wakeup> wakeups(_workers);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < _workers; ++i) {
+        Wakeup *wakeup = &wakeups[i];
+        workers.emplace_back([&, wakeup] {
+            Work(_mode, recv_queue, *wakeup, answered, checksum);
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    size_t pushed = 0;
+    while (answered < _requests) {
+        while (pushed < _requests && pushed - answered < kMaxBacklog) {
+            if (!recv_queue.push_back(++pushed)) {
+                --pushed;
+                break;
+            }
+            for (Wakeup &wakeup : wakeups) {
+                if (wakeup.WakeForRequests()) {
+                    break;
+                }
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    recv_queue.Terminate();
+    for (Wakeup &wakeup : wakeups) {
+        wakeup.WakeForRequests();
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (checksum != _requests * (_requests + 1) / 2) {
+        fprintf(stderr, "lost requests\n");
+        exit(1);
+    }
+    double secs = std::chrono::duration<double>(end - begin).count();
+    return _requests / secs;
+}
+
+
+int main(int _argc, char **_argv) {
+    size_t requests = _argc > 1 ? strtoul(_argv[1], nullptr, 10) : 20000;
+    query_millis = _argc > 2 ? strtoul(_argv[2], nullptr, 10) : 2;
+    CoScheduler::SetBlockingThreadCnt(kBlockingThreads);
+
+    printf("%zu requests per run, query of %llu ms, %zu blocking threads\n",
+           requests, (unsigned long long) query_millis, kBlockingThreads);
+    printf("%8s %16s %16s %24s\n", "workers", "threads (k/s)",
+           "coroutines (k/s)", "coroutines, async (k/s)");
+    for (int workers : {1, 2, 4, 8, 16}) {
+        // Threads are too slow to wait for all the requests.
+        size_t thread_requests = std::min(requests, (size_t) (workers * 1000 / query_millis + 1));
+        printf("%8d %16.2f %16.2f %24.2f\n", workers,
+               Run(kThreads, workers, thread_requests) / 1e3,
+               Run(kCoroutines, workers, requests) / 1e3,
+               Run(kCoroutinesAsync, workers, requests) / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Requests per second through the queues between a NetThread and its
+ * workers: the NetThread pushes requests and drains responses, workers
+ * pop requests and push responses, with 1, 4 and 16 workers.
+ *
+ * Compares ThreadSafeDeque and BoundedRingQueue, each popped and pushed
+ * one element at a time versus in batches (pop_up_to / push_batch /
+ * drain_all), the way WorkerThread::Run() and HandleSend() do.
+ *
+ * Usage: queue_bench [requests per run]
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "utils/messagequeue.h"
+#include "utils/ringqueue.h"
+
+
+static const size_t kMaxBacklog = 4096;
+static const size_t kBatchSize = 16;
+
+using Deque = MessageQueue::ThreadSafeDeque<size_t>;
+using RecvRing = MessageQueue::BoundedRingQueue<size_t,
+                        MessageQueue::kSingle, MessageQueue::kMulti>;
+using SendRing = MessageQueue::BoundedRingQueue<size_t,
+                        MessageQueue::kMulti, MessageQueue::kSingle>;
+
+
+template<class RecvQueue, class SendQueue>
+static double Run(bool _batch, int _workers, size_t _requests) {
+    RecvQueue recv_queue(kMaxBacklog * 2);
+    SendQueue send_queue(kMaxBacklog * 2);
+    std::atomic<size_t> checksum(0);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < _workers; ++i) {
+        workers.emplace_back([&] {
+            std::vector<size_t> requests;
+            std::vector<size_t> responses;
+            size_t sum = 0;
+            while (true) {
+                requests.clear();
+                if (_batch) {
+                    recv_queue.pop_up_to(kBatchSize, requests);
+                } else {
+                    size_t request;
+                    if (recv_queue.pop_front_to(request)) {
+                        requests.push_back(request);
+                    }
+                }
+                if (requests.empty()) {
+                    break;  // terminated.
+                }
+                for (size_t request : requests) {
+                    sum += request;
+                    responses.push_back(request);
+                }
+                if (_batch) {
+                    auto first = responses.begin();
+                    while (first != responses.end()) {
+                        first += send_queue.push_batch(first, responses.end(), false);
+                    }
+                } else {
+                    for (size_t response : responses) {
+                        while (!send_queue.push_back(response, false)) {
+                        }
+                    }
+                }
+                responses.clear();
+            }
+            checksum.fetch_add(sum);
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    size_t pushed = 0;
+    size_t answered = 0;
+    std::vector<size_t> sending;
+    while (answered < _requests) {
+        // Parsed requests are pushed one by one, as they are by the NetThread.
+        while (pushed < _requests && pushed - answered < kMaxBacklog) {
+            if (!recv_queue.push_back(++pushed)) {
+                --pushed;
+                break;
+            }
+        }
+        if (_batch) {
+            sending.clear();
+            answered += send_queue.drain_all(sending);
+        } else {
+            size_t response;
+            while (send_queue.pop_front_to(response, false)) {
+                ++answered;
+            }
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    recv_queue.Terminate();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (checksum != _requests * (_requests + 1) / 2) {
+        fprintf(stderr, "lost requests\n");
+        exit(1);
+    }
+    double secs = std::chrono::duration<double>(end - begin).count();
+    return _requests / secs;
+}
+
+
+int main(int _argc, char **_argv) {
+    size_t requests = _argc > 1 ? strtoul(_argv[1], nullptr, 10) : 2000000;
+
+    printf("%zu requests per run, batch of %zu\n", requests, kBatchSize);
+    printf("%8s %22s %22s %22s %22s\n", "workers", "deque, single (M/s)",
+           "deque, batch (M/s)", "ring, single (M/s)", "ring, batch (M/s)");
+    for (int workers : {1, 4, 16}) {
+        printf("%8d %22.2f %22.2f %22.2f %22.2f\n", workers,
+               Run<Deque, Deque>(false, workers, requests) / 1e6,
+               Run<Deque, Deque>(true, workers, requests) / 1e6,
+               Run<RecvRing, SendRing>(false, workers, requests) / 1e6,
+               Run<RecvRing, SendRing>(true, workers, requests) / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * Heap allocations and time per response on the send path:
+ * MakeSendContext(), packing the response, sending it and
+ * letting go of the context, with and without a SendContextPool.
+ *
+ * Usage: sendcontext_bench [responses]
+ */
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "networkmodel/tcpconnection.h"
+#include "networkmodel/serverbase.h"
+
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t _size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(_size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *_p) noexcept {
+    free(_p);
+}
+
+
+static void Run(const char *_name, tcp::SendContextPool *_pool, int _responses) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    tcp::ConnectionFrom conn(fds[0], "127.0.0.1", 80);
+    conn.SetSendContextPool(_pool);
+    
+    static const char kResponse[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    char drain[256];
+    
+    auto round = [&] {
+        tcp::SendContext::Ptr send_ctx = conn.MakeSendContext();
+        send_ctx->buffer.Write(kResponse, sizeof(kResponse) - 1);
+        ServerBase::NetThreadBase::TrySendAndMarkPendingIfUndone(send_ctx);
+        send_ctx.reset();
+        ssize_t n = ::read(fds[1], drain, sizeof(drain));
+        (void) n;
+    };
+    
+    for (int i = 0; i < 1000; ++i) {    // warm up.
+        round();
+    }
+    
+    uint64_t allocations_before = allocations.load();
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < _responses; ++i) {
+        round();
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t n_allocations = allocations.load() - allocations_before;
+    
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    printf("%-10s %d responses, %.3f allocations/response, %.0f ns/response\n",
+           _name, _responses, (double) n_allocations / _responses, ns / _responses);
+    
+    ::close(fds[1]);
+}
+
+
+int main(int _argc, char **_argv) {
+    int responses = _argc > 1 ? atoi(_argv[1]) : 200000;
+    
+    Run("unpooled", nullptr, responses);
+    
+    tcp::SendContextPool pool;
+    Run("pooled", &pool, responses);
+    printf("pooled     %zu send contexts allocated in total\n", pool.Allocated());
+    return 0;
+}
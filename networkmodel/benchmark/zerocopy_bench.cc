@@ -0,0 +1,178 @@
+/**
+ * Sender cpu time per GB sent, by write(2) versus by MSG_ZEROCOPY
+ * with completions reaped from the error queue, for several send sizes.
+ *
+ * Over loopback the kernel copies MSG_ZEROCOPY data anyway (reported as
+ * "copied"), so compare over a real NIC against a remote sink, e.g.
+ * `nc -l 9000 > /dev/null` on the peer.
+ *
+ * Usage: zerocopy_bench [MB per run] [peer ip] [peer port]
+ */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "socket/unixsocket.h"
+
+
+static double ThreadCpuMs() {
+    timespec ts {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int Connect(const char *_ip, uint16_t _port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_port);
+    inet_pton(AF_INET, _ip, &addr.sin_addr);
+    if (::connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+/**
+ * Connects to a local sink draining on its own thread.
+ */
+static int ConnectLoopback(std::thread &_sink) {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listen_fd, (sockaddr *) &addr, len) < 0 || ::listen(listen_fd, 1) < 0) {
+        perror("bind / listen");
+        exit(1);
+    }
+    ::getsockname(listen_fd, (sockaddr *) &addr, &len);
+
+    _sink = std::thread([listen_fd] {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        ::close(listen_fd);
+        std::vector<char> drain(1 << 20);
+        while (::recv(fd, drain.data(), drain.size(), 0) > 0) {
+        }
+        ::close(fd);
+    });
+    return Connect("127.0.0.1", ntohs(addr.sin_port));
+}
+
+struct Result {
+    double      cpu_ms;
+    double      wall_ms;
+    size_t      zerocopy_sends;
+    size_t      copied;
+};
+
+static Result Run(bool _zerocopy, size_t _send_size, size_t _total,
+                  const char *_peer_ip, uint16_t _peer_port) {
+    std::thread sink;
+    SOCKET fd = _peer_ip ? Connect(_peer_ip, _peer_port) : ConnectLoopback(sink);
+    Socket socket(fd, SOCK_STREAM, true, true);
+    if (_zerocopy && !socket.EnableZeroCopy()) {
+        fprintf(stderr, "SO_ZEROCOPY not supported\n");
+        exit(1);
+    }
+    // Never written after, so it may be referred to by any number of sends.
+    std::string payload(_send_size, 'z');
+
+    Result result {0, 0, 0, 0};
+    size_t inflight = 0;
+
+    auto reap = [&] {
+        uint32_t lo;
+        uint32_t hi;
+        bool is_copied;
+        while (socket.ReadZeroCopyCompletion(&lo, &hi, &is_copied) > 0) {
+            inflight -= hi - lo + 1;
+            result.copied += is_copied ? hi - lo + 1 : 0;
+        }
+    };
+
+    double cpu_begin = ThreadCpuMs();
+    auto begin = std::chrono::steady_clock::now();
+
+    size_t sent = 0;
+    size_t offset = 0;
+    while (sent < _total) {
+        size_t len = std::min(_send_size - offset, _total - sent);
+        ssize_t n;
+        if (_zerocopy) {
+            uint32_t seq;
+            n = socket.SendZeroCopy(payload.data() + offset, len, &seq);
+            if (seq != UINT32_MAX) {
+                ++inflight;
+                ++result.zerocopy_sends;
+            }
+        } else {
+            struct iovec iov = {&payload[offset], len};
+            n = socket.Send(&iov, 1);
+        }
+        if (n < 0) {
+            fprintf(stderr, "send failed\n");
+            exit(1);
+        }
+        sent += n;
+        offset = (offset + n) % _send_size;
+        if (n == 0 || inflight > 0) {
+            pollfd pfd = {fd, (short) (n == 0 ? POLLOUT : 0), 0};
+            ::poll(&pfd, 1, n == 0 ? 100 : 0);
+            if (pfd.revents & POLLERR) {
+                reap();
+            }
+        }
+    }
+    while (inflight > 0) {
+        pollfd pfd = {fd, 0, 0};
+        ::poll(&pfd, 1, 100);
+        reap();
+    }
+
+    result.cpu_ms = ThreadCpuMs() - cpu_begin;
+    result.wall_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - begin).count();
+
+    socket.Close();
+    if (sink.joinable()) {
+        sink.join();
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    size_t total_mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1024;
+    const char *peer_ip = argc > 3 ? argv[2] : nullptr;
+    auto peer_port = (uint16_t) (argc > 3 ? atoi(argv[3]) : 0);
+    size_t total = total_mb << 20;
+    double gb = total / (double) (1 << 30);
+
+    printf("%zu MB per run to %s\n", total_mb, peer_ip ? peer_ip : "loopback");
+    printf("%10s %10s %14s %10s %14s\n", "send size", "path", "cpu ms / GB", "GB / s", "copied sends");
+
+    const size_t kSendSizes[] = {16 << 10, 64 << 10, 256 << 10, 1 << 20, 4 << 20};
+    for (size_t send_size : kSendSizes) {
+        for (bool zerocopy : {false, true}) {
+            Result result = Run(zerocopy, send_size, total, peer_ip, peer_port);
+            char copied[32] = "-";
+            if (zerocopy) {
+                snprintf(copied, sizeof(copied), "%zu/%zu", result.copied, result.zerocopy_sends);
+            }
+            printf("%9zuK %10s %14.1f %10.2f %14s\n", send_size >> 10,
+                   zerocopy ? "zerocopy" : "write", result.cpu_ms / gb,
+                   gb / (result.wall_ms / 1e3), copied);
+        }
+    }
+    return 0;
+}
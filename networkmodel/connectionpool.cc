@@ -0,0 +1,136 @@
+#include "connectionpool.h"
+#include "log.h"
+
+
+namespace tcp {
+
+const size_t ConnectionPool::kDefaultCapacity = 1024;
+const size_t ConnectionPool::kMaxRetainedBuffer = 16 * 1024;
+
+ConnectionPool::Stats::Stats()
+        : acquires(0)
+        , hits(0)
+        , app_layer_hits(0)
+        , releases(0)
+        , drops(0)
+        , pooled(0)
+        , retained_bytes(0)
+        , send_ctx_allocated(0)
+        , recv_ctx_allocated(0)
+        , packet_allocated(0) {
+}
+
+ConnectionPool::ConnectionPool()
+        : capacity_(kDefaultCapacity)
+        , acquires_(0)
+        , hits_(0)
+        , app_layer_hits_(0)
+        , releases_(0)
+        , drops_(0)
+        , pooled_(0)
+        , retained_bytes_(0) {
+}
+
+void ConnectionPool::SetCapacity(size_t _capacity) {
+    capacity_ = _capacity;
+}
+
+template<class Conn>
+Conn *ConnectionPool::__Pop(std::vector<Conn *> &_free) {
+    acquires_.fetch_add(1, std::memory_order_relaxed);
+    if (_free.empty()) {
+        return nullptr;
+    }
+    Conn *conn = _free.back();
+    _free.pop_back();
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    pooled_.fetch_sub(1, std::memory_order_relaxed);
+    retained_bytes_.fetch_sub(sizeof(Conn) + conn->RetainedSize(),
+                              std::memory_order_relaxed);
+    return conn;
+}
+
+ConnectionFrom *ConnectionPool::AcquireFrom(SOCKET _fd, std::string &_ip,
+                                            uint16_t _port) {
+    ConnectionFrom *conn = __Pop(free_from_);
+    if (!conn) {
+        conn = new ConnectionFrom(_fd, _ip, _port);
+        __SetPools(conn);
+        return conn;
+    }
+    conn->Reuse(_fd, _ip, _port);
+    return conn;
+}
+
+ConnectionTo *ConnectionPool::AcquireTo(std::string &_ip, uint16_t _port) {
+    ConnectionTo *conn = __Pop(free_to_);
+    if (!conn) {
+        conn = new ConnectionTo(_ip, _port);
+        __SetPools(conn);
+        return conn;
+    }
+    conn->Reuse(_ip, _port);
+    return conn;
+}
+
+void ConnectionPool::__SetPools(ConnectionProfile *_conn) {
+    _conn->SetSendContextPool(&send_ctx_pool_);
+    _conn->SetRecvContextPool(&recv_ctx_pool_);
+    _conn->SetPacketPool(&packet_pool_);
+}
+
+void ConnectionPool::OnApplicationLayerConfigured(const ConnectionProfile *_conn) {
+    if (_conn->IsApplicationLayerRecycled()) {
+        app_layer_hits_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ConnectionPool::Release(ConnectionProfile *_conn) {
+    if (!_conn) {
+        return;
+    }
+    releases_.fetch_add(1, std::memory_order_relaxed);
+    if (free_from_.size() + free_to_.size() >= capacity_) {
+        drops_.fetch_add(1, std::memory_order_relaxed);
+        delete _conn, _conn = nullptr;
+        return;
+    }
+    _conn->Recycle(kMaxRetainedBuffer);
+    
+    size_t retained = _conn->RetainedSize();
+    if (_conn->GetType() == kAcceptFrom) {
+        free_from_.push_back((ConnectionFrom *) _conn);
+        retained += sizeof(ConnectionFrom);
+    } else {
+        free_to_.push_back((ConnectionTo *) _conn);
+        retained += sizeof(ConnectionTo);
+    }
+    pooled_.fetch_add(1, std::memory_order_relaxed);
+    retained_bytes_.fetch_add(retained, std::memory_order_relaxed);
+}
+
+ConnectionPool::Stats ConnectionPool::GetStats() const {
+    Stats stats;
+    stats.acquires = acquires_.load(std::memory_order_relaxed);
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.app_layer_hits = app_layer_hits_.load(std::memory_order_relaxed);
+    stats.releases = releases_.load(std::memory_order_relaxed);
+    stats.drops = drops_.load(std::memory_order_relaxed);
+    stats.pooled = pooled_.load(std::memory_order_relaxed);
+    stats.retained_bytes = retained_bytes_.load(std::memory_order_relaxed);
+    stats.send_ctx_allocated = send_ctx_pool_.Allocated();
+    stats.recv_ctx_allocated = recv_ctx_pool_.Allocated();
+    stats.packet_allocated = packet_pool_.Allocated();
+    return stats;
+}
+
+ConnectionPool::~ConnectionPool() {
+    for (auto &conn : free_from_) {
+        delete conn, conn = nullptr;
+    }
+    for (auto &conn : free_to_) {
+        delete conn, conn = nullptr;
+    }
+}
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "tcpconnection.h"
+
+
+namespace tcp {
+
+/**
+ * Idle connection objects of a NetThread, recycled instead of being
+ * deleted, together with their byte arrays and parsers, so that short
+ * links churning do not allocate per accept. Connections handed out
+ * take their Send / RecvContexts and packets from the pools here too.
+ *
+ * Touched by the loop of its NetThread only, except GetStats().
+ */
+class ConnectionPool {
+  public:
+    
+    struct Stats {
+        Stats();
+        
+        uint64_t    acquires;
+        uint64_t    hits;               // acquires served by a pooled object.
+        uint64_t    app_layer_hits;     // parsers reused.
+        uint64_t    releases;
+        uint64_t    drops;              // released but deleted, the pool being full.
+        uint64_t    pooled;
+        uint64_t    retained_bytes;     // by the pooled objects, roughly.
+        uint64_t    send_ctx_allocated; // the three stop growing in steady state.
+        uint64_t    recv_ctx_allocated;
+        uint64_t    packet_allocated;
+    };
+    
+    ConnectionPool();
+    
+    ~ConnectionPool();
+    
+    /**
+     * Objects kept at most, 0 disables pooling.
+     * Call it before the NetThread starts.
+     */
+    void SetCapacity(size_t _capacity);
+    
+    ConnectionFrom *AcquireFrom(SOCKET _fd, std::string &_ip, uint16_t _port);
+    
+    ConnectionTo *AcquireTo(std::string &_ip, uint16_t _port);
+    
+    /**
+     * Counts whether @param{_conn} reused its application layer,
+     * call it once the application layer is configured.
+     */
+    void OnApplicationLayerConfigured(const ConnectionProfile *_conn);
+    
+    /**
+     * Takes @param{_conn} back, which must be removed from
+     * the Poller already, or deletes it if the pool is full.
+     */
+    void Release(ConnectionProfile *_conn);
+    
+    /**
+     * Lock-free snapshot, may be called from any thread.
+     */
+    Stats GetStats() const;
+    
+    static const size_t             kDefaultCapacity;
+    /* Byte arrays larger are freed, so that a burst of
+     * large requests does not pin memory forever. */
+    static const size_t             kMaxRetainedBuffer;
+
+  private:
+    template<class Conn>
+    Conn *__Pop(std::vector<Conn *> &_free);
+    
+    void __SetPools(ConnectionProfile *_conn);
+  
+  private:
+    size_t                          capacity_;
+    /* Outlive the connections. */
+    SendContextPool                 send_ctx_pool_;
+    RecvContextPool                 recv_ctx_pool_;
+    ApplicationPacketPool           packet_pool_;
+    std::vector<ConnectionFrom *>   free_from_;
+    std::vector<ConnectionTo *>     free_to_;
+    std::atomic<uint64_t>           acquires_;
+    std::atomic<uint64_t>           hits_;
+    std::atomic<uint64_t>           app_layer_hits_;
+    std::atomic<uint64_t>           releases_;
+    std::atomic<uint64_t>           drops_;
+    std::atomic<uint64_t>           pooled_;
+    std::atomic<uint64_t>           retained_bytes_;
+};
+
+}
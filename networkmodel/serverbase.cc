@@ -1,8 +1,13 @@
 #include "serverbase.h"
 #include <unistd.h>
+#include <cerrno>
+#include <cstdio>
 #include "signalhandler.h"
 #include "log.h"
 #include "timeutil.h"
+#include "cpuutil.h"
+#include "strutil.h"
+#include <algorithm>
 
 
 
@@ -10,12 +15,55 @@ const size_t ServerBase::kDefaultListenBacklog = 4096;
 
 const char *const ServerBase::ServerConfigBase::key_port("port");
 const char *const ServerBase::ServerConfigBase::key_net_thread_cnt("net_thread_cnt");
+const char *const ServerBase::ServerConfigBase::key_header_read_timeout("header_read_timeout");
+const char *const ServerBase::ServerConfigBase::key_body_read_timeout("body_read_timeout");
+const char *const ServerBase::ServerConfigBase::key_keep_alive_timeout("keep_alive_timeout");
+const char *const ServerBase::ServerConfigBase::key_max_requests_per_connection("max_requests_per_connection");
 const char *const ServerBase::ServerConfigBase::key_max_connections("max_connections");
+const char *const ServerBase::ServerConfigBase::key_accept_mode("accept_mode");
+const char *const ServerBase::ServerConfigBase::kAcceptModeAcceptor("acceptor");
+const char *const ServerBase::ServerConfigBase::kAcceptModeReusePort("reuseport");
+const char *const ServerBase::ServerConfigBase::kAcceptModeReusePortCBPF("reuseport_cbpf");
+const char *const ServerBase::ServerConfigBase::kAcceptModeEpollExclusive("epoll_exclusive");
+const char *const ServerBase::ServerConfigBase::key_conn_placement("conn_placement");
+const char *const ServerBase::ServerConfigBase::kConnPlacementModulo("modulo");
+const char *const ServerBase::ServerConfigBase::kConnPlacementLeastConn("least_conn");
+const char *const ServerBase::ServerConfigBase::kConnPlacementLeastBacklog("least_backlog");
+const char *const ServerBase::ServerConfigBase::kConnPlacementP2C("p2c");
+const char *const ServerBase::ServerConfigBase::key_io_backend("io_backend");
+const char *const ServerBase::ServerConfigBase::kIoBackendEpoll("epoll");
+const char *const ServerBase::ServerConfigBase::kIoBackendIoUring("io_uring");
+const char *const ServerBase::ServerConfigBase::key_busy_poll_us("busy_poll_us");
+const char *const ServerBase::ServerConfigBase::key_so_busy_poll_us("so_busy_poll_us");
+const char *const ServerBase::ServerConfigBase::key_connection_pool_size("connection_pool_size");
+const char *const ServerBase::ServerConfigBase::key_zerocopy_threshold("zerocopy_threshold");
+const char *const ServerBase::ServerConfigBase::key_output_high_watermark_kb("output_high_watermark_kb");
+const char *const ServerBase::ServerConfigBase::key_output_low_watermark_kb("output_low_watermark_kb");
+const char *const ServerBase::ServerConfigBase::key_output_buffer_cap_mb("output_buffer_cap_mb");
+const char *const ServerBase::ServerConfigBase::key_buffer_pool_mb("buffer_pool_mb");
+const char *const ServerBase::ServerConfigBase::key_buffer_pool_huge_pages("buffer_pool_huge_pages");
+const char *const ServerBase::ServerConfigBase::key_cpu_affinity("cpu_affinity");
+const char *const ServerBase::ServerConfigBase::key_numa_node("numa_node");
+const char *const ServerBase::ServerConfigBase::kPlacementNone("none");
+const char *const ServerBase::ServerConfigBase::kPlacementAuto("auto");
 
 ServerBase::ServerConfigBase::ServerConfigBase()
         : port(0)
         , net_thread_cnt(0)
         , max_connections(0)
+        , accept_mode(kAcceptor)
+        , conn_placement(kModulo)
+        , io_backend(Poller::kEpoll)
+        , busy_poll_us(0)
+        , so_busy_poll_us(0)
+        , connection_pool_size(tcp::ConnectionPool::kDefaultCapacity)
+        , zerocopy_threshold(0)
+        , max_requests_per_connection(0)
+        , output_high_watermark(tcp::OutputBudget::kDefaultHighWatermark)
+        , output_low_watermark(tcp::OutputBudget::kDefaultLowWatermark)
+        , output_buffer_cap(0)
+        , buffer_pool_size(0)
+        , buffer_pool_huge_pages(false)
         , is_config_done(false) {
 }
 
@@ -23,11 +71,15 @@ ServerBase::ServerConfigBase::ServerConfigBase()
 ServerBase::ServerBase()
         : config_(nullptr)
         , running_(false)
-        , listenfd_(INVALID_SOCKET) {
+        , listenfd_(INVALID_SOCKET)
+        , placement_rand_(std::random_device()()) {
     
 }
 
 ServerBase::~ServerBase() {
+    for (auto & listenfd : reuseport_listenfds_) {
+        delete listenfd, listenfd = nullptr;
+    }
     delete config_, config_ = nullptr;
 }
 
@@ -59,25 +111,186 @@ void ServerBase::Config() {
             yaml::ValueLeaf *port = config_yaml->GetLeaf(ServerConfigBase::key_port);
             port->To(config_->port);
     
-            yaml::ValueLeaf *net_thread_cnt = config_yaml->GetLeaf(
-                    ServerConfigBase::key_net_thread_cnt);
-            net_thread_cnt->To((int &) config_->net_thread_cnt);
+            // Absent or 0: one NetThread per available cpu.
+            if (yaml::ValueLeaf *net_thread_cnt = config_yaml->FindLeaf(
+                        ServerConfigBase::key_net_thread_cnt)) {
+                net_thread_cnt->To((int &) config_->net_thread_cnt);
+            }
+            if (config_->net_thread_cnt == 0) {
+                config_->net_thread_cnt = cpu::AvailableCpuCnt();
+            }
     
+            // In seconds, absent: 10s, 0: no deadline.
+            std::pair<const char *, uint64_t *> deadlines[] = {
+                    {ServerConfigBase::key_header_read_timeout, &config_->deadlines.header_read},
+                    {ServerConfigBase::key_body_read_timeout, &config_->deadlines.body_read},
+                    {ServerConfigBase::key_keep_alive_timeout, &config_->deadlines.keep_alive},
+            };
+            for (auto &deadline : deadlines) {
+                if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(deadline.first)) {
+                    int seconds;
+                    leaf->To(seconds);
+                    if (seconds < 0) {
+                        LogE("Illegal %s: %d", deadline.first, seconds)
+                        seconds = 0;
+                    }
+                    *deadline.second = (uint64_t) seconds * 1000;
+                }
+            }
+            
             yaml::ValueLeaf *max_connections = config_yaml->GetLeaf(
                     ServerConfigBase::key_max_connections);
             max_connections->To((int &) config_->max_connections);
             
+            std::string accept_mode(ServerConfigBase::kAcceptModeAcceptor);
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_accept_mode)) {
+                leaf->To(accept_mode);
+            }
+            if (accept_mode == ServerConfigBase::kAcceptModeAcceptor) {
+                config_->accept_mode = ServerConfigBase::kAcceptor;
+            } else if (accept_mode == ServerConfigBase::kAcceptModeReusePort) {
+                config_->accept_mode = ServerConfigBase::kReusePort;
+            } else if (accept_mode == ServerConfigBase::kAcceptModeReusePortCBPF) {
+                config_->accept_mode = ServerConfigBase::kReusePortCBPF;
+            } else if (accept_mode == ServerConfigBase::kAcceptModeEpollExclusive) {
+                config_->accept_mode = ServerConfigBase::kEpollExclusive;
+            } else {
+                LogE("Illegal accept_mode: %s, choose among: acceptor, reuseport, "
+                     "reuseport_cbpf, epoll_exclusive.", accept_mode.c_str())
+                break;
+            }
+            LogI("accept_mode: %s", accept_mode.c_str())
+            
+            std::string conn_placement(ServerConfigBase::kConnPlacementModulo);
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_conn_placement)) {
+                leaf->To(conn_placement);
+            }
+            if (conn_placement == ServerConfigBase::kConnPlacementModulo) {
+                config_->conn_placement = ServerConfigBase::kModulo;
+            } else if (conn_placement == ServerConfigBase::kConnPlacementLeastConn) {
+                config_->conn_placement = ServerConfigBase::kLeastConnections;
+            } else if (conn_placement == ServerConfigBase::kConnPlacementLeastBacklog) {
+                config_->conn_placement = ServerConfigBase::kLeastBacklog;
+            } else if (conn_placement == ServerConfigBase::kConnPlacementP2C) {
+                config_->conn_placement = ServerConfigBase::kPowerOfTwoChoices;
+            } else {
+                LogE("Illegal conn_placement: %s, choose among: modulo, least_conn, "
+                     "least_backlog, p2c.", conn_placement.c_str())
+                break;
+            }
+            LogI("conn_placement: %s", conn_placement.c_str())
+            
+            std::string io_backend(ServerConfigBase::kIoBackendEpoll);
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_io_backend)) {
+                leaf->To(io_backend);
+            }
+            if (io_backend == ServerConfigBase::kIoBackendEpoll) {
+                config_->io_backend = Poller::kEpoll;
+            } else if (io_backend == ServerConfigBase::kIoBackendIoUring) {
+                config_->io_backend = Poller::kIoUring;
+            } else {
+                LogE("Illegal io_backend: %s, choose among: epoll, io_uring.",
+                     io_backend.c_str())
+                break;
+            }
+            
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_busy_poll_us)) {
+                int busy_poll_us;
+                leaf->To(busy_poll_us);
+                config_->busy_poll_us = busy_poll_us > 0 ? busy_poll_us : 0;
+            }
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_so_busy_poll_us)) {
+                leaf->To(config_->so_busy_poll_us);
+            }
+            LogI("busy_poll_us: %lu, so_busy_poll_us: %d",
+                 config_->busy_poll_us, config_->so_busy_poll_us)
+            
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_connection_pool_size)) {
+                int connection_pool_size;
+                leaf->To(connection_pool_size);
+                config_->connection_pool_size = connection_pool_size > 0
+                                                ? connection_pool_size : 0;
+            }
+            LogI("connection_pool_size: %zu", config_->connection_pool_size)
+            
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_zerocopy_threshold)) {
+                int zerocopy_threshold;
+                leaf->To(zerocopy_threshold);
+                config_->zerocopy_threshold = zerocopy_threshold > 0
+                                              ? zerocopy_threshold : 0;
+            }
+            LogI("zerocopy_threshold: %zu", config_->zerocopy_threshold)
+            
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_max_requests_per_connection)) {
+                int max_requests;
+                leaf->To(max_requests);
+                config_->max_requests_per_connection = max_requests > 0 ? max_requests : 0;
+            }
+            LogI("max_requests_per_connection: %zu", config_->max_requests_per_connection)
+            
+            // In KB and MB, so that int holds them.
+            std::pair<const char *, size_t *> watermarks[] = {
+                    {ServerConfigBase::key_output_high_watermark_kb, &config_->output_high_watermark},
+                    {ServerConfigBase::key_output_low_watermark_kb, &config_->output_low_watermark},
+            };
+            for (auto &watermark : watermarks) {
+                if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(watermark.first)) {
+                    int kb;
+                    leaf->To(kb);
+                    *watermark.second = kb > 0 ? (size_t) kb << 10 : 0;
+                }
+            }
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_output_buffer_cap_mb)) {
+                int mb;
+                leaf->To(mb);
+                config_->output_buffer_cap = mb > 0 ? (size_t) mb << 20 : 0;
+            }
+            if (config_->output_low_watermark > config_->output_high_watermark
+                        && config_->output_high_watermark > 0) {
+                LogE("Illegal %s: above %s, lowered to it",
+                     ServerConfigBase::key_output_low_watermark_kb,
+                     ServerConfigBase::key_output_high_watermark_kb)
+                config_->output_low_watermark = config_->output_high_watermark;
+            }
+            LogI("output watermarks: %zu / %zu B, cap: %zu B per NetThread",
+                 config_->output_high_watermark, config_->output_low_watermark,
+                 config_->output_buffer_cap)
+            
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_buffer_pool_mb)) {
+                int mb;
+                leaf->To(mb);
+                config_->buffer_pool_size = mb > 0 ? (size_t) mb << 20 : 0;
+            }
+            if (yaml::ValueLeaf *leaf = config_yaml->FindLeaf(
+                        ServerConfigBase::key_buffer_pool_huge_pages)) {
+                leaf->To(config_->buffer_pool_huge_pages);
+            }
+            LogI("buffer pool: %zu B per NetThread, huge pages: %d",
+                 config_->buffer_pool_size, config_->buffer_pool_huge_pages)
+            
         } catch (std::exception &exception) {
             LogE("catch yaml exception: %s", exception.what())
             break;
         }
         
-        if (config_->net_thread_cnt < 1) {
-            LogE("Illegal net_thread_cnt: %zu", config_->net_thread_cnt)
+        if ((int) config_->net_thread_cnt < 1) {
+            LogE("Illegal net_thread_cnt: %d", (int) config_->net_thread_cnt)
             break;
         }
-        if (config_->net_thread_cnt > 8) {
-            config_->net_thread_cnt = 8;
+        
+        if (!_ConfigPlacement(config_yaml)) {
+            LogE("_ConfigPlacement failed")
+            break;
         }
         
         if (!_CustomConfig(config_yaml)) {
@@ -91,9 +304,11 @@ void ServerBase::Config() {
     
     yaml::Close(config_yaml);
     
-    assert(_CreateListenFd() >= 0);
-    
-    assert(listenfd_.Bind(AF_INET, config_->port) >= 0);
+    if (config_->accept_mode == ServerConfigBase::kAcceptor
+                || config_->accept_mode == ServerConfigBase::kEpollExclusive) {
+        assert(_CreateListenFd(listenfd_) >= 0);
+        assert(listenfd_.Bind(AF_INET, config_->port) >= 0);
+    }
     
     
     SignalHandler::Instance().RegisterCallback(SIGINT, [this] {
@@ -108,6 +323,34 @@ void ServerBase::AfterConfig() {
             config_->max_connections / net_threads_.size();
     for (NetThreadBase *p : net_threads_) {
         p->SetMaxConnection(max_conn_per_thread);
+        p->SetDeadlines(config_->deadlines);
+        p->SetIoBackend(config_->io_backend);
+        p->SetBusyPoll(config_->busy_poll_us, config_->so_busy_poll_us);
+        p->SetConnectionPoolSize(config_->connection_pool_size);
+        p->SetZeroCopyThreshold(config_->zerocopy_threshold);
+        p->SetMaxRequestsPerConnection(config_->max_requests_per_connection);
+        p->SetOutputLimits(config_->output_high_watermark,
+                           config_->output_low_watermark, config_->output_buffer_cap);
+        p->SetBufferPool(config_->buffer_pool_size, config_->buffer_pool_huge_pages);
+    }
+    LogI("io_backend: %s", Poller::BackendName(net_threads_[0]->IoBackend()))
+    for (size_t i = 0; i < net_threads_.size(); ++i) {
+        if (!config_->cpu_affinity.empty()) {
+            net_threads_[i]->SetCpuAffinity(config_->cpu_affinity[i]);
+        }
+        if (!config_->numa_node.empty()) {
+            net_threads_[i]->SetNumaNode(config_->numa_node[i]);
+        }
+    }
+    if (config_->accept_mode == ServerConfigBase::kReusePort
+                || config_->accept_mode == ServerConfigBase::kReusePortCBPF) {
+        for (size_t i = 0; i < net_threads_.size(); ++i) {
+            auto listenfd = new Socket(INVALID_SOCKET);
+            assert(_CreateListenFd(*listenfd) >= 0);
+            listenfd->SetReusePort();
+            assert(listenfd->Bind(AF_INET, config_->port) >= 0);
+            reuseport_listenfds_.push_back(listenfd);
+        }
     }
 }
 void ServerBase::LoopingEpollWait() {
@@ -122,20 +365,24 @@ void ServerBase::Serve() {
     
     running_ = true;
     
-    assert(listenfd_.Listen(kDefaultListenBacklog) >= 0);
-    
-    socket_epoll_.SetListenFd(listenfd_.FD());
+    if (config_->accept_mode == ServerConfigBase::kAcceptor) {
+        assert(listenfd_.Listen(kDefaultListenBacklog) >= 0);
+        socket_epoll_.AddListenFd(listenfd_.FD(), false);
+    } else {
+        _ListenInNetThreads();
+    }
     
-    epoll_notifier_.SetSocketEpoll(&socket_epoll_);
+    epoll_notifier_.SetPoller(&socket_epoll_);
     
     for (auto &net_thread : net_threads_) {
         net_thread->Start();
     }
     const int kEpollWaitInterval = EpollLoopInterval();
     uint64_t last_invoke = 0;
+    std::vector<Poller::Event> events;
     
     while (running_) {
-        int n_events = socket_epoll_.EpollWait(kEpollWaitInterval);
+        int n_events = socket_epoll_.Poll(kEpollWaitInterval, events);
         
         if (n_events < 0) {
             int epoll_errno = socket_epoll_.GetErrNo();
@@ -145,22 +392,22 @@ void ServerBase::Serve() {
             break;
         }
         
-        for (int i = 0; i < n_events; ++i) {
-            EpollNotifier::Notification probable_notification(
-                    socket_epoll_.GetEpollDataPtr(i));
-            
-            if (_IsNotifyStop(probable_notification)) {
-                LogI("recv notification_stop, break")
-                running_ = false;
-                break;
+        for (auto &event : events) {
+            if (event.flags & Poller::kNotify) {
+                if (_IsNotifyStop()) {
+                    LogI("recv notification_stop, break")
+                    running_ = false;
+                    break;
+                }
+                continue;
             }
             
-            if (auto fd = (SOCKET) socket_epoll_.IsErrSet(i)) {
-                _OnEpollErr(fd);
+            if (event.flags & Poller::kError) {
+                _OnEpollErr((SOCKET) event.data);
                 continue;
             }
 
-            if (socket_epoll_.IsNewConnect(i)) {
+            if (event.flags & Poller::kNewConnect) {
                 _OnConnect();
             }
         }
@@ -168,6 +415,18 @@ void ServerBase::Serve() {
         uint64_t now = ::gettickcount();
         if (now - last_invoke > kEpollWaitInterval) {
             LoopingEpollWait();
+            if (config_->busy_poll_us > 0) {
+                _LogLoopStats();
+            }
+            if (config_->connection_pool_size > 0) {
+                _LogConnectionPoolStats();
+            }
+            if (config_->output_high_watermark > 0 || config_->output_buffer_cap > 0) {
+                _LogOutputBudgetStats();
+            }
+            if (config_->buffer_pool_size > 0) {
+                _LogBufferPoolStats();
+            }
             last_invoke = now;
         }
     }
@@ -183,51 +442,72 @@ void ServerBase::NotifyStop() {
 
 
 const uint32_t ServerBase::ConnectionManager::kInvalidUid = 0;
-const size_t ServerBase::ConnectionManager::kReserveSize = 128;
+// 2^20 connections per NetThread, a slot is
+// reused 2^12 times before its uids repeat.
+const int ServerBase::ConnectionManager::kSlotBits = 20;
+const uint32_t ServerBase::ConnectionManager::kSlotMask = (1u << kSlotBits) - 1;
+const uint32_t ServerBase::ConnectionManager::kGenerationMask = (1u << (32 - kSlotBits)) - 1;
+const uint32_t ServerBase::ConnectionManager::kNoSlot = UINT32_MAX;
 const size_t ServerBase::ConnectionManager::kEnlargeUnit = 128;
 
 ServerBase::ConnectionManager::ConnectionManager()
-        : socket_epoll_(nullptr) {
-    
-    ScopedLock lock(mutex_);
-    pool_.reserve(kReserveSize);
-    pool_.push_back(nullptr);    // pool_[kInvalidUid] not available.
-    for (uint32_t i = kInvalidUid + 1; i < kReserveSize; ++i) {
-        free_places_.push_back(i);
-        pool_.push_back(nullptr);
-    }
+        : free_head_(kNoSlot)
+        , free_tail_(kNoSlot)
+        , conn_cnt_(0)
+        , poller_(nullptr)
+        , connection_pool_(nullptr) {
+    __Enlarge();
 }
 
-void ServerBase::ConnectionManager::SetEpoll(SocketEpoll *_epoll) {
-    if (_epoll) {
-        socket_epoll_ = _epoll;
+void ServerBase::ConnectionManager::SetPoller(Poller *_poller) {
+    if (_poller) {
+        poller_ = _poller;
     }
 }
 
-tcp::ConnectionProfile *ServerBase::ConnectionManager::GetConnection(uint32_t _uid) {
-    assert(_uid > kInvalidUid && _uid < pool_.capacity());
-    ScopedLock lock(mutex_);
-    return pool_[_uid];
+void ServerBase::ConnectionManager::SetConnectionPool(tcp::ConnectionPool *_pool) {
+    connection_pool_ = _pool;
 }
 
-size_t ServerBase::ConnectionManager::CurrConnectionCnt() {
-    ScopedLock lock(mutex_);
-    return pool_.capacity() - free_places_.size();
+uint32_t ServerBase::ConnectionManager::__MakeUid(uint32_t _generation, uint32_t _slot) {
+    return (_generation << kSlotBits) | _slot;
+}
+
+tcp::ConnectionProfile *ServerBase::ConnectionManager::GetConnection(uint32_t _uid) const {
+    uint32_t slot = _uid & kSlotMask;
+    if (_uid == kInvalidUid || slot >= slots_.size()) {
+        return nullptr;
+    }
+    const Slot &entry = slots_[slot];
+    if (entry.generation != _uid >> kSlotBits) {
+        return nullptr;     // deleted, probably reused by another connection.
+    }
+    return entry.conn;
+}
+
+size_t ServerBase::ConnectionManager::CurrConnectionCnt() const {
+    return conn_cnt_.load(std::memory_order_relaxed);
 }
 
 void ServerBase::ConnectionManager::AddConnection(tcp::ConnectionProfile *_conn) {
-    assert(socket_epoll_);
+    assert(poller_);
     assert(_conn);
     
     SOCKET fd = _conn->FD();
     
-    __CheckCapacity();
-    
-    ScopedLock lock(mutex_);
-    
-    uint32_t uid = free_places_.front();
-    free_places_.pop_front();
+    if (free_head_ == kNoSlot) {
+        __Enlarge();
+    }
+    uint32_t slot = free_head_;
+    Slot &entry = slots_[slot];
+    free_head_ = entry.next_free;
+    if (free_head_ == kNoSlot) {
+        free_tail_ = kNoSlot;
+    }
+    entry.next_free = kNoSlot;
+    entry.conn = _conn;
     
+    uint32_t uid = __MakeUid(entry.generation, slot);
     _conn->SetUid(uid);
     
     if (_conn->GetType() == tcp::TConnectionType::kAcceptFrom) {
@@ -238,151 +518,251 @@ void ServerBase::ConnectionManager::AddConnection(tcp::ConnectionProfile *_conn)
              _conn->RemoteIp().c_str(), _conn->RemotePort(), uid)
     }
     
-    pool_[uid] = _conn;
+    conn_cnt_.fetch_add(1, std::memory_order_relaxed);
+    _conn->SetPoller(poller_);
     
-    // While one thread is blocked in a call to epoll_wait(), it is
-    // possible for another thread to add a file descriptor to the
-    // waited-upon epoll instance.  If the new file descriptor becomes
-    // ready, it will cause the epoll_wait() call to unblock.
-    socket_epoll_->AddSocketReadWrite(fd, (uint64_t) _conn);
+    poller_->AddConnection(fd, (uint64_t) _conn);
 }
 
 void ServerBase::ConnectionManager::DelConnection(uint32_t _uid) {
-    ScopedLock lock(mutex_);
-    assert(_uid > kInvalidUid && _uid < pool_.capacity());
-    assert(socket_epoll_);
-    
-    auto &conn = pool_[_uid];
-    assert(conn);
+    assert(poller_);
+    tcp::ConnectionProfile *conn = GetConnection(_uid);
+    if (!conn) {
+        LogE("uid: %u already deleted", _uid)
+        return;
+    }
+    uint32_t slot = _uid & kSlotMask;
+    Slot &entry = slots_[slot];
     
     SOCKET fd = conn->FD();
     
-    socket_epoll_->DelSocket(fd);
+    poller_->DelSocket(fd);
     
-    free_places_.push_front(_uid);
+    entry.conn = nullptr;
+    // Generation 0 is skipped, so that no uid equals kInvalidUid.
+    entry.generation = (entry.generation + 1) & kGenerationMask;
+    if (entry.generation == 0) {
+        entry.generation = 1;
+    }
+    __PushFree(slot);
+    conn_cnt_.fetch_sub(1, std::memory_order_relaxed);
     
-    delete conn, conn = nullptr;
-    LogD("fd(%d), uid: %u, free size: %lu", fd, _uid, free_places_.size())
+    if (connection_pool_) {
+        connection_pool_->Release(conn);
+    } else {
+        delete conn, conn = nullptr;
+    }
+    LogD("fd(%d), uid: %u, conn cnt: %zu", fd, _uid, CurrConnectionCnt())
 }
 
-void ServerBase::ConnectionManager::ClearTimeout() {
-    uint64_t now = ::gettickcount();
-    ScopedLock lock(mutex_);
-    
-    for (auto & conn : pool_) {
-        if (conn && conn->IsTimeout(now)) {
-            LogI("clear fd: %d", conn->FD())
-            socket_epoll_->DelSocket(conn->FD());
-            free_places_.push_front(conn->Uid());
-            delete conn, conn = nullptr;
-        }
+void ServerBase::ConnectionManager::__Enlarge() {
+    size_t curr = slots_.size();
+    if (curr + kEnlargeUnit > kSlotMask + 1) {
+        LogE("too many connections: %zu", curr)
+        assert(false);
+    }
+    slots_.resize(curr + kEnlargeUnit, Slot{nullptr, 1, kNoSlot});
+    for (size_t i = curr; i < slots_.size(); ++i) {
+        __PushFree((uint32_t) i);
     }
 }
 
-void ServerBase::ConnectionManager::__CheckCapacity() {
-    ScopedLock lock(mutex_);
-    if (free_places_.empty()) {
-        size_t curr = pool_.capacity();
-        pool_.resize(curr + kEnlargeUnit, nullptr);
-        for (size_t i = curr; i < pool_.capacity(); ++i) {
-            free_places_.push_back(i);
-        }
+void ServerBase::ConnectionManager::__PushFree(uint32_t _slot) {
+    slots_[_slot].next_free = kNoSlot;
+    if (free_tail_ == kNoSlot) {
+        free_head_ = _slot;
+    } else {
+        slots_[free_tail_].next_free = _slot;
     }
+    free_tail_ = _slot;
 }
 
 ServerBase::ConnectionManager::~ConnectionManager() {
-    ScopedLock lock(mutex_);
-    for (auto & conn : pool_) {
-        if (conn) {
-            delete conn, conn = nullptr;
+    for (auto &entry : slots_) {
+        if (entry.conn) {
+            delete entry.conn, entry.conn = nullptr;
         }
     }
 }
 
 
 
+const int ServerBase::NetThreadBase::kMaxEpollWaitMills = 10 * 1000;
+const size_t ServerBase::NetThreadBase::kMaxAcceptedQueued = 4096;
+
+ServerBase::NetThreadBase::LoopStats::LoopStats()
+        : spin_us(0)
+        , spin_polls(0)
+        , spin_hits(0)
+        , blocking_polls(0)
+        , wakeups(0) {
+}
+
 ServerBase::NetThreadBase::NetThreadBase()
         : Thread()
+        , poller_(&socket_epoll_)
+        , use_buffer_pool_(false)
+        , listen_socket_(nullptr)
+        , busy_poll_us_(0)
+        , so_busy_poll_us_(0)
+        , zerocopy_threshold_(0)
+        , max_requests_per_conn_(0)
+        , spin_us_(0)
+        , spin_polls_(0)
+        , spin_hits_(0)
+        , blocking_polls_(0)
+        , wakeups_(0)
+        , accepted_(kMaxAcceptedQueued)
+        , accepted_cnt_(0)
         , max_connections_(0) {
-    connection_manager_.SetEpoll(&socket_epoll_);
-    epoll_notifier_.SetSocketEpoll(&socket_epoll_);
+    connection_manager_.SetPoller(poller_);
+    connection_manager_.SetConnectionPool(&connection_pool_);
+    epoll_notifier_.SetPoller(poller_);
 }
 
 void ServerBase::NetThreadBase::Run() {
-    LogD("launching NetThread!")
-    int epoll_retry = 3;
+    LogD("launching NetThread on %s!", Poller::BackendName(poller_->Backend()))
+    if (use_buffer_pool_) {
+        BufferPool::BindThread(&buffer_pool_);
+    }
+    int poll_retry = 3;
     
-    const uint64_t clear_timeout_period = 10 * 1000;
-    uint64_t last_clear_ts = 0;
-    std::vector<EpollNotifier::Notification> notifications;
+    std::vector<Poller::Event> events;
+    std::vector<EpollNotifier::Notification *> notifications;
+    uint64_t spin_until = 0;
     
     while (running_) {
         
-        int n_events = socket_epoll_.EpollWait(clear_timeout_period);
+        int timeout = timing_wheel_.NextTimeout();
+        if (timeout < 0 || timeout > kMaxEpollWaitMills) {
+            timeout = kMaxEpollWaitMills;
+        }
+        uint64_t poll_begin = busy_poll_us_ ? ::gettickcountus() : 0;
+        bool is_spinning = poll_begin < spin_until;
+        if (is_spinning) {
+            timeout = 0;
+        }
+        
+        int n_events = poller_->Poll(timeout, events);
+        
+        if (is_spinning) {
+            uint64_t poll_end = ::gettickcountus();
+            spin_us_.fetch_add(poll_end - poll_begin, std::memory_order_relaxed);
+            spin_polls_.fetch_add(1, std::memory_order_relaxed);
+            if (n_events > 0) {
+                spin_hits_.fetch_add(1, std::memory_order_relaxed);
+                spin_until = poll_end + busy_poll_us_;
+            }
+        } else {
+            blocking_polls_.fetch_add(1, std::memory_order_relaxed);
+            if (n_events > 0) {
+                wakeups_.fetch_add(1, std::memory_order_relaxed);
+                if (busy_poll_us_) {
+                    // More is likely to follow shortly, e.g. the next
+                    // WebSocket frame, catches it without sleeping.
+                    spin_until = ::gettickcountus() + busy_poll_us_;
+                }
+            }
+        }
         
         if (n_events < 0) {
-            if (socket_epoll_.GetErrNo() == EINTR || --epoll_retry > 0) {
+            if (poller_->GetErrNo() == EINTR || --poll_retry > 0) {
                 continue;
             }
             break;
         }
         
-        for (int i = 0; i < n_events; ++i) {
-            EpollNotifier::Notification probable_notification(
-                    socket_epoll_.GetEpollDataPtr(i));
-    
-            if (__IsNotifyStop(probable_notification)) {
-                LogI("NetThread notification-stop")
-                running_ = false;
-                return;
+        bool notified = false;
+        
+        for (auto &event : events) {
+            if (!poller_->IsValid(event)) {
+                // Of a connection deleted by former events.
+                poller_->ReleaseEvent(event);
+                continue;
             }
             
-            if (CheckNotification(probable_notification)) {
-                notifications.push_back(probable_notification);
+            if (event.flags & Poller::kNotify) {
+                notified = true;
                 continue;
             }
             
-            tcp::ConnectionProfile *tcp_conn;
+            if (event.flags & Poller::kNewConnect) {
+                if (listen_socket_) {
+                    __OnConnect();
+                }
+                continue;
+            }
+            
+            if (event.flags & Poller::kAccepted) {
+                __OnAccepted((SOCKET) event.res);
+                continue;
+            }
             
-            if ((tcp_conn = (tcp::ConnectionProfile *) socket_epoll_.IsErrSet(i))) {
-                __OnErrEvent(tcp_conn);
+            if (event.flags & Poller::kSent) {
+                __OnSent((uint32_t) event.data, event.res);
                 continue;
             }
             
-            if ((tcp_conn = (tcp::ConnectionProfile *) socket_epoll_.IsReadSet(i))) {
+            auto tcp_conn = (tcp::ConnectionProfile *) event.data;
+            
+            if (event.flags & Poller::kError) {
+                // Also how MSG_ZEROCOPY completions are reported.
+                if (!tcp_conn->HasZeroCopyInFlight()
+                            || !tcp_conn->ReapZeroCopyCompletions()) {
+                    __OnErrEvent(tcp_conn);
+                    continue;
+                }
+            }
+            
+            if (event.flags & Poller::kReceived) {
+                __OnRecvEvent(tcp_conn, event);
+                continue;
+            }
+            
+            if (event.flags & Poller::kReadable) {
                 bool deleted = __OnReadEvent(tcp_conn);
                 if (deleted) {
                     continue;
                 }
             }
             
-            if ((tcp_conn = (tcp::ConnectionProfile *) socket_epoll_.IsWriteSet(i))) {
+            if (event.flags & Poller::kWritable) {
                 __OnWriteEvent(tcp_conn);
             }
         }
         
-        // Handle epoll events before notifications,
+        // Handle I/O events before notifications,
         // because sometimes epoll notifies important events such as peer FIN,
         // in which case data transferring during processing notification cannot be executed.
-        for (auto & notification : notifications) {
-            HandleNotification(notification);
+        if (notified) {
+            epoll_notifier_.PopAll(notifications);
+        }
+        for (auto notification : notifications) {
+            if (__IsNotifyStop(*notification)) {
+                LogI("NetThread notification-stop")
+                running_ = false;
+                return;
+            }
+            if (*notification == notification_wakeup_) {
+                // To recalculate the timeout, to run tasks posted,
+                // or to register connections handed over.
+                continue;
+            }
+            HandleNotification(*notification);
         }
         
         notifications.clear();
         
-        uint64_t now = ::gettickcount();
-        if (now - last_clear_ts > clear_timeout_period) {
-            last_clear_ts = now;
-            ClearTimeout();
-        }
+        __RunPendingTasks();
+        
+        __RegisterAccepted();
+        
+        // Costs O(expired), rather than O(connections).
+        timing_wheel_.Expire();
     }
     
 }
 
-bool ServerBase::NetThreadBase::CheckNotification(EpollNotifier::Notification &) {
-    return false;
-}
-
 void ServerBase::NetThreadBase::HandleNotification(EpollNotifier::Notification &) {
     // Implement if needed,
 }
@@ -396,23 +776,150 @@ void ServerBase::NetThreadBase::NotifyStop() {
     epoll_notifier_.NotifyEpoll(notification_stop_);
 }
 
+void ServerBase::NetThreadBase::ListenOn(const Socket *_listen_socket,
+                                         bool _exclusive) {
+    assert(_listen_socket && !listen_socket_);
+    listen_socket_ = _listen_socket;
+    poller_->AddListenFd(listen_socket_->FD(), _exclusive);
+}
+
+bool ServerBase::NetThreadBase::SetIoBackend(Poller::TBackend _backend) {
+    Poller *poller = &socket_epoll_;
+    if (_backend == Poller::kIoUring) {
+        if (io_uring_poller_.Init()) {
+            poller = &io_uring_poller_;
+        } else {
+            LogW("io_uring not supported, fall back to epoll")
+        }
+    }
+    poller_ = poller;
+    connection_manager_.SetPoller(poller_);
+    epoll_notifier_.SetPoller(poller_);
+    return poller_->Backend() == _backend;
+}
+
+Poller::TBackend ServerBase::NetThreadBase::IoBackend() const {
+    return poller_->Backend();
+}
+
+void ServerBase::NetThreadBase::SetBusyPoll(uint64_t _spin_us, int _so_busy_poll_us) {
+    busy_poll_us_ = _spin_us;
+    so_busy_poll_us_ = _so_busy_poll_us > 0 ? _so_busy_poll_us : 0;
+}
+
+void ServerBase::NetThreadBase::SetConnectionPoolSize(size_t _size) {
+    connection_pool_.SetCapacity(_size);
+}
+
+tcp::ConnectionPool::Stats ServerBase::NetThreadBase::GetConnectionPoolStats() const {
+    return connection_pool_.GetStats();
+}
+
+void ServerBase::NetThreadBase::SetZeroCopyThreshold(size_t _threshold) {
+    zerocopy_threshold_ = _threshold;
+}
+
+void ServerBase::NetThreadBase::SetMaxRequestsPerConnection(size_t _max_requests) {
+    max_requests_per_conn_ = _max_requests;
+}
+
+void ServerBase::NetThreadBase::SetOutputLimits(size_t _high_watermark,
+                                                size_t _low_watermark, size_t _cap) {
+    output_budget_.SetLimits(_high_watermark, _low_watermark, _cap);
+}
+
+bool ServerBase::NetThreadBase::IsOutputOverCap() const {
+    return output_budget_.IsOverCap();
+}
+
+tcp::OutputBudget::Stats ServerBase::NetThreadBase::GetOutputBudgetStats() const {
+    return output_budget_.GetStats();
+}
+
+void ServerBase::NetThreadBase::SetBufferPool(size_t _max_mapped, bool _huge_pages) {
+    use_buffer_pool_ = _max_mapped > 0;
+    buffer_pool_.SetLimit(_max_mapped);
+    buffer_pool_.SetHugePages(_huge_pages);
+}
+
+BufferPool::Stats ServerBase::NetThreadBase::GetBufferPoolStats() const {
+    return buffer_pool_.GetStats();
+}
+
+ServerBase::NetThreadBase::LoopStats ServerBase::NetThreadBase::GetLoopStats() const {
+    LoopStats stats;
+    stats.spin_us = spin_us_.load(std::memory_order_relaxed);
+    stats.spin_polls = spin_polls_.load(std::memory_order_relaxed);
+    stats.spin_hits = spin_hits_.load(std::memory_order_relaxed);
+    stats.blocking_polls = blocking_polls_.load(std::memory_order_relaxed);
+    stats.wakeups = wakeups_.load(std::memory_order_relaxed);
+    return stats;
+}
+
 void ServerBase::NetThreadBase::RegisterConnection(int _fd, std::string &_ip,
                                                    uint16_t _port) {
     if (_fd < 0) {
         LogE("invalid fd: %d", _fd)
         return;
     }
+    if (__IsInLoop()) {
+        __Register(_fd, _ip, _port);
+        return;
+    }
+    // e.g. handed by the acceptor, counted before the next is placed.
+    AcceptedFd accepted;
+    accepted.fd = _fd;
+    accepted.port = _port;
+    snprintf(accepted.ip, sizeof(accepted.ip), "%s", _ip.c_str());
+    accepted_cnt_.fetch_add(1, std::memory_order_relaxed);
+    if (!accepted_.push_back(accepted, false)) {
+        // The loop is far behind, not worth a bigger ring.
+        accepted_cnt_.fetch_sub(1, std::memory_order_relaxed);
+        LogE("drop conn because of too many handed over, fd(%d)", _fd)
+        ::close(_fd);
+        return;
+    }
+    epoll_notifier_.NotifyEpoll(notification_wakeup_);
+}
+
+void ServerBase::NetThreadBase::__RegisterAccepted() {
+    if (accepted_.drain_all(registering_) == 0) {
+        return;
+    }
+    for (AcceptedFd &accepted : registering_) {
+        std::string ip(accepted.ip);
+        __Register(accepted.fd, ip, accepted.port);
+        // Counted by the connection manager from now on.
+        accepted_cnt_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    registering_.clear();
+}
+
+void ServerBase::NetThreadBase::__Register(SOCKET _fd, std::string &_ip,
+                                           uint16_t _port) {
     if (connection_manager_.CurrConnectionCnt() >= max_connections_) {
         LogI("drop conn because of max connections, fd(%d)", _fd)
         ::close(_fd);
         return;
     }
     
-    auto neo = new tcp::ConnectionFrom(_fd, _ip, _port,
-                                       ConnectionManager::kInvalidUid);
+    tcp::ConnectionFrom *neo = connection_pool_.AcquireFrom(_fd, _ip, _port);
+    if (so_busy_poll_us_ > 0 && neo->GetSocket().SetBusyPoll(so_busy_poll_us_) < 0) {
+        LogW("SO_BUSY_POLL not permitted, give up setting it")
+        so_busy_poll_us_ = 0;
+    }
+    if (poller_->Backend() == Poller::kEpoll) {
+        neo->SetZeroCopyThreshold(zerocopy_threshold_);
+    }
+    neo->SetMaxRequests(max_requests_per_conn_);
+    neo->SetOutputBudget(&output_budget_);
+    neo->StartDeadlineTimer(&timing_wheel_, &deadlines_, [this, neo] {
+        __OnDeadline(neo);
+    });
     connection_manager_.AddConnection(neo);
     
     ConfigApplicationLayer(neo);
+    connection_pool_.OnApplicationLayerConfigured(neo);
 }
 
 void ServerBase::NetThreadBase::SetMaxConnection(size_t _max_conn) {
@@ -420,10 +927,20 @@ void ServerBase::NetThreadBase::SetMaxConnection(size_t _max_conn) {
     max_connections_ = _max_conn;
 }
 
+size_t ServerBase::NetThreadBase::CurrConnectionCnt() const {
+    return connection_manager_.CurrConnectionCnt()
+            + accepted_cnt_.load(std::memory_order_relaxed);
+}
+
+size_t ServerBase::NetThreadBase::Backlog() {
+    // Implement if the NetThread queues requests for other threads.
+    return 0;
+}
+
 tcp::ConnectionProfile *ServerBase::NetThreadBase::MakeConnection(std::string &_ip,
                                                                   uint16_t _port) {
-    auto neo = new tcp::ConnectionTo(_ip, _port,
-                                     ConnectionManager::kInvalidUid);
+    assert(__IsInLoop());
+    tcp::ConnectionTo *neo = connection_pool_.AcquireTo(_ip, _port);
     
     int retry = 3;
     bool success = false;
@@ -437,11 +954,19 @@ tcp::ConnectionProfile *ServerBase::NetThreadBase::MakeConnection(std::string &_
         break;
     }
     if (success) {
+        if (poller_->Backend() == Poller::kEpoll) {
+            neo->SetZeroCopyThreshold(zerocopy_threshold_);
+        }
+        neo->SetOutputBudget(&output_budget_);
+        neo->StartDeadlineTimer(&timing_wheel_, &deadlines_, [this, neo] {
+            __OnDeadline(neo);
+        });
         connection_manager_.AddConnection(neo);
         ConfigApplicationLayer(neo);
+        connection_pool_.OnApplicationLayerConfigured(neo);
         return neo;
     }
-    delete neo;
+    connection_pool_.Release(neo);
     return nullptr;
 }
 
@@ -450,40 +975,185 @@ tcp::ConnectionProfile *ServerBase::NetThreadBase::GetConnection(uint32_t _uid)
 }
 
 void ServerBase::NetThreadBase::DelConnection(uint32_t _uid) {
+    auto iter = async_sends_.find(_uid);
+    if (iter != async_sends_.end()) {
+        AutoBuffer &buffer = iter->second.front()->buffer;
+        if (buffer.Pos() == buffer.Length()) {
+            // A file body waiting to be writable, nothing in flight.
+            async_sends_.erase(iter);
+        }
+        // Otherwise dropped once the send cancelled by the poller is reported.
+    }
     connection_manager_.DelConnection(_uid);
 }
 
-void ServerBase::NetThreadBase::ClearTimeout() { connection_manager_.ClearTimeout(); }
+void ServerBase::NetThreadBase::SetDeadlines(const tcp::Deadlines &_deadlines) {
+    deadlines_ = _deadlines;
+}
 
+void ServerBase::NetThreadBase::AddTimer(TimingWheel::TimerNode *_timer,
+                                         uint64_t _after_mills) {
+    timing_wheel_.Schedule(_timer, _after_mills);
+    __WakeupIfOffLoop();
+}
+
+void ServerBase::NetThreadBase::RunAfter(uint64_t _after_mills,
+                                         std::function<void()> _task) {
+    timing_wheel_.RunAfter(_after_mills, std::move(_task));
+    __WakeupIfOffLoop();
+}
+
+void ServerBase::NetThreadBase::CancelTimer(TimingWheel::TimerNode *_timer) {
+    timing_wheel_.Cancel(_timer);
+}
+
+void ServerBase::NetThreadBase::RunInLoop(std::function<void()> _task) {
+    if (__IsInLoop()) {
+        _task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(task_mutex_);
+        tasks_.push_back(std::move(_task));
+    }
+    epoll_notifier_.NotifyEpoll(notification_wakeup_);
+}
+
+bool ServerBase::NetThreadBase::__IsInLoop() const {
+    return std::this_thread::get_id() == Tid();
+}
+
+void ServerBase::NetThreadBase::__RunPendingTasks() {
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(task_mutex_);
+        if (tasks_.empty()) {
+            return;
+        }
+        tasks.swap(tasks_);
+    }
+    for (auto &task : tasks) {
+        task();
+    }
+}
+
+void ServerBase::NetThreadBase::__WakeupIfOffLoop() {
+    if (!__IsInLoop()) {
+        // The loop may be waiting with a longer timeout.
+        epoll_notifier_.NotifyEpoll(notification_wakeup_);
+    }
+}
+
+void ServerBase::NetThreadBase::__OnDeadline(tcp::ConnectionProfile *_conn) {
+    bool has_output = _conn->HasPendingPacketToSend() || _conn->OutputBytes() > 0;
+    if (has_output && _conn->IsSendProgressing()) {
+        // Timeout just because of poor networking
+        // is not considered as timeout.
+        _conn->ExtendDeadline();
+        return;
+    }
+    if (has_output) {
+        // Not reading at all, the output would pile up forever.
+        LogI("fd(%d), uid: %u, nothing sent for a deadline, %zu B unsent",
+             _conn->FD(), _conn->Uid(), _conn->OutputBytes())
+        DelConnection(_conn->Uid());
+        return;
+    }
+    LogI("fd(%d), uid: %u, deadline %d missed", _conn->FD(),
+         _conn->Uid(), _conn->DeadlinePhase())
+    DelConnection(_conn->Uid());
+}
+
+
+int ServerBase::NetThreadBase::__OnConnect() {
+    std::string ip;
+    uint16_t port;
+    while (true) {
+        SOCKET fd = listen_socket_->Accept(ip, port);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (IS_EAGAIN(errno)) {
+                // Drained, or another NetThread sharing
+                // the listen fd took the connection.
+                return 0;
+            }
+            LogE("errno(%d): %s", errno, strerror(errno))
+            return -1;
+        }
+        RegisterConnection(fd, ip, port);
+    }
+}
+
+void ServerBase::NetThreadBase::__OnAccepted(SOCKET _fd) {
+    std::string ip;
+    uint16_t port = 0;
+    Socket::PeerName(_fd, ip, port);
+    RegisterConnection(_fd, ip, port);
+}
 
 bool ServerBase::NetThreadBase::__OnReadEvent(tcp::ConnectionProfile *_conn) {
     assert(_conn);
     
-    SOCKET fd = _conn->FD();
-    uint32_t uid = _conn->Uid();
-    
     if (_conn->Receive() < 0) {
         LogE("fd(%d), uid: %d Receive() err, _conn: %p",
                 _conn->FD(), _conn->Uid(), _conn)
-        DelConnection(uid);
+        DelConnection(_conn->Uid());
+        return true;
+    }
+    return __OnReceived(_conn);
+}
+
+bool ServerBase::NetThreadBase::__OnRecvEvent(tcp::ConnectionProfile *_conn,
+                                              const Poller::Event &_event) {
+    assert(_conn);
+    
+    int ret = _conn->Receive(_event.buf, _event.res);
+    // Copied into the connection's byte array already.
+    poller_->ReleaseEvent(_event);
+    
+    if (ret < 0) {
+        LogE("fd(%d), uid: %d Receive() err, _conn: %p",
+                _conn->FD(), _conn->Uid(), _conn)
+        DelConnection(_conn->Uid());
         return true;
     }
+    return __OnReceived(_conn);
+}
+
+bool ServerBase::NetThreadBase::__OnReceived(tcp::ConnectionProfile *_conn) {
+    SOCKET fd = _conn->FD();
+    uint32_t uid = _conn->Uid();
     
     if (_conn->HasReceivedFin()) {
         DelConnection(uid);
         return true;
     }
     
-    if (_conn->IsParseDone()) {
+    _conn->UpdateDeadline();
+    
+    // Pipelined requests, or frames of a long link, are handed
+    // over one by one, responses going back in the same order.
+    while (_conn->IsParseDone()) {
         LogI("fd(%d) %s parse succeed", fd, _conn->ApplicationProtocolName())
         
         bool is_upgrade_app_proto = _conn->IsUpgradeApplicationProtocol();
+        bool is_longlink = _conn->IsLongLinkApplicationProtocol();
+        bool is_keep_alive = true;
         tcp::RecvContext::Ptr recv_ctx = _conn->MakeRecvContext();
     
         if (_conn->GetType() == tcp::TConnectionType::kAcceptFrom
                         && !is_upgrade_app_proto) {
             // Only requests need a packet to send back.
-            recv_ctx->return_packet = _conn->MakeSendContext();
+            if (is_longlink) {
+                recv_ctx->return_packet = _conn->MakeSendContext();
+            } else {
+                recv_ctx->return_packet = _conn->MakeResponseContext();
+                is_keep_alive = recv_ctx->application_packet->IsKeepAlive()
+                                && !_conn->IsMaxRequestsReached();
+                recv_ctx->return_packet->is_connection_close = !is_keep_alive;
+            }
         }
         
         if (is_upgrade_app_proto) {
@@ -494,20 +1164,149 @@ bool ServerBase::NetThreadBase::__OnReadEvent(tcp::ConnectionProfile *_conn) {
             recv_ctx = _conn->MakeRecvContext(true);
         }
         
-        return HandleApplicationPacket(recv_ctx);
+        if (HandleApplicationPacket(std::move(recv_ctx))) {
+            return true;
+        }
+        if (is_upgrade_app_proto) {
+            return false;
+        }
+        if (!is_keep_alive) {
+            _conn->StopReceivingPackets();
+            return false;
+        }
+        int ret = _conn->NextPacket();
+        if (ret < 0) {
+            LogI("fd(%d), uid: %u, parse pipelined packet failed", fd, uid)
+            DelConnection(uid);
+            return true;
+        }
+        if (ret == 0) {
+            _conn->UpdateDeadline();
+        }
     }
     return false;
 }
 
 void ServerBase::NetThreadBase::__OnWriteEvent(
                         tcp::ConnectionProfile *_conn) {
+    auto iter = async_sends_.find(_conn->Uid());
+    if (iter != async_sends_.end() && !iter->second.empty()) {
+        // Resumes a file body, unless a send is still in flight.
+        tcp::SendContext::Ptr &send_ctx = iter->second.front();
+        if (send_ctx->buffer.Pos() == send_ctx->buffer.Length()
+                    && send_ctx->file_body.length > 0) {
+            __SubmitAsyncSend(_conn->Uid());
+        }
+    }
     if (_conn->HasPendingPacketToSend()) {
         bool write_done = _conn->TrySendPendingPackets();
         if (!_conn->IsLongLinkApplicationProtocol() && write_done) {
             // No deleting the connection, waiting for
             // the client to time out or send Tcp FIN.
         }
+        if (!write_done) {
+            // Reported once per request by completion based pollers.
+            poller_->WaitWritable(_conn->FD(), (uint64_t) _conn);
+        }
+    }
+}
+
+bool ServerBase::NetThreadBase::AsyncSend(const tcp::SendContext::Ptr &_send_ctx) {
+    if (!_send_ctx->is_tcp_conn_valid
+            || !GetConnection(_send_ctx->tcp_connection_uid)) {
+        LogI("tcp conn already been deleted, uid: %u", _send_ctx->tcp_connection_uid)
+        return true;
+    }
+    if (poller_->Backend() != Poller::kIoUring) {
+        return TrySendAndMarkPendingIfUndone(_send_ctx);
+    }
+    tcp::ConnectionProfile *conn = _send_ctx->connection;
+    AutoBuffer &buffer = _send_ctx->buffer;
+    conn->ChargeOutput(buffer.Length() - buffer.Pos());
+    if (!conn->TakeInOrder(_send_ctx.get())) {
+        return false;   // held until the responses before it are sent.
+    }
+    uint32_t uid = conn->Uid();
+    std::deque<tcp::SendContext::Ptr> &queue = async_sends_[uid];
+    bool is_idle = queue.empty();
+    queue.push_back(_send_ctx);
+    while (tcp::SendContext *send_ctx = conn->NextInOrder()) {
+        queue.emplace_back(send_ctx);
+    }
+    if (is_idle) {
+        __SubmitAsyncSend(uid);
+    }
+    return false;
+}
+
+void ServerBase::NetThreadBase::__SubmitAsyncSend(uint32_t _uid) {
+    auto iter = async_sends_.find(_uid);
+    if (iter == async_sends_.end()) {
+        return;
+    }
+    std::deque<tcp::SendContext::Ptr> &queue = iter->second;
+    while (!queue.empty()) {
+        tcp::SendContext::Ptr &send_ctx = queue.front();
+        // The socket of a deleted connection may be gone.
+        SOCKET fd = send_ctx->is_tcp_conn_valid ? send_ctx->socket->FD() : INVALID_SOCKET;
+        AutoBuffer &buffer = send_ctx->buffer;
+        size_t left = buffer.Length() - buffer.Pos();
+        if (send_ctx->is_tcp_conn_valid && left == 0
+                    && send_ctx->file_body.length > 0) {
+            // No sendfile in io_uring, the body goes by sendfile(2) as soon as writable.
+            int ret = tcp::ConnectionProfile::TrySendFileBody(send_ctx.get());
+            if (ret == 0) {
+                poller_->WaitWritable(fd, (uint64_t) send_ctx->connection);
+                return;
+            }
+            if (ret > 0) {
+                send_ctx->connection->OnSendDone(send_ctx.get());
+            }
+        } else if (send_ctx->is_tcp_conn_valid && left == 0) {
+            send_ctx->connection->OnSendDone(send_ctx.get());
+        } else if (send_ctx->is_tcp_conn_valid) {
+            // The buffer is kept by the queue until kSent. If chained,
+            // a segment at a time, the rest resubmitted by __OnSent().
+            struct iovec iov;
+            buffer.Iovecs(buffer.Pos(), &iov, 1);
+            if (poller_->SubmitSend(fd, iov.iov_base, iov.iov_len, _uid)) {
+                return;
+            }
+            LogE("fd(%d), uid: %u, submit send failed", fd, _uid)
+        }
+        queue.pop_front();
     }
+    async_sends_.erase(iter);
+}
+
+void ServerBase::NetThreadBase::__OnSent(uint32_t _uid, ssize_t _res) {
+    auto iter = async_sends_.find(_uid);
+    if (iter == async_sends_.end() || iter->second.empty()) {
+        LogE("uid: %u, no packet in flight", _uid)
+        return;
+    }
+    tcp::SendContext::Ptr send_ctx = iter->second.front();
+    
+    if (!send_ctx->is_tcp_conn_valid) {
+        // Cancelled by the poller, or sent before that.
+        LogI("tcp conn already been deleted, uid: %u", _uid)
+    } else if (_res < 0) {
+        // The connection is deleted upon the recv error or FIN.
+        LogE("uid: %u, errno(%zd): %s", _uid, -_res, strerror((int) -_res))
+    } else {
+        AutoBuffer &buffer = send_ctx->buffer;
+        buffer.Seek(AutoBuffer::kCurrent, _res);
+        send_ctx->connection->CreditOutput(_res);
+        LogI("uid: %u, write %zd B, %zu B left", _uid, _res,
+             buffer.Length() - buffer.Pos())
+        if (buffer.Pos() < buffer.Length()) {
+            __SubmitAsyncSend(_uid);     // the rest of it.
+            return;
+        }
+        send_ctx->connection->OnSendDone(send_ctx.get());
+    }
+    iter->second.pop_front();
+    __SubmitAsyncSend(_uid);
 }
 
 bool ServerBase::NetThreadBase::TrySendAndMarkPendingIfUndone(
@@ -517,20 +1316,58 @@ bool ServerBase::NetThreadBase::TrySendAndMarkPendingIfUndone(
                 _send_ctx->socket->FD(), _send_ctx->tcp_connection_uid)
         return true;
     }
-    bool is_send_done = tcp::ConnectionProfile::TrySend(_send_ctx);
-    
-    if (is_send_done) {
-        if (_send_ctx->OnSendDone) {
-            _send_ctx->OnSendDone();
-        }
-    } else if (_send_ctx->MarkAsPendingPacket) {
+    tcp::ConnectionProfile *conn = _send_ctx->connection;
+    if (conn->HasPendingPacketToSend()) {
+        // Behind those waiting for the socket to be writable.
+        conn->AddPendingPacketToSend(_send_ctx.get());
+        return false;
+    }
+    conn->EnqueueToSend(_send_ctx.get());
+    if (!conn->HasPendingPacketToSend()) {
+        return false;   // held until the responses before it are sent.
+    }
+    bool is_send_done = conn->TrySendPendingPackets();
+    if (!is_send_done) {
         // Mark self as pending so that epoll will
         // continue to notify sending if it's possible.
-        _send_ctx->MarkAsPendingPacket();
+        conn->WaitWritable();
     }
     return is_send_done;
 }
 
+void ServerBase::NetThreadBase::SendInBatch(
+                std::vector<tcp::SendContext::Ptr> &_send_ctxs) {
+    if (poller_->Backend() == Poller::kIoUring) {
+        for (auto &send_ctx : _send_ctxs) {
+            AsyncSend(send_ctx);
+        }
+        _send_ctxs.clear();
+        return;
+    }
+    flushing_.clear();
+    for (auto &send_ctx : _send_ctxs) {
+        if (!send_ctx->is_tcp_conn_valid
+                || !GetConnection(send_ctx->tcp_connection_uid)) {
+            LogI("tcp conn already been deleted, uid: %u", send_ctx->tcp_connection_uid)
+            continue;
+        }
+        tcp::ConnectionProfile *conn = send_ctx->connection;
+        bool is_idle = !conn->HasPendingPacketToSend();
+        conn->EnqueueToSend(send_ctx.get());
+        if (is_idle && conn->HasPendingPacketToSend()) {
+            // Otherwise waiting for writable already, flushed then.
+            flushing_.push_back(conn);
+        }
+    }
+    // Kept alive by their connections until sent.
+    _send_ctxs.clear();
+    
+    for (tcp::ConnectionProfile *conn : flushing_) {
+        __OnWriteEvent(conn);
+    }
+    flushing_.clear();
+}
+
 int ServerBase::NetThreadBase::__OnErrEvent(tcp::ConnectionProfile *_conn) {
     if (!_conn) {
         return -1;
@@ -559,6 +1396,110 @@ bool ServerBase::_CustomConfig(yaml::YamlDescriptor *_desc) {
     return true;
 }
 
+/**
+ * Splits "0-3;4-7" into one item per NetThread.
+ */
+static void SplitPerNetThread(const std::string &_src, std::vector<std::string> &_res) {
+    str::split(_src, ";", _res);
+    if (_res.empty() && !_src.empty()) {
+        _res.push_back(_src);
+    }
+    for (auto &item : _res) {
+        str::trim(item);
+    }
+}
+
+bool ServerBase::_ConfigPlacement(yaml::YamlDescriptor *_desc) {
+    std::string cpu_affinity(ServerConfigBase::kPlacementNone);
+    std::string numa_node(ServerConfigBase::kPlacementNone);
+    
+    try {
+        if (yaml::ValueLeaf *leaf = _desc->FindLeaf(ServerConfigBase::key_cpu_affinity)) {
+            leaf->To(cpu_affinity);
+        }
+        if (yaml::ValueLeaf *leaf = _desc->FindLeaf(ServerConfigBase::key_numa_node)) {
+            leaf->To(numa_node);
+        }
+    } catch (std::exception &ex) {
+        LogE("Yaml Exception: %s", ex.what())
+        return false;
+    }
+    size_t n = config_->net_thread_cnt;
+    auto &affinity = config_->cpu_affinity;
+    auto &nodes = config_->numa_node;
+    
+    if (cpu_affinity == ServerConfigBase::kPlacementAuto) {
+        // Slices cpus grouped by NUMA node, so that a
+        // NetThread's core set rarely spans two nodes.
+        std::vector<int> cpus = cpu::AllowedCpus();
+        if (cpus.empty()) {
+            LogE("no cpu allowed to run on")
+            return false;
+        }
+        std::vector<std::pair<int, int>> node_cpu;
+        for (int cpu : cpus) {
+            node_cpu.emplace_back(cpu::NumaNodeOfCpu(cpu), cpu);
+        }
+        std::sort(node_cpu.begin(), node_cpu.end());
+        
+        affinity.resize(n);
+        size_t total = node_cpu.size();
+        for (size_t i = 0; i < n; ++i) {
+            if (total < n) {
+                affinity[i].push_back(node_cpu[i % total].second);
+                continue;
+            }
+            for (size_t j = i * total / n; j < (i + 1) * total / n; ++j) {
+                affinity[i].push_back(node_cpu[j].second);
+            }
+        }
+    } else if (cpu_affinity != ServerConfigBase::kPlacementNone) {
+        std::vector<std::string> cpu_lists;
+        SplitPerNetThread(cpu_affinity, cpu_lists);
+        if (cpu_lists.size() != n) {
+            LogE("cpu_affinity: %zu core sets for %zu NetThreads", cpu_lists.size(), n)
+            return false;
+        }
+        affinity.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            if (!cpu::ParseCpuList(cpu_lists[i], affinity[i])) {
+                LogE("Illegal cpu list: %s", cpu_lists[i].c_str())
+                return false;
+            }
+        }
+    }
+    
+    if (numa_node == ServerConfigBase::kPlacementAuto) {
+        if (affinity.empty()) {
+            LogE("numa_node auto needs cpu_affinity to be configured")
+            return false;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            nodes.push_back(cpu::NumaNodeOfCpu(affinity[i].front()));
+        }
+    } else if (numa_node != ServerConfigBase::kPlacementNone) {
+        std::vector<std::string> node_list;
+        SplitPerNetThread(numa_node, node_list);
+        if (node_list.size() != n) {
+            LogE("numa_node: %zu nodes for %zu NetThreads", node_list.size(), n)
+            return false;
+        }
+        for (auto &node : node_list) {
+            nodes.push_back((int) strtol(node.c_str(), nullptr, 10));
+        }
+    }
+    
+    for (size_t i = 0; i < affinity.size(); ++i) {
+        std::string cpus;
+        for (int cpu : affinity[i]) {
+            cpus += std::to_string(cpu) + " ";
+        }
+        LogI("NetThread%zu cpus: %snuma node: %d", i, cpus.c_str(),
+             nodes.empty() ? Thread::kNoNumaNode : nodes[i])
+    }
+    return true;
+}
+
 void ServerBase::_NotifyNetThreadsStop() {
     for (auto & net_thread : net_threads_) {
         net_thread->NotifyStop();
@@ -569,20 +1510,23 @@ void ServerBase::_NotifyNetThreadsStop() {
     LogI("All Threads Joined!")
 }
 
-bool ServerBase::_IsNotifyStop(EpollNotifier::Notification &_notification) const {
-    return _notification == notification_stop_;
+bool ServerBase::_IsNotifyStop() {
+    std::vector<EpollNotifier::Notification *> notifications;
+    epoll_notifier_.PopAll(notifications);
+    for (auto notification : notifications) {
+        if (*notification == notification_stop_) {
+            return true;
+        }
+    }
+    return false;
 }
 
 int ServerBase::_OnConnect() {
-    SOCKET fd;
-    struct sockaddr_in sock_in{};
-    socklen_t socklen = sizeof(sockaddr_in);
-    char ip_str[INET_ADDRSTRLEN] = {0, };
+    std::string ip;
     uint16_t port;
     
-    SOCKET listen_fd = listenfd_.FD();
     while (true) {
-        fd = ::accept(listen_fd, (struct sockaddr *) &sock_in, &socklen);
+        SOCKET fd = listenfd_.Accept(ip, port);
         if (fd < 0) {
             if (errno == EINTR) {
                 continue;
@@ -593,12 +1537,6 @@ int ServerBase::_OnConnect() {
             LogE("errno(%d): %s", errno, strerror(errno))
             return -1;
         }
-        if (!inet_ntop(AF_INET, &sock_in.sin_addr, ip_str, sizeof(ip_str))) {
-            LogE("inet_ntop errno(%d): %s", errno, strerror(errno))
-        }
-        port = ntohs(sock_in.sin_port);
-        std::string ip(ip_str);
-        
         _RegisterConnection(fd, ip, port);
     }
 }
@@ -609,8 +1547,7 @@ void ServerBase::_RegisterConnection(int _fd, std::string &_ip,
         LogE("wtf??")
         return;
     }
-    uint net_thread_idx = _fd % net_threads_.size();
-    NetThreadBase *owner_thread = net_threads_[net_thread_idx];
+    NetThreadBase *owner_thread = _SelectNetThread(_fd);
     if (!owner_thread) {
         LogE("wtf???")
         return;
@@ -618,8 +1555,53 @@ void ServerBase::_RegisterConnection(int _fd, std::string &_ip,
     owner_thread->RegisterConnection(_fd, _ip, _port);
 }
 
-int ServerBase::_CreateListenFd() {
-    assert(listenfd_.Create(AF_INET, SOCK_STREAM) >= 0);
+ServerBase::NetThreadBase *ServerBase::_SelectNetThread(SOCKET _fd) {
+    size_t n = net_threads_.size();
+    
+    switch (config_->conn_placement) {
+        case ServerConfigBase::kLeastConnections: {
+            NetThreadBase *least = net_threads_[0];
+            for (size_t i = 1; i < n; ++i) {
+                if (net_threads_[i]->CurrConnectionCnt() < least->CurrConnectionCnt()) {
+                    least = net_threads_[i];
+                }
+            }
+            return least;
+        }
+        case ServerConfigBase::kLeastBacklog: {
+            NetThreadBase *least = net_threads_[0];
+            size_t least_backlog = least->Backlog();
+            for (size_t i = 1; i < n; ++i) {
+                size_t backlog = net_threads_[i]->Backlog();
+                if (backlog < least_backlog || (backlog == least_backlog
+                        && net_threads_[i]->CurrConnectionCnt() < least->CurrConnectionCnt())) {
+                    least = net_threads_[i];
+                    least_backlog = backlog;
+                }
+            }
+            return least;
+        }
+        case ServerConfigBase::kPowerOfTwoChoices: {
+            if (n == 1) {
+                return net_threads_[0];
+            }
+            size_t a = placement_rand_() % n;
+            size_t b = placement_rand_() % (n - 1);
+            if (b >= a) {
+                ++b;    // two distinct NetThreads.
+            }
+            NetThreadBase *first = net_threads_[a];
+            NetThreadBase *second = net_threads_[b];
+            return first->CurrConnectionCnt() <= second->CurrConnectionCnt() ? first : second;
+        }
+        case ServerConfigBase::kModulo:
+        default:
+            return net_threads_[_fd % n];
+    }
+}
+
+int ServerBase::_CreateListenFd(Socket &_listen_fd) {
+    assert(_listen_fd.Create(AF_INET, SOCK_STREAM) >= 0);
     
     // If l_onoff is not 0, The system waits for the length of time
     // described by l_linger for the data in the fd buffer to be sent
@@ -627,11 +1609,75 @@ int ServerBase::_CreateListenFd() {
     struct linger ling{};
     ling.l_linger = 0;
     ling.l_onoff = 0;   // identical to default.
-    listenfd_.SetSocketOpt(SOL_SOCKET, SO_LINGER, &ling, sizeof(ling));
-    listenfd_.SetNonblocking();
+    _listen_fd.SetSocketOpt(SOL_SOCKET, SO_LINGER, &ling, sizeof(ling));
+    _listen_fd.SetNonblocking();
     return 0;
 }
 
+void ServerBase::_ListenInNetThreads() {
+    if (config_->accept_mode == ServerConfigBase::kEpollExclusive) {
+        assert(listenfd_.Listen(kDefaultListenBacklog) >= 0);
+        for (auto & net_thread : net_threads_) {
+            net_thread->ListenOn(&listenfd_, true);
+        }
+        return;
+    }
+    assert(reuseport_listenfds_.size() == net_threads_.size());
+    
+    for (size_t i = 0; i < net_threads_.size(); ++i) {
+        assert(reuseport_listenfds_[i]->Listen(kDefaultListenBacklog) >= 0);
+        net_threads_[i]->ListenOn(reuseport_listenfds_[i], false);
+    }
+    if (config_->accept_mode == ServerConfigBase::kReusePortCBPF) {
+        // The program is shared by the whole reuseport group,
+        // attaching it to any one socket of the group is enough.
+        if (reuseport_listenfds_[0]->AttachReusePortCpuSteering(
+                    reuseport_listenfds_.size()) < 0) {
+            LogE("attach reuseport cbpf failed, fall back to kernel hashing")
+        }
+    }
+}
+
+void ServerBase::_LogLoopStats() {
+    for (size_t i = 0; i < net_threads_.size(); ++i) {
+        NetThreadBase::LoopStats stats = net_threads_[i]->GetLoopStats();
+        LogI("NetThread%zu spin: %lu us, %lu polls, %lu hits; blocking: %lu polls, "
+             "%lu wakeups", i, stats.spin_us, stats.spin_polls, stats.spin_hits,
+             stats.blocking_polls, stats.wakeups)
+    }
+}
+
+void ServerBase::_LogConnectionPoolStats() {
+    for (size_t i = 0; i < net_threads_.size(); ++i) {
+        tcp::ConnectionPool::Stats stats = net_threads_[i]->GetConnectionPoolStats();
+        uint64_t hit_rate = stats.acquires ? stats.hits * 100 / stats.acquires : 0;
+        LogI("NetThread%zu conn pool: %lu acquires, %lu%% hit, %lu app layer hits, "
+             "%lu drops; %lu pooled, %lu B retained; allocated: %lu send contexts, "
+             "%lu recv contexts, %lu packets", i, stats.acquires, hit_rate,
+             stats.app_layer_hits, stats.drops, stats.pooled, stats.retained_bytes,
+             stats.send_ctx_allocated, stats.recv_ctx_allocated, stats.packet_allocated)
+    }
+}
+
+void ServerBase::_LogOutputBudgetStats() {
+    for (size_t i = 0; i < net_threads_.size(); ++i) {
+        tcp::OutputBudget::Stats stats = net_threads_[i]->GetOutputBudgetStats();
+        LogI("NetThread%zu output: %lu B unsent; paused %lu times by watermark, "
+             "%lu times by cap; %lu resumes", i, stats.buffered, stats.high_hits,
+             stats.cap_hits, stats.resumes)
+    }
+}
+
+void ServerBase::_LogBufferPoolStats() {
+    for (size_t i = 0; i < net_threads_.size(); ++i) {
+        BufferPool::Stats stats = net_threads_[i]->GetBufferPoolStats();
+        LogI("NetThread%zu buffer pool: %lu B mapped%s, %lu B in use, %lu B cached; "
+             "%lu cross-thread frees, %lu left to malloc", i, stats.mapped_bytes,
+             stats.is_huge_pages ? " (huge pages)" : "", stats.in_use_bytes,
+             stats.cached_bytes, stats.cross_thread_frees, stats.fallbacks)
+    }
+}
+
 int ServerBase::_OnEpollErr(SOCKET _fd) {
     LogE("fd: %d", _fd)
     return 0;
@@ -4,11 +4,18 @@
 #include <list>
 #include <mutex>
 #include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <random>
 #include <cassert>
 #include "thread.h"
+#include "bufferpool.h"
 #include "networkmodel/tcpconnection.h"
+#include "networkmodel/connectionpool.h"
 #include "socket/socketepoll.h"
+#include "socket/iouringpoller.h"
 #include "yamlutil.h"
+#include "ringqueue.h"
 
 
 
@@ -38,54 +45,167 @@ class ServerBase {
     class ServerConfigBase {
       public:
         ServerConfigBase();
+        
+        /* how new connections are accepted and distributed to NetThreads */
+        enum TAcceptMode {
+            kAcceptor = 0,      // one acceptor (main thread) hands fds to NetThreads.
+            kReusePort,         // each NetThread listens on its own SO_REUSEPORT fd.
+            kReusePortCBPF,     // kReusePort, steered by the cpu handling the softirq.
+            kEpollExclusive,    // NetThreads share one listen fd with EPOLLEXCLUSIVE.
+        };
+        /* which NetThread the acceptor hands a new connection to */
+        enum TConnPlacement {
+            kModulo = 0,            // fd % net_thread_cnt.
+            kLeastConnections,
+            kLeastBacklog,          // fewest requests waiting for workers.
+            kPowerOfTwoChoices,     // less connections of two random NetThreads.
+        };
         static const char *const    key_port;
         static const char *const    key_net_thread_cnt;
+        static const char *const    key_header_read_timeout;
+        static const char *const    key_body_read_timeout;
+        static const char *const    key_keep_alive_timeout;
+        static const char *const    key_max_requests_per_connection;
         static const char *const    key_max_connections;
+        static const char *const    key_accept_mode;
+        static const char *const    kAcceptModeAcceptor;
+        static const char *const    kAcceptModeReusePort;
+        static const char *const    kAcceptModeReusePortCBPF;
+        static const char *const    kAcceptModeEpollExclusive;
+        static const char *const    key_conn_placement;
+        static const char *const    kConnPlacementModulo;
+        static const char *const    kConnPlacementLeastConn;
+        static const char *const    kConnPlacementLeastBacklog;
+        static const char *const    kConnPlacementP2C;
+        static const char *const    key_io_backend;
+        static const char *const    kIoBackendEpoll;
+        static const char *const    kIoBackendIoUring;
+        static const char *const    key_busy_poll_us;
+        static const char *const    key_so_busy_poll_us;
+        static const char *const    key_connection_pool_size;
+        static const char *const    key_zerocopy_threshold;
+        static const char *const    key_output_high_watermark_kb;
+        static const char *const    key_output_low_watermark_kb;
+        static const char *const    key_output_buffer_cap_mb;
+        static const char *const    key_buffer_pool_mb;
+        static const char *const    key_buffer_pool_huge_pages;
+        static const char *const    key_cpu_affinity;
+        static const char *const    key_numa_node;
+        static const char *const    kPlacementNone;
+        static const char *const    kPlacementAuto;
         uint16_t                    port;
         size_t                      net_thread_cnt;
+        tcp::Deadlines              deadlines;
         size_t                      max_connections;
+        TAcceptMode                 accept_mode;
+        TConnPlacement              conn_placement;
+        Poller::TBackend            io_backend;
+        /* How long NetThreads keep polling without blocking after I/O, 0: off. */
+        uint64_t                    busy_poll_us;
+        /* SO_BUSY_POLL of accepted sockets, 0: not set. */
+        int                         so_busy_poll_us;
+        /* Idle connection objects each NetThread keeps for reuse, 0: off. */
+        size_t                      connection_pool_size;
+        /* Responses of at least so many bytes are sent with MSG_ZEROCOPY, 0: off. */
+        size_t                      zerocopy_threshold;
+        /* Requests served per keep-alive connection, 0: unlimited. */
+        size_t                      max_requests_per_connection;
+        /* Unsent bytes a connection stops reading above, and reads again below, 0: off. */
+        size_t                      output_high_watermark;
+        size_t                      output_low_watermark;
+        /* Unsent bytes of all connections of a NetThread, 0: unlimited. */
+        size_t                      output_buffer_cap;
+        /* Arenas of the BufferPool of a NetThread, 0: byte arrays are malloc(3)ed. */
+        size_t                      buffer_pool_size;
+        bool                        buffer_pool_huge_pages;
+        /* Core set of each NetThread and its WorkerThreads, empty if not pinned. */
+        std::vector<std::vector<int>>   cpu_affinity;
+        /* NUMA node of each NetThread and its WorkerThreads, empty if not bound. */
+        std::vector<int>            numa_node;
         bool                        is_config_done;
     };
     
+    /**
+     * Connections of one NetThread, touched by its loop only, so no lock.
+     *
+     * A connection is identified by a 32-bit uid packing the index of
+     * its slot and the generation of that slot, which is bumped once the
+     * connection is deleted, so that a uid held after the deletion, e.g.
+     * by a SendContext or a proxied request, never resolves to another
+     * connection reusing the slot.
+     */
     class ConnectionManager final {
-        
-        using ScopedLock = std::lock_guard<std::mutex>;
-        
       public:
         ConnectionManager();
         
         ~ConnectionManager();
         
-        void SetEpoll(SocketEpoll *_epoll);
+        void SetPoller(Poller *_poller);
         
-        tcp::ConnectionProfile *GetConnection(uint32_t _uid);
+        /**
+         * Deleted connections go back to @param{_pool}.
+         */
+        void SetConnectionPool(tcp::ConnectionPool *_pool);
+        
+        /**
+         * @return: nullptr if @param{_uid} is invalid or stale.
+         */
+        tcp::ConnectionProfile *GetConnection(uint32_t _uid) const;
     
-        size_t CurrConnectionCnt();
+        /**
+         * Lock-free, so that other threads can read it cheaply.
+         */
+        size_t CurrConnectionCnt() const;
         
         void AddConnection(tcp::ConnectionProfile *);
         
         void DelConnection(uint32_t _uid);
-        
-        void ClearTimeout();
     
       private:
-        void __CheckCapacity();
+        struct Slot {
+            tcp::ConnectionProfile    * conn;
+            uint32_t                    generation;
+            uint32_t                    next_free;
+        };
+        
+        static uint32_t __MakeUid(uint32_t _generation, uint32_t _slot);
+        
+        void __Enlarge();
+        
+        void __PushFree(uint32_t _slot);
     
       public:
         static const uint32_t                           kInvalidUid;
       private:
-        static const size_t                             kReserveSize;
+        static const int                                kSlotBits;
+        static const uint32_t                           kSlotMask;
+        static const uint32_t                           kGenerationMask;
+        static const uint32_t                           kNoSlot;
         static const size_t                             kEnlargeUnit;
-        std::vector<tcp::ConnectionProfile *>           pool_;
-        std::deque<uint32_t>                            free_places_;
-        SocketEpoll *                                   socket_epoll_;
-        std::mutex                                      mutex_;
+        std::vector<Slot>                               slots_;
+        /* FIFO, so that a slot is reused as late as possible. */
+        uint32_t                                        free_head_;
+        uint32_t                                        free_tail_;
+        std::atomic<size_t>                             conn_cnt_;
+        Poller *                                        poller_;
+        tcp::ConnectionPool *                           connection_pool_;
     };
     
     
     class NetThreadBase : public Thread {
       public:
         
+        /* Counters of the loop, to tune busy polling against cpu burn. */
+        struct LoopStats {
+            LoopStats();
+            
+            uint64_t    spin_us;        // time spent polling with timeout 0.
+            uint64_t    spin_polls;
+            uint64_t    spin_hits;      // spin polls which got events, wakeups saved.
+            uint64_t    blocking_polls;
+            uint64_t    wakeups;        // blocking polls which got events.
+        };
+        
         NetThreadBase();
     
         ~NetThreadBase() override;
@@ -93,11 +213,9 @@ class ServerBase {
         void Run() final;
     
         /**
-         *
-         * @return: true if you handled your Notification, else false.
+         * Called after the I/O events of a round are handled,
+         * once for each Notification posted to epoll_notifier_.
          */
-        virtual bool CheckNotification(EpollNotifier::Notification &);
-        
         virtual void HandleNotification(EpollNotifier::Notification &);
     
         /**
@@ -107,13 +225,132 @@ class ServerBase {
         virtual bool HandleApplicationPacket(tcp::RecvContext::Ptr) = 0;
     
         /**
+         * Sends behind the packets pending on the same connection,
+         * a response made ahead of its turn is held till then.
          *
          * @return: whether write event is done.
          */
         static bool TrySendAndMarkPendingIfUndone(const tcp::SendContext::Ptr&);
         
+        /**
+         * Sends on the loop of this NetThread, dropping the packet if the
+         * uid it carries is stale. With io_uring, the packet is
+         * queued behind those of the same connection and submitted in batch
+         * at the next loop round, OnSendDone() of its connection is called
+         * once it is all sent.
+         * Otherwise identical to {@link TrySendAndMarkPendingIfUndone}.
+         *
+         * @return: whether the packet is sent already.
+         */
+        bool AsyncSend(const tcp::SendContext::Ptr&);
+        
+        /**
+         * Sends packets in batch, e.g. drained from a queue. Packets are
+         * grouped by connection, so that each connection is flushed by
+         * one writev(2) rather than one write(2) per packet.
+         *
+         * @param _send_ctxs: cleared once queued to their connections.
+         */
+        void SendInBatch(std::vector<tcp::SendContext::Ptr> &_send_ctxs);
+        
+        /**
+         * Selects the Poller of this NetThread, falling back to epoll if
+         * @param{_backend} is not supported by the kernel.
+         * Call it before the NetThread starts and before {@link ListenOn}.
+         *
+         * @return: whether @param{_backend} is in use.
+         */
+        bool SetIoBackend(Poller::TBackend _backend);
+        
+        Poller::TBackend IoBackend() const;
+        
+        /**
+         * After I/O events, keeps polling with timeout 0 for
+         * @param{_spin_us} before blocking again, trading cpu for
+         * wakeup latency. Call it before the NetThread starts.
+         *
+         * @param _so_busy_poll_us: SO_BUSY_POLL set on accepted sockets, 0: not set.
+         */
+        void SetBusyPoll(uint64_t _spin_us, int _so_busy_poll_us);
+        
+        /**
+         * Lock-free snapshot, may be called from any thread.
+         */
+        LoopStats GetLoopStats() const;
+        
+        /**
+         * Idle connection objects kept for reuse, 0 disables pooling.
+         * Call it before the NetThread starts.
+         */
+        void SetConnectionPoolSize(size_t _size);
+        
+        /**
+         * Lock-free snapshot, may be called from any thread.
+         */
+        tcp::ConnectionPool::Stats GetConnectionPoolStats() const;
+        
+        /**
+         * Packets of at least @param{_threshold} bytes to accepted
+         * connections are sent with MSG_ZEROCOPY, 0 disables it.
+         * Epoll only, call it before the NetThread starts.
+         */
+        void SetZeroCopyThreshold(size_t _threshold);
+        
+        /**
+         * Requests served at most per accepted connection, the last
+         * one answered by "Connection: close", 0: unlimited.
+         */
+        void SetMaxRequestsPerConnection(size_t _max_requests);
+        
+        /**
+         * Bounds the bytes waiting to be sent, see {@link tcp::OutputBudget}.
+         * Call it before the NetThread starts.
+         */
+        void SetOutputLimits(size_t _high_watermark, size_t _low_watermark,
+                             size_t _cap);
+        
+        /**
+         * Lock-free, may be called from any thread, e.g. by workers
+         * to hold back pushes which would only pile up.
+         */
+        bool IsOutputOverCap() const;
+        
+        /**
+         * Lock-free snapshot, may be called from any thread.
+         */
+        tcp::OutputBudget::Stats GetOutputBudgetStats() const;
+        
+        /**
+         * Byte arrays grown by this NetThread are drawn from a
+         * {@link BufferPool} mapping @param{_max_mapped} bytes at most,
+         * 0 leaves them to malloc(3). Call it before the NetThread starts.
+         *
+         * @param _huge_pages: whether arenas are backed by huge pages.
+         */
+        void SetBufferPool(size_t _max_mapped, bool _huge_pages);
+        
+        /**
+         * Lock-free snapshot, may be called from any thread.
+         */
+        BufferPool::Stats GetBufferPoolStats() const;
+        
         void NotifyStop();
+        
+        /**
+         * Accepts connections inside this NetThread's own loop
+         * instead of being handed fds by the acceptor.
+         * Call it before the NetThread starts.
+         *
+         * @param _exclusive: whether @param{_listen_socket} is shared
+         *                    with other NetThreads.
+         */
+        void ListenOn(const Socket *_listen_socket, bool _exclusive);
       
+        /**
+         * Thread safe. Off the loop, e.g. by the acceptor, @param{_fd} is
+         * handed over through a lock-free ring, and counted by
+         * CurrConnectionCnt() at once.
+         */
         void RegisterConnection(SOCKET _fd, std::string &_ip, uint16_t _port);
     
         virtual void ConfigApplicationLayer(tcp::ConnectionProfile *) = 0;
@@ -123,32 +360,156 @@ class ServerBase {
     
         void SetMaxConnection(size_t);
         
+        /**
+         * Lock-free, including those handed over and not registered yet,
+         * so that connections placed in a burst see each other.
+         */
+        size_t CurrConnectionCnt() const;
+        
+        /**
+         * @return: How many parsed requests are waiting to be processed,
+         *          lock-free, used to place new connections.
+         */
+        virtual size_t Backlog();
+        
         tcp::ConnectionProfile *MakeConnection(std::string &_ip, uint16_t _port);
     
         tcp::ConnectionProfile *GetConnection(uint32_t _uid);
         
         void DelConnection(uint32_t _uid);
-    
-        void ClearTimeout();
+        
+        /**
+         * Deadlines of the connections of this NetThread,
+         * call it before the NetThread starts.
+         */
+        void SetDeadlines(const tcp::Deadlines &_deadlines);
+        
+        /**
+         * Fires @param{_timer} inside the loop of this NetThread after
+         * @param{_after_mills}, e.g. to ping WebSocket clients or to
+         * push messages later. Rescheduling a scheduled timer moves it.
+         * Can be called from any thread.
+         */
+        void AddTimer(TimingWheel::TimerNode *_timer, uint64_t _after_mills);
+        
+        /**
+         * One-shot version of {@link AddTimer}.
+         */
+        void RunAfter(uint64_t _after_mills, std::function<void()> _task);
+        
+        void CancelTimer(TimingWheel::TimerNode *_timer);
+        
+        /**
+         * Runs @param{_task} inside the loop of this NetThread, at once if
+         * called from it, the only way for other threads to touch
+         * its connections, which are not guarded by any lock.
+         */
+        void RunInLoop(std::function<void()> _task);
 
       private:
         
+        int __OnConnect();
+        
+        /**
+         * Wakes the loop up if called from other threads, e.g. for it
+         * to recalculate the timeout, or to arm what was just added.
+         */
+        void __WakeupIfOffLoop();
+        
+        bool __IsInLoop() const;
+        
+        void __RunPendingTasks();
+        
+        void __OnAccepted(SOCKET _fd);
+        
+        void __OnDeadline(tcp::ConnectionProfile *_conn);
+        
         /**
          *
          * @return: whether @param{_conn} is deleted.
          */
         bool __OnReadEvent(tcp::ConnectionProfile *_conn);
+        
+        /**
+         * Data received by the Poller on behalf of the loop.
+         *
+         * @return: whether @param{_conn} is deleted.
+         */
+        bool __OnRecvEvent(tcp::ConnectionProfile *_conn, const Poller::Event &_event);
+        
+        /**
+         * Handles FIN and parsed packets after receiving.
+         *
+         * @return: whether @param{_conn} is deleted.
+         */
+        bool __OnReceived(tcp::ConnectionProfile *_conn);
     
-        static void __OnWriteEvent(tcp::ConnectionProfile *);
+        void __OnWriteEvent(tcp::ConnectionProfile *);
+        
+        void __OnSent(uint32_t _uid, ssize_t _res);
+        
+        /**
+         * Submits the front packet queued for the connection
+         * @param{_uid}, dropping those of deleted connections.
+         */
+        void __SubmitAsyncSend(uint32_t _uid);
     
         virtual int __OnErrEvent(tcp::ConnectionProfile *);
         
         bool __IsNotifyStop(EpollNotifier::Notification &) const;
+        
+        void __Register(SOCKET _fd, std::string &_ip, uint16_t _port);
+        
+        /**
+         * Registers the connections handed over by RegisterConnection().
+         */
+        void __RegisterAccepted();
 
+      private:
+        struct AcceptedFd {
+            SOCKET      fd;
+            uint16_t    port;
+            char        ip[INET_ADDRSTRLEN];
+        };
+        
       private:
         SocketEpoll                         socket_epoll_;
+        IoUringPoller                       io_uring_poller_;   // outlives epoll_notifier_.
+        Poller                            * poller_;
+        BufferPool                          buffer_pool_;       // outlives the byte arrays.
+        bool                                use_buffer_pool_;
+        tcp::OutputBudget                   output_budget_;     // outlives the connections.
+        TimingWheel                         timing_wheel_;      // outlives connection_manager_.
+        tcp::ConnectionPool                 connection_pool_;   // outlives connection_manager_.
         ConnectionManager                   connection_manager_;
         EpollNotifier::Notification         notification_stop_;
+        EpollNotifier::Notification         notification_wakeup_;
+        const Socket                      * listen_socket_;
+        tcp::Deadlines                      deadlines_;
+        uint64_t                            busy_poll_us_;
+        int                                 so_busy_poll_us_;
+        size_t                              zerocopy_threshold_;
+        size_t                              max_requests_per_conn_;
+        std::atomic<uint64_t>               spin_us_;
+        std::atomic<uint64_t>               spin_polls_;
+        std::atomic<uint64_t>               spin_hits_;
+        std::atomic<uint64_t>               blocking_polls_;
+        std::atomic<uint64_t>               wakeups_;
+        /* Handed over by RegisterConnection() from other threads. */
+        MessageQueue::BoundedRingQueue<AcceptedFd, MessageQueue::kMulti,
+                                       MessageQueue::kSingle>   accepted_;
+        std::atomic<size_t>                 accepted_cnt_;
+        std::vector<AcceptedFd>             registering_;
+        static const size_t                 kMaxAcceptedQueued;
+        /* Posted by RunInLoop() from other threads. */
+        std::mutex                          task_mutex_;
+        std::vector<std::function<void()>>  tasks_;
+        /* Packets queued by AsyncSend() with io_uring, the front one in flight,
+         * by uid, not fd, which may be reused before the cancelled send is reported. */
+        std::unordered_map<uint32_t, std::deque<tcp::SendContext::Ptr>>  async_sends_;
+        /* Connections to flush in SendInBatch(), reused to save allocations. */
+        std::vector<tcp::ConnectionProfile *>   flushing_;
+        static const int                    kMaxEpollWaitMills;
       protected:
         EpollNotifier                       epoll_notifier_;
         size_t                              max_connections_;
@@ -171,16 +532,33 @@ class ServerBase {
     
     virtual bool _CustomConfig(yaml::YamlDescriptor *_desc);
     
+    bool _ConfigPlacement(yaml::YamlDescriptor *_desc);
+    
     void _NotifyNetThreadsStop();
     
-    bool _IsNotifyStop(EpollNotifier::Notification &) const;
+    /**
+     * Pops the pending notifications of the acceptor.
+     */
+    bool _IsNotifyStop();
     
     int _OnConnect();
     
     void _RegisterConnection(SOCKET _fd, std::string &_ip,
                              uint16_t _port);
     
-    int _CreateListenFd();
+    NetThreadBase *_SelectNetThread(SOCKET _fd);
+    
+    int _CreateListenFd(Socket &_listen_fd);
+    
+    void _ListenInNetThreads();
+    
+    void _LogLoopStats();
+    
+    void _LogConnectionPoolStats();
+    
+    void _LogOutputBudgetStats();
+    
+    void _LogBufferPoolStats();
     
     virtual int _OnEpollErr(SOCKET);
 
@@ -192,6 +570,8 @@ class ServerBase {
     EpollNotifier::Notification         notification_stop_;
     bool                                running_;
     Socket                              listenfd_;
+    std::vector<Socket *>               reuseport_listenfds_;
+    std::minstd_rand                    placement_rand_;
     static const size_t                 kDefaultListenBacklog;
     
 };
@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cerrno>
 #include <utility>
+#include <algorithm>
 #include <unistd.h>
 #include "timeutil.h"
 #include "socket/unixsocket.h"
@@ -9,29 +10,269 @@
 
 namespace tcp {
 
-SendContext::SendContext(uint32_t _seq)
-        : seq(_seq)
+SendContext::SendContext()
+        : seq(0)
         , tcp_connection_uid(0)
         , socket(nullptr)
         , is_tcp_conn_valid(true)
-        , MarkAsPendingPacket(nullptr)
-        , OnSendDone(nullptr) {
+        , response_seq(0)
+        , is_connection_close(false)
+        , connection(nullptr)
+        , ref_cnt_(0)
+        , pool_(nullptr)
+        , prev_(nullptr)
+        , next_(nullptr)
+        , next_pending_(nullptr)
+        , is_linked_(false)
+        , next_zerocopy_(nullptr)
+        , zerocopy_first_(0)
+        , zerocopy_cnt_(0)
+        , zerocopy_done_(0) {
 }
 
+void SendContext::AddRef() {
+    ref_cnt_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SendContext::Release() {
+    if (ref_cnt_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (pool_) {
+        pool_->__Release(this);
+    } else {
+        delete this;
+    }
+}
+
+
+const size_t SendContextPool::kMaxRetainedBuffer = 64 * 1024;
+
+SendContextPool::SendContextPool()
+        : free_(nullptr)
+        , released_(nullptr)
+        , allocated_(0) {
+}
+
+SendContext::Ptr SendContextPool::Acquire() {
+    if (!free_) {
+        free_ = released_.exchange(nullptr, std::memory_order_acquire);
+    }
+    SendContext *send_ctx = free_;
+    if (send_ctx) {
+        free_ = send_ctx->next_;
+        send_ctx->next_ = nullptr;
+    } else {
+        send_ctx = new SendContext();
+        send_ctx->pool_ = this;
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return SendContext::Ptr(send_ctx);
+}
+
+void SendContextPool::__Release(SendContext *_send_ctx) {
+    _send_ctx->seq = 0;
+    _send_ctx->tcp_connection_uid = 0;
+    _send_ctx->socket = nullptr;
+    _send_ctx->buffer.ResetAndShrink(kMaxRetainedBuffer);
+    _send_ctx->file_body.Reset();
+    _send_ctx->is_tcp_conn_valid = true;
+    _send_ctx->response_seq = 0;
+    _send_ctx->is_connection_close = false;
+    _send_ctx->connection = nullptr;
+    
+    SendContext *head = released_.load(std::memory_order_relaxed);
+    do {
+        _send_ctx->next_ = head;
+    } while (!released_.compare_exchange_weak(head, _send_ctx,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+}
+
+size_t SendContextPool::Allocated() const {
+    return allocated_.load(std::memory_order_relaxed);
+}
+
+SendContextPool::~SendContextPool() {
+    SendContext *lists[] = {free_, released_.exchange(nullptr)};
+    for (SendContext *send_ctx : lists) {
+        while (send_ctx) {
+            SendContext *next = send_ctx->next_;
+            delete send_ctx;
+            send_ctx = next;
+        }
+    }
+}
+
+const size_t OutputBudget::kDefaultHighWatermark = 4 * 1024 * 1024;
+const size_t OutputBudget::kDefaultLowWatermark = 1024 * 1024;
+
+OutputBudget::Stats::Stats()
+        : buffered(0)
+        , high_hits(0)
+        , cap_hits(0)
+        , resumes(0) {
+}
+
+OutputBudget::OutputBudget()
+        : high_(kDefaultHighWatermark)
+        , low_(kDefaultLowWatermark)
+        , cap_(0)
+        , buffered_(0)
+        , high_hits_(0)
+        , cap_hits_(0)
+        , resumes_(0) {
+}
+
+void OutputBudget::SetLimits(size_t _high, size_t _low, size_t _cap) {
+    high_ = _high;
+    low_ = _high > 0 ? std::min(_low, _high) : _low;
+    cap_ = _cap;
+}
+
+void OutputBudget::Charge(size_t _bytes) {
+    buffered_.fetch_add(_bytes, std::memory_order_relaxed);
+}
+
+void OutputBudget::Credit(size_t _bytes) {
+    buffered_.fetch_sub(_bytes, std::memory_order_relaxed);
+}
+
+bool OutputBudget::ShouldPause(size_t _conn_bytes) {
+    if (high_ > 0 && _conn_bytes > high_) {
+        high_hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if (IsOverCap()) {
+        cap_hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool OutputBudget::ShouldResume(size_t _conn_bytes) {
+    // Not waiting for the cap, a connection drained has nothing to
+    // credit anymore, and would be paused for good.
+    if (_conn_bytes > low_) {
+        return false;
+    }
+    resumes_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool OutputBudget::IsOverCap() const {
+    return cap_ > 0 && buffered_.load(std::memory_order_relaxed) > cap_;
+}
+
+OutputBudget::Stats OutputBudget::GetStats() const {
+    Stats stats;
+    stats.buffered = buffered_.load(std::memory_order_relaxed);
+    stats.high_hits = high_hits_.load(std::memory_order_relaxed);
+    stats.cap_hits = cap_hits_.load(std::memory_order_relaxed);
+    stats.resumes = resumes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
 RecvContext::RecvContext()
         : fd(INVALID_SOCKET)
         , tcp_connection_uid(0)
         , from_port(0)
         , type(kUnknown)
         , application_packet(nullptr)
-        , return_packet(nullptr) {
+        , is_output_blocked(false)
+        , return_packet(nullptr)
+        , ref_cnt_(0)
+        , pool_(nullptr)
+        , next_(nullptr) {
+    from_ip[0] = '\0';
 }
 
+void RecvContext::AddRef() {
+    ref_cnt_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RecvContext::Release() {
+    if (ref_cnt_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (pool_) {
+        pool_->__Release(this);
+    } else {
+        delete this;
+    }
+}
+
+
+RecvContextPool::RecvContextPool()
+        : free_(nullptr)
+        , released_(nullptr)
+        , allocated_(0) {
+}
+
+RecvContext::Ptr RecvContextPool::Acquire() {
+    if (!free_) {
+        free_ = released_.exchange(nullptr, std::memory_order_acquire);
+    }
+    RecvContext *recv_ctx = free_;
+    if (recv_ctx) {
+        free_ = recv_ctx->next_;
+        recv_ctx->next_ = nullptr;
+    } else {
+        recv_ctx = new RecvContext();
+        recv_ctx->pool_ = this;
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return RecvContext::Ptr(recv_ctx);
+}
+
+void RecvContextPool::__Release(RecvContext *_recv_ctx) {
+    _recv_ctx->tcp_connection_uid = 0;
+    _recv_ctx->fd = INVALID_SOCKET;
+    _recv_ctx->from_ip[0] = '\0';
+    _recv_ctx->from_port = 0;
+    _recv_ctx->type = kUnknown;
+    _recv_ctx->is_output_blocked = false;
+    // Probably back to their own pools.
+    _recv_ctx->application_packet = nullptr;
+    _recv_ctx->packets_push_others.clear();
+    _recv_ctx->return_packet = nullptr;
+    
+    RecvContext *head = released_.load(std::memory_order_relaxed);
+    do {
+        _recv_ctx->next_ = head;
+    } while (!released_.compare_exchange_weak(head, _recv_ctx,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+}
+
+size_t RecvContextPool::Allocated() const {
+    return allocated_.load(std::memory_order_relaxed);
+}
+
+RecvContextPool::~RecvContextPool() {
+    RecvContext *lists[] = {free_, released_.exchange(nullptr)};
+    for (RecvContext *recv_ctx : lists) {
+        while (recv_ctx) {
+            RecvContext *next = recv_ctx->next_;
+            delete recv_ctx;
+            recv_ctx = next;
+        }
+    }
+}
+
+
+const uint64_t Deadlines::kDefaultTimeout = 10 * 1000;
+
+const int ConnectionProfile::kMaxIovecs = 64;
+const size_t ConnectionProfile::kMaxIdleByteArray = 64 * 1024;
+
+Deadlines::Deadlines()
+        : header_read(kDefaultTimeout)
+        , body_read(kDefaultTimeout)
+        , keep_alive(kDefaultTimeout) {
+}
 
-// For Connection from client, it will be considered timeout
-// if no data is sent within such interval
-// after the connection has been established.
-const uint64_t ConnectionProfile::kDefaultTimeout = 10 * 1000;
 
 ConnectionProfile::ConnectionProfile(std::string _remote_ip,
                                      uint16_t _remote_port, uint32_t _uid/* = 0*/)
@@ -40,13 +281,37 @@ ConnectionProfile::ConnectionProfile(std::string _remote_ip,
         , is_longlink_app_proto_(false)
         , remote_ip_(std::move(_remote_ip))
         , remote_port_(_remote_port)
-        , record_(::gettickcount())
         , socket_(INVALID_SOCKET)
+        , poller_(nullptr)
         , has_received_Fin_(false)
-        , timeout_ts_(record_ + kDefaultTimeout)
+        , timing_wheel_(nullptr)
+        , deadlines_(nullptr)
+        , deadline_phase_(kNoDeadline)
         , curr_application_packet_(nullptr)
         , application_protocol_parser_(nullptr)
-        , send_ctx_seq_(0) {
+        , has_spare_application_layer_(false)
+        , is_application_layer_recycled_(false)
+        , send_ctx_seq_(0)
+        , send_ctx_pool_(nullptr)
+        , recv_ctx_pool_(nullptr)
+        , packet_pool_(nullptr)
+        , send_contexts_(nullptr)
+        , pending_send_ctx_head_(nullptr)
+        , pending_send_ctx_tail_(nullptr)
+        , pending_send_ctx_cnt_(0)
+        , response_seq_(0)
+        , next_response_seq_(1)
+        , held_responses_(nullptr)
+        , max_requests_(0)
+        , is_receiving_stopped_(false)
+        , output_budget_(nullptr)
+        , output_bytes_(0)
+        , is_reading_paused_(false)
+        , sent_bytes_(0)
+        , sent_bytes_checked_(0)
+        , zerocopy_threshold_(0)
+        , zerocopy_head_(nullptr)
+        , zerocopy_tail_(nullptr) {
 }
 
 
@@ -81,15 +346,145 @@ int ConnectionProfile::Receive() {
             return -1;
         }
     
-        if (IsParseDone() || !has_more_data) {
+        // Reads on, the bytes after being pipelined requests or the next
+        // frames, while those after an upgrade request belong to the new protocol.
+        if (!has_more_data || (IsParseDone() && IsUpgradeApplicationProtocol())) {
             return 0;
         }
     }
 }
 
-void ConnectionProfile::AddPendingPacketToSend(
-            SendContext::Ptr _send_ctx) {
-    pending_send_ctx_.push(std::move(_send_ctx));
+int ConnectionProfile::Receive(const char *_buf, ssize_t _n) {
+    if (_n < 0) {
+        LogE("fd(%d), uid: %d, errno(%zd): %s", socket_.FD(), uid_, -_n, strerror((int) -_n))
+        return -1;
+    }
+    if (_n == 0) {   // FIN.
+        has_received_Fin_ = true;
+        LogI("fd(%d), uid: %d, peer sent FIN", socket_.FD(), uid_)
+        return 0;
+    }
+    tcp_byte_arr_.Write(_buf, _n);
+    
+    int ret = ParseProtocol();
+    if (ret == -1) {
+        LogE("No application_protocol_parser set")
+        return -1;
+    }
+    return ret == -2 ? -1 : 0;
+}
+
+void ConnectionProfile::AddPendingPacketToSend(SendContext *_send_ctx) {
+    EnqueueToSend(_send_ctx);
+    WaitWritable();
+}
+
+void ConnectionProfile::EnqueueToSend(SendContext *_send_ctx) {
+    // Kept alive by send_contexts_ till sent.
+    assert(_send_ctx->is_linked_ && !_send_ctx->next_pending_);
+    // Held responses take memory as well.
+    ChargeOutput(_send_ctx->buffer.Length() - _send_ctx->buffer.Pos());
+    if (!TakeInOrder(_send_ctx)) {
+        return;
+    }
+    do {
+        if (pending_send_ctx_tail_) {
+            pending_send_ctx_tail_->next_pending_ = _send_ctx;
+        } else {
+            pending_send_ctx_head_ = _send_ctx;
+        }
+        pending_send_ctx_tail_ = _send_ctx;
+        ++pending_send_ctx_cnt_;
+    } while ((_send_ctx = NextInOrder()));
+}
+
+void ConnectionProfile::WaitWritable() {
+    if (poller_) {
+        poller_->WaitWritable(FD(), (uint64_t) this);
+    }
+}
+
+bool ConnectionProfile::TakeInOrder(SendContext *_send_ctx) {
+    if (_send_ctx->response_seq == 0) {
+        return true;
+    }
+    if (_send_ctx->response_seq == next_response_seq_) {
+        ++next_response_seq_;
+        return true;
+    }
+    // Workers mostly finish in order, the list is short.
+    SendContext **link = &held_responses_;
+    while (*link && (*link)->response_seq < _send_ctx->response_seq) {
+        link = &(*link)->next_pending_;
+    }
+    _send_ctx->next_pending_ = *link;
+    *link = _send_ctx;
+    return false;
+}
+
+SendContext *ConnectionProfile::NextInOrder() {
+    SendContext *send_ctx = held_responses_;
+    if (!send_ctx || send_ctx->response_seq != next_response_seq_) {
+        return nullptr;
+    }
+    held_responses_ = send_ctx->next_pending_;
+    send_ctx->next_pending_ = nullptr;
+    ++next_response_seq_;
+    return send_ctx;
+}
+
+bool ConnectionProfile::__HasResponseInFlight() const {
+    return next_response_seq_ <= response_seq_;
+}
+
+void ConnectionProfile::ChargeOutput(size_t _bytes) {
+    output_bytes_ += _bytes;
+    if (!output_budget_ || _bytes == 0) {
+        return;
+    }
+    output_budget_->Charge(_bytes);
+    if (!is_reading_paused_ && output_budget_->ShouldPause(output_bytes_)) {
+        LogI("fd(%d), uid: %u, %zu B unsent, stop reading", FD(), uid_, output_bytes_)
+        is_reading_paused_ = true;
+        if (poller_) {
+            poller_->PauseReading(FD(), (uint64_t) this);
+        }
+        // Dropped at the deadline unless sending goes on meanwhile.
+        sent_bytes_checked_ = sent_bytes_;
+        ExtendDeadline();
+    }
+}
+
+void ConnectionProfile::CreditOutput(size_t _bytes) {
+    _bytes = std::min(_bytes, output_bytes_);
+    output_bytes_ -= _bytes;
+    sent_bytes_ += _bytes;
+    if (!output_budget_) {
+        return;
+    }
+    output_budget_->Credit(_bytes);
+    if (is_reading_paused_ && output_budget_->ShouldResume(output_bytes_)) {
+        LogI("fd(%d), uid: %u, %zu B unsent, read again", FD(), uid_, output_bytes_)
+        is_reading_paused_ = false;
+        if (poller_) {
+            poller_->ResumeReading(FD(), (uint64_t) this);
+        }
+        UpdateDeadline();
+    }
+}
+
+size_t ConnectionProfile::OutputBytes() const { return output_bytes_; }
+
+bool ConnectionProfile::IsReadingPaused() const { return is_reading_paused_; }
+
+bool ConnectionProfile::IsSendProgressing() {
+    bool is_progressing = sent_bytes_ != sent_bytes_checked_;
+    sent_bytes_checked_ = sent_bytes_;
+    return is_progressing;
+}
+
+void ConnectionProfile::SetOutputBudget(OutputBudget *_budget) {
+    output_budget_ = _budget;
 }
 
 bool ConnectionProfile::TrySend(const SendContext::Ptr& _send_ctx) {
@@ -98,36 +493,232 @@ bool ConnectionProfile::TrySend(const SendContext::Ptr& _send_ctx) {
         LogPrintStacktrace()
         return false;
     }
+    return __TrySend(_send_ctx.get());
+}
+
+bool ConnectionProfile::__TrySend(SendContext *_send_ctx) {
     AutoBuffer &resp = _send_ctx->buffer;
     bool is_send_done = false;
 
     _send_ctx->socket->Send(&resp, &is_send_done);
-
+    
+    if (_send_ctx->file_body.length > 0 && resp.Pos() == resp.Length()) {
+        is_send_done = TrySendFileBody(_send_ctx) > 0;
+    }
     return is_send_done;
 }
 
+int ConnectionProfile::TrySendFileBody(SendContext *_send_ctx) {
+    file::FileRegion &body = _send_ctx->file_body;
+    while (body.length > 0) {
+        ssize_t nwrite = _send_ctx->socket->SendFile(body.file->Fd(),
+                                                     &body.offset, body.length);
+        if (nwrite <= 0) {
+            return (int) nwrite;
+        }
+        body.length -= nwrite;
+        if (_send_ctx->connection) {
+            // Not charged, the file pins no memory of ours.
+            _send_ctx->connection->sent_bytes_ += nwrite;
+        }
+    }
+    return 1;
+}
+
 bool ConnectionProfile::HasPendingPacketToSend() const {
-    return !pending_send_ctx_.empty();
+    return pending_send_ctx_head_ != nullptr;
 }
 
 bool ConnectionProfile::TrySendPendingPackets() {
-    LogD("fd(%d), %lu pending packets waiting to be sent",
-                FD(), pending_send_ctx_.size())
-    while (!pending_send_ctx_.empty()) {
-        auto send_ctx = pending_send_ctx_.front();
-        bool is_send_done = TrySend(send_ctx);
-        if (is_send_done) {
-            if (send_ctx->OnSendDone) {
-                send_ctx->OnSendDone();
+    LogD("fd(%d), %zu pending packets waiting to be sent",
+                FD(), pending_send_ctx_cnt_)
+    struct iovec iov[kMaxIovecs];
+    
+    while (pending_send_ctx_head_) {
+        int iov_cnt = 0;
+        size_t ntotal = 0;
+        SendContext *zerocopy = nullptr;
+        for (SendContext *send_ctx = pending_send_ctx_head_;
+                    send_ctx && iov_cnt < kMaxIovecs;
+                    send_ctx = send_ctx->next_pending_) {
+            AutoBuffer &buffer = send_ctx->buffer;
+            size_t left = buffer.Length() - buffer.Pos();
+            // A shallow copy, e.g. a response relayed by the proxy, does
+            // not own its bytes, which may be reused before the kernel
+            // is done with them.
+            if (!buffer.IsSegmented() && !buffer.IsShallowCopy()
+                        && __IsZeroCopyWorthy(left)) {
+                // Sent alone, since its buffer is held till completion.
+                if (iov_cnt == 0) {
+                    zerocopy = send_ctx;
+                    iov[iov_cnt].iov_base = buffer.Ptr(buffer.Pos());
+                    iov[iov_cnt].iov_len = left;
+                    ntotal += left;
+                    ++iov_cnt;
+                }
+                break;
+            }
+            // One iovec, or one per segment if chained.
+            int n = buffer.Iovecs(buffer.Pos(), iov + iov_cnt, kMaxIovecs - iov_cnt);
+            size_t gathered = 0;
+            for (int i = iov_cnt; i < iov_cnt + n; ++i) {
+                gathered += iov[i].iov_len;
+            }
+            iov_cnt += n;
+            ntotal += gathered;
+            if (gathered < left) {
+                break;  // out of iovecs, the rest goes next round.
+            }
+            if (send_ctx->file_body.length > 0) {
+                break;  // the file goes right after its headers.
+            }
+        }
+        
+        ssize_t nwrite;
+        if (zerocopy) {
+            uint32_t seq;
+            nwrite = socket_.SendZeroCopy(iov[0].iov_base, iov[0].iov_len, &seq);
+            if (seq != UINT32_MAX) {
+                __HoldForZeroCopy(zerocopy, seq);
+            }
+        } else {
+            nwrite = iov_cnt ? socket_.Send(iov, iov_cnt) : 0;
+        }
+        if (nwrite < 0) {
+            return false;
+        }
+        
+        // Credits what is written to the packets in order,
+        // the last one touched may be written partially.
+        size_t credit = nwrite;
+        while (pending_send_ctx_head_) {
+            AutoBuffer &buffer = pending_send_ctx_head_->buffer;
+            size_t left = buffer.Length() - buffer.Pos();
+            size_t n = std::min(left, credit);
+            buffer.Seek(AutoBuffer::kCurrent, n);
+            credit -= n;
+            if (n < left || pending_send_ctx_head_->file_body.length > 0) {
+                break;
+            }
+            __PopPendingPacket();
+            if (credit == 0 && (size_t) nwrite < ntotal) {
+                break;
+            }
+        }
+        CreditOutput(nwrite);
+        if ((size_t) nwrite < ntotal) {
+            return false;   // EAGAIN, or the socket buffer is full.
+        }
+        if (pending_send_ctx_head_ && pending_send_ctx_head_->file_body.length > 0
+                    && pending_send_ctx_head_->buffer.Pos() == pending_send_ctx_head_->buffer.Length()) {
+            if (TrySendFileBody(pending_send_ctx_head_) <= 0) {
+                return false;
             }
-            pending_send_ctx_.pop();
-            continue;
+            __PopPendingPacket();
         }
+    }
+    return true;
+}
+
+void ConnectionProfile::__PopPendingPacket() {
+    SendContext *send_ctx = pending_send_ctx_head_;
+    pending_send_ctx_head_ = send_ctx->next_pending_;
+    if (!pending_send_ctx_head_) {
+        pending_send_ctx_tail_ = nullptr;
+    }
+    send_ctx->next_pending_ = nullptr;
+    --pending_send_ctx_cnt_;
+    OnSendDone(send_ctx);
+}
+
+void ConnectionProfile::SetZeroCopyThreshold(size_t _threshold) {
+    zerocopy_threshold_ = _threshold;
+}
+
+bool ConnectionProfile::HasZeroCopyInFlight() const {
+    return zerocopy_head_ != nullptr;
+}
+
+bool ConnectionProfile::__IsZeroCopyWorthy(size_t _len) {
+    if (zerocopy_threshold_ == 0 || _len < zerocopy_threshold_) {
+        return false;
+    }
+    if (!socket_.IsZeroCopyEnabled() && !socket_.EnableZeroCopy()) {
+        LogI("fd(%d), MSG_ZEROCOPY not supported", FD())
+        zerocopy_threshold_ = 0;
         return false;
     }
     return true;
 }
 
+void ConnectionProfile::__HoldForZeroCopy(SendContext *_send_ctx, uint32_t _seq) {
+    if (_send_ctx->zerocopy_cnt_ == 0) {
+        _send_ctx->AddRef();
+        _send_ctx->zerocopy_first_ = _seq;
+        if (zerocopy_tail_) {
+            zerocopy_tail_->next_zerocopy_ = _send_ctx;
+        } else {
+            zerocopy_head_ = _send_ctx;
+        }
+        zerocopy_tail_ = _send_ctx;
+    }
+    // A packet sent partially keeps the ids of its sends consecutive.
+    ++_send_ctx->zerocopy_cnt_;
+}
+
+bool ConnectionProfile::ReapZeroCopyCompletions() {
+    uint32_t lo;
+    uint32_t hi;
+    bool is_copied;
+    int ret;
+    while ((ret = socket_.ReadZeroCopyCompletion(&lo, &hi, &is_copied)) > 0) {
+        if (is_copied && zerocopy_threshold_ > 0) {
+            LogI("fd(%d), kernel copied anyway, give up MSG_ZEROCOPY", FD())
+            zerocopy_threshold_ = 0;
+        }
+        SendContext *prev = nullptr;
+        SendContext *send_ctx = zerocopy_head_;
+        while (send_ctx) {
+            SendContext *next = send_ctx->next_zerocopy_;
+            uint32_t first = std::max(lo, send_ctx->zerocopy_first_);
+            uint32_t last = std::min(hi, send_ctx->zerocopy_first_
+                                         + send_ctx->zerocopy_cnt_ - 1);
+            if (first <= last) {
+                send_ctx->zerocopy_done_ += last - first + 1;
+            }
+            AutoBuffer &buffer = send_ctx->buffer;
+            if (send_ctx->zerocopy_done_ == send_ctx->zerocopy_cnt_
+                        && buffer.Pos() == buffer.Length()) {
+                __ReleaseZeroCopied(prev, send_ctx);
+            } else {
+                prev = send_ctx;
+            }
+            send_ctx = next;
+        }
+    }
+    if (ret < 0) {
+        socket_.SocketError();
+        return false;
+    }
+    return socket_.PendingError() == 0;
+}
+
+void ConnectionProfile::__ReleaseZeroCopied(SendContext *_prev, SendContext *_send_ctx) {
+    if (_prev) {
+        _prev->next_zerocopy_ = _send_ctx->next_zerocopy_;
+    } else {
+        zerocopy_head_ = _send_ctx->next_zerocopy_;
+    }
+    if (zerocopy_tail_ == _send_ctx) {
+        zerocopy_tail_ = _prev;
+    }
+    _send_ctx->next_zerocopy_ = nullptr;
+    _send_ctx->zerocopy_first_ = 0;
+    _send_ctx->zerocopy_cnt_ = 0;
+    _send_ctx->zerocopy_done_ = 0;
+    _send_ctx->Release();
+}
+
 uint32_t ConnectionProfile::Uid() const { return uid_; }
 
 void ConnectionProfile::SetUid(uint32_t _uid) { uid_ = _uid; }
@@ -137,6 +728,10 @@ int ConnectionProfile::ParseProtocol() {
         LogE("please config application protocol first")
         return -1;
     }
+    if (is_receiving_stopped_) {
+        tcp_byte_arr_.DropFront(tcp_byte_arr_.Length());
+        return 0;
+    }
     
     application_protocol_parser_->DoParse();
     
@@ -153,6 +748,48 @@ bool ConnectionProfile::IsParseDone() {
     return application_protocol_parser_->IsEnd();
 }
 
+size_t ConnectionProfile::PacketLength() const {
+    assert(application_protocol_parser_);
+    return application_protocol_parser_->PacketLength();
+}
+
+int ConnectionProfile::NextPacket() {
+    assert(application_protocol_parser_ && application_protocol_parser_->IsEnd());
+    if (!curr_application_packet_) {
+        LogE("fd(%d), %s parses one packet per connection", FD(), ApplicationProtocolName())
+        return -1;
+    }
+    // Only the read cursor moves, the memory is reused by the next packet.
+    tcp_byte_arr_.DropFront(application_protocol_parser_->PacketLength());
+    application_protocol_parser_->Reset();
+    
+    if (tcp_byte_arr_.Length() == 0) {
+        // Bounds what an idle connection keeps after a large packet.
+        tcp_byte_arr_.ResetAndShrink(kMaxIdleByteArray);
+        return 0;
+    }
+    if (ParseProtocol() != 0) {
+        return -1;
+    }
+    return IsParseDone() ? 1 : 0;
+}
+
+void ConnectionProfile::StopReceivingPackets() {
+    is_receiving_stopped_ = true;
+    if (application_protocol_parser_) {
+        application_protocol_parser_->Reset();
+    }
+    tcp_byte_arr_.DropFront(tcp_byte_arr_.Length());
+}
+
+void ConnectionProfile::SetMaxRequests(size_t _max_requests) {
+    max_requests_ = _max_requests;
+}
+
+bool ConnectionProfile::IsMaxRequestsReached() const {
+    return max_requests_ > 0 && response_seq_ >= max_requests_;
+}
+
 bool ConnectionProfile::IsUpgradeApplicationProtocol() const {
     if (!application_protocol_parser_) {
         return false;
@@ -187,19 +824,84 @@ Socket &ConnectionProfile::GetSocket() { return socket_; }
 
 SOCKET ConnectionProfile::FD() const { return socket_.FD(); }
 
-bool ConnectionProfile::IsTimeout(uint64_t _now) const {
-    if (IsLongLinkApplicationProtocol()) {
-        return false;
+void ConnectionProfile::SetPoller(Poller *_poller) { poller_ = _poller; }
+
+void ConnectionProfile::StartDeadlineTimer(TimingWheel *_wheel,
+                                           const Deadlines *_deadlines,
+                                           std::function<void()> _on_deadline) {
+    assert(_wheel && _deadlines);
+    timing_wheel_ = _wheel;
+    deadlines_ = _deadlines;
+    deadline_timer_.SetCallback(std::move(_on_deadline));
+    __ArmDeadline(kHeaderRead);
+}
+
+void ConnectionProfile::UpdateDeadline() {
+    if (!timing_wheel_) {
+        return;
     }
-    if (!pending_send_ctx_.empty()) {
-        // timeout just because of poor networking
-        // is not considered as timeout.
-        return false;
+    if (IsLongLinkApplicationProtocol() || !application_protocol_parser_) {
+        // Long links are kept alive by Tcp heartbeat.
+        __ArmDeadline(kNoDeadline);
+        return;
     }
-    if (_now == 0) {
-        _now = ::gettickcount();
+    if (application_protocol_parser_->IsEnd()) {
+        // Waiting for the packet to be processed,
+        // the keep-alive deadline starts after sending back.
+        __ArmDeadline(kNoDeadline);
+        return;
+    }
+    if (tcp_byte_arr_.Length() == 0) {
+        // Between packets, idle once all responses are sent back.
+        __ArmDeadline(__HasResponseInFlight() ? kNoDeadline : kKeepAlive);
+        return;
+    }
+    if (application_protocol_parser_->IsHeaderDone()) {
+        if (deadline_phase_ != kBodyRead) {
+            __ArmDeadline(kBodyRead);
+        }
+        return;
+    }
+    if (deadline_phase_ != kHeaderRead) {
+        // Not extended by every few bytes received,
+        // so that slow clients can not hold the buffer forever.
+        __ArmDeadline(kHeaderRead);
     }
-    return _now > timeout_ts_;
+}
+
+void ConnectionProfile::ExtendDeadline() {
+    __ArmDeadline(kKeepAlive);
+}
+
+TDeadlinePhase ConnectionProfile::DeadlinePhase() const { return deadline_phase_; }
+
+void ConnectionProfile::__ArmDeadline(TDeadlinePhase _phase) {
+    if (!timing_wheel_) {
+        return;
+    }
+    uint64_t timeout = 0;
+    switch (_phase) {
+        case kHeaderRead:
+            timeout = deadlines_->header_read;
+            break;
+        case kBodyRead:
+            timeout = deadlines_->body_read;
+            break;
+        case kKeepAlive:
+            timeout = deadlines_->keep_alive;
+            if (GetType() == kConnectTo) {
+                timeout *= 2;
+            }
+            break;
+        default:
+            break;
+    }
+    deadline_phase_ = _phase;
+    if (timeout == 0) {
+        timing_wheel_->Cancel(&deadline_timer_);
+        return;
+    }
+    timing_wheel_->Schedule(&deadline_timer_, timeout);
 }
 
 void ConnectionProfile::SendTcpFin() const {
@@ -208,18 +910,21 @@ void ConnectionProfile::SendTcpFin() const {
 
 bool ConnectionProfile::HasReceivedFin() const { return has_received_Fin_; }
 
-void ConnectionProfile::SendContextSendDoneCallback(
-                const SendContext::Ptr& _send_ctx) {
-    if (!IsLongLinkApplicationProtocol()) {
+void ConnectionProfile::OnSendDone(SendContext *_send_ctx) {
+    if (_send_ctx->is_connection_close) {
+        SendTcpFin();
+        StopReceivingPackets();
+    }
+    // Pipelined requests answered or being received are timed already.
+    bool is_idle = _send_ctx->response_seq == 0
+            || (_send_ctx->response_seq == response_seq_ && tcp_byte_arr_.Length() == 0);
+    if (!IsLongLinkApplicationProtocol() && is_idle) {
         // After sending the return packet, the client is expected
-        // to send a Tcp Fin within the specific interval,
-        // else such connection will be considered as timeout.
-        timeout_ts_ = ::gettickcount() + kDefaultTimeout;
-        if (GetType() == kConnectTo) {
-            timeout_ts_ += kDefaultTimeout;
-        }
+        // to send a Tcp Fin or the next packet within the specific
+        // interval, else such connection will be considered as timeout.
+        __ArmDeadline(kKeepAlive);
     }
-    DelSendContext(_send_ctx->seq);
+    __UnlinkSendContext(_send_ctx);
 }
 
 bool ConnectionProfile::IsTypeValid() const {
@@ -229,61 +934,196 @@ bool ConnectionProfile::IsTypeValid() const {
 
 RecvContext::Ptr ConnectionProfile::MakeRecvContext(
                         bool _with_send_ctx /* = false */) {
-    auto neo = std::make_shared<tcp::RecvContext>();
+    RecvContext::Ptr neo = recv_ctx_pool_ ? recv_ctx_pool_->Acquire()
+                                          : RecvContext::Ptr(new RecvContext());
     neo->fd = socket_.FD();
     neo->tcp_connection_uid = Uid();
-    neo->from_ip = std::string(RemoteIp());
+    size_t ip_len = std::min(remote_ip_.size(), sizeof(neo->from_ip) - 1);
+    memcpy(neo->from_ip, remote_ip_.data(), ip_len);
+    neo->from_ip[ip_len] = '\0';
     neo->from_port = RemotePort();
     neo->type = GetType();
-    neo->application_packet = curr_application_packet_;
-    if (IsLongLinkApplicationProtocol()) {
-        // Resets parser to clear data of last application packet,
-        // because longlink protocol reuses the parser.
-        application_protocol_parser_->Reset();
-        
-        // Allocates a new packet because the old one probably has not
-        // been processed by the worker thread when new data comes and
-        // a new application packet is needed to be parsed in.
-        curr_application_packet_ = curr_application_packet_->AllocNewPacket();
+    neo->is_output_blocked = is_reading_paused_
+            || (output_budget_ && output_budget_->IsOverCap());
+    
+    // The packet handed over is probably still being processed by the
+    // worker when the next one, pipelined or the next frame, is parsed.
+    // nullptr if the protocol parses one packet per connection.
+    ApplicationPacket::Ptr next = curr_application_packet_->AllocNewPacket();
+    neo->application_packet = std::move(curr_application_packet_);
+    curr_application_packet_ = std::move(next);
+    if (curr_application_packet_) {
         application_protocol_parser_->SetPacketToParse(curr_application_packet_);
     }
-    neo->return_packet = _with_send_ctx ? MakeSendContext() : nullptr;
+    neo->return_packet = _with_send_ctx ? MakeResponseContext() : nullptr;
     return neo;
 }
 
 SendContext::Ptr ConnectionProfile::MakeSendContext() {
-    auto neo = std::make_shared<tcp::SendContext>(++send_ctx_seq_);
+    SendContext::Ptr neo = send_ctx_pool_ ? send_ctx_pool_->Acquire()
+                                          : SendContext::Ptr(new SendContext());
+    neo->seq = ++send_ctx_seq_;
     neo->tcp_connection_uid = Uid();
     neo->socket = &socket_;
     neo->is_tcp_conn_valid = true;
-    neo->MarkAsPendingPacket = std::bind(
-            &ConnectionProfile::AddPendingPacketToSend, this, neo);
-    neo->OnSendDone = std::bind(
-            &ConnectionProfile::SendContextSendDoneCallback, this, neo);
-    send_contexts_.push_back(neo);
+    neo->connection = this;
+    __LinkSendContext(neo.get());
     return neo;
 }
 
-void ConnectionProfile::DelSendContext(uint32_t _send_ctx_seq) {
-    send_contexts_.remove_if([=] (SendContext::Ptr &ptr) -> bool {
-        return ptr->seq == _send_ctx_seq;
-    });
+SendContext::Ptr ConnectionProfile::MakeResponseContext() {
+    SendContext::Ptr neo = MakeSendContext();
+    neo->response_seq = ++response_seq_;
+    return neo;
+}
+
+void ConnectionProfile::SetSendContextPool(SendContextPool *_pool) {
+    send_ctx_pool_ = _pool;
+}
+
+void ConnectionProfile::SetRecvContextPool(RecvContextPool *_pool) {
+    recv_ctx_pool_ = _pool;
+}
+
+void ConnectionProfile::SetPacketPool(ApplicationPacketPool *_pool) {
+    packet_pool_ = _pool;
+}
+
+void ConnectionProfile::__LinkSendContext(SendContext *_send_ctx) {
+    _send_ctx->AddRef();
+    _send_ctx->prev_ = nullptr;
+    _send_ctx->next_ = send_contexts_;
+    if (send_contexts_) {
+        send_contexts_->prev_ = _send_ctx;
+    }
+    send_contexts_ = _send_ctx;
+    _send_ctx->is_linked_ = true;
+}
+
+void ConnectionProfile::__UnlinkSendContext(SendContext *_send_ctx) {
+    if (!_send_ctx->is_linked_) {
+        return;
+    }
+    if (_send_ctx->prev_) {
+        _send_ctx->prev_->next_ = _send_ctx->next_;
+    } else {
+        send_contexts_ = _send_ctx->next_;
+    }
+    if (_send_ctx->next_) {
+        _send_ctx->next_->prev_ = _send_ctx->prev_;
+    }
+    _send_ctx->prev_ = nullptr;
+    _send_ctx->next_ = nullptr;
+    _send_ctx->is_linked_ = false;
+    _send_ctx->Release();   // probably back to the pool.
+}
+
+void ConnectionProfile::__InvalidateSendContexts() {
+    pending_send_ctx_head_ = nullptr;
+    pending_send_ctx_tail_ = nullptr;
+    pending_send_ctx_cnt_ = 0;
+    held_responses_ = nullptr;
+    if (output_budget_) {
+        output_budget_->Credit(output_bytes_);
+    }
+    output_bytes_ = 0;
+    // Removed from the Poller already, nothing to resume.
+    is_reading_paused_ = false;
+    // No completion can be read once the socket is gone, while a graceful
+    // close would have the kernel go on sending from buffers about to be
+    // reused for other peers. Unless done by now, the connection is
+    // aborted on close, which discards the data not sent yet.
+    if (zerocopy_head_) {
+        ReapZeroCopyCompletions();
+    }
+    for (SendContext *send_ctx = zerocopy_head_; send_ctx;
+                send_ctx = send_ctx->next_zerocopy_) {
+        if (send_ctx->zerocopy_done_ < send_ctx->zerocopy_cnt_) {
+            LogI("fd(%d), zero copy in flight, reset on close", FD())
+            socket_.SetCloseLingerTimeout(0);
+            break;
+        }
+    }
+    while (zerocopy_head_) {
+        __ReleaseZeroCopied(nullptr, zerocopy_head_);
+    }
+    while (send_contexts_) {
+        SendContext *send_ctx = send_contexts_;
+        send_ctx->is_tcp_conn_valid = false;
+        send_ctx->connection = nullptr;
+        send_ctx->next_pending_ = nullptr;
+        __UnlinkSendContext(send_ctx);
+    }
 }
 
 std::string &ConnectionProfile::RemoteIp() { return remote_ip_; }
 
 uint16_t ConnectionProfile::RemotePort() const { return remote_port_; }
 
+void ConnectionProfile::Recycle(size_t _max_retained) {
+    __InvalidateSendContexts();
+    if (timing_wheel_) {
+        timing_wheel_->Cancel(&deadline_timer_);
+    }
+    timing_wheel_ = nullptr;
+    deadlines_ = nullptr;
+    deadline_phase_ = kNoDeadline;
+    deadline_timer_.SetCallback(nullptr);
+    
+    socket_.Close();
+    socket_.SetConnected(false);
+    tcp_byte_arr_.ResetAndShrink(_max_retained);
+    
+    uid_ = 0;
+    poller_ = nullptr;
+    has_received_Fin_ = false;
+    response_seq_ = 0;
+    next_response_seq_ = 1;
+    max_requests_ = 0;
+    is_receiving_stopped_ = false;
+    output_budget_ = nullptr;
+    sent_bytes_ = 0;
+    sent_bytes_checked_ = 0;
+    zerocopy_threshold_ = 0;
+    remote_port_ = 0;
+    application_protocol_ = kNone;
+    is_longlink_app_proto_ = false;
+    is_application_layer_recycled_ = false;
+    
+    // The packet goes back to its pool once
+    // the worker still holding it lets go as well.
+    has_spare_application_layer_ = application_protocol_parser_
+            && application_protocol_parser_->Recycle();
+    if (!has_spare_application_layer_) {
+        delete application_protocol_parser_, application_protocol_parser_ = nullptr;
+    }
+    curr_application_packet_ = nullptr;
+}
+
+size_t ConnectionProfile::RetainedSize() const {
+    return tcp_byte_arr_.RetainedSize() + remote_ip_.capacity();
+}
+
+bool ConnectionProfile::IsApplicationLayerRecycled() const {
+    return is_application_layer_recycled_;
+}
+
+bool ConnectionProfile::__IsSpareParserOf(const std::type_info &_parser_type) const {
+    return has_spare_application_layer_
+            && typeid(*application_protocol_parser_) == _parser_type;
+}
+
 ConnectionProfile::~ConnectionProfile() {
-    if (!pending_send_ctx_.empty()) {
+    if (HasPendingPacketToSend()) {
         LogI("pending_send_ctx_ NOT empty, deleted probably because of FIN")
     }
     // Notify all send_ctx not to send anymore.
-    for (auto & send_ctx : send_contexts_) {
-        send_ctx->is_tcp_conn_valid = false;
-    }
+    __InvalidateSendContexts();
     delete application_protocol_parser_;
     application_protocol_parser_ = nullptr;
+    if (timing_wheel_) {
+        timing_wheel_->Cancel(&deadline_timer_);
+    }
 }
 
 
@@ -298,6 +1138,14 @@ ConnectionTo::ConnectionTo(std::string _remote_ip, uint16_t _remote_port, uint32
 
 ConnectionTo::~ConnectionTo() = default;
 
+void ConnectionTo::Reuse(std::string &_remote_ip, uint16_t _remote_port) {
+    remote_ip_ = _remote_ip;
+    remote_port_ = _remote_port;
+    if (socket_.Create(AF_INET, SOCK_STREAM)) {
+        LogE("Create socket_ failed")
+    }
+}
+
 int ConnectionTo::Connect() {
     int ret = socket_.Connect(remote_ip_, remote_port_);
     if (ret == 0) {
@@ -317,12 +1165,21 @@ ConnectionFrom::ConnectionFrom(SOCKET _fd, std::string _remote_ip,
         : ConnectionProfile(std::move(_remote_ip), _remote_port, _uid) {
     
     assert(_fd > 0);
-    socket_.Set(_fd);
+    socket_.Set(_fd, true);     // accept4(SOCK_NONBLOCK) already.
     socket_.SetConnected(true);
-    socket_.SetNonblocking();
     socket_.SetTcpNoDelay();    // disable Nagle's algorithm
 }
 
+void ConnectionFrom::Reuse(SOCKET _fd, std::string &_remote_ip,
+                           uint16_t _remote_port) {
+    assert(_fd > 0);
+    remote_ip_ = _remote_ip;    // reuses the storage of the former peer's.
+    remote_port_ = _remote_port;
+    socket_.Set(_fd, true);
+    socket_.SetConnected(true);
+    socket_.SetTcpNoDelay();
+}
+
 TConnectionType ConnectionFrom::GetType() const { return kAcceptFrom; }
 
 
@@ -1,11 +1,16 @@
 #pragma once
 #include <cassert>
-#include <queue>
-#include <list>
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <typeinfo>
+#include <netinet/in.h>
 #include "socket/unixsocket.h"
+#include "socket/poller.h"
 #include "applicationlayer.h"
+#include "timingwheel.h"
+#include "intrusiveptr.h"
+#include "fileutil.h"
 #include "log.h"
 
 
@@ -19,36 +24,256 @@ enum TConnectionType {
 };
 
 
+/* which deadline a connection is currently timed against */
+enum TDeadlinePhase {
+    kNoDeadline = 0,
+    kHeaderRead,    // until the headers of a packet are parsed.
+    kBodyRead,      // until the rest of the packet is parsed.
+    kKeepAlive,     // idle after a packet is sent back.
+};
+
+
+/* Deadlines in milliseconds, 0 means no deadline. */
+struct Deadlines {
+    Deadlines();
+    
+    uint64_t                header_read;
+    uint64_t                body_read;
+    uint64_t                keep_alive;
+    
+    static const uint64_t   kDefaultTimeout;
+};
+
+
+class ConnectionProfile;
+class SendContextPool;
+class RecvContextPool;
+
+
 struct SendContext {
-    using Ptr = std::shared_ptr<tcp::SendContext>;
-    explicit SendContext(uint32_t _seq);
+    using Ptr = IntrusivePtr<tcp::SendContext>;
+    SendContext();
     
     uint32_t                seq;
     uint32_t                tcp_connection_uid;
     Socket                * socket;
     AutoBuffer              buffer;
+    /* Sent after buffer by sendfile(2), e.g. the body of a static file. */
+    file::FileRegion        file_body;
     bool                    is_tcp_conn_valid;
-    std::function<void()>   MarkAsPendingPacket;
-    std::function<void()>   OnSendDone;
+    /* Order among the responses of the connection, 0 if not a response. */
+    uint32_t                response_seq;
+    /* Shuts the connection down for writing once sent, e.g. "Connection: close". */
+    bool                    is_connection_close;
+    /* Owner, to be called on its loop only, and only while is_tcp_conn_valid. */
+    ConnectionProfile     * connection;
+    
+    void AddRef();
+    
+    /**
+     * Goes back to its pool once unreferenced, may be called from any thread.
+     */
+    void Release();
+    
+  private:
+    friend class ConnectionProfile;
+    friend class SendContextPool;
+    std::atomic<uint32_t>   ref_cnt_;
+    SendContextPool       * pool_;
+    /* Links of the live list of the connection, or of the free list of the pool. */
+    SendContext           * prev_;
+    SendContext           * next_;
+    /* Link of the pending queue, or of the held responses. */
+    SendContext           * next_pending_;
+    bool                    is_linked_;
+    /* MSG_ZEROCOPY sends of the buffer, held until all of them complete. */
+    SendContext           * next_zerocopy_;
+    uint32_t                zerocopy_first_;
+    uint32_t                zerocopy_cnt_;
+    uint32_t                zerocopy_done_;
+};
+
+
+/**
+ * SendContexts of a NetThread, recycled together with their buffers,
+ * so that sending back a response allocates nothing in steady state.
+ *
+ * Acquire() on the loop only. Contexts released by other threads are
+ * pushed onto a lock-free stack, which the loop takes over as a whole
+ * once its own free list runs out, so there is no ABA problem.
+ *
+ * Outlives the contexts it hands out.
+ */
+class SendContextPool {
+  public:
+    
+    SendContextPool();
+    
+    ~SendContextPool();
+    
+    SendContext::Ptr Acquire();
+    
+    /**
+     * @return: contexts ever allocated.
+     */
+    size_t Allocated() const;
+    
+    /* Buffers larger are freed when released. */
+    static const size_t                 kMaxRetainedBuffer;
+
+  private:
+    friend struct SendContext;
+    
+    void __Release(SendContext *_send_ctx);
+
+  private:
+    SendContext                       * free_;
+    std::atomic<SendContext *>          released_;
+    std::atomic<size_t>                 allocated_;
+};
+
+
+/**
+ * Bytes waiting to be sent by the connections of a NetThread, so that
+ * peers not reading what is sent back can not pin memory without limit.
+ *
+ * A connection buffering more than the high watermark, or adding bytes
+ * while the NetThread buffers more than the cap, stops reading until it
+ * drains down to the low watermark, its peer pushed back by the Tcp
+ * receive window meanwhile.
+ *
+ * Charged and credited on the loop only, the rest from any thread.
+ */
+class OutputBudget {
+  public:
+    
+    struct Stats {
+        Stats();
+        
+        uint64_t    buffered;       // bytes waiting to be sent now.
+        uint64_t    high_hits;      // connections paused by the high watermark.
+        uint64_t    cap_hits;       // connections paused by the cap.
+        uint64_t    resumes;
+    };
+    
+    OutputBudget();
+    
+    /**
+     * 0 disables the respective limit. Call it before the NetThread starts.
+     *
+     * @param _low: at most @param{_high}.
+     */
+    void SetLimits(size_t _high, size_t _low, size_t _cap);
+    
+    void Charge(size_t _bytes);
+    
+    void Credit(size_t _bytes);
+    
+    /**
+     * Counts the hit if so.
+     *
+     * @return: whether a connection buffering @param{_conn_bytes},
+     *          just charged, should stop reading.
+     */
+    bool ShouldPause(size_t _conn_bytes);
+    
+    /**
+     * Counts the resume if so.
+     *
+     * @return: whether a paused connection buffering
+     *          @param{_conn_bytes} may read again.
+     */
+    bool ShouldResume(size_t _conn_bytes);
+    
+    /**
+     * Lock-free, e.g. for workers to hold back pushes.
+     */
+    bool IsOverCap() const;
+    
+    /**
+     * Lock-free snapshot, may be called from any thread.
+     */
+    Stats GetStats() const;
+    
+    static const size_t         kDefaultHighWatermark;
+    static const size_t         kDefaultLowWatermark;
+
+  private:
+    size_t                      high_;
+    size_t                      low_;
+    size_t                      cap_;
+    std::atomic<size_t>         buffered_;
+    std::atomic<uint64_t>       high_hits_;
+    std::atomic<uint64_t>       cap_hits_;
+    std::atomic<uint64_t>       resumes_;
 };
 
 
 struct RecvContext {
-    using Ptr = std::shared_ptr<tcp::RecvContext>;
+    using Ptr = IntrusivePtr<tcp::RecvContext>;
     RecvContext();
     /* <------ input fields begin ------> */
     uint32_t                            tcp_connection_uid;
     SOCKET                              fd;
-    std::string                         from_ip;
+    char                                from_ip[INET_ADDRSTRLEN];
     uint16_t                            from_port;
     TConnectionType                     type;
     ApplicationPacket::Ptr              application_packet;
+    /* The connection stopped reading as its peer does not read what is sent
+     * back, or its NetThread buffers too much output: pushes would block. */
+    bool                                is_output_blocked;
     /* <------ input fields end ------> */
     
     /* <------ output fields begin ------> */
     std::vector<SendContext::Ptr>       packets_push_others;
     SendContext::Ptr                    return_packet;
     /* <------ output fields end ------> */
+    
+    void AddRef();
+    
+    /**
+     * Goes back to its pool once unreferenced, may be called from any
+     * thread, letting go of the packets it refers to on the way.
+     */
+    void Release();
+    
+  private:
+    friend class RecvContextPool;
+    std::atomic<uint32_t>               ref_cnt_;
+    RecvContextPool                   * pool_;
+    RecvContext                       * next_;     // of the free list of the pool.
+};
+
+
+/**
+ * RecvContexts of a NetThread, the counterpart of {@link SendContextPool}
+ * for what is handed over to the workers, with the same threading rules.
+ *
+ * Outlives the contexts it hands out.
+ */
+class RecvContextPool {
+  public:
+    
+    RecvContextPool();
+    
+    ~RecvContextPool();
+    
+    RecvContext::Ptr Acquire();
+    
+    /**
+     * @return: contexts ever allocated.
+     */
+    size_t Allocated() const;
+
+  private:
+    friend struct RecvContext;
+    
+    void __Release(RecvContext *_recv_ctx);
+
+  private:
+    RecvContext                       * free_;
+    std::atomic<RecvContext *>          released_;
+    std::atomic<size_t>                 allocated_;
 };
 }
 
@@ -64,14 +289,112 @@ class ConnectionProfile {
     
     int Receive();
     
+    /**
+     * Parses data received by a completion based Poller.
+     *
+     * @param _n: bytes in @param{_buf}, 0 on FIN, -errno on error.
+     */
+    int Receive(const char *_buf, ssize_t _n);
+    
     static bool TrySend(const SendContext::Ptr&);
     
-    void AddPendingPacketToSend(SendContext::Ptr);
+    /**
+     * Sends what is left of the file body of @param{_send_ctx},
+     * whose buffer must have been all sent.
+     *
+     * @return: 1 if all sent, 0 if the socket is not writable, -1 on error.
+     */
+    static int TrySendFileBody(SendContext *_send_ctx);
+    
+    /**
+     * Sends @param{_send_ctx} once the socket is writable again.
+     */
+    void AddPendingPacketToSend(SendContext *_send_ctx);
+    
+    /**
+     * Queues @param{_send_ctx} behind the pending ones, without
+     * waiting for writable, call TrySendPendingPackets() later.
+     * A response made ahead of its turn is held, see TakeInOrder().
+     */
+    void EnqueueToSend(SendContext *_send_ctx);
+    
+    /**
+     * Asks the Poller to report kWritable.
+     */
+    void WaitWritable();
+    
+    /**
+     * @return: whether @param{_send_ctx} may go now, otherwise it is
+     *          held until the responses to the requests before it go,
+     *          and then handed out by NextInOrder().
+     */
+    bool TakeInOrder(SendContext *_send_ctx);
+    
+    /**
+     * @return: the held response whose turn has come, nullptr if none.
+     */
+    SendContext *NextInOrder();
     
     bool HasPendingPacketToSend() const;
     
+    /**
+     * Counts @param{_bytes} more waiting to be sent, stopping reading if
+     * the output budget says so. Done by EnqueueToSend() already, call it
+     * for packets queued elsewhere, e.g. for a completion based Poller.
+     */
+    void ChargeOutput(size_t _bytes);
+    
+    /**
+     * Counts @param{_bytes} charged as sent, reading
+     * again once drained to the low watermark.
+     */
+    void CreditOutput(size_t _bytes);
+    
+    /**
+     * @return: bytes charged but not sent yet.
+     */
+    size_t OutputBytes() const;
+    
+    bool IsReadingPaused() const;
+    
+    /**
+     * @return: whether anything is sent since the last call,
+     *          telling a slow peer from one not reading at all.
+     */
+    bool IsSendProgressing();
+    
+    /**
+     * Where output is charged to, not bounded if not set.
+     */
+    void SetOutputBudget(OutputBudget *_budget);
+    
+    /**
+     * Gathers the pending packets into as few writev(2) as possible,
+     * a packet written partially stays at the front.
+     *
+     * @return: whether all pending packets are sent.
+     */
     bool TrySendPendingPackets();
     
+    /**
+     * Pending packets of at least @param{_threshold} bytes are sent with
+     * MSG_ZEROCOPY, their buffers held until the kernel reports them
+     * done through the error queue, see ReapZeroCopyCompletions().
+     * Shallow copies are always copied, their bytes not being theirs
+     * to hold. 0 disables it.
+     */
+    void SetZeroCopyThreshold(size_t _threshold);
+    
+    bool HasZeroCopyInFlight() const;
+    
+    /**
+     * Reads MSG_ZEROCOPY completions from the error queue,
+     * call it when the socket is reported in error.
+     *
+     * @return: false if the socket is in error besides.
+     */
+    bool ReapZeroCopyCompletions();
+    
     uint32_t Uid() const;
     
     void SetUid(uint32_t _uid);
@@ -84,13 +407,41 @@ class ConnectionProfile {
     
     bool IsParseDone();
     
+    /**
+     * @return: bytes of the byte array taken by the packet parsed.
+     */
+    size_t PacketLength() const;
+    
+    /**
+     * Drops the bytes of the packet just handed over and
+     * parses those after, e.g. pipelined requests.
+     *
+     * @return: 1 if the next packet is parsed already,
+     *          0 if more bytes are needed, -1 on parse error.
+     */
+    int NextPacket();
+    
+    /**
+     * Discards whatever is received from now on,
+     * e.g. after a request asking for "Connection: close".
+     */
+    void StopReceivingPackets();
+    
+    /**
+     * Requests served at most before the connection is closed, 0: unlimited.
+     */
+    void SetMaxRequests(size_t _max_requests);
+    
+    bool IsMaxRequestsReached() const;
+    
     
     template<class ApplicationPacketImpl /* : public ApplicationPacket */,
              class ApplicationParserImpl /* : public ApplicationProtocolParser */,
              class ...Args>
     void
     ConfigApplicationLayer(Args &&..._init_args) {
-        if (curr_application_packet_ && !IsUpgradeApplicationProtocol()) {
+        if (curr_application_packet_ && !has_spare_application_layer_
+                    && !IsUpgradeApplicationProtocol()) {
             LogE("application protocol already set && no need to upgrade")
             assert(false);
         }
@@ -98,10 +449,20 @@ class ConnectionProfile {
         
         ApplicationProtocolParser *old_parser = application_protocol_parser_;
         
-        curr_application_packet_ = std::make_shared<ApplicationPacketImpl>();
-        application_protocol_parser_ = new ApplicationParserImpl(&tcp_byte_arr_,
-                std::dynamic_pointer_cast<ApplicationPacketImpl>(curr_application_packet_),
-                _init_args...);
+        // Parsers taking extra arguments are bound to them, never reused.
+        is_application_layer_recycled_ = sizeof...(_init_args) == 0
+                && __IsSpareParserOf(typeid(ApplicationParserImpl));
+        has_spare_application_layer_ = false;
+        
+        auto packet = ApplicationPacket::New<ApplicationPacketImpl>(packet_pool_);
+        if (is_application_layer_recycled_) {
+            old_parser = nullptr;
+            application_protocol_parser_->SetPacketToParse(packet);
+        } else {
+            application_protocol_parser_ = new ApplicationParserImpl(&tcp_byte_arr_,
+                    packet, _init_args...);
+        }
+        curr_application_packet_ = std::move(packet);
         application_protocol_ = curr_application_packet_->Protocol();
         is_longlink_app_proto_ = curr_application_packet_->IsLongLink();
         
@@ -134,13 +495,41 @@ class ConnectionProfile {
     
     SOCKET FD() const;
     
-    bool IsTimeout(uint64_t _now = 0) const;
+    /**
+     * The Poller watching this connection, asked to report
+     * kWritable when packets are left pending.
+     */
+    void SetPoller(Poller *_poller);
+    
+    /**
+     * Starts timing the connection, @param{_on_deadline} is called
+     * on the thread expiring @param{_wheel} when a deadline is missed.
+     */
+    void StartDeadlineTimer(TimingWheel *_wheel, const Deadlines *_deadlines,
+                            std::function<void()> _on_deadline);
+    
+    /**
+     * Moves to the deadline of the current parse state,
+     * call it each time data is received.
+     */
+    void UpdateDeadline();
+    
+    /**
+     * Waits another keep-alive period, e.g. when the deadline
+     * is missed because the peer does not read fast enough.
+     */
+    void ExtendDeadline();
+    
+    TDeadlinePhase DeadlinePhase() const;
     
     void SendTcpFin() const;
     
     bool HasReceivedFin() const;
     
-    void SendContextSendDoneCallback(const SendContext::Ptr&);
+    /**
+     * Called once @param{_send_ctx} is all sent.
+     */
+    void OnSendDone(SendContext *_send_ctx);
     
     virtual TConnectionType GetType() const = 0;
     
@@ -150,29 +539,134 @@ class ConnectionProfile {
 
     SendContext::Ptr MakeSendContext();
     
-    void DelSendContext(uint32_t _send_ctx_seq);
+    /**
+     * A context to send back the response to the packet parsed
+     * last, responses go out in the order of their requests.
+     */
+    SendContext::Ptr MakeResponseContext();
+    
+    /**
+     * Where MakeSendContext() takes contexts from, they are
+     * allocated one by one if not set.
+     */
+    void SetSendContextPool(SendContextPool *_pool);
+    
+    /**
+     * Where MakeRecvContext() takes contexts from, likewise.
+     */
+    void SetRecvContextPool(RecvContextPool *_pool);
+    
+    /**
+     * Where packets are taken from, by ConfigApplicationLayer()
+     * and by the packets themselves, likewise.
+     */
+    void SetPacketPool(ApplicationPacketPool *_pool);
     
     std::string &RemoteIp();
     
     uint16_t RemotePort() const;
+    
+    /**
+     * Clears the connection, for {@link ConnectionPool} to hand it out
+     * again. Its byte array is kept unless larger than @param{_max_retained},
+     * and so is its parser if it supports recycling. The packet goes back
+     * to its pool once no longer referred to by the workers either.
+     */
+    void Recycle(size_t _max_retained);
+    
+    /**
+     * @return: heap bytes kept for reuse, roughly.
+     */
+    size_t RetainedSize() const;
+    
+    /**
+     * @return: whether the last {@link ConfigApplicationLayer} reused the
+     *          parser left by the former user of this object.
+     */
+    bool IsApplicationLayerRecycled() const;
 
+  private:
+    static bool __TrySend(SendContext *_send_ctx);
+    
+    void __LinkSendContext(SendContext *_send_ctx);
+    
+    void __UnlinkSendContext(SendContext *_send_ctx);
+    
+    /**
+     * Tells all send contexts not to send anymore, and lets go of them.
+     */
+    void __InvalidateSendContexts();
+    
+    void __ArmDeadline(TDeadlinePhase _phase);
+    
+    /**
+     * Pops the front pending packet, calling OnSendDone().
+     */
+    void __PopPendingPacket();
+    
+    /**
+     * @return: whether some request is not answered yet.
+     */
+    bool __HasResponseInFlight() const;
+    
+    bool __IsZeroCopyWorthy(size_t _len);
+    
+    /**
+     * Keeps @param{_send_ctx} until the completion of @param{_seq}.
+     */
+    void __HoldForZeroCopy(SendContext *_send_ctx, uint32_t _seq);
+    
+    void __ReleaseZeroCopied(SendContext *_prev, SendContext *_send_ctx);
+    
+    bool __IsSpareParserOf(const std::type_info &_parser_type) const;
+    
   protected:
-    static const uint64_t               kDefaultTimeout;
     uint32_t                            uid_;
     TApplicationProtocol                application_protocol_;
     bool                                is_longlink_app_proto_;
     std::string                         remote_ip_;
     uint16_t                            remote_port_;
     Socket                              socket_;
+    Poller                            * poller_;
     bool                                has_received_Fin_;
-    uint64_t                            record_;
-    uint64_t                            timeout_ts_;
+    TimingWheel                       * timing_wheel_;
+    const Deadlines                   * deadlines_;
+    TDeadlinePhase                      deadline_phase_;
+    TimingWheel::TimerNode              deadline_timer_;
     AutoBuffer                          tcp_byte_arr_;
     ApplicationPacket::Ptr              curr_application_packet_;
     ApplicationProtocolParser         * application_protocol_parser_;
+    /* Parser recycled, waiting for ConfigApplicationLayer(). */
+    bool                                has_spare_application_layer_;
+    bool                                is_application_layer_recycled_;
     uint32_t                            send_ctx_seq_;
-    std::list<SendContext::Ptr>         send_contexts_;
-    std::queue<SendContext::Ptr>        pending_send_ctx_;
+    SendContextPool                   * send_ctx_pool_;
+    RecvContextPool                   * recv_ctx_pool_;
+    ApplicationPacketPool             * packet_pool_;
+    /* Intrusive, each linked context is referenced until sent. */
+    SendContext                       * send_contexts_;
+    SendContext                       * pending_send_ctx_head_;
+    SendContext                       * pending_send_ctx_tail_;
+    size_t                              pending_send_ctx_cnt_;
+    /* Last one assigned, and the next one allowed to go. */
+    uint32_t                            response_seq_;
+    uint32_t                            next_response_seq_;
+    /* Made ahead of their turn, sorted by response_seq. */
+    SendContext                       * held_responses_;
+    size_t                              max_requests_;
+    bool                                is_receiving_stopped_;
+    OutputBudget                      * output_budget_;
+    size_t                              output_bytes_;
+    bool                                is_reading_paused_;
+    /* Bytes ever sent, and as of the last IsSendProgressing(). */
+    uint64_t                            sent_bytes_;
+    uint64_t                            sent_bytes_checked_;
+    size_t                              zerocopy_threshold_;
+    SendContext                       * zerocopy_head_;
+    SendContext                       * zerocopy_tail_;
+    static const int                    kMaxIovecs;
+    /* Byte arrays larger are freed once drained. */
+    static const size_t                 kMaxIdleByteArray;
     
 };
 
@@ -185,6 +679,11 @@ class ConnectionFrom : public ConnectionProfile {
     
     ~ConnectionFrom() override;
     
+    /**
+     * Takes over a new accepted fd after being recycled.
+     */
+    void Reuse(SOCKET _fd, std::string &_remote_ip, uint16_t _remote_port);
+    
     TConnectionType GetType() const override;
     
   private:
@@ -203,6 +702,11 @@ class ConnectionTo : public ConnectionProfile {
     
     int Connect();
     
+    /**
+     * Creates a new socket to @param{_remote_ip} after being recycled.
+     */
+    void Reuse(std::string &_remote_ip, uint16_t _remote_port);
+    
     TConnectionType GetType() const override;
 
   private:
@@ -0,0 +1,112 @@
+/**
+ * Checks that a pending packet above the MSG_ZEROCOPY threshold goes out
+ * by plain writev(2) if its buffer is a shallow copy, e.g. a response
+ * relayed by the proxy pointing into the byte array of another
+ * connection, which may be reused before the kernel is done with it,
+ * while one owning its bytes is held for zero copy.
+ *
+ * Usage: testzerocopyshallow
+ */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include "networkmodel/tcpconnection.h"
+
+
+static const size_t kThreshold = 4096;
+static const size_t kPacketSize = 32 * 1024;
+
+static void Expect(bool _ok, const char *_what) {
+    if (!_ok) {
+        fprintf(stderr, "FAILED: %s\n", _what);
+        exit(1);
+    }
+}
+
+/**
+ * Connects over loopback, with a sink draining the peer on its own thread.
+ *
+ * @return: the accepted fd, the one sent through.
+ */
+static int ConnectLoopback(std::thread &_sink) {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    Expect(::bind(listen_fd, (sockaddr *) &addr, len) == 0
+                && ::listen(listen_fd, 1) == 0, "bind / listen");
+    ::getsockname(listen_fd, (sockaddr *) &addr, &len);
+    
+    int peer = ::socket(AF_INET, SOCK_STREAM, 0);
+    Expect(::connect(peer, (sockaddr *) &addr, len) == 0, "connect");
+    int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+    Expect(fd > 0, "accept4");
+    ::close(listen_fd);
+    
+    _sink = std::thread([peer] {
+        char buf[64 * 1024];
+        while (::read(peer, buf, sizeof(buf)) > 0) {}
+        ::close(peer);
+    });
+    return fd;
+}
+
+static void SendAll(tcp::ConnectionProfile &_conn) {
+    while (!_conn.TrySendPendingPackets()) {
+        pollfd pfd {_conn.FD(), POLLOUT, 0};
+        ::poll(&pfd, 1, 1000);
+    }
+}
+
+static void ReapAll(tcp::ConnectionProfile &_conn) {
+    for (int i = 0; i < 100 && _conn.HasZeroCopyInFlight(); ++i) {
+        pollfd pfd {_conn.FD(), 0, 0};
+        ::poll(&pfd, 1, 10);
+        _conn.ReapZeroCopyCompletions();
+    }
+}
+
+
+int main() {
+    std::thread sink;
+    int fd = ConnectLoopback(sink);
+    {
+        tcp::ConnectionFrom conn(fd, "127.0.0.1", 0);
+        conn.SetZeroCopyThreshold(kThreshold);
+        std::string bytes(kPacketSize, 'x');
+        
+        // Shallow: copied by the kernel, so nothing is held.
+        tcp::SendContext::Ptr shallow = conn.MakeSendContext();
+        shallow->buffer.ShallowCopyFrom(&bytes[0], bytes.size());
+        conn.EnqueueToSend(shallow.get());
+        shallow.reset();
+        SendAll(conn);
+        Expect(!conn.HasZeroCopyInFlight(), "shallow buffer sent by MSG_ZEROCOPY");
+        
+        // Owning its bytes: held for zero copy, if the kernel supports it.
+        // Comes second, as over loopback the first completion reports
+        // a copy and zero copy is given up.
+        tcp::SendContext::Ptr owned = conn.MakeSendContext();
+        owned->buffer.Write(bytes.data(), bytes.size());
+        conn.EnqueueToSend(owned.get());
+        owned.reset();
+        SendAll(conn);
+        bool is_zerocopy_supported = conn.GetSocket().IsZeroCopyEnabled();
+        Expect(!is_zerocopy_supported || conn.HasZeroCopyInFlight(),
+               "owned buffer not sent by MSG_ZEROCOPY");
+        ReapAll(conn);
+        Expect(!conn.HasZeroCopyInFlight(), "zero copy completions not reaped");
+        
+        printf("testzerocopyshallow: passed%s\n",
+               is_zerocopy_supported ? "" : " (MSG_ZEROCOPY not supported here)");
+    }
+    sink.join();
+    return 0;
+}
@@ -98,8 +98,7 @@ bool ReverseProxyServer::NetThread::HandleHttpPacket(
         
     } else if (type == tcp::kConnectTo) {
         // Send back response to client.
-        HandleHttpResponse(_recv_ctx);
-        return true;
+        return HandleHttpResponse(_recv_ctx);
     }
     LogE("unknown type: %d", type)
     DelConnection(_recv_ctx->tcp_connection_uid);
@@ -116,16 +115,24 @@ bool ReverseProxyServer::NetThread::HandleHttpRequest(
         return true;
     }
     
-    std::string src_ip = _recv_ctx->from_ip;
+    std::string src_ip(_recv_ctx->from_ip);
+    WebServerProfile *forward_host;
     tcp::ConnectionProfile *conn_to_webserver;
     
     while (true) {
-        auto forward_host = ReverseProxyServer::Instance().LoadBalance(src_ip);
+        forward_host = ReverseProxyServer::Instance().LoadBalance(src_ip);
         if (!forward_host) {
             LogE("no web server to forward")
             HandleForwardFailed(_recv_ctx);
             return false;
         }
+        conn_to_webserver = __TakeIdleConnection(forward_host);
+        if (conn_to_webserver) {
+            LogI("forward request from [%s:%d] to [%s:%d] by keep-alive fd(%d)", src_ip.c_str(),
+                 _recv_ctx->from_port, forward_host->ip.c_str(), forward_host->port,
+                 conn_to_webserver->FD())
+            break;
+        }
         LogI("try forward request from [%s:%d] to [%s:%d], fd(%d)", src_ip.c_str(),
              _recv_ctx->from_port, forward_host->ip.c_str(), forward_host->port, _recv_ctx->fd)
         
@@ -141,55 +148,100 @@ bool ReverseProxyServer::NetThread::HandleHttpRequest(
     
     tcp::SendContext::Ptr send_ctx = conn_to_webserver->MakeSendContext();
     
-    conn_map_[conn_to_webserver->Uid()] = std::make_pair(uid, _recv_ctx->return_packet);
+    conn_map_[conn_to_webserver->Uid()] = Forwarding {uid, _recv_ctx->return_packet,
+                                                      forward_host};
     
-    AutoBuffer *http_packet = GetConnection(uid)->TcpByteArray();
-    send_ctx->buffer.ShallowCopyFrom(http_packet->Ptr(), http_packet->Length());
+    // Copied, for the byte array moves on to the next pipelined request.
+    tcp::ConnectionProfile *client_conn = GetConnection(uid);
+    send_ctx->buffer.Write(client_conn->TcpByteArray()->Ptr(), client_conn->PacketLength());
     
     TrySendAndMarkPendingIfUndone(send_ctx);
     
     return false;
 }
 
-void ReverseProxyServer::NetThread::HandleHttpResponse(
+bool ReverseProxyServer::NetThread::HandleHttpResponse(
                     const tcp::RecvContext::Ptr &_recv_ctx) {
     assert(_recv_ctx->type == tcp::kConnectTo);
     
     uint32_t webserver_uid = _recv_ctx->tcp_connection_uid;
     
-    uint32_t client_uid = conn_map_[webserver_uid].first;
+    auto iter = conn_map_.find(webserver_uid);
+    if (iter == conn_map_.end()) {
+        LogE("no client waiting for uid: %u", webserver_uid)
+        DelConnection(webserver_uid);
+        return true;
+    }
+    uint32_t client_uid = iter->second.client_uid;
+    // Nullptr if the uid is stale, even if its slot is reused.
     tcp::ConnectionProfile *client_conn = GetConnection(client_uid);
     
     if (!client_conn) {
         LogE("client connection has already been delete.")
-        conn_map_.erase(client_uid);
+        conn_map_.erase(iter);
         DelConnection(webserver_uid);     // del connection to webserver.
-        return;
+        return true;
     }
     
     LogI("send back to client: [%s:%d]", client_conn->RemoteIp().c_str(),
          client_conn->RemotePort())
 
-    tcp::SendContext::Ptr return_packet = conn_map_[webserver_uid].second;
+    tcp::SendContext::Ptr return_packet = iter->second.return_packet;
+    WebServerProfile *webserver = iter->second.webserver;
+    conn_map_.erase(iter);
     
-    AutoBuffer *http_packet = GetConnection(webserver_uid)->TcpByteArray();
+    tcp::ConnectionProfile *webserver_conn = GetConnection(webserver_uid);
+    AutoBuffer *http_packet = webserver_conn->TcpByteArray();
+    size_t packet_len = webserver_conn->PacketLength();
     // Try shallow copy first.
-    return_packet->buffer.ShallowCopyFrom(http_packet->Ptr(),
-                                          http_packet->Length());
+    return_packet->buffer.ShallowCopyFrom(http_packet->Ptr(), packet_len);
     
     bool send_done = TrySendAndMarkPendingIfUndone(return_packet);
-    conn_map_.erase(client_uid);
     
     if (!send_done) {
         size_t nsend = return_packet->buffer.Pos();
         return_packet->buffer.Reset();
-        // Deep copy the remaining part, because the connection
-        // to the webserver will be deleted,
-        // causing its TCP byte array to be deleted as well.
-        return_packet->buffer.Write(http_packet->Ptr(nsend),
-                   http_packet->Length() - nsend);
+        // Deep copy the remaining part, because the TCP byte array
+        // of the connection to the webserver moves on to the next
+        // response, or is deleted along with the connection.
+        return_packet->buffer.Write(http_packet->Ptr(nsend), packet_len - nsend);
     }
-    DelConnection(webserver_uid);     // del connection to webserver.
+    
+    if (!_recv_ctx->application_packet->IsKeepAlive()) {
+        DelConnection(webserver_uid);     // del connection to webserver.
+        return true;
+    }
+    __ParkIdleConnection(webserver, webserver_uid);
+    return false;
+}
+
+tcp::ConnectionProfile *ReverseProxyServer::NetThread::__TakeIdleConnection(
+                    WebServerProfile *_webserver) {
+    auto iter = idle_conns_.find(_webserver);
+    if (iter == idle_conns_.end()) {
+        return nullptr;
+    }
+    std::deque<uint32_t> &uids = iter->second;
+    while (!uids.empty()) {
+        // The most recently used one, least likely to be closed by the webserver.
+        uint32_t uid = uids.back();
+        uids.pop_back();
+        // Nullptr if closed meanwhile, even if its slot is reused.
+        if (tcp::ConnectionProfile *conn = GetConnection(uid)) {
+            return conn;
+        }
+    }
+    return nullptr;
+}
+
+void ReverseProxyServer::NetThread::__ParkIdleConnection(
+                    WebServerProfile *_webserver, uint32_t _uid) {
+    std::deque<uint32_t> &uids = idle_conns_[_webserver];
+    // Those idle the longest are the first to time out.
+    while (!uids.empty() && !GetConnection(uids.front())) {
+        uids.pop_front();
+    }
+    uids.push_back(_uid);
 }
 
 bool ReverseProxyServer::NetThread::HandleWebSocketPacket(
@@ -203,8 +255,12 @@ void ReverseProxyServer::NetThread::HandleForwardFailed(
     static std::string forward_failed_msg("Internal Server Error: Reverse Proxy Error");
     tcp::SendContext::Ptr return_packet = _recv_ctx->return_packet;
     
+    std::map<std::string, std::string> headers;
+    headers[http::HeaderField::kConnection] = return_packet->is_connection_close
+            ? http::HeaderField::kConnectionClose : http::HeaderField::kKeepAlive;
+    
     http::response::Pack(http::THttpVersion::kHTTP_1_1, 500,
-                         http::StatusLine::kStatusDescOk, nullptr,
+                         http::StatusLine::kStatusDescOk, &headers,
                          return_packet->buffer, &forward_failed_msg);
     
     TrySendAndMarkPendingIfUndone(return_packet);
@@ -256,7 +312,7 @@ const char *ReverseProxyServer::ConfigFile() {
 }
 
 bool ReverseProxyServer::CheckHeartbeat(const tcp::RecvContext::Ptr& _recv_ctx) {
-    std::string &ip = _recv_ctx->from_ip;
+    const char *ip = _recv_ctx->from_ip;
     auto &webservers = ((ProxyConfig *) config_)->webservers;
     
     bool has_parsed = false;
@@ -268,8 +324,8 @@ bool ReverseProxyServer::CheckHeartbeat(const tcp::RecvContext::Ptr& _recv_ctx)
             continue;
         }
         if (!has_parsed) {
-            auto http_req = std::dynamic_pointer_cast<http::request::HttpRequest>
-                    (_recv_ctx->application_packet);
+            auto *http_req = static_cast<http::request::HttpRequest *>(
+                    _recv_ctx->application_packet.get());
             AutoBuffer *body = http_req->Body();
             
             NetSceneSvrHeartbeatProto::NetSceneSvrHeartbeatReq req;
@@ -283,7 +339,7 @@ bool ReverseProxyServer::CheckHeartbeat(const tcp::RecvContext::Ptr& _recv_ctx)
         }
         if (webserver->port == port) {
             load_balancer_.OnRecvHeartbeat(webserver, request_backlog);
-            LogI("heartbeat from [%s:%d], backlog: %u", ip.c_str(), port, request_backlog)
+            LogI("heartbeat from [%s:%d], backlog: %u", ip, port, request_backlog)
             return true;
         }
     }
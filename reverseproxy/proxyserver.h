@@ -4,6 +4,7 @@
 #include "loadbalancer.h"
 #include <string>
 #include <map>
+#include <deque>
 
 
 
@@ -54,7 +55,11 @@ class ReverseProxyServer final : public ServerBase {
         
         bool HandleHttpRequest(const tcp::RecvContext::Ptr&);
         
-        void HandleHttpResponse(const tcp::RecvContext::Ptr&);
+        /**
+         * @return: whether the connection to the webserver is deleted,
+         *          otherwise kept alive for the next request to it.
+         */
+        bool HandleHttpResponse(const tcp::RecvContext::Ptr&);
         
         bool HandleWebSocketPacket(const tcp::RecvContext::Ptr&);
     
@@ -63,8 +68,23 @@ class ReverseProxyServer final : public ServerBase {
       protected:
       
       private:
-        std::map<uint32_t, std::pair<uint32_t,
-                        tcp::SendContext::Ptr>> conn_map_;
+        /**
+         * @return: an idle keep-alive connection to @param{_webserver}, nullptr if none.
+         */
+        tcp::ConnectionProfile *__TakeIdleConnection(WebServerProfile *_webserver);
+        
+        void __ParkIdleConnection(WebServerProfile *_webserver, uint32_t _uid);
+        
+      private:
+        /* A request forwarded, waiting for the response of the webserver. */
+        struct Forwarding {
+            uint32_t                client_uid;
+            tcp::SendContext::Ptr   return_packet;
+            WebServerProfile      * webserver;
+        };
+        std::map<uint32_t, Forwarding>                      conn_map_;
+        /* Uids of idle connections to each webserver, stale ones skipped. */
+        std::map<WebServerProfile *, std::deque<uint32_t>>  idle_conns_;
     };
     
   protected:
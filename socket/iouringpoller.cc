@@ -0,0 +1,753 @@
+#include "iouringpoller.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <unistd.h>
+#include "log.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#endif
+
+
+const unsigned IoUringPoller::kDefaultEntries = 1024;
+const uint16_t IoUringPoller::kBufferGroup = 0;
+// Buffers are given back as soon as the data is appended to the
+// connection's byte array, so they only need to cover one loop round.
+const uint16_t IoUringPoller::kBufferCnt = 512;
+const uint32_t IoUringPoller::kBufferSize = 4096;
+
+
+IoUringPoller::FdState::FdState()
+        : data(0)
+        , gen(0)
+        , is_recv_armed(false)
+        , is_pollout_armed(false)
+        , is_recv_starved(false)
+        , is_recv_paused(false) {
+}
+
+IoUringPoller::IoUringPoller(unsigned _entries/* = kDefaultEntries*/)
+        : entries_(_entries)
+        , ring_fd_(-1)
+        , errno_(0)
+        , ring_ptr_(nullptr)
+        , ring_size_(0)
+        , sqes_(nullptr)
+        , sqes_size_(0)
+        , sq_head_(nullptr)
+        , sq_tail_(nullptr)
+        , sq_array_(nullptr)
+        , sq_mask_(0)
+        , sq_entries_(0)
+        , sq_tail_local_(0)
+        , cq_head_(nullptr)
+        , cq_tail_(nullptr)
+        , cq_mask_(0)
+        , cqes_(nullptr)
+        , buf_ring_(nullptr)
+        , buf_ring_size_(0)
+        , bufs_(nullptr)
+        , buf_tail_(0)
+        , listen_fd_(INVALID_SOCKET)
+        , notify_fd_(INVALID_SOCKET) {
+}
+
+Poller::TBackend IoUringPoller::Backend() const { return kIoUring; }
+
+int IoUringPoller::GetErrNo() const { return errno_; }
+
+uint64_t IoUringPoller::__Key(TOp _op, uint32_t _gen, uint32_t _fd) {
+    return ((uint64_t) _op << 56) | ((uint64_t) (_gen & 0xffffff) << 32) | _fd;
+}
+
+IoUringPoller::TOp IoUringPoller::__OpOf(uint64_t _key) { return (TOp) (_key >> 56); }
+
+uint32_t IoUringPoller::__GenOf(uint64_t _key) { return (uint32_t) (_key >> 32) & 0xffffff; }
+
+SOCKET IoUringPoller::__FdOf(uint64_t _key) { return (SOCKET) (uint32_t) _key; }
+
+IoUringPoller::FdState &IoUringPoller::__State(SOCKET _fd) {
+    assert(_fd >= 0);
+    if ((size_t) _fd >= fds_.size()) {
+        fds_.resize(_fd + 1024);
+    }
+    return fds_[_fd];
+}
+
+int IoUringPoller::AddListenFd(SOCKET _fd, bool /*_exclusive*/) {
+    // Accept is woken exclusively by io_uring anyway.
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back({kOpAccept, _fd, 0});
+    return 0;
+}
+
+int IoUringPoller::AddNotifyFd(SOCKET _fd, uint64_t _data) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back({kOpNotify, _fd, _data});
+    return 0;
+}
+
+int IoUringPoller::AddConnection(SOCKET _fd, uint64_t _data) {
+    if (_fd < 0) {
+        return -1;
+    }
+    // The ring is only touched by the loop thread,
+    // armed by the next Poll().
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back({kOpRecv, _fd, _data});
+    return 0;
+}
+
+int IoUringPoller::WaitWritable(SOCKET _fd, uint64_t _data) {
+    if (_fd < 0) {
+        return -1;
+    }
+    // Packets may be left pending by other threads, e.g. heartbeats.
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back({kOpPollOut, _fd, _data});
+    return 0;
+}
+
+#ifdef __linux__
+
+bool IoUringPoller::Init() {
+    if (ring_fd_ >= 0) {
+        return true;
+    }
+    if (!__IsKernelSupported()) {
+        return false;
+    }
+    struct io_uring_params params{};
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    ring_fd_ = (int) ::syscall(__NR_io_uring_setup, entries_, &params);
+    if (ring_fd_ < 0) {
+        errno_ = errno;
+        LogW("io_uring_setup, errno(%d): %s", errno_, strerror(errno_))
+        return false;
+    }
+    uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed) {
+        LogW("io_uring features(0x%x) not enough", params.features)
+        __Destroy();
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+    ring_ptr_ = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (ring_ptr_ == MAP_FAILED) {
+        ring_ptr_ = nullptr;
+        errno_ = errno;
+        LogE("mmap ring, errno(%d): %s", errno_, strerror(errno_))
+        __Destroy();
+        return false;
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        errno_ = errno;
+        LogE("mmap sqes, errno(%d): %s", errno_, strerror(errno_))
+        __Destroy();
+        return false;
+    }
+    sqes_ = (struct io_uring_sqe *) sqes;
+
+    auto base = (char *) ring_ptr_;
+    sq_head_ = (unsigned *) (base + params.sq_off.head);
+    sq_tail_ = (unsigned *) (base + params.sq_off.tail);
+    sq_array_ = (unsigned *) (base + params.sq_off.array);
+    sq_mask_ = *(unsigned *) (base + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_tail_local_ = *sq_tail_;
+    cq_head_ = (unsigned *) (base + params.cq_off.head);
+    cq_tail_ = (unsigned *) (base + params.cq_off.tail);
+    cq_mask_ = *(unsigned *) (base + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe *) (base + params.cq_off.cqes);
+
+    if (!__SetupBufferRing()) {
+        __Destroy();
+        return false;
+    }
+    LogI("io_uring fd: %d, sq entries: %u, cq entries: %u",
+         ring_fd_, params.sq_entries, params.cq_entries)
+    return true;
+}
+
+bool IoUringPoller::__IsKernelSupported() const {
+    // Multishot recv arrived in 6.0, no way to probe it but the version.
+    struct utsname name{};
+    int major = 0, minor = 0;
+    if (::uname(&name) < 0 || sscanf(name.release, "%d.%d", &major, &minor) != 2) {
+        return false;
+    }
+    if (major < 6) {
+        LogW("kernel %s lacks multishot recv", name.release)
+        return false;
+    }
+
+    struct io_uring_params params{};
+    int fd = (int) ::syscall(__NR_io_uring_setup, 2, &params);
+    if (fd < 0) {
+        LogW("io_uring unavailable, errno(%d): %s", errno, strerror(errno))
+        return false;
+    }
+    const int kProbeOps = 256;
+    size_t probe_size = sizeof(struct io_uring_probe) + kProbeOps * sizeof(struct io_uring_probe_op);
+    auto probe = (struct io_uring_probe *) calloc(1, probe_size);
+    bool supported = ::syscall(__NR_io_uring_register, fd,
+                               IORING_REGISTER_PROBE, probe, kProbeOps) >= 0;
+    const uint8_t needed_ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                                  IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL};
+    for (uint8_t op : needed_ops) {
+        if (!supported) {
+            break;
+        }
+        supported = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    ::close(fd);
+    if (!supported) {
+        LogW("io_uring lacks needed opcodes")
+    }
+    return supported;
+}
+
+bool IoUringPoller::__SetupBufferRing() {
+    buf_ring_size_ = kBufferCnt * sizeof(struct io_uring_buf);
+    void *ring = ::mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        errno_ = errno;
+        LogE("mmap buf ring, errno(%d): %s", errno_, strerror(errno_))
+        return false;
+    }
+    buf_ring_ = (struct io_uring_buf_ring *) ring;
+
+    struct io_uring_buf_reg reg{};
+    reg.ring_addr = (uint64_t) buf_ring_;
+    reg.ring_entries = kBufferCnt;
+    reg.bgid = kBufferGroup;
+    if (::syscall(__NR_io_uring_register, ring_fd_,
+                  IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        errno_ = errno;
+        LogW("register pbuf ring, errno(%d): %s", errno_, strerror(errno_))
+        return false;
+    }
+    bufs_ = (char *) malloc((size_t) kBufferCnt * kBufferSize);
+    if (!bufs_) {
+        return false;
+    }
+    for (uint16_t bid = 0; bid < kBufferCnt; ++bid) {
+        __ProvideBuffer(bid);
+    }
+    return true;
+}
+
+void IoUringPoller::__ProvideBuffer(uint16_t _bid) {
+    // Not &buf_ring_->bufs[i], the flex array of the uapi header
+    // is off by the padding of an empty struct in C++.
+    auto buf = (struct io_uring_buf *) buf_ring_ + (buf_tail_ & (kBufferCnt - 1));
+    buf->addr = (uint64_t) (bufs_ + (size_t) _bid * kBufferSize);
+    buf->len = kBufferSize;
+    buf->bid = _bid;
+    ++buf_tail_;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe *IoUringPoller::__GetSqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_tail_local_ - head >= sq_entries_) {
+        // Full, hands what is queued to the kernel first.
+        __Submit();
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_tail_local_ - head >= sq_entries_) {
+            LogE("io_uring sq full")
+            return nullptr;
+        }
+    }
+    unsigned idx = sq_tail_local_ & sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++sq_tail_local_;
+    return sqe;
+}
+
+int IoUringPoller::__Enter(unsigned _to_submit, unsigned _min_complete,
+                           int _timeout_mills) {
+    __atomic_store_n(sq_tail_, sq_tail_local_, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    struct __kernel_timespec ts{};
+    struct io_uring_getevents_arg arg{};
+    if (_min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        arg.sigmask_sz = _NSIG / 8;
+        if (_timeout_mills >= 0) {
+            ts.tv_sec = _timeout_mills / 1000;
+            ts.tv_nsec = (long long) (_timeout_mills % 1000) * 1000000;
+            arg.ts = (uint64_t) &ts;
+        }
+    }
+    int ret = (int) ::syscall(__NR_io_uring_enter, ring_fd_, _to_submit,
+                              _min_complete, flags, flags ? &arg : nullptr,
+                              flags ? sizeof(arg) : 0);
+    if (ret < 0) {
+        errno_ = errno;
+    }
+    return ret;
+}
+
+int IoUringPoller::__Submit() {
+    unsigned to_submit = sq_tail_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (to_submit == 0) {
+        return 0;
+    }
+    return __Enter(to_submit, 0, 0);
+}
+
+void IoUringPoller::__DrainPending() {
+    std::vector<PendingAdd> pending;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending.swap(pending_);
+    }
+    for (auto &add : pending) {
+        if (add.op == kOpPollOut) {
+            __ArmPollOut(add.fd);
+            continue;
+        }
+        FdState &state = __State(add.fd);
+        uint32_t gen = state.gen;
+        state = FdState();
+        state.gen = gen + 1;
+        state.data = add.data;
+        switch (add.op) {
+            case kOpAccept:
+                listen_fd_ = add.fd;
+                __ArmAccept(add.fd);
+                break;
+            case kOpNotify:
+                notify_fd_ = add.fd;
+                __ArmNotify(add.fd);
+                break;
+            case kOpRecv:
+                __ArmRecv(add.fd);
+                break;
+            default:
+                break;
+        }
+    }
+    for (SOCKET fd : starved_fds_) {
+        FdState &state = __State(fd);
+        if (state.is_recv_starved) {
+            state.is_recv_starved = false;
+            if (!state.is_recv_paused) {
+                __ArmRecv(fd);
+            }
+        }
+    }
+    starved_fds_.clear();
+}
+
+void IoUringPoller::__ArmAccept(SOCKET _fd) {
+    struct io_uring_sqe *sqe = __GetSqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = _fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = __Key(kOpAccept, __State(_fd).gen, _fd);
+}
+
+void IoUringPoller::__ArmNotify(SOCKET _fd) {
+    struct io_uring_sqe *sqe = __GetSqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = _fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = __Key(kOpNotify, __State(_fd).gen, _fd);
+}
+
+void IoUringPoller::__ArmRecv(SOCKET _fd) {
+    struct io_uring_sqe *sqe = __GetSqe();
+    if (!sqe) {
+        return;
+    }
+    FdState &state = __State(_fd);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = _fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = __Key(kOpRecv, state.gen, _fd);
+    state.is_recv_armed = true;
+}
+
+void IoUringPoller::__Cancel(uint64_t _key) {
+    struct io_uring_sqe *sqe = __GetSqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = _key;
+    sqe->user_data = __Key(kOpCancel, 0, 0);
+}
+
+int IoUringPoller::PauseReading(SOCKET _fd, uint64_t /*_data*/) {
+    if (_fd < 0 || ring_fd_ < 0) {
+        return -1;
+    }
+    FdState &state = __State(_fd);
+    if (state.is_recv_paused) {
+        return 0;
+    }
+    state.is_recv_paused = true;
+    if (state.is_recv_armed) {
+        // Data received before the cancel takes effect is still reported.
+        __Cancel(__Key(kOpRecv, state.gen, _fd));
+    }
+    return 0;
+}
+
+int IoUringPoller::ResumeReading(SOCKET _fd, uint64_t /*_data*/) {
+    if (_fd < 0 || ring_fd_ < 0) {
+        return -1;
+    }
+    FdState &state = __State(_fd);
+    if (!state.is_recv_paused) {
+        return 0;
+    }
+    state.is_recv_paused = false;
+    // Otherwise re-armed once the cancel, or the buffers, come back.
+    if (!state.is_recv_armed && !state.is_recv_starved) {
+        __ArmRecv(_fd);
+    }
+    return 0;
+}
+
+int IoUringPoller::DelSocket(SOCKET _fd) {
+    if (_fd < 0) {
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        for (auto iter = pending_.begin(); iter != pending_.end(); ) {
+            iter = iter->fd == _fd ? pending_.erase(iter) : iter + 1;
+        }
+    }
+    if (ring_fd_ < 0) {
+        return 0;
+    }
+    FdState &state = __State(_fd);
+    // A pending recv holds the file, which would not be
+    // released by close(2) until the recv is cancelled.
+    if (state.is_recv_armed) {
+        __Cancel(__Key(kOpRecv, state.gen, _fd));
+    }
+    if (state.is_pollout_armed) {
+        __Cancel(__Key(kOpPollOut, state.gen, _fd));
+    }
+    if (_fd == notify_fd_) {
+        __Cancel(__Key(kOpNotify, state.gen, _fd));
+        notify_fd_ = INVALID_SOCKET;
+    }
+    if (_fd == listen_fd_) {
+        __Cancel(__Key(kOpAccept, state.gen, _fd));
+        listen_fd_ = INVALID_SOCKET;
+    }
+    // So is a send, e.g. polling for a peer which never reads,
+    // its buffer kept by the caller till the kSent on the way.
+    for (uint32_t slot : state.send_slots) {
+        __Cancel(__Key(kOpSend, 0, slot));
+    }
+    uint32_t gen = state.gen;
+    state = FdState();
+    state.gen = gen + 1;    // obsoletes completions on the way.
+    return 0;
+}
+
+void IoUringPoller::__ArmPollOut(SOCKET _fd) {
+    FdState &state = __State(_fd);
+    if (state.is_pollout_armed) {
+        return;
+    }
+    struct io_uring_sqe *sqe = __GetSqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = _fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = __Key(kOpPollOut, state.gen, _fd);
+    state.is_pollout_armed = true;
+}
+
+bool IoUringPoller::SubmitSend(SOCKET _fd, const void *_buf, size_t _len,
+                               uint64_t _data) {
+    if (ring_fd_ < 0 || _fd < 0) {
+        return false;
+    }
+    uint32_t slot;
+    if (free_send_slots_.empty()) {
+        slot = (uint32_t) send_slots_.size();
+        send_slots_.emplace_back();
+    } else {
+        slot = free_send_slots_.back();
+        free_send_slots_.pop_back();
+    }
+    FdState &state = __State(_fd);
+    send_slots_[slot] = {_fd, state.gen, (const char *) _buf, _len, _data};
+    state.send_slots.push_back(slot);
+    __PrepSend(slot, false);
+    return true;
+}
+
+void IoUringPoller::__PrepSend(uint32_t _slot, bool _poll_first) {
+    SendSlot &send = send_slots_[_slot];
+    struct io_uring_sqe *sqe = __GetSqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = send.fd;
+    sqe->addr = (uint64_t) send.buf;
+    sqe->len = (uint32_t) send.len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->ioprio = _poll_first ? IORING_RECVSEND_POLL_FIRST : 0;
+    sqe->user_data = __Key(kOpSend, 0, _slot);
+}
+
+int IoUringPoller::Poll(int _timeout_mills, std::vector<Event> &_events) {
+    _events.clear();
+    if (ring_fd_ < 0) {
+        errno_ = EBADF;
+        return -1;
+    }
+    __DrainPending();
+
+    unsigned to_submit = sq_tail_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    bool has_cqe = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_;
+    unsigned min_complete = has_cqe || _timeout_mills == 0 ? 0 : 1;
+
+    if (to_submit > 0 || min_complete > 0) {
+        // Submits and waits in one syscall.
+        if (__Enter(to_submit, min_complete, _timeout_mills) < 0
+                    && errno_ != ETIME && errno_ != EINTR && errno_ != EBUSY) {
+            LogE("io_uring_enter, errno(%d): %s", errno_, strerror(errno_))
+            return -1;
+        }
+    }
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        __HandleCqe(&cqes_[head & cq_mask_], _events);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return (int) _events.size();
+}
+
+void IoUringPoller::__HandleCqe(const struct io_uring_cqe *_cqe,
+                                std::vector<Event> &_events) {
+    uint64_t key = _cqe->user_data;
+    int res = _cqe->res;
+    bool more = _cqe->flags & IORING_CQE_F_MORE;
+    SOCKET fd = __FdOf(key);
+
+    Event event;
+    event.key = key;
+    event.res = res;
+
+    switch (__OpOf(key)) {
+        case kOpAccept: {
+            if (!more && fd == listen_fd_ && __GenOf(key) == (__State(fd).gen & 0xffffff)) {
+                __ArmAccept(fd);
+            }
+            if (res < 0) {
+                if (res != -ECANCELED && res != -EAGAIN) {
+                    LogE("multishot accept, errno(%d): %s", -res, strerror(-res))
+                }
+                return;
+            }
+            event.flags = kAccepted;
+            event.data = (uint64_t) fd;
+            break;
+        }
+        case kOpNotify: {
+            FdState &state = __State(fd);
+            if (__GenOf(key) != (state.gen & 0xffffff)) {
+                return;
+            }
+            if (!more) {
+                __ArmNotify(fd);
+            }
+            if (res < 0) {
+                return;
+            }
+            event.flags = kNotify;
+            event.data = state.data;
+            break;
+        }
+        case kOpRecv: {
+            FdState &state = __State(fd);
+            bool has_buffer = _cqe->flags & IORING_CQE_F_BUFFER;
+            uint16_t bid = (uint16_t) (_cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (__GenOf(key) != (state.gen & 0xffffff)) {
+                if (has_buffer) {
+                    __ProvideBuffer(bid);
+                }
+                return;
+            }
+            if (!more) {
+                state.is_recv_armed = false;
+            }
+            if (res == -ECANCELED) {
+                // By PauseReading(), DelSocket() having bumped the gen.
+                if (!more && !state.is_recv_paused) {
+                    __ArmRecv(fd);
+                }
+                return;
+            }
+            if (res == -ENOBUFS) {
+                // Re-armed once buffers of this round are given back.
+                state.is_recv_starved = true;
+                starved_fds_.push_back(fd);
+                return;
+            }
+            if (res > 0 && !more && !state.is_recv_paused) {
+                __ArmRecv(fd);
+            }
+            event.flags = kReceived;
+            event.data = state.data;
+            event.buf = has_buffer ? bufs_ + (size_t) bid * kBufferSize : nullptr;
+            break;
+        }
+        case kOpPollOut: {
+            FdState &state = __State(fd);
+            if (__GenOf(key) != (state.gen & 0xffffff)) {
+                return;
+            }
+            state.is_pollout_armed = false;
+            event.flags = res < 0 ? kError : kWritable;
+            event.data = state.data;
+            break;
+        }
+        case kOpSend: {
+            uint32_t slot = (uint32_t) key;
+            SendSlot &send = send_slots_[slot];
+            FdState &state = __State(send.fd);
+            bool is_deleted = send.gen != state.gen;
+            if (res == -EAGAIN) {
+                if (!is_deleted) {
+                    // Nonblocking socket full, waits for it inside the kernel.
+                    __PrepSend(slot, true);
+                    return;
+                }
+                res = -ECANCELED;
+            }
+            if (!is_deleted) {
+                std::vector<uint32_t> &slots = state.send_slots;
+                auto iter = std::find(slots.begin(), slots.end(), slot);
+                if (iter != slots.end()) {
+                    slots.erase(iter);
+                }
+            }
+            event.res = res;
+            event.flags = kSent;
+            event.data = send.data;
+            free_send_slots_.push_back(slot);
+            break;
+        }
+        default:
+            return;
+    }
+    _events.push_back(event);
+}
+
+bool IoUringPoller::IsValid(const Event &_event) const {
+    TOp op = __OpOf(_event.key);
+    if (op != kOpRecv && op != kOpPollOut) {
+        return true;
+    }
+    SOCKET fd = __FdOf(_event.key);
+    return (size_t) fd < fds_.size()
+                && __GenOf(_event.key) == (fds_[fd].gen & 0xffffff);
+}
+
+void IoUringPoller::ReleaseEvent(const Event &_event) {
+    if (!(_event.flags & kReceived) || !_event.buf) {
+        return;
+    }
+    __ProvideBuffer((uint16_t) ((_event.buf - bufs_) / kBufferSize));
+}
+
+void IoUringPoller::__Destroy() {
+    if (sqes_) {
+        ::munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if (ring_ptr_) {
+        ::munmap(ring_ptr_, ring_size_);
+        ring_ptr_ = nullptr;
+    }
+    if (ring_fd_ >= 0) {
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+    }
+    if (buf_ring_) {
+        ::munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = nullptr;
+    }
+    free(bufs_);
+    bufs_ = nullptr;
+}
+
+#else
+
+bool IoUringPoller::Init() { return false; }
+
+int IoUringPoller::DelSocket(SOCKET _fd) { return -1; }
+
+int IoUringPoller::PauseReading(SOCKET _fd, uint64_t /*_data*/) { return -1; }
+
+int IoUringPoller::ResumeReading(SOCKET _fd, uint64_t /*_data*/) { return -1; }
+
+bool IoUringPoller::SubmitSend(SOCKET _fd, const void *_buf, size_t _len,
+                               uint64_t _data) {
+    return false;
+}
+
+int IoUringPoller::Poll(int _timeout_mills, std::vector<Event> &_events) { return -1; }
+
+bool IoUringPoller::IsValid(const Event &_event) const { return true; }
+
+void IoUringPoller::ReleaseEvent(const Event &_event) {}
+
+void IoUringPoller::__Destroy() {}
+
+#endif
+
+IoUringPoller::~IoUringPoller() {
+    // Closing the ring cancels whatever is in flight.
+    __Destroy();
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "poller.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+
+/**
+ * Completion based Poller on io_uring, talking to the kernel through
+ * the raw syscalls, so that liburing is not needed.
+ *
+ * Listen fds are served by multishot accept, connections by multishot
+ * recv into a ring of provided buffers, and sends are batched into the
+ * same io_uring_enter(2) that waits for completions, so a loop round
+ * costs a single syscall.
+ *
+ * Except Add*() and WaitWritable(), which are armed by the next
+ * Poll(), call it from the loop thread only.
+ */
+class IoUringPoller : public Poller {
+  public:
+
+    explicit IoUringPoller(unsigned _entries = kDefaultEntries);
+
+    ~IoUringPoller() override;
+
+    /**
+     * @return: false if the kernel lacks what this poller relies on
+     *          (multishot accept / recv, provided buffer rings, 6.0+),
+     *          in which case fall back to epoll.
+     */
+    bool Init();
+
+    TBackend Backend() const override;
+
+    int AddListenFd(SOCKET _fd, bool _exclusive) override;
+
+    int AddNotifyFd(SOCKET _fd, uint64_t _data) override;
+
+    int AddConnection(SOCKET _fd, uint64_t _data) override;
+
+    int DelSocket(SOCKET _fd) override;
+
+    int WaitWritable(SOCKET _fd, uint64_t _data) override;
+    
+    /**
+     * Cancels the multishot recv, re-armed by ResumeReading().
+     */
+    int PauseReading(SOCKET _fd, uint64_t _data) override;
+    
+    int ResumeReading(SOCKET _fd, uint64_t _data) override;
+
+    bool SubmitSend(SOCKET _fd, const void *_buf, size_t _len,
+                    uint64_t _data) override;
+
+    int Poll(int _timeout_mills, std::vector<Event> &_events) override;
+
+    bool IsValid(const Event &_event) const override;
+
+    void ReleaseEvent(const Event &_event) override;
+
+    int GetErrNo() const override;
+
+    static const unsigned       kDefaultEntries;
+
+  private:
+    enum TOp : uint8_t {
+        kOpNone = 0,
+        kOpAccept,
+        kOpNotify,
+        kOpRecv,
+        kOpPollOut,
+        kOpSend,
+        kOpCancel,
+    };
+
+    struct FdState {
+        FdState();
+
+        uint64_t    data;
+        uint32_t    gen;
+        bool        is_recv_armed;
+        bool        is_pollout_armed;
+        bool        is_recv_starved;    // multishot recv stopped by ENOBUFS.
+        bool        is_recv_paused;     // not re-armed until resumed.
+        std::vector<uint32_t>   send_slots;     // sends in flight.
+    };
+
+    struct PendingAdd {
+        TOp         op;
+        SOCKET      fd;
+        uint64_t    data;
+    };
+
+    struct SendSlot {
+        SOCKET          fd;
+        uint32_t        gen;    // of the fd when submitted.
+        const char    * buf;
+        size_t          len;
+        uint64_t        data;
+    };
+
+    static uint64_t __Key(TOp _op, uint32_t _gen, uint32_t _fd);
+
+    static TOp __OpOf(uint64_t _key);
+
+    static uint32_t __GenOf(uint64_t _key);
+
+    static SOCKET __FdOf(uint64_t _key);
+
+    FdState &__State(SOCKET _fd);
+
+    io_uring_sqe *__GetSqe();
+
+    int __Enter(unsigned _to_submit, unsigned _min_complete, int _timeout_mills);
+
+    int __Submit();
+
+    void __DrainPending();
+
+    void __ArmAccept(SOCKET _fd);
+
+    void __ArmNotify(SOCKET _fd);
+
+    void __ArmRecv(SOCKET _fd);
+
+    void __ArmPollOut(SOCKET _fd);
+
+    void __Cancel(uint64_t _key);
+
+    void __PrepSend(uint32_t _slot, bool _poll_first);
+
+    void __HandleCqe(const io_uring_cqe *_cqe, std::vector<Event> &_events);
+
+    void __ProvideBuffer(uint16_t _bid);
+
+    bool __IsKernelSupported() const;
+
+    bool __SetupBufferRing();
+
+    void __Destroy();
+
+  private:
+    unsigned                    entries_;
+    int                         ring_fd_;
+    int                         errno_;
+
+    void                      * ring_ptr_;
+    size_t                      ring_size_;
+    io_uring_sqe              * sqes_;
+    size_t                      sqes_size_;
+    unsigned                  * sq_head_;
+    unsigned                  * sq_tail_;
+    unsigned                  * sq_array_;
+    unsigned                    sq_mask_;
+    unsigned                    sq_entries_;
+    unsigned                    sq_tail_local_;
+    unsigned                  * cq_head_;
+    unsigned                  * cq_tail_;
+    unsigned                    cq_mask_;
+    io_uring_cqe              * cqes_;
+
+    io_uring_buf_ring         * buf_ring_;
+    size_t                      buf_ring_size_;
+    char                      * bufs_;
+    uint16_t                    buf_tail_;
+    static const uint16_t       kBufferGroup;
+    static const uint16_t       kBufferCnt;
+    static const uint32_t       kBufferSize;
+
+    SOCKET                      listen_fd_;
+    SOCKET                      notify_fd_;
+    std::vector<FdState>        fds_;
+    std::vector<SendSlot>       send_slots_;
+    std::vector<uint32_t>       free_send_slots_;
+    std::vector<SOCKET>         starved_fds_;
+
+    std::mutex                  pending_mutex_;
+    std::vector<PendingAdd>     pending_;
+};
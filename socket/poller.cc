@@ -0,0 +1,48 @@
+#include "poller.h"
+
+
+Poller::Event::Event()
+        : flags(0)
+        , data(0)
+        , res(0)
+        , buf(nullptr)
+        , key(0) {
+}
+
+const char *Poller::BackendName(TBackend _backend) {
+    switch (_backend) {
+        case kEpoll:
+            return "epoll";
+        case kIoUring:
+            return "io_uring";
+        default:
+            return "unknown";
+    }
+}
+
+Poller::~Poller() = default;
+
+int Poller::WaitWritable(SOCKET /*_fd*/, uint64_t /*_data*/) {
+    return 0;
+}
+
+int Poller::PauseReading(SOCKET /*_fd*/, uint64_t /*_data*/) {
+    return -1;
+}
+
+int Poller::ResumeReading(SOCKET /*_fd*/, uint64_t /*_data*/) {
+    return -1;
+}
+
+bool Poller::SubmitSend(SOCKET /*_fd*/, const void * /*_buf*/, size_t /*_len*/,
+                        uint64_t /*_data*/) {
+    return false;
+}
+
+bool Poller::IsValid(const Event & /*_event*/) const {
+    return true;
+}
+
+void Poller::ReleaseEvent(const Event & /*_event*/) {
+    // Implemented by pollers which lend buffers.
+}
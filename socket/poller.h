@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+#include "unixsocket.h"
+
+
+/**
+ * I/O event source of an event loop.
+ *
+ * A readiness based poller (epoll) reports fds being readable or
+ * writable, while a completion based one (io_uring) accepts, receives
+ * and sends on behalf of the loop, and reports the results.
+ */
+class Poller {
+  public:
+
+    enum TBackend {
+        kEpoll = 0,
+        kIoUring,
+    };
+
+    enum TEventFlag : uint32_t {
+        kNotify         = 1 << 0,   // the notify fd is readable.
+        kNewConnect     = 1 << 1,   // the listen fd is readable, accept till EAGAIN.
+        kAccepted       = 1 << 2,   // accepted by the poller, the new fd in res.
+        kReadable       = 1 << 3,   // receive till EAGAIN.
+        kReceived       = 1 << 4,   // received by the poller, see Event.
+        kWritable       = 1 << 5,
+        kSent           = 1 << 6,   // a SubmitSend() done, res bytes or -errno.
+        kError          = 1 << 7,
+    };
+
+    struct Event {
+        Event();
+
+        uint32_t        flags;
+        uint64_t        data;       // as registered.
+        /* kReceived: bytes in buf, 0 on FIN, -errno on error. */
+        ssize_t         res;
+        const char    * buf;
+        uint64_t        key;        // for the poller to validate the event.
+    };
+
+    static const char *BackendName(TBackend _backend);
+
+    virtual ~Poller();
+
+    virtual TBackend Backend() const = 0;
+
+    virtual int AddListenFd(SOCKET _fd, bool _exclusive) = 0;
+
+    virtual int AddNotifyFd(SOCKET _fd, uint64_t _data) = 0;
+
+    /**
+     * Watches a connection for read, write and error.
+     * Thread safe.
+     */
+    virtual int AddConnection(SOCKET _fd, uint64_t _data) = 0;
+
+    /**
+     * Stops watching, call it before closing @param{_fd}.
+     */
+    virtual int DelSocket(SOCKET _fd) = 0;
+
+    /**
+     * Reports kWritable once @param{_fd} becomes writable,
+     * if the poller does not do so by itself.
+     */
+    virtual int WaitWritable(SOCKET _fd, uint64_t _data);
+    
+    /**
+     * Neither reports nor receives data of @param{_fd} until
+     * ResumeReading(), so that the Tcp receive window pushes back
+     * on its peer. Call it from the loop thread.
+     *
+     * @return: -1 if not supported.
+     */
+    virtual int PauseReading(SOCKET _fd, uint64_t _data);
+    
+    /**
+     * Data arrived while paused is reported, or received, afterwards.
+     */
+    virtual int ResumeReading(SOCKET _fd, uint64_t _data);
+
+    /**
+     * Sends asynchronously, @param{_buf} must stay valid until kSent
+     * with @param{_data} is reported. Sends are submitted in batch on
+     * the next Poll(). Those still in flight on DelSocket() are cancelled,
+     * kSent being reported all the same, probably with -ECANCELED.
+     *
+     * @return: false if not supported, or the submission failed.
+     */
+    virtual bool SubmitSend(SOCKET _fd, const void *_buf, size_t _len,
+                            uint64_t _data);
+
+    /**
+     * @param _events: cleared and filled with what happened.
+     * @return: number of events, -1 on error.
+     */
+    virtual int Poll(int _timeout_mills, std::vector<Event> &_events) = 0;
+
+    /**
+     * @return: false if the event is obsolete, e.g. it belongs
+     *          to a connection deleted while handling the events
+     *          before it, in which case just skip it.
+     */
+    virtual bool IsValid(const Event &_event) const;
+
+    /**
+     * Gives the buffer of a kReceived event back to the poller,
+     * call it once its data is consumed.
+     */
+    virtual void ReleaseEvent(const Event &_event);
+
+    virtual int GetErrNo() const = 0;
+};
@@ -3,7 +3,13 @@
 #include <cerrno>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
 #include "log.h"
+#ifdef __linux__
+#include <sys/eventfd.h>
+#else
+#include <fcntl.h>
+#endif
 
 
 const int SocketEpoll::kMaxFds = 1024;
@@ -11,6 +17,7 @@ const int SocketEpoll::kMaxFds = 1024;
 SocketEpoll::SocketEpoll(int _max_fds)
         : epoll_fd_(INVALID_SOCKET)
         , listen_fd_(INVALID_SOCKET)
+        , notify_data_(0)
         , epoll_events_(nullptr)
         , errno_(0)
 {
@@ -29,6 +36,53 @@ SocketEpoll::SocketEpoll(int _max_fds)
 }
 
 
+Poller::TBackend SocketEpoll::Backend() const { return kEpoll; }
+
+int SocketEpoll::AddListenFd(SOCKET _fd, bool _exclusive) {
+    return SetListenFd(_fd, _exclusive);
+}
+
+int SocketEpoll::AddNotifyFd(SOCKET _fd, uint64_t _data) {
+    notify_data_ = _data;
+    return AddSocketRead(_fd, _data);
+}
+
+int SocketEpoll::AddConnection(SOCKET _fd, uint64_t _data) {
+    return AddSocketReadWrite(_fd, _data);
+}
+
+int SocketEpoll::PauseReading(SOCKET _fd, uint64_t _data) {
+    return ModSocketWrite(_fd, _data);
+}
+
+int SocketEpoll::ResumeReading(SOCKET _fd, uint64_t _data) {
+    // EPOLL_CTL_MOD polls the fd again, edge triggered or not.
+    return ModSocketReadWrite(_fd, _data);
+}
+
+int SocketEpoll::Poll(int _timeout_mills, std::vector<Event> &_events) {
+    _events.clear();
+    int n_events = EpollWait(_timeout_mills);
+#ifdef __linux__
+    for (int i = 0; i < n_events; ++i) {
+        Event event;
+        event.data = epoll_events_[i].data.u64;
+        uint32_t flags = epoll_events_[i].events;
+        if (notify_data_ && event.data == notify_data_) {
+            event.flags = kNotify;
+        } else if (IsNewConnect(i)) {
+            event.flags = kNewConnect | ((flags & EPOLLERR) ? (uint32_t) kError : 0);
+        } else {
+            event.flags |= (flags & EPOLLERR) ? (uint32_t) kError : 0;
+            event.flags |= (flags & EPOLLIN) ? (uint32_t) kReadable : 0;
+            event.flags |= (flags & EPOLLOUT) ? (uint32_t) kWritable : 0;
+        }
+        _events.push_back(event);
+    }
+#endif
+    return n_events;
+}
+
 int SocketEpoll::AddSocketRead(int _fd) {
     return AddSocketRead(_fd, _fd);
 }
@@ -37,7 +91,7 @@ int SocketEpoll::AddSocketRead(int _fd, uint64_t _data) {
 #ifdef __linux__
     struct epoll_event event;
     event.events = EPOLLIN | EPOLLET;
-    event.data.fd = _fd;
+    event.data.u64 = _data;
     return __EpollCtl(EPOLL_CTL_ADD, _fd, &event);
 #else
     return 0;
@@ -66,6 +120,17 @@ int SocketEpoll::ModSocketWrite(int _fd, uint64_t _data) {
 #endif
 }
 
+int SocketEpoll::ModSocketReadWrite(int _fd, uint64_t _data) {
+#ifdef __linux__
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.u64 = _data;
+    return __EpollCtl(EPOLL_CTL_MOD, _fd, &event);
+#else
+    return 0;
+#endif
+}
+
 int SocketEpoll::DelSocket(int _fd) {
 #ifdef __linux__
     return __EpollCtl(EPOLL_CTL_DEL, _fd);
@@ -165,7 +230,8 @@ bool SocketEpoll::IsNewConnect(int _idx) {
         LogE("invalid _idx: %d", _idx)
         return false;
     }
-    return epoll_events_[_idx].data.fd == listen_fd_;
+    return listen_fd_ != INVALID_SOCKET
+                && epoll_events_[_idx].data.u64 == (uint64_t) listen_fd_;
 #else
     return false;
 #endif
@@ -194,14 +260,25 @@ epoll_data *SocketEpoll::__IsFlagSet(int _idx, uint32_t _flag) {
 }
 
 
-void SocketEpoll::SetListenFd(int _listen_fd) {
+int SocketEpoll::SetListenFd(int _listen_fd, bool _exclusive/* = false*/) {
 #ifdef __linux__
     if (_listen_fd < 0) {
         LogE("_listen_fd: %d", _listen_fd)
-        return;
+        return -1;
+    }
+    int ret;
+    if (_exclusive) {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+        event.data.u64 = _listen_fd;
+        ret = __EpollCtl(EPOLL_CTL_ADD, _listen_fd, &event);
+    } else {
+        ret = AddSocketRead(_listen_fd);
     }
-    AddSocketRead(_listen_fd);
     listen_fd_ = _listen_fd;
+    return ret;
+#else
+    return 0;
 #endif
 }
 
@@ -222,48 +299,111 @@ SocketEpoll::~SocketEpoll() {
 
 
 EpollNotifier::EpollNotifier()
-        : socket_(INVALID_SOCKET)
-        , socket_epoll_(nullptr) {
-    
-    if (socket_.Create(AF_INET, SOCK_STREAM) < 0) {
-        LogE("create socket error: %s, errno: %d",
-             strerror(errno), errno);
+        : notify_fd_(INVALID_SOCKET)
+        , notify_write_fd_(INVALID_SOCKET)
+        , poller_(nullptr)
+        , head_(nullptr) {
+#ifdef __linux__
+    notify_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    notify_write_fd_ = notify_fd_;
+    if (notify_fd_ < 0) {
+        LogE("create eventfd error: %s, errno: %d", strerror(errno), errno)
+        return;
+    }
+#else
+    int fds[2];
+    if (::pipe(fds) < 0) {
+        LogE("create pipe error: %s, errno: %d", strerror(errno), errno)
         return;
     }
-    LogI("notify fd: %d", socket_.FD())
-    socket_.SetNonblocking();
+    for (int fd : fds) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    notify_fd_ = fds[0];
+    notify_write_fd_ = fds[1];
+#endif
+    LogI("notify fd: %d", notify_fd_)
 }
 
-void EpollNotifier::SetSocketEpoll(SocketEpoll *_epoll) {
-    assert(!socket_epoll_);
-    if (_epoll) {
-        socket_epoll_ = _epoll;
-        socket_epoll_->AddSocketRead(socket_.FD());
+void EpollNotifier::SetPoller(Poller *_poller) {
+    if (!_poller || _poller == poller_) {
+        return;
+    }
+    if (poller_) {
+        poller_->DelSocket(notify_fd_);
     }
+    poller_ = _poller;
+    poller_->AddNotifyFd(notify_fd_, (uint64_t) this);
 }
 
 void EpollNotifier::NotifyEpoll(Notification &_notification) {
-    assert(socket_epoll_);
-    socket_epoll_->ModSocketWrite(socket_.FD(), (uint64_t) _notification.notify_id_);
+    assert(poller_);
+    if (_notification.queued_.exchange(true, std::memory_order_acq_rel)) {
+        return;     // coalesced into the pending one.
+    }
+    Notification *head = head_.load(std::memory_order_relaxed);
+    do {
+        _notification.next_ = head;
+    } while (!head_.compare_exchange_weak(head, &_notification,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+    if (!head) {
+        // Only the first post of a batch needs to wake up the epoll thread.
+        __Wakeup();
+    }
 }
 
-SOCKET EpollNotifier::GetNotifyFd() const { return socket_.FD(); }
+void EpollNotifier::PopAll(std::vector<Notification *> &_res) {
+    // Drain the eventfd before taking the list, so that a post which
+    // finds the list empty afterwards always triggers another event.
+    __ClearWakeup();
+    
+    Notification *node = head_.exchange(nullptr, std::memory_order_acquire);
+    size_t begin = _res.size();
+    while (node) {
+        Notification *next = node->next_;
+        node->next_ = nullptr;
+        // Dequeued before handled, a post from now on is queued again.
+        node->queued_.exchange(false, std::memory_order_acq_rel);
+        _res.push_back(node);
+        node = next;
+    }
+    std::reverse(_res.begin() + begin, _res.end());
+}
 
-EpollNotifier::~EpollNotifier() {
-    SOCKET fd = socket_.FD();
-    if (fd != INVALID_SOCKET && socket_epoll_) {
-        socket_epoll_->DelSocket(fd);
+SOCKET EpollNotifier::GetNotifyFd() const { return notify_fd_; }
+
+void EpollNotifier::__Wakeup() {
+    uint64_t one = 1;
+    while (::write(notify_write_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
     }
 }
 
-EpollNotifier::Notification::Notification()
-        : notify_id_(&notify_id_) {
+void EpollNotifier::__ClearWakeup() {
+    uint64_t cnt;
+    while (::read(notify_fd_, &cnt, sizeof(cnt)) > 0) {
+    }
 }
 
-EpollNotifier::Notification::Notification(EpollNotifier::Notification::NotifyId _notify_id)
-        : notify_id_(_notify_id) {
+EpollNotifier::~EpollNotifier() {
+    if (notify_fd_ == INVALID_SOCKET) {
+        return;
+    }
+    if (poller_) {
+        poller_->DelSocket(notify_fd_);
+    }
+    if (notify_write_fd_ != notify_fd_) {
+        ::close(notify_write_fd_);
+    }
+    ::close(notify_fd_);
+}
+
+EpollNotifier::Notification::Notification()
+        : next_(nullptr)
+        , queued_(false) {
 }
 
-bool EpollNotifier::Notification::operator==(const EpollNotifier::Notification &another) {
-    return notify_id_ == another.notify_id_;
+bool EpollNotifier::Notification::operator==(const EpollNotifier::Notification &another) const {
+    return this == &another;
 }
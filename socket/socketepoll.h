@@ -12,17 +12,45 @@
 #endif
 #endif
 #include <cstddef>
+#include <atomic>
+#include <vector>
 #include "unixsocket.h"
+#include "poller.h"
 
 
-class SocketEpoll {
+class SocketEpoll : public Poller {
   public:
     
     explicit SocketEpoll(int _max_fds = 1024);
     
-    ~SocketEpoll();
+    ~SocketEpoll() override;
     
-    void SetListenFd(SOCKET _listen_fd);
+    TBackend Backend() const override;
+    
+    int AddListenFd(SOCKET _fd, bool _exclusive) override;
+    
+    int AddNotifyFd(SOCKET _fd, uint64_t _data) override;
+    
+    int AddConnection(SOCKET _fd, uint64_t _data) override;
+    
+    int Poll(int _timeout_mills, std::vector<Event> &_events) override;
+    
+    /**
+     * Drops EPOLLIN, watching for write and error only.
+     */
+    int PauseReading(SOCKET _fd, uint64_t _data) override;
+    
+    /**
+     * Re-arms EPOLLIN, reported at once if data is waiting.
+     */
+    int ResumeReading(SOCKET _fd, uint64_t _data) override;
+    
+    /**
+     * @param _exclusive: Registers with EPOLLEXCLUSIVE, so that when
+     *                    several epoll instances wait on the same
+     *                    listen fd, only one of them is woken up.
+     */
+    int SetListenFd(SOCKET _listen_fd, bool _exclusive = false);
     
     int EpollWait(int _timeout_mills = -1, int _max_events = kMaxFds);
     
@@ -34,7 +62,9 @@ class SocketEpoll {
     
     int ModSocketWrite(SOCKET _fd, uint64_t _data);
     
-    int DelSocket(SOCKET _fd);
+    int ModSocketReadWrite(SOCKET _fd, uint64_t _data);
+    
+    int DelSocket(SOCKET _fd) override;
     
     SOCKET GetSocket(int _idx);
     
@@ -63,7 +93,7 @@ class SocketEpoll {
     
     bool IsNewConnect(int _idx);
     
-    int GetErrNo() const;
+    int GetErrNo() const override;
     
     
   private:
@@ -81,6 +111,7 @@ class SocketEpoll {
   private:
     SOCKET                      epoll_fd_;
     SOCKET                      listen_fd_;
+    uint64_t                    notify_data_;
     struct epoll_event *        epoll_events_;
     int                         errno_;
     static const int            kMaxFds;
@@ -90,46 +121,73 @@ class SocketEpoll {
 
 /**
  * Actively notify the epoll from waiting.
+ *
+ * A mailbox of Notifications backed by an eventfd: any thread
+ * posts a Notification into a lock-free intrusive list, and only
+ * the post that finds the list empty writes the eventfd, so a burst
+ * of notifications costs the epoll thread a single wakeup.
  */
 class EpollNotifier {
   public:
     
+    /**
+     * A Notification is identified by its address, typically it is
+     * a member of the thread that handles it.
+     *
+     * Posting a Notification that is already pending is coalesced
+     * into the pending one. It is dequeued before it is handled,
+     * so a post racing with the handling is never lost, but delivered
+     * once more.
+     */
     class Notification {
         friend class EpollNotifier;
         
       public:
-        
-        /**
-         * NotifyId is merely a flag for you to tell
-         * which notification it is, and the address it points to
-         * does not signify anything else.
-         *
-         * See {@code Notification()}
-         */
-        using NotifyId = void const *;
-    
         Notification();
         
-        explicit Notification(NotifyId _notify_id);
+        Notification(const Notification &) = delete;
+        
+        Notification &operator=(const Notification &) = delete;
         
-        bool operator==(const Notification &another);
+        bool operator==(const Notification &another) const;
         
       private:
-        NotifyId notify_id_;
+        Notification *              next_;
+        std::atomic<bool>           queued_;
     };
     
     EpollNotifier();
     
-    void SetSocketEpoll(SocketEpoll *_epoll);
+    /**
+     * Registers the notify fd with @param{_poller},
+     * moving it from the previous one if any.
+     */
+    void SetPoller(Poller *_poller);
     
+    /**
+     * Thread safe, and async-signal-safe.
+     */
     void NotifyEpoll(Notification &_notification);
     
+    /**
+     * Called by the epoll thread only, appends all pending
+     * Notifications to _res in the order they were posted.
+     */
+    void PopAll(std::vector<Notification *> &_res);
+    
     SOCKET GetNotifyFd() const;
     
     ~EpollNotifier();
 
   private:
-    Socket          socket_;
-    SocketEpoll *   socket_epoll_;
+    void __Wakeup();
+    
+    void __ClearWakeup();
+
+  private:
+    SOCKET                          notify_fd_;
+    SOCKET                          notify_write_fd_;   // == notify_fd_ for eventfd
+    Poller *                        poller_;
+    std::atomic<Notification *>     head_;
 };
 
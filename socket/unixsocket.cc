@@ -3,10 +3,20 @@
 #include "cassert"
 #include <fcntl.h>
 #include <cerrno>
+#include <algorithm>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
 #include "log.h"
 
 
 const int Socket::kBufferSize = 4096;
+const size_t Socket::kMaxReadHint = 64 * 1024;
+const size_t Socket::kOverflowSize = 64 * 1024;
+const int Socket::kMaxIovecs = 64;
 
 Socket::Socket(SOCKET _fd, int _type /* = SOCK_STREAM*/,
                bool _nonblocking /* = true*/, bool _connected /* = false*/)
@@ -15,7 +25,10 @@ Socket::Socket(SOCKET _fd, int _type /* = SOCK_STREAM*/,
         , errno_(0)
         , is_eagain_(false)
         , is_connected_(_connected)
-        , nonblocking_(_nonblocking) {
+        , nonblocking_(_nonblocking)
+        , read_hint_(kBufferSize)
+        , is_zerocopy_(false)
+        , zerocopy_seq_(0) {
     
     assert(_type == SOCK_STREAM || _type == SOCK_DGRAM);
     
@@ -117,6 +130,48 @@ int Socket::SetCloseLingerTimeout(int _linger) const {
     return SetSocketOpt(SOL_SOCKET, SO_LINGER, &ling, sizeof(ling));
 }
 
+int Socket::SetReusePort() const {
+    int reuse_port = 1;
+    return SetSocketOpt(SOL_SOCKET, SO_REUSEPORT,
+                        &reuse_port, sizeof(reuse_port));
+}
+
+int Socket::SetBusyPoll(int _usecs) const {
+#ifdef __linux__
+    int ret = SetSocketOpt(SOL_SOCKET, SO_BUSY_POLL, &_usecs, sizeof(_usecs));
+#ifdef SO_PREFER_BUSY_POLL
+    if (ret == 0) {
+        int prefer = 1;
+        SetSocketOpt(SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+    }
+#endif
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+int Socket::AttachReusePortCpuSteering(uint32_t _group_size) const {
+#ifdef __linux__
+    assert(_group_size > 0);
+    struct sock_filter code[] = {
+            // A = raw_smp_processor_id()
+            { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU) },
+            // A = A % _group_size
+            { BPF_ALU | BPF_MOD | BPF_K, 0, 0, _group_size },
+            // return A, the index of socket in the reuseport group.
+            { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog{};
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return SetSocketOpt(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                        &prog, sizeof(prog));
+#else
+    return -1;
+#endif
+}
+
 int Socket::Listen(int _backlog) const {
     assert(_backlog > 0);
     int ret = ::listen(fd_, _backlog);
@@ -126,19 +181,82 @@ int Socket::Listen(int _backlog) const {
     return ret;
 }
 
+SOCKET Socket::Accept(std::string &_ip, uint16_t &_port) const {
+    struct sockaddr_in sock_in{};
+    socklen_t socklen = sizeof(sockaddr_in);
+    char ip_str[INET_ADDRSTRLEN] = {0, };
+    
+#ifdef __linux__
+    // Saves the fcntl(2) calls needed to set the flags afterwards.
+    SOCKET fd = ::accept4(fd_, (struct sockaddr *) &sock_in, &socklen,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return INVALID_SOCKET;
+    }
+#else
+    SOCKET fd = ::accept(fd_, (struct sockaddr *) &sock_in, &socklen);
+    if (fd < 0) {
+        return INVALID_SOCKET;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+    if (!inet_ntop(AF_INET, &sock_in.sin_addr, ip_str, sizeof(ip_str))) {
+        LogE("inet_ntop errno(%d): %s", errno, strerror(errno))
+    }
+    _ip = ip_str;
+    _port = ntohs(sock_in.sin_port);
+    return fd;
+}
+
+int Socket::PeerName(SOCKET _fd, std::string &_ip, uint16_t &_port) {
+    struct sockaddr_in sock_in{};
+    socklen_t socklen = sizeof(sockaddr_in);
+    char ip_str[INET_ADDRSTRLEN] = {0, };
+    
+    if (::getpeername(_fd, (struct sockaddr *) &sock_in, &socklen) < 0) {
+        LogE("getpeername errno(%d): %s", errno, strerror(errno))
+        return -1;
+    }
+    if (!inet_ntop(AF_INET, &sock_in.sin_addr, ip_str, sizeof(ip_str))) {
+        LogE("inet_ntop errno(%d): %s", errno, strerror(errno))
+    }
+    _ip = ip_str;
+    _port = ntohs(sock_in.sin_port);
+    return 0;
+}
+
 ssize_t Socket::Receive(AutoBuffer *_buff, bool *_is_buffer_full) {
     assert(_buff && _is_buffer_full);
     
+    // One per thread, only touched between the readv and the copy.
+    static thread_local char overflow[kOverflowSize];
+    
+    // Of this read only, a drained socket reads fine after more arrives.
+    errno_ = 0;
+    is_eagain_ = false;
+    
     size_t available = _buff->AvailableSize();
-    if (available < kBufferSize) {
-        _buff->AddCapacity(kBufferSize - available);
+    if (available < read_hint_) {
+        _buff->AddCapacity(read_hint_ - available);
+        available = _buff->AvailableSize();
     }
     
-    ssize_t n = ::read(fd_, _buff->Ptr(
-            _buff->Length()), kBufferSize);
+    struct iovec iov[2];
+    iov[0].iov_base = _buff->Ptr(_buff->Length());
+    iov[0].iov_len = available;
+    iov[1].iov_base = overflow;
+    iov[1].iov_len = kOverflowSize;
+    
+    ssize_t n = ::readv(fd_, iov, 2);
     
     if (n > 0) {
-        _buff->AddLength(n);
+        size_t in_place = (size_t) n < available ? n : available;
+        _buff->AddLength(in_place);
+        if ((size_t) n > in_place) {
+            _buff->Write(overflow, n - in_place);
+        }
+        __AdaptReadHint(n);
         
     } else if (n < 0) {
         errno_ = errno;
@@ -148,11 +266,22 @@ ssize_t Socket::Receive(AutoBuffer *_buff, bool *_is_buffer_full) {
         }
     }
     
-    *_is_buffer_full = n == kBufferSize;
+    *_is_buffer_full = n > 0 && (size_t) n == available + kOverflowSize;
     
     return n;
 }
 
+void Socket::__AdaptReadHint(size_t _nread) {
+    if (_nread > read_hint_) {
+        // Spilled, reserves as much next time.
+        while (read_hint_ < _nread && read_hint_ < kMaxReadHint) {
+            read_hint_ <<= 1;
+        }
+    } else if (_nread < read_hint_ / 4 && read_hint_ > kBufferSize) {
+        read_hint_ >>= 1;
+    }
+}
+
 ssize_t Socket::Send(AutoBuffer *_buff, bool *_is_send_done) {
     size_t pos = _buff->Pos();
     size_t ntotal = _buff->Length() - pos;
@@ -163,7 +292,24 @@ ssize_t Socket::Send(AutoBuffer *_buff, bool *_is_send_done) {
         return 0;
     }
     
-    ssize_t nwrite = ::write(fd_, _buff->Ptr(pos), ntotal);
+    struct iovec iov[kMaxIovecs];
+    ssize_t nwrite = 0;
+    while ((size_t) nwrite < ntotal) {
+        int iov_cnt = _buff->Iovecs(pos + nwrite, iov, kMaxIovecs);
+        size_t len = 0;
+        for (int i = 0; i < iov_cnt; ++i) {
+            len += iov[i].iov_len;
+        }
+        ssize_t n = ::writev(fd_, iov, iov_cnt);
+        if (n < 0) {
+            nwrite = nwrite > 0 ? nwrite : n;
+            break;
+        }
+        nwrite += n;
+        if ((size_t) n < len) {
+            break;
+        }
+    }
     
     if (nwrite == ntotal) {
         LogI("fd(%d), write %zd/%zu B, done", fd_, nwrite, ntotal)
@@ -190,10 +336,153 @@ ssize_t Socket::Send(AutoBuffer *_buff, bool *_is_send_done) {
     return nwrite;
 }
 
-void Socket::Set(SOCKET _fd) {
+ssize_t Socket::Send(const struct iovec *_iov, int _iov_cnt) {
+    if (fd_ <= 0 || _iov_cnt <= 0) {
+        return 0;
+    }
+    ssize_t nwrite = ::writev(fd_, _iov, _iov_cnt);
+    if (nwrite >= 0) {
+        LogI("fd(%d), writev %zd B in %d iovecs", fd_, nwrite, _iov_cnt)
+        return nwrite;
+    }
+    errno_ = errno;
+    if (IS_EAGAIN(errno)) {
+        return 0;
+    }
+    if (errno == EPIPE) {
+        // fd probably closed by peer, or cleared because of timeout.
+        LogE("fd(%d) already closed, send nothing", fd_)
+    } else {
+        LogE("fd(%d) errno(%d): %s", fd_, errno, strerror(errno))
+    }
+    return -1;
+}
+
+ssize_t Socket::SendFile(int _in_fd, off_t *_offset, size_t _count) {
+    if (fd_ <= 0 || _count == 0) {
+        return 0;
+    }
+#ifdef __linux__
+    ssize_t nwrite = ::sendfile(fd_, _in_fd, _offset, _count);
+#else
+    char buff[kBufferSize];
+    ssize_t nwrite = ::pread(_in_fd, buff, std::min(_count, sizeof(buff)), *_offset);
+    if (nwrite > 0) {
+        nwrite = ::write(fd_, buff, nwrite);
+        if (nwrite > 0) {
+            *_offset += nwrite;
+        }
+    }
+#endif
+    if (nwrite > 0) {
+        LogI("fd(%d), sendfile %zd/%zu B", fd_, nwrite, _count)
+        return nwrite;
+    }
+    if (nwrite == 0) {
+        errno_ = EIO;
+        LogE("fd(%d), file fd(%d) ends at %lld before %zu B more",
+             fd_, _in_fd, (long long) *_offset, _count)
+        return -1;
+    }
+    errno_ = errno;
+    if (IS_EAGAIN(errno)) {
+        return 0;
+    }
+    if (errno == EPIPE) {
+        // fd probably closed by peer, or cleared because of timeout.
+        LogE("fd(%d) already closed, send nothing", fd_)
+    } else {
+        LogE("fd(%d) errno(%d): %s", fd_, errno, strerror(errno))
+    }
+    return -1;
+}
+
+bool Socket::EnableZeroCopy() {
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+    if (is_zerocopy_) {
+        return true;
+    }
+    int on = 1;
+    is_zerocopy_ = SetSocketOpt(SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+    return is_zerocopy_;
+#else
+    return false;
+#endif
+}
+
+bool Socket::IsZeroCopyEnabled() const { return is_zerocopy_; }
+
+ssize_t Socket::SendZeroCopy(const void *_buf, size_t _len, uint32_t *_seq) {
+    *_seq = UINT32_MAX;
+    if (fd_ <= 0 || _len == 0) {
+        return 0;
+    }
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+    if (is_zerocopy_) {
+        ssize_t nwrite = ::send(fd_, _buf, _len, MSG_ZEROCOPY);
+        if (nwrite > 0) {
+            LogI("fd(%d), send %zd/%zu B zero copy, seq: %u", fd_, nwrite, _len, zerocopy_seq_)
+            *_seq = zerocopy_seq_++;
+            return nwrite;
+        }
+        if (nwrite < 0 && errno != ENOBUFS) {
+            errno_ = errno;
+            if (IS_EAGAIN(errno)) {
+                return 0;
+            }
+            LogE("fd(%d) errno(%d): %s", fd_, errno, strerror(errno))
+            return -1;
+        }
+        // Pages pinned beyond the optmem limit, copy this time.
+    }
+#endif
+    struct iovec iov = {const_cast<void *>(_buf), _len};
+    return Send(&iov, 1);
+}
+
+int Socket::ReadZeroCopyCompletion(uint32_t *_lo, uint32_t *_hi, bool *_is_copied) {
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err))
+                 + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct msghdr msg {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    
+    if (::recvmsg(fd_, &msg, MSG_ERRQUEUE) < 0) {
+        if (IS_EAGAIN(errno)) {
+            return 0;
+        }
+        errno_ = errno;
+        LogE("fd(%d) errno(%d): %s", fd_, errno, strerror(errno))
+        return -1;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+            continue;
+        }
+        auto *err = (struct sock_extended_err *) CMSG_DATA(cmsg);
+        if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+        }
+        *_lo = err->ee_info;
+        *_hi = err->ee_data;
+        *_is_copied = err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+        return 1;
+    }
+    LogE("fd(%d), not a zero copy completion", fd_)
+    return -1;
+#else
+    return 0;
+#endif
+}
+
+void Socket::Set(SOCKET _fd, bool _nonblocking/* = false*/) {
     assert(fd_ < 0);
     if (_fd > 0) {
         fd_ = _fd;
+        nonblocking_ = _nonblocking;
     }
 }
 
@@ -228,6 +517,13 @@ void Socket::Close() {
         }
         fd_ = INVALID_SOCKET;
     }
+    // The object may be reused for another peer, see ConnectionPool.
+    errno_ = 0;
+    is_eagain_ = false;
+    is_connected_ = false;
+    read_hint_ = kBufferSize;
+    is_zerocopy_ = false;
+    zerocopy_seq_ = 0;
 }
 
 SOCKET Socket::FD() const {
@@ -247,6 +543,15 @@ int Socket::SocketError() const {
     return error;
 }
 
+int Socket::PendingError() const {
+    int error = 0;
+    socklen_t errlen = sizeof(error);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, (void *) &error, &errlen) < 0) {
+        return errno;
+    }
+    return error;
+}
+
 int Socket::SetSocketOpt(int _level, int _option_name,
                          const void *_option_value,
                          socklen_t _option_len) const {
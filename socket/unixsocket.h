@@ -4,6 +4,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #include "autobuffer.h"
 #include <string>
 
@@ -30,13 +31,95 @@ class Socket {
     
     int Listen(int _backlog) const;
     
+    /**
+     * Accepts one pending connection, which is
+     * already nonblocking and close-on-exec.
+     *
+     * @return: fd of the new connection, or INVALID_SOCKET,
+     *          in which case errno is set by accept(2).
+     */
+    SOCKET Accept(std::string &_ip, uint16_t &_port) const;
+    
+    /**
+     * Address of the peer of @param{_fd}, e.g. accepted by io_uring.
+     */
+    static int PeerName(SOCKET _fd, std::string &_ip, uint16_t &_port);
+    
+    /**
+     * Reads into the tail of @param{_buff}, whatever does not fit
+     * spills into a thread local overflow area and is appended after,
+     * so that a large payload takes one or two syscalls without
+     * every connection's buffer being grown for it in advance.
+     *
+     * The tail reserved is adapted to the sizes recently read.
+     *
+     * @param _is_buffer_full: whether the read was cut short by
+     *                         the space given, i.e. more may be pending.
+     */
     ssize_t Receive(AutoBuffer *_buff, bool *_is_buffer_full);
     
+    /**
+     * Sends from the position of @param{_buff} on, a chained
+     * buffer by writev(2) straight from its segments.
+     */
     ssize_t Send(AutoBuffer *_buff, bool *_is_send_done);
     
+    /**
+     * Gathers @param{_iov} into a single writev(2).
+     *
+     * @return: bytes written, 0 on EAGAIN, -1 on error.
+     */
+    ssize_t Send(const struct iovec *_iov, int _iov_cnt);
+    
+    /**
+     * Sends @param{_count} bytes of @param{_in_fd} from @param{_offset}
+     * by sendfile(2), the data never passing through user space.
+     * @param{_offset} is advanced by what is sent.
+     *
+     * @return: bytes sent, 0 on EAGAIN, -1 on error, including
+     *          the file having been truncated.
+     */
+    ssize_t SendFile(int _in_fd, off_t *_offset, size_t _count);
+    
+    /**
+     * Sets SO_ZEROCOPY, so that SendZeroCopy() can be used.
+     *
+     * @return: false if not supported, e.g. by the kernel or the protocol.
+     */
+    bool EnableZeroCopy();
+    
+    bool IsZeroCopyEnabled() const;
+    
+    /**
+     * send(2) with MSG_ZEROCOPY: the kernel keeps referring to
+     * @param{_buf} after returning, until the completion of this
+     * call is read by ReadZeroCopyCompletion(). Falls back to
+     * copying if the kernel is short of option memory.
+     *
+     * @param _seq: the completion id assigned to this call,
+     *              UINT32_MAX if nothing was sent without copying.
+     * @return: bytes sent, 0 on EAGAIN, -1 on error.
+     */
+    ssize_t SendZeroCopy(const void *_buf, size_t _len, uint32_t *_seq);
+    
+    /**
+     * Reads a completion of SendZeroCopy() from the error queue,
+     * i.e. the calls with id in [@param{_lo}, @param{_hi}] are done with
+     * their buffers.
+     *
+     * @param _is_copied: whether the kernel copied the data after all,
+     *                    e.g. over loopback, zero copy not paying off.
+     * @return: 1 on a completion read, 0 if none is queued, -1 on error.
+     */
+    int ReadZeroCopyCompletion(uint32_t *_lo, uint32_t *_hi, bool *_is_copied);
+    
     bool IsEAgain() const;
     
-    void Set(SOCKET _fd);
+    /**
+     * @param _nonblocking: whether @param{_fd} is already nonblocking,
+     *                      e.g. accepted by {@link Accept()}.
+     */
+    void Set(SOCKET _fd, bool _nonblocking = false);
     
     int ShutDown(int _how) const;
     
@@ -58,6 +141,22 @@ class Socket {
     
     int SetCloseLingerTimeout(int _linger) const;
     
+    int SetReusePort() const;
+    
+    /**
+     * Lets a blocking receive busy poll the device queue for up to
+     * @param{_usecs}, and prefers busy polling to interrupts if supported.
+     * Raising it above net.core.busy_read requires CAP_NET_ADMIN.
+     */
+    int SetBusyPoll(int _usecs) const;
+    
+    /**
+     * Steers new connections of the SO_REUSEPORT group this socket
+     * belongs to by the cpu which handles the softirq, i.e. the
+     * connection goes to the (cpu % _group_size)-th socket of the group.
+     */
+    int AttachReusePortCpuSteering(uint32_t _group_size) const;
+    
     int SetSocketOpt(int _level, int _option_name,
                      const void *_option_value,
                      socklen_t _option_len) const;
@@ -65,14 +164,29 @@ class Socket {
     bool IsNonblocking() const;
     
     int SocketError() const;
+    
+    /**
+     * Like SocketError(), without logging, for hot paths where
+     * the socket is mostly fine.
+     */
+    int PendingError() const;
 
+  private:
+    void __AdaptReadHint(size_t _nread);
+    
   private:
     static const int    kBufferSize;
+    static const size_t kMaxReadHint;
+    static const size_t kOverflowSize;
+    static const int    kMaxIovecs;
     SOCKET              fd_;
     int                 errno_;
     bool                is_eagain_;
     bool                is_connected_;
     int                 type_;
     bool                nonblocking_;
+    size_t              read_hint_;     // tail reserved for the next read.
+    bool                is_zerocopy_;
+    uint32_t            zerocopy_seq_;  // id of the next MSG_ZEROCOPY send.
 };
 
@@ -1,24 +1,38 @@
 #include "autobuffer.h"
+#include <algorithm>
 #include <cstring>
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "bufferpool.h"
 #include "log.h"
 
 
 AutoBuffer::AutoBuffer(size_t _malloc_unit_size)
         : byte_array_p_(nullptr)
         , is_shallow_copy_(false)
+        , heap_(nullptr)
+        , heap_size_(0)
+        , heap_pool_(nullptr)
+        , begin_(0)
         , pos_(0)
         , length_(0)
         , capacity_(0)
-        , malloc_unit_size_(_malloc_unit_size) {}
+        , malloc_unit_size_(_malloc_unit_size)
+        , segment_size_(0) {}
 
 
 void AutoBuffer::Write(const char *_byte_array, size_t _len) {
     if (_len <= 0 || _byte_array == nullptr) { return; }
     assert(!is_shallow_copy_);
-    if (capacity_ < length_ + _len) {
-        AddCapacity(length_ + _len - capacity_);
+    if (segment_size_) {
+        __WriteSegmented(_byte_array, _len);
+        return;
+    }
+    size_t available = AvailableSize();
+    if (available < _len) {
+        AddCapacity(_len - available);
     }
     memcpy(Ptr(length_), _byte_array, _len);
     length_ += _len;
@@ -46,7 +60,11 @@ size_t AutoBuffer::Length() const {
 }
 
 char *AutoBuffer::Ptr(const size_t _offset /* = 0*/) const {
-    return byte_array_p_ + _offset;
+    if (segment_size_) {
+        size_t i = _offset / segment_size_;
+        return i < segments_.size() ? segments_[i].ptr + _offset % segment_size_ : nullptr;
+    }
+    return byte_array_p_ + begin_ + _offset;
 }
 
 void AutoBuffer::AddCapacity(size_t _size_to_add) {
@@ -54,15 +72,130 @@ void AutoBuffer::AddCapacity(size_t _size_to_add) {
         LogE("Illegal arg _size_to_add: %zd", _size_to_add);
         return;
     }
-    assert(!is_shallow_copy_);
+    assert(!is_shallow_copy_ && !segment_size_);
     
-    if (_size_to_add % malloc_unit_size_ != 0) {
-        _size_to_add = (_size_to_add / malloc_unit_size_ + 1) * malloc_unit_size_;
+    size_t wanted = AvailableSize() + _size_to_add;
+    if (begin_ > 0) {
+        __Compact();
+        if (AvailableSize() >= wanted) {
+            return;
+        }
     }
-    
-    byte_array_.resize(capacity_ + _size_to_add);
-    capacity_ += _size_to_add;
-    byte_array_p_ = byte_array_.data();
+    size_t size = length_ + wanted;
+    if (size % malloc_unit_size_ != 0) {
+        size = (size / malloc_unit_size_ + 1) * malloc_unit_size_;
+    }
+    if (size < capacity_ * 2) {
+        size = capacity_ * 2;
+    }
+    BufferPool *pool = nullptr;
+    char *heap = nullptr;
+    if (heap_pool_ || (size <= BufferPool::kMaxClassSize && BufferPool::ThreadLocal())) {
+        heap = __Allocate(&size, &pool);
+        if (length_ > 0) {
+            memcpy(heap, heap_, length_);
+        }
+        __FreeHeap();
+    } else {
+        // Uninitialized, and large blocks are remapped rather than copied.
+        heap = (char *) realloc(heap_, size);
+        if (!heap) {
+            throw std::bad_alloc();
+        }
+    }
+    heap_ = heap;
+    heap_size_ = size;
+    heap_pool_ = pool;
+    capacity_ = size;
+    byte_array_p_ = heap_;
+}
+
+char *AutoBuffer::__Allocate(size_t *_size, BufferPool **_pool) {
+    BufferPool *pool = BufferPool::ThreadLocal();
+    size_t class_size = 0;
+    char *block = pool ? pool->Allocate(*_size, &class_size) : nullptr;
+    if (block) {
+        *_size = class_size;
+        *_pool = pool;
+        return block;
+    }
+    block = (char *) malloc(*_size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    *_pool = nullptr;
+    return block;
+}
+
+void AutoBuffer::__Free(char *_block, size_t _size, BufferPool *_pool) {
+    if (_pool) {
+        _pool->Free(_block, _size);
+    } else {
+        free(_block);
+    }
+}
+
+void AutoBuffer::__FreeHeap() {
+    __Free(heap_, heap_size_, heap_pool_);
+    heap_ = nullptr;
+    heap_size_ = 0;
+    heap_pool_ = nullptr;
+}
+
+void AutoBuffer::SetSegmented(size_t _segment_size) {
+    assert(length_ == 0 && !is_shallow_copy_ && _segment_size > 0);
+    segment_size_ = _segment_size;
+    capacity_ = 0;
+}
+
+bool AutoBuffer::IsSegmented() const { return segment_size_ != 0; }
+
+void AutoBuffer::__WriteSegmented(const char *_byte_array, size_t _len) {
+    while (_len > 0) {
+        size_t offset = length_ % segment_size_;
+        if (length_ / segment_size_ == segments_.size()) {
+            size_t size = segment_size_;
+            Segment segment {nullptr, nullptr};
+            segment.ptr = __Allocate(&size, &segment.pool);
+            segments_.push_back(segment);
+            capacity_ += segment_size_;
+        }
+        size_t n = std::min(_len, segment_size_ - offset);
+        memcpy(segments_.back().ptr + offset, _byte_array, n);
+        _byte_array += n;
+        _len -= n;
+        length_ += n;
+    }
+}
+
+int AutoBuffer::Iovecs(size_t _offset, struct iovec *_iov, int _max) const {
+    int cnt = 0;
+    if (!segment_size_) {
+        if (_offset < length_ && _max > 0) {
+            _iov[cnt].iov_base = Ptr(_offset);
+            _iov[cnt].iov_len = length_ - _offset;
+            ++cnt;
+        }
+        return cnt;
+    }
+    while (_offset < length_ && cnt < _max) {
+        size_t in_segment = segment_size_ - _offset % segment_size_;
+        size_t n = std::min(in_segment, length_ - _offset);
+        _iov[cnt].iov_base = Ptr(_offset);
+        _iov[cnt].iov_len = n;
+        ++cnt;
+        _offset += n;
+    }
+    return cnt;
+}
+
+void AutoBuffer::__FreeSegments() {
+    for (Segment &segment : segments_) {
+        __Free(segment.ptr, segment.pool ? BufferPool::ClassSize(segment_size_)
+                                         : segment_size_, segment.pool);
+    }
+    segments_.clear();
+    segment_size_ = 0;
 }
 
 size_t AutoBuffer::Capacity() const {
@@ -70,36 +203,79 @@ size_t AutoBuffer::Capacity() const {
 }
 
 size_t AutoBuffer::AvailableSize() const {
-    return capacity_ - length_;
+    return capacity_ - begin_ - length_;
+}
+
+void AutoBuffer::__Compact() {
+    memmove(byte_array_p_, byte_array_p_ + begin_, length_);
+    begin_ = 0;
 }
 
 AutoBuffer::~AutoBuffer() {
     Reset();
+    __FreeHeap();
 }
 
 void AutoBuffer::ShallowCopyFrom(char *_ptr, size_t _len) {
+    assert(!segment_size_);
     byte_array_p_ = _ptr;
+    begin_ = 0;
     SetLength(_len);
     is_shallow_copy_ = true;
-    byte_array_.clear();
+    capacity_ = _len;
+}
+
+bool AutoBuffer::IsShallowCopy() const { return is_shallow_copy_; }
+
+void AutoBuffer::DropFront(size_t _len) {
+    assert(!is_shallow_copy_ && !segment_size_);
+    if (_len >= length_) {
+        begin_ = 0;
+        length_ = 0;
+        pos_ = 0;
+        return;
+    }
+    begin_ += _len;
+    length_ -= _len;
+    pos_ = pos_ > _len ? pos_ - _len : 0;
 }
 
 void AutoBuffer::Reset() {
-    capacity_ = 0;
+    __FreeSegments();
+    capacity_ = heap_size_;
+    begin_ = 0;
     length_ = 0;
     pos_ = 0;
-    byte_array_.clear();
-    byte_array_p_ = nullptr;
+    byte_array_p_ = heap_;
     is_shallow_copy_ = false;
 }
 
+void AutoBuffer::ResetAndShrink(size_t _max_retained) {
+    Reset();
+    if (heap_size_ > _max_retained) {
+        __FreeHeap();
+        capacity_ = 0;
+        byte_array_p_ = nullptr;
+    }
+}
+
+size_t AutoBuffer::RetainedSize() const {
+    size_t size = heap_size_;
+    for (const Segment &segment : segments_) {
+        size += segment.pool ? BufferPool::ClassSize(segment_size_) : segment_size_;
+    }
+    return size;
+}
+
 void AutoBuffer::SetLength(size_t _len) {
+    assert(!segment_size_);
     if (_len >= 0) {
         length_ = _len;
     }
 }
 
 void AutoBuffer::AddLength(size_t _len) {
+    assert(!segment_size_);
     if (_len > 0) {
         length_ += _len;
     }
@@ -2,8 +2,23 @@
 
 #include <cstddef>
 #include <vector>
+#include <sys/uio.h>
 
+class BufferPool;
 
+
+/**
+ * Byte array growing geometrically without zero-filling.
+ *
+ * Optionally chained: a list of fixed-size segments, so that a large
+ * body is appended to without moving the bytes before, and sent by
+ * writev(2) through Iovecs(). Contiguous views, i.e. Ptr() beyond a
+ * segment, AddCapacity() and the like, are not available then.
+ *
+ * Memory is drawn from the BufferPool bound to the thread growing the
+ * buffer, if any and if the size fits its classes, otherwise from
+ * malloc(3), and goes back to where it came from.
+ */
 class AutoBuffer {
   public:
     explicit AutoBuffer(size_t _malloc_unit_size = 128);
@@ -22,14 +37,38 @@ class AutoBuffer {
     
     void AddLength(size_t _len);
     
+    /**
+     * If chained, valid up to the end of the segment of @param{_offset}.
+     */
     char *Ptr(size_t _offset = 0) const;
     
     size_t Capacity() const;
     
     size_t AvailableSize() const;
     
+    /**
+     * Makes room for at least @param{_size} bytes more, reclaiming what
+     * DropFront() left first, otherwise doubling the capacity at least,
+     * so that appending is amortized O(1).
+     */
     void AddCapacity(size_t _size);
     
+    /**
+     * Appends to segments of @param{_segment_size} bytes from now on,
+     * call it while empty. Reset() goes back to contiguous.
+     */
+    void SetSegmented(size_t _segment_size);
+    
+    bool IsSegmented() const;
+    
+    /**
+     * Fills @param{_iov} with the bytes from @param{_offset} on, one
+     * iovec per segment, or just one if contiguous.
+     *
+     * @return: iovecs filled, at most @param{_max}.
+     */
+    int Iovecs(size_t _offset, struct iovec *_iov, int _max) const;
+    
     enum TWhence {
         kStart = 0,
         kCurrent,
@@ -39,16 +78,70 @@ class AutoBuffer {
     
     void Reset();
     
+    /**
+     * Resets, and frees the memory kept for reuse
+     * if more than @param{_max_retained} bytes.
+     */
+    void ResetAndShrink(size_t _max_retained);
+    
+    /**
+     * @return: heap bytes held, including those kept by Reset().
+     */
+    size_t RetainedSize() const;
+    
     void ShallowCopyFrom(char *_ptr, size_t _len);
+    
+    /**
+     * @return: whether the bytes are owned by someone else,
+     *          who may reuse them once this buffer is done with.
+     */
+    bool IsShallowCopy() const;
+    
+    /**
+     * Drops the first @param{_len} bytes by moving the read cursor past
+     * them, e.g. a frame parsed. Those after are moved to the front only
+     * once room is needed, the capacity is kept.
+     */
+    void DropFront(size_t _len);
+
+  private:
+    struct Segment {
+        char          * ptr;
+        BufferPool    * pool;
+    };
+    
+    /**
+     * @param _size: rounded up to what is allocated.
+     */
+    static char *__Allocate(size_t *_size, BufferPool **_pool);
+    
+    static void __Free(char *_block, size_t _size, BufferPool *_pool);
+    
+    void __FreeHeap();
+    
+    void __Compact();
+    
+    void __WriteSegmented(const char *_byte_array, size_t _len);
+    
+    void __FreeSegments();
 
   private:
     char              * byte_array_p_;
     bool                is_shallow_copy_;
-    std::vector<char>   byte_array_;
+    /* Kept by Reset(). */
+    char              * heap_;
+    size_t              heap_size_;
+    /* Owner of heap_, nullptr if malloc(3)ed. */
+    BufferPool        * heap_pool_;
+    /* Read cursor, bytes before it are dropped. */
+    size_t              begin_;
     size_t              pos_;
     size_t              length_;
     size_t              capacity_;
     const size_t        malloc_unit_size_;
+    /* Chained mode, 0 if contiguous. */
+    size_t              segment_size_;
+    std::vector<Segment> segments_;
     
 };
 
@@ -0,0 +1,222 @@
+#include "bufferpool.h"
+#include <sys/mman.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include "log.h"
+
+
+const size_t BufferPool::kArenaSize = 2 * 1024 * 1024;
+const size_t BufferPool::kClassSizes[kClassCnt] = {
+        4 * 1024, 16 * 1024, 64 * 1024, 1024 * 1024};
+const size_t BufferPool::kMaxClassSize = 1024 * 1024;
+
+static thread_local BufferPool *tls_pool = nullptr;
+
+BufferPool::Stats::Stats()
+        : mapped_bytes(0)
+        , in_use_bytes(0)
+        , cached_bytes(0)
+        , cross_thread_frees(0)
+        , fallbacks(0)
+        , is_huge_pages(false) {
+}
+
+BufferPool::BufferPool()
+        : use_huge_pages_(false)
+        , max_mapped_(0)
+        , carve_ptr_(nullptr)
+        , carve_left_(0)
+        , mapped_bytes_(0)
+        , in_use_bytes_(0)
+        , cached_bytes_(0)
+        , cross_thread_frees_(0)
+        , fallbacks_(0)
+        , is_huge_pages_(false) {
+    for (int i = 0; i < kClassCnt; ++i) {
+        free_[i] = nullptr;
+        released_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (void *arena : arenas_) {
+        ::munmap(arena, kArenaSize);
+    }
+}
+
+void BufferPool::SetHugePages(bool _enable) {
+    use_huge_pages_ = _enable;
+}
+
+void BufferPool::SetLimit(size_t _max_mapped) {
+    max_mapped_ = _max_mapped;
+}
+
+void BufferPool::BindThread(BufferPool *_pool) {
+    tls_pool = _pool;
+}
+
+BufferPool *BufferPool::ThreadLocal() {
+    return tls_pool;
+}
+
+bool BufferPool::__IsOwner() const {
+    return tls_pool == this;
+}
+
+int BufferPool::__ClassOf(size_t _size) {
+    for (int i = 0; i < kClassCnt; ++i) {
+        if (_size <= kClassSizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+size_t BufferPool::ClassSize(size_t _size) {
+    int cls = __ClassOf(_size);
+    return cls < 0 ? 0 : kClassSizes[cls];
+}
+
+char *BufferPool::Allocate(size_t _size, size_t *_class_size) {
+    assert(__IsOwner());
+    int cls = __ClassOf(_size);
+    if (cls < 0) {
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    size_t size = kClassSizes[cls];
+    if (!free_[cls]) {
+        Block *released = released_[cls].exchange(nullptr, std::memory_order_acquire);
+        if (released) {
+            uint64_t n = 0;
+            for (Block *block = released; block; block = block->next) {
+                ++n;
+            }
+            free_[cls] = released;
+            in_use_bytes_.store(in_use_bytes_.load(std::memory_order_relaxed) - n * size,
+                                std::memory_order_relaxed);
+            cached_bytes_.store(cached_bytes_.load(std::memory_order_relaxed) + n * size,
+                                std::memory_order_relaxed);
+        } else if (!__Carve(cls)) {
+            fallbacks_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    Block *block = free_[cls];
+    free_[cls] = block->next;
+    cached_bytes_.store(cached_bytes_.load(std::memory_order_relaxed) - size,
+                        std::memory_order_relaxed);
+    in_use_bytes_.store(in_use_bytes_.load(std::memory_order_relaxed) + size,
+                        std::memory_order_relaxed);
+    *_class_size = size;
+    return (char *) block;
+}
+
+void BufferPool::Free(char *_block, size_t _class_size) {
+    int cls = __ClassOf(_class_size);
+    assert(cls >= 0 && kClassSizes[cls] == _class_size);
+    auto *block = (Block *) _block;
+    if (__IsOwner()) {
+        block->next = free_[cls];
+        free_[cls] = block;
+        in_use_bytes_.store(in_use_bytes_.load(std::memory_order_relaxed) - _class_size,
+                            std::memory_order_relaxed);
+        cached_bytes_.store(cached_bytes_.load(std::memory_order_relaxed) + _class_size,
+                            std::memory_order_relaxed);
+        return;
+    }
+    block->next = released_[cls].load(std::memory_order_relaxed);
+    while (!released_[cls].compare_exchange_weak(block->next, block,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+    }
+    cross_thread_frees_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Carves one block of @param{_class} onto its free list, spreading
+ * what is left of the last arena over the free lists of the smaller
+ * classes if too little, then mapping a new arena.
+ *
+ * @return: false if no arena could be mapped.
+ */
+bool BufferPool::__Carve(int _class) {
+    size_t size = kClassSizes[_class];
+    if (carve_left_ < size) {
+        for (int i = _class - 1; i >= 0; --i) {
+            while (carve_left_ >= kClassSizes[i]) {
+                auto *block = (Block *) carve_ptr_;
+                block->next = free_[i];
+                free_[i] = block;
+                carve_ptr_ += kClassSizes[i];
+                carve_left_ -= kClassSizes[i];
+                cached_bytes_.store(cached_bytes_.load(std::memory_order_relaxed)
+                                    + kClassSizes[i], std::memory_order_relaxed);
+            }
+        }
+        if (max_mapped_ && (arenas_.size() + 1) * kArenaSize > max_mapped_) {
+            return false;
+        }
+        void *arena = __Map();
+        if (!arena) {
+            return false;
+        }
+        arenas_.push_back(arena);
+        mapped_bytes_.store(arenas_.size() * kArenaSize, std::memory_order_relaxed);
+        carve_ptr_ = (char *) arena;
+        carve_left_ = kArenaSize;
+    }
+    auto *block = (Block *) carve_ptr_;
+    block->next = free_[_class];
+    free_[_class] = block;
+    carve_ptr_ += size;
+    carve_left_ -= size;
+    cached_bytes_.store(cached_bytes_.load(std::memory_order_relaxed) + size,
+                        std::memory_order_relaxed);
+    return true;
+}
+
+void *BufferPool::__Map() {
+    if (use_huge_pages_) {
+        void *arena = ::mmap(nullptr, kArenaSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena != MAP_FAILED) {
+            is_huge_pages_.store(true, std::memory_order_relaxed);
+            return arena;
+        }
+    }
+    // Mapped twice as large and trimmed, so that the arena is aligned
+    // to kArenaSize for transparent huge pages to back it.
+    size_t len = kArenaSize * 2;
+    void *mem = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        LogE("mmap failed, errno: %d", errno)
+        return nullptr;
+    }
+    auto addr = (uintptr_t) mem;
+    uintptr_t aligned = (addr + kArenaSize - 1) & ~(uintptr_t) (kArenaSize - 1);
+    if (aligned > addr) {
+        ::munmap(mem, aligned - addr);
+    }
+    if (aligned + kArenaSize < addr + len) {
+        ::munmap((void *) (aligned + kArenaSize), addr + len - aligned - kArenaSize);
+    }
+    if (use_huge_pages_) {
+        ::madvise((void *) aligned, kArenaSize, MADV_HUGEPAGE);
+    }
+    return (void *) aligned;
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    Stats stats;
+    stats.mapped_bytes = mapped_bytes_.load(std::memory_order_relaxed);
+    stats.in_use_bytes = in_use_bytes_.load(std::memory_order_relaxed);
+    stats.cached_bytes = cached_bytes_.load(std::memory_order_relaxed);
+    stats.cross_thread_frees = cross_thread_frees_.load(std::memory_order_relaxed);
+    stats.fallbacks = fallbacks_.load(std::memory_order_relaxed);
+    stats.is_huge_pages = is_huge_pages_.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+
+/**
+ * Size-classed blocks (4K / 16K / 64K / 1M) for the byte arrays of a
+ * NetThread, carved from 2M arenas mapped by mmap(2), optionally backed
+ * by huge pages, so that NetThreads do not contend in malloc(3) nor
+ * fragment the heap with buffers of connections coming and going.
+ *
+ * Allocate() on the owner thread only, i.e. the one it is bound to by
+ * BindThread(). Blocks freed by other threads, e.g. workers dropping a
+ * response, are pushed onto a lock-free stack per size class, which the
+ * owner takes over as a whole once its own free list runs out, so there
+ * is no ABA problem.
+ *
+ * Arenas are unmapped only with the pool, which outlives the blocks it
+ * hands out.
+ */
+class BufferPool {
+  public:
+
+    struct Stats {
+        Stats();
+
+        uint64_t    mapped_bytes;       // by arenas.
+        uint64_t    in_use_bytes;       // by blocks handed out, freed by other threads included until taken back.
+        uint64_t    cached_bytes;       // by blocks ready to be handed out.
+        uint64_t    cross_thread_frees;
+        uint64_t    fallbacks;          // allocations left to malloc(3), too large or over the limit.
+        bool        is_huge_pages;      // whether MAP_HUGETLB arenas were got.
+    };
+
+    BufferPool();
+
+    ~BufferPool();
+
+    /**
+     * Arenas are mapped with MAP_HUGETLB, falling back to transparent
+     * huge pages by madvise(2) if none is reserved.
+     * Call it before the first Allocate().
+     */
+    void SetHugePages(bool _enable);
+
+    /**
+     * Bytes mapped at most, allocations beyond are left to malloc(3),
+     * 0: unlimited. Call it before the first Allocate().
+     */
+    void SetLimit(size_t _max_mapped);
+
+    /**
+     * @param _size: rounded up to the size class.
+     * @return: nullptr if @param{_size} is beyond the largest class
+     *          or the limit is reached, leave it to malloc(3) then.
+     */
+    char *Allocate(size_t _size, size_t *_class_size);
+
+    /**
+     * May be called from any thread.
+     *
+     * @param _class_size: as returned by Allocate().
+     */
+    void Free(char *_block, size_t _class_size);
+
+    /**
+     * @return: size class of @param{_size}, 0 if beyond the largest.
+     */
+    static size_t ClassSize(size_t _size);
+
+    /**
+     * Lock-free snapshot, may be called from any thread.
+     */
+    Stats GetStats() const;
+
+    /**
+     * Makes @param{_pool} the one byte arrays of the calling thread draw
+     * from, nullptr to leave them to malloc(3).
+     */
+    static void BindThread(BufferPool *_pool);
+
+    /**
+     * @return: the pool bound to the calling thread, or nullptr.
+     */
+    static BufferPool *ThreadLocal();
+
+    static const size_t             kArenaSize;
+    static const size_t             kMaxClassSize;
+
+  private:
+    struct Block {
+        Block     * next;
+    };
+
+    static int __ClassOf(size_t _size);
+
+    bool __Carve(int _class);
+
+    void *__Map();
+
+    bool __IsOwner() const;
+
+  private:
+    static const int                kClassCnt = 4;
+    static const size_t             kClassSizes[kClassCnt];
+    bool                            use_huge_pages_;
+    size_t                          max_mapped_;
+    std::vector<void *>             arenas_;
+    /* Uncarved part of the last arena. */
+    char                          * carve_ptr_;
+    size_t                          carve_left_;
+    Block                         * free_[kClassCnt];
+    std::atomic<Block *>            released_[kClassCnt];
+    /* Written by the owner only, but read by any thread. */
+    std::atomic<uint64_t>           mapped_bytes_;
+    std::atomic<uint64_t>           in_use_bytes_;
+    std::atomic<uint64_t>           cached_bytes_;
+    std::atomic<uint64_t>           cross_thread_frees_;
+    std::atomic<uint64_t>           fallbacks_;
+    std::atomic<bool>               is_huge_pages_;
+};
@@ -1,7 +1,10 @@
 #include "coroutine.h"
+#include <sys/mman.h>
+#include <unistd.h>
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
+#include <atomic>
 
 
 #ifdef __x86_64__
@@ -33,6 +36,10 @@ void SaveStackFrames(void *_buf, void *_stack_start, uint64_t _size)
 void RestoreStackFrames(void *_buf, void *_stack_start, uint64_t _size)
                        asm("RestoreStackFrames");
 
+void SwapStackContext(void **_from_sp, void *_to_sp) asm("SwapStackContext");
+
+void CoStackTrampoline() asm("CoStackTrampoline");
+
 }
 #else
 // Only support x64.
@@ -78,7 +85,7 @@ CoroutineProfile::CoroutineProfile(CoEntry _entry)
         , co_entry_(_entry)
         , has_start_(false) {
     
-    static uint64_t curr_uid = kInvalidUid;
+    static std::atomic<uint64_t> curr_uid(kInvalidUid);
     co_uid_ = ++curr_uid;
     InitialCoContext(&co_ctx_);
     co_ctx_.co_resume_addr = (void *) co_entry_;
@@ -92,8 +99,11 @@ void CoroutineProfile::CoYieldTo(CoroutineProfile *_to) {
     rsp += 8;   // `addq $8, %rsp` because this is a procedure call.
 #endif
     
-    // save current stack frames
-    if (has_start_) {
+    // save current stack frames, none if it runs on the stack of the
+    // thread, i.e. yields without having been started.
+    if (!has_start_) {
+        has_start_ = true;
+    } else if (co_ctx_.stack_frames_start) {
         assert((uint64_t) co_ctx_.stack_frames_start >= rsp);
 
         // x86 full descent stack.
@@ -107,8 +117,10 @@ void CoroutineProfile::CoYieldTo(CoroutineProfile *_to) {
     if (_to->has_start_) {
         assert(co_ctx_.stack_frames_len < kMaxCoStackFramesBuffSize);
     
-        RestoreStackFrames(_to->co_ctx_.stack_frames_buf, _to->co_ctx_.stack_frames_start,
-                           _to->co_ctx_.stack_frames_len);
+        if (_to->co_ctx_.stack_frames_start) {
+            RestoreStackFrames(_to->co_ctx_.stack_frames_buf, _to->co_ctx_.stack_frames_start,
+                               _to->co_ctx_.stack_frames_len);
+        }
         SwitchCoroutine(&co_ctx_, &_to->co_ctx_);
         
     } else {
@@ -172,3 +184,137 @@ CoroutineProfile *CoroutineDispatcher::MainCoro() { return &main_coro_; }
 
 CoroutineDispatcher::~CoroutineDispatcher() = default;
 
+
+
+CoStackPool::Stack::Stack()
+        : base(nullptr)
+        , size(0) {
+}
+
+const size_t CoStackPool::kDefaultMaxCached = 64;
+
+CoStackPool::CoStackPool()
+        : max_cached_(kDefaultMaxCached) {
+}
+
+size_t CoStackPool::__PageSize() {
+    static const size_t page_size = (size_t) ::sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+CoStackPool::Stack CoStackPool::Allocate(size_t _size) {
+    size_t page_size = __PageSize();
+    Stack stack;
+    stack.size = (_size + page_size - 1) / page_size * page_size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cached_.find(stack.size);
+        if (it != cached_.end() && !it->second.empty()) {
+            stack.base = it->second.back();
+            it->second.pop_back();
+            return stack;
+        }
+    }
+    void *mem = ::mmap(nullptr, stack.size + page_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mem == MAP_FAILED) {
+        return Stack();
+    }
+    // guard page.
+    ::mprotect(mem, page_size, PROT_NONE);
+    stack.base = (char *) mem + page_size;
+    return stack;
+}
+
+void CoStackPool::Free(const Stack &_stack) {
+    if (!_stack.base) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<char *> &cached = cached_[_stack.size];
+        if (cached.size() < max_cached_) {
+            cached.push_back(_stack.base);
+            return;
+        }
+    }
+    ::munmap(_stack.base - __PageSize(), _stack.size + __PageSize());
+}
+
+void CoStackPool::SetMaxCached(size_t _n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_cached_ = _n;
+}
+
+CoStackPool::~CoStackPool() {
+    for (auto &it : cached_) {
+        for (char *base : it.second) {
+            ::munmap(base - __PageSize(), it.first + __PageSize());
+        }
+    }
+}
+
+
+
+const size_t SeparateStackProfile::kDefaultStackSize = 256 * 1024;
+
+SeparateStackProfile::SeparateStackProfile(CoEntry _entry, void *_arg,
+                                           size_t _stack_size)
+        : co_uid_(CoroutineProfile::kInvalidUid)
+        , co_entry_(_entry)
+        , co_arg_(_arg)
+        , sp_(nullptr)
+        , caller_(nullptr)
+        , is_done_(false) {
+    
+    static std::atomic<uint64_t> curr_uid(CoroutineProfile::kInvalidUid);
+    co_uid_ = ++curr_uid;
+    if (!co_entry_) {
+        return;     // the thread itself.
+    }
+    stack_ = CoStackPool::Instance().Allocate(_stack_size);
+    if (!stack_.base) {
+        return;     // see IsValid().
+    }
+    
+    // As if switched away by SwapStackContext() right before returning
+    // to CoStackTrampoline, which then finds itself 16-byte aligned.
+    auto *sp = (uint64_t *) (stack_.base + stack_.size) - 10;
+    uint32_t mxcsr;
+    uint16_t fpu_cw;
+    asm volatile("stmxcsr %0" : "=m"(mxcsr));
+    asm volatile("fnstcw %0" : "=m"(fpu_cw));
+    sp[0] = mxcsr | (uint64_t) fpu_cw << 32;
+    sp[1] = 0;                                  // r15
+    sp[2] = 0;                                  // r14
+    sp[3] = (uint64_t) &__Main;                 // r13
+    sp[4] = (uint64_t) this;                    // r12
+    sp[5] = 0;                                  // rbx
+    sp[6] = 0;                                  // rbp
+    sp[7] = (uint64_t) &CoStackTrampoline;      // return address
+    sp_ = sp;
+}
+
+void SeparateStackProfile::CoYieldTo(SeparateStackProfile *_to) {
+    assert(this != _to);
+    assert(!_to->is_done_ && _to->sp_);
+    _to->caller_ = this;
+    SwapStackContext(&sp_, _to->sp_);
+}
+
+void SeparateStackProfile::__Main(SeparateStackProfile *_self) {
+    _self->co_entry_(_self->co_arg_);
+    _self->is_done_ = true;
+    SwapStackContext(&_self->sp_, _self->caller_->sp_);
+    assert(false);  // never switched to again.
+}
+
+uint64_t SeparateStackProfile::CoUid() const { return co_uid_; }
+
+bool SeparateStackProfile::IsDone() const { return is_done_; }
+
+bool SeparateStackProfile::IsValid() const { return !co_entry_ || stack_.base; }
+
+SeparateStackProfile::~SeparateStackProfile() {
+    CoStackPool::Instance().Free(stack_);
+}
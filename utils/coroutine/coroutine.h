@@ -7,6 +7,9 @@
 #include <cstdint>
 #include <cstddef>
 #include <list>
+#include <map>
+#include <mutex>
+#include <vector>
 
 
 struct CoroutineContext {     // POD.
@@ -101,3 +104,104 @@ class CoroutineDispatcher {
 };
 
 
+/**
+ * Stacks of SeparateStackProfile, mapped by mmap(2) with a guard page
+ * below, so that overflowing one faults instead of overwriting memory,
+ * and kept for reuse once freed. Thread-safe.
+ */
+class CoStackPool {
+  public:
+    struct Stack {
+        Stack();
+        
+        char      * base;     // lowest usable address, the guard page below.
+        size_t      size;     // usable bytes.
+    };
+    
+    static CoStackPool &Instance() {
+        static CoStackPool instance;
+        return instance;
+    }
+    
+    CoStackPool();
+    
+    ~CoStackPool();
+    
+    /**
+     * @param _size: rounded up to pages.
+     * @return: base nullptr if mmap(2) failed.
+     */
+    Stack Allocate(size_t _size);
+    
+    void Free(const Stack &_stack);
+    
+    /**
+     * Freed stacks kept per size at most, unmapped beyond. Their pages
+     * stay touched, so bound it by the coroutines alive at once.
+     */
+    void SetMaxCached(size_t _n);
+    
+  private:
+    static size_t __PageSize();
+    
+  private:
+    static const size_t                         kDefaultMaxCached;
+    std::mutex                                  mutex_;
+    std::map<size_t, std::vector<char *>>       cached_;
+    size_t                                      max_cached_;
+};
+
+
+/**
+ * Coroutine running on a stack of its own drawn from CoStackPool, so
+ * that a switch saves and restores registers only, however deep the
+ * stacks are, whereas CoroutineProfile copies the stack out and in.
+ *
+ * Constructed without an entry, it stands for the thread running it,
+ * which switches to the others and is switched back to.
+ * Once the entry returns, the coroutine switches back to the one that
+ * last switched to it, never to be switched to again.
+ */
+class SeparateStackProfile {
+  public:
+    using CoEntry = CoroutineProfile::CoEntry;
+    
+    explicit SeparateStackProfile(CoEntry _entry = nullptr, void *_arg = nullptr,
+                                  size_t _stack_size = kDefaultStackSize);
+    
+    SeparateStackProfile(const SeparateStackProfile &) = delete;
+    
+    SeparateStackProfile &operator=(const SeparateStackProfile &) = delete;
+    
+    ~SeparateStackProfile();
+    
+    void CoYieldTo(SeparateStackProfile *_to);
+    
+    uint64_t CoUid() const;
+    
+    /**
+     * @return: whether the entry has returned.
+     */
+    bool IsDone() const;
+    
+    /**
+     * @return: false if no stack could be mapped, never switch to it then.
+     */
+    bool IsValid() const;
+
+  private:
+    static void __Main(SeparateStackProfile *_self);
+
+  public:
+    static const size_t             kDefaultStackSize;
+  private:
+    uint64_t                        co_uid_;
+    CoEntry                         co_entry_;
+    void                          * co_arg_;
+    CoStackPool::Stack              stack_;
+    /* Where the registers are pushed while switched away. */
+    void                          * sp_;
+    SeparateStackProfile          * caller_;
+    bool                            is_done_;
+};
+
@@ -0,0 +1,270 @@
+#include "coscheduler.h"
+#include <algorithm>
+#include <cassert>
+#include <exception>
+#include <limits>
+#include <thread>
+#include "log.h"
+#include "thread.h"
+#include "messagequeue.h"
+
+
+namespace {
+
+/**
+ * Threads making the Blocking() calls of all the schedulers, started
+ * on the first call.
+ */
+class BlockingPool {
+  public:
+    static BlockingPool &Instance() {
+        static BlockingPool instance;
+        return instance;
+    }
+
+    BlockingPool()
+            : thread_cnt_(kDefaultThreadCnt)
+            , calls_(std::numeric_limits<size_t>::max()) {
+    }
+
+    ~BlockingPool() {
+        calls_.Terminate();
+        for (BlockingThread *thread : threads_) {
+            thread->Join();
+            delete thread;
+        }
+    }
+
+    void SetThreadCnt(size_t _n) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        thread_cnt_ = std::max(_n, (size_t) 1);
+    }
+
+    void Execute(const CoScheduler::Task &_call) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (threads_.size() < thread_cnt_) {
+                auto *thread = new BlockingThread(&calls_);
+                thread->Start();
+                threads_.push_back(thread);
+            }
+        }
+        calls_.push_back(_call);
+    }
+
+  private:
+    using CallQueue = MessageQueue::ThreadSafeDeque<CoScheduler::Task>;
+
+    class BlockingThread : public Thread {
+      public:
+        explicit BlockingThread(CallQueue *_calls) : calls_(_calls) {}
+
+        void Run() override {
+            CoScheduler::Task call;
+            while (calls_->pop_front_to(call)) {
+                call();
+                call = nullptr;
+            }
+        }
+
+      private:
+        CallQueue     * calls_;
+    };
+
+  private:
+    static const size_t             kDefaultThreadCnt = 16;
+    std::mutex                      mutex_;
+    size_t                          thread_cnt_;
+    std::vector<BlockingThread *>   threads_;
+    CallQueue                       calls_;
+};
+
+}
+
+
+static thread_local CoScheduler *tls_scheduler = nullptr;
+
+CoScheduler::Coroutine::Coroutine(Task &&_task, size_t _stack_size)
+        : profile(&CoScheduler::__Entry, this, _stack_size)
+        , task(std::move(_task)) {
+}
+
+CoScheduler::CoScheduler(size_t _stack_size, EventCount *_wakeup)
+        : stack_size_(_stack_size)
+        , curr_(nullptr)
+        , in_flight_(0)
+        , has_woken_(false)
+        , wakeup_(_wakeup ? _wakeup : &own_wakeup_) {
+}
+
+CoScheduler::~CoScheduler() {
+    if (in_flight_ > 0) {
+        LogE("%zu coroutines unfinished", in_flight_)
+    }
+}
+
+bool CoScheduler::Spawn(Task _task) {
+    auto *co = new Coroutine(std::move(_task), stack_size_);
+    if (!co->profile.IsValid()) {
+        LogE("no stack of %zu B mapped, running the task inline", stack_size_)
+        Task task = std::move(co->task);
+        delete co;
+        try {
+            task();
+        } catch (std::exception &ex) {
+            LogE("inline task: %s", ex.what())
+        } catch (...) {
+            LogE("inline task: unknown exception")
+        }
+        return false;
+    }
+    ready_.push_back(co);
+    ++in_flight_;
+    return true;
+}
+
+size_t CoScheduler::RunReady() {
+    assert(!curr_);
+    CoScheduler *prev = tls_scheduler;
+    tls_scheduler = this;
+
+    __TakeWoken();
+    // Those yielding are run again on the next call.
+    size_t n = ready_.size();
+    for (size_t i = 0; i < n; ++i) {
+        Coroutine *co = ready_.front();
+        ready_.pop_front();
+        curr_ = co;
+        main_.CoYieldTo(&co->profile);
+        curr_ = nullptr;
+        if (co->profile.IsDone()) {
+            delete co;
+            --in_flight_;
+        }
+    }
+
+    tls_scheduler = prev;
+    return n;
+}
+
+size_t CoScheduler::InFlight() const { return in_flight_; }
+
+void CoScheduler::WaitReady(const Deadline &_deadline,
+                            const std::function<bool()> &_has_other_work) {
+    Deadline deadline = _deadline;
+    if (!timers_.empty()) {
+        deadline = std::min(deadline, timers_.top().first);
+    }
+    auto is_done = [&] {
+        return __HasReady() || (_has_other_work && _has_other_work());
+    };
+    while (!is_done()) {
+        uint32_t key = wakeup_->PrepareWait();
+        if (is_done()) {
+            wakeup_->CancelWait();
+            break;
+        }
+        if (!wakeup_->Wait(key, &deadline)) {
+            break;
+        }
+    }
+}
+
+CoScheduler *CoScheduler::Current() {
+    return tls_scheduler && tls_scheduler->curr_ ? tls_scheduler : nullptr;
+}
+
+void CoScheduler::Yield() {
+    CoScheduler *scheduler = Current();
+    if (!scheduler) {
+        return;
+    }
+    scheduler->ready_.push_back(scheduler->curr_);
+    scheduler->__Park();
+}
+
+void CoScheduler::Sleep(uint64_t _millis) {
+    CoScheduler *scheduler = Current();
+    if (!scheduler) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(_millis));
+        return;
+    }
+    Deadline deadline = std::chrono::steady_clock::now()
+                        + std::chrono::milliseconds(_millis);
+    scheduler->timers_.emplace(deadline, scheduler->curr_);
+    scheduler->__Park();
+}
+
+void CoScheduler::Blocking(const Task &_call) {
+    CoScheduler *scheduler = Current();
+    if (!scheduler) {
+        _call();
+        return;
+    }
+    Coroutine *co = scheduler->curr_;
+    std::exception_ptr error;
+    BlockingPool::Instance().Execute([&_call, &error, scheduler, co] {
+        try {
+            _call();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        scheduler->__Wake(co);
+    });
+    scheduler->__Park();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void CoScheduler::SetBlockingThreadCnt(size_t _n) {
+    BlockingPool::Instance().SetThreadCnt(_n);
+}
+
+void *CoScheduler::__Entry(void *_co) {
+    auto *co = (Coroutine *) _co;
+    try {
+        co->task();
+    } catch (std::exception &ex) {
+        LogE("coroutine %lu: %s", co->profile.CoUid(), ex.what())
+    } catch (...) {
+        LogE("coroutine %lu: unknown exception", co->profile.CoUid())
+    }
+    co->task = nullptr;
+    return nullptr;     // back to RunReady().
+}
+
+void CoScheduler::__Park() {
+    assert(curr_);
+    curr_->profile.CoYieldTo(&main_);
+}
+
+void CoScheduler::__Wake(Coroutine *_co) {
+    // Notified with the lock held, the scheduler may be gone as soon as
+    // @param{_co} is taken.
+    std::lock_guard<std::mutex> lock(woken_mutex_);
+    woken_.push_back(_co);
+    has_woken_.store(true, std::memory_order_seq_cst);
+    wakeup_->Notify();
+}
+
+void CoScheduler::__TakeWoken() {
+    if (has_woken_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(woken_mutex_);
+        ready_.insert(ready_.end(), woken_.begin(), woken_.end());
+        woken_.clear();
+        has_woken_.store(false, std::memory_order_relaxed);
+    }
+    auto now = std::chrono::steady_clock::now();
+    while (!timers_.empty() && timers_.top().first <= now) {
+        ready_.push_back(timers_.top().second);
+        timers_.pop();
+    }
+}
+
+bool CoScheduler::__HasReady() {
+    return !ready_.empty()
+            || has_woken_.load(std::memory_order_seq_cst)
+            || (!timers_.empty() && timers_.top().first <= std::chrono::steady_clock::now());
+}
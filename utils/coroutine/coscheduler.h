@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "coroutine.h"
+#include "eventcount.h"
+
+
+/**
+ * Runs tasks, e.g. the NetScenes of a WorkerThread, as coroutines on the
+ * thread owning the scheduler, so that a task waiting for a database,
+ * an outbound request or a timer parks itself rather than the thread.
+ *
+ * Within a task:
+ *      Yield(): lets the other coroutines run;
+ *      Sleep(): parks till the time is up;
+ *      Blocking(): makes a blocking call on a pool of threads shared by
+ *                  all the schedulers, parking till it returns.
+ * Called out of a coroutine, they act inline, blocking the thread, so
+ * code calling them runs either way.
+ *
+ * Each coroutine has a stack of its own, see SeparateStackProfile.
+ * Never park with a lock held, a coroutine of the same thread taking
+ * it next would deadlock.
+ */
+class CoScheduler {
+  public:
+    using Task = std::function<void()>;
+    using Deadline = EventCount::Deadline;
+
+    /**
+     * @param _stack_size: of each coroutine, overflowing it faults.
+     * @param _wakeup: what WaitReady() sleeps on, nullptr: one of its own.
+     *                 Given, it is shared with whoever else has work for
+     *                 the owner thread, e.g. queues requests, and notifies it.
+     */
+    explicit CoScheduler(size_t _stack_size = SeparateStackProfile::kDefaultStackSize,
+                         EventCount *_wakeup = nullptr);
+
+    CoScheduler(const CoScheduler &) = delete;
+
+    CoScheduler &operator=(const CoScheduler &) = delete;
+
+    ~CoScheduler();
+
+    /**
+     * Owner thread only, @param{_task} starts on the next RunReady().
+     *
+     * @return: false if no stack could be mapped for it, e.g. under memory
+     *          pressure, @param{_task} is then run inline, blocking the thread.
+     */
+    bool Spawn(Task _task);
+
+    /**
+     * Runs the coroutines ready, each till it finishes or parks.
+     *
+     * @return: coroutines run.
+     */
+    size_t RunReady();
+
+    /**
+     * @return: tasks spawned and not finished yet.
+     */
+    size_t InFlight() const;
+
+    /**
+     * Sleeps till a coroutine is ready, @param{_deadline}, or
+     * @param{_has_other_work} returns true, e.g. a request is queued,
+     * whose producer notifies the EventCount given to the constructor.
+     */
+    void WaitReady(const Deadline &_deadline,
+                   const std::function<bool()> &_has_other_work = nullptr);
+
+    /**
+     * @return: the scheduler running the calling coroutine, or nullptr.
+     */
+    static CoScheduler *Current();
+
+    static void Yield();
+
+    static void Sleep(uint64_t _millis);
+
+    /**
+     * @param _call: exceptions thrown by it are rethrown to the caller.
+     */
+    static void Blocking(const Task &_call);
+
+    /**
+     * Threads of the blocking pool, i.e. Blocking() calls running at
+     * once, call it before the first Blocking().
+     */
+    static void SetBlockingThreadCnt(size_t _n);
+
+  private:
+    struct Coroutine {
+        Coroutine(Task &&_task, size_t _stack_size);
+
+        SeparateStackProfile    profile;
+        Task                    task;
+    };
+
+    using Timer = std::pair<Deadline, Coroutine *>;
+
+    static void *__Entry(void *_co);
+
+    /**
+     * From the running coroutine back to RunReady().
+     */
+    void __Park();
+
+    /**
+     * Makes @param{_co} ready, may be called from any thread.
+     */
+    void __Wake(Coroutine *_co);
+
+    void __TakeWoken();
+
+    bool __HasReady();
+
+  private:
+    const size_t                        stack_size_;
+    SeparateStackProfile                main_;
+    Coroutine                         * curr_;
+    std::deque<Coroutine *>             ready_;
+    std::priority_queue<Timer, std::vector<Timer>,
+                        std::greater<Timer>>    timers_;
+    size_t                              in_flight_;
+    /* Woken by blocking threads. */
+    std::mutex                          woken_mutex_;
+    std::vector<Coroutine *>            woken_;
+    std::atomic<bool>                   has_woken_;
+    EventCount                          own_wakeup_;
+    EventCount                        * wakeup_;
+};
@@ -1,33 +1,132 @@
+/**
+ * A producer and a consumer coroutine switching to each other, first to
+ * check that each engine hands the items over in order, then to measure
+ * the switch latency of either engine with the coroutines switching from
+ * several stack depths:
+ *      CoroutineProfile, copying the stack out and in on each switch;
+ *      SeparateStackProfile, switching stacks, registers only.
+ *
+ * Usage: testco [switches per run]
+ */
 #include "coroutine.h"
-#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
 
-void *Produce(void *) {
-    for (int i = 0; i < 10; ++i) {
-        printf("Produce: %d\n", i);
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        CoroutineDispatcher::Instance().CoYieldCurr();
+template<class Profile>
+class PingPong {
+  public:
+    /**
+     * @param _depth_kb: stack the coroutines take before switching.
+     * @return: nanoseconds per switch.
+     */
+    static double Run(size_t _depth_kb, size_t _items, bool _verbose) {
+        Profile main_co;
+        Profile producer(Produce);
+        Profile consumer(Consume);
+        main_ = &main_co;
+        producer_ = &producer;
+        consumer_ = &consumer;
+        depth_kb_ = _depth_kb;
+        items_ = _items;
+        verbose_ = _verbose;
+
+        auto begin = std::chrono::steady_clock::now();
+        main_co.CoYieldTo(&producer);
+        auto end = std::chrono::steady_clock::now();
+
+        if (item_ != _items - 1) {
+            fprintf(stderr, "item %zu is not %zu\n", item_, _items - 1);
+            exit(1);
+        }
+        double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+        return ns / (2 * _items);
     }
-    printf("produce done\n");
-    return nullptr;
-}
 
-void *Consume(void *) {
-    for (int i = 0; i < 10; ++i) {
-        printf("Consume: %d\n", i);
-        CoroutineDispatcher::Instance().CoYieldCurr();
+  private:
+    static void *Produce(void *) {
+        Descend(depth_kb_, [] {
+            for (size_t i = 0; i < items_; ++i) {
+                if (verbose_) {
+                    printf("Produce: %zu\n", i);
+                }
+                item_ = i;
+                producer_->CoYieldTo(consumer_);
+            }
+            if (verbose_) {
+                printf("produce done\n");
+            }
+        });
+        // Must not return, see StartCoroutine.
+        producer_->CoYieldTo(main_);
+        return nullptr;
     }
-    printf("consume done\n");
-    return nullptr;
-}
 
+    static void *Consume(void *) {
+        Descend(depth_kb_, [] {
+            for (size_t i = 0; i < items_; ++i) {
+                if (item_ != i) {
+                    fprintf(stderr, "consumed %zu, %zu expected\n", item_, i);
+                    exit(1);
+                }
+                if (verbose_) {
+                    printf("Consume: %zu\n", i);
+                }
+                consumer_->CoYieldTo(producer_);
+            }
+        });
+        return nullptr;
+    }
 
-int main() {
-    CoroutineProfile producer(Produce);
-    CoroutineProfile consumer(Consume);
-    CoroutineDispatcher::Instance().AddCoroutine(&producer);
-    CoroutineDispatcher::Instance().AddCoroutine(&consumer);
-    
-    CoroutineDispatcher::Instance().CoStart();
-}
+    /**
+     * Calls @param{_loop} @param{_kb} frames of 1KB deep.
+     */
+    static void Descend(size_t _kb, void (*_loop)()) {
+        if (_kb == 0) {
+            _loop();
+            return;
+        }
+        char frame[1024];
+        Descend(_kb - 1, _loop);
+        // Used after the call, so neither optimized out nor a tail call.
+        asm volatile("" : : "r"(frame) : "memory");
+    }
 
+  private:
+    static Profile    * main_;
+    static Profile    * producer_;
+    static Profile    * consumer_;
+    static size_t       depth_kb_;
+    static size_t       items_;
+    static size_t       item_;
+    static bool         verbose_;
+};
+
+template<class Profile> Profile *PingPong<Profile>::main_ = nullptr;
+template<class Profile> Profile *PingPong<Profile>::producer_ = nullptr;
+template<class Profile> Profile *PingPong<Profile>::consumer_ = nullptr;
+template<class Profile> size_t PingPong<Profile>::depth_kb_ = 0;
+template<class Profile> size_t PingPong<Profile>::items_ = 0;
+template<class Profile> size_t PingPong<Profile>::item_ = 0;
+template<class Profile> bool PingPong<Profile>::verbose_ = false;
+
+
+int main(int _argc, char **_argv) {
+    size_t switches = _argc > 1 ? strtoul(_argv[1], nullptr, 10) : 200000;
+
+    printf("CoroutineProfile:\n");
+    PingPong<CoroutineProfile>::Run(0, 10, true);
+    printf("SeparateStackProfile:\n");
+    PingPong<SeparateStackProfile>::Run(0, 10, true);
+
+    printf("\n%zu switches per run\n", switches);
+    printf("%10s %28s %32s\n", "depth (KB)", "CoroutineProfile (ns/switch)",
+           "SeparateStackProfile (ns/switch)");
+    for (size_t depth_kb : {0, 1, 4, 16, 64}) {
+        printf("%10zu %28.1f %32.1f\n", depth_kb,
+               PingPong<CoroutineProfile>::Run(depth_kb, switches / 2, false),
+               PingPong<SeparateStackProfile>::Run(depth_kb, switches / 2, false));
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include "cpuutil.h"
+#include <thread>
+#include <fstream>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+#include "strutil.h"
+#include "log.h"
+
+
+namespace cpu {
+
+/**
+ *
+ * @return: Cpu quota of the cgroup this process is in,
+ *          <= 0 if unlimited or unknown.
+ */
+static double CgroupCpuQuota() {
+    // cgroup v2: "$MAX $PERIOD", $MAX may be "max".
+    std::ifstream cpu_max("/sys/fs/cgroup/cpu.max");
+    if (cpu_max) {
+        std::string max;
+        double period = 0;
+        cpu_max >> max >> period;
+        if (max == "max" || period <= 0) {
+            return -1;
+        }
+        return strtod(max.c_str(), nullptr) / period;
+    }
+    // cgroup v1.
+    std::ifstream cfs_quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream cfs_period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    if (cfs_quota && cfs_period) {
+        double quota = -1;
+        double period = 0;
+        cfs_quota >> quota;
+        cfs_period >> period;
+        if (quota <= 0 || period <= 0) {
+            return -1;
+        }
+        return quota / period;
+    }
+    return -1;
+}
+
+size_t AvailableCpuCnt() {
+    size_t cnt = std::thread::hardware_concurrency();
+    
+    size_t allowed = AllowedCpus().size();
+    if (allowed > 0 && (cnt == 0 || allowed < cnt)) {
+        cnt = allowed;
+    }
+    double quota = CgroupCpuQuota();
+    if (quota > 0) {
+        auto quota_cnt = (size_t) std::ceil(quota);
+        if (cnt == 0 || quota_cnt < cnt) {
+            cnt = quota_cnt;
+        }
+    }
+    return cnt > 0 ? cnt : 1;
+}
+
+std::vector<int> AllowedCpus() {
+    std::vector<int> res;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (::sched_getaffinity(0, sizeof(set), &set) < 0) {
+        LogE("sched_getaffinity errno(%d): %s", errno, strerror(errno))
+        return res;
+    }
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set)) {
+            res.push_back(i);
+        }
+    }
+#else
+    for (int i = 0; i < (int) std::thread::hardware_concurrency(); ++i) {
+        res.push_back(i);
+    }
+#endif
+    return res;
+}
+
+bool ParseCpuList(const std::string &_list, std::vector<int> &_res) {
+    std::vector<std::string> ranges;
+    str::split(_list, ",", ranges);
+    if (ranges.empty()) {
+        ranges.push_back(_list);    // a single range, no separator.
+    }
+    
+    for (auto &range : ranges) {
+        str::trim(range);
+        if (range.empty()) {
+            continue;
+        }
+        char *end = nullptr;
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (end == range.c_str() || first < 0) {
+            return false;
+        }
+        if (*end == '-') {
+            const char *last_start = end + 1;
+            last = strtol(last_start, &end, 10);
+            if (end == last_start || last < first) {
+                return false;
+            }
+        }
+        if (*end != '\0') {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            _res.push_back((int) cpu);
+        }
+    }
+    std::sort(_res.begin(), _res.end());
+    _res.erase(std::unique(_res.begin(), _res.end()), _res.end());
+    return !_res.empty();
+}
+
+int NumaNodeOfCpu(int _cpu) {
+    // Node ids may be sparse, e.g. "0,2" with node1 offline or absent.
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodelist;
+    std::vector<int> nodes;
+    if (!online || !std::getline(online, nodelist)
+            || !ParseCpuList(nodelist, nodes)) {
+        return 0;
+    }
+    for (int node : nodes) {
+        char path[128] = {0, };
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+        std::ifstream fin(path);
+        std::string cpulist;
+        std::vector<int> cpus;
+        if (fin && std::getline(fin, cpulist) && ParseCpuList(cpulist, cpus)
+                && std::binary_search(cpus.begin(), cpus.end(), _cpu)) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+int SetThreadAffinity(const std::vector<int> &_cpus) {
+#ifdef __linux__
+    if (_cpus.empty()) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : _cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (::sched_setaffinity(0, sizeof(set), &set) < 0) {
+        LogE("sched_setaffinity errno(%d): %s", errno, strerror(errno))
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int SetThreadPreferredNumaNode(int _node) {
+#ifdef __linux__
+    if (_node < 0 || _node >= (int) sizeof(unsigned long) * 8) {
+        return -1;
+    }
+    unsigned long node_mask = 1UL << _node;
+    // Issued directly to avoid depending on libnuma.
+    if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED,
+                  &node_mask, sizeof(node_mask) * 8) < 0) {
+        LogE("set_mempolicy errno(%d): %s", errno, strerror(errno))
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int BindMemoryToNumaNode(void *_addr, size_t _len, int _node) {
+#ifdef __linux__
+    if (_node < 0 || _node >= (int) sizeof(unsigned long) * 8) {
+        return -1;
+    }
+    // Pages shared with neighbouring allocations are left alone.
+    auto page = (uintptr_t) ::sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t) _addr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t) _addr + _len) & ~(page - 1);
+    if (begin >= end) {
+        return 0;
+    }
+    unsigned long node_mask = 1UL << _node;
+    if (::syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED,
+                  &node_mask, sizeof(node_mask) * 8, MPOL_MF_MOVE) < 0) {
+        LogE("mbind errno(%d): %s", errno, strerror(errno))
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+namespace cpu {
+
+/**
+ *
+ * @return: Number of cpus this process can actually use, i.e. the minimum
+ *          of std::thread::hardware_concurrency, the affinity mask of the
+ *          process and the cgroup cpu quota (rounded up), at least 1.
+ */
+size_t AvailableCpuCnt();
+
+/**
+ *
+ * @return: Cpus in the affinity mask of the calling thread, ascending.
+ */
+std::vector<int> AllowedCpus();
+
+/**
+ * Parses a cpu list like "0-3,8,10-11".
+ *
+ * @return: true on success, else false.
+ */
+bool ParseCpuList(const std::string &_list, std::vector<int> &_res);
+
+/**
+ *
+ * @return: The NUMA node @param{_cpu} belongs to, 0 if unknown.
+ */
+int NumaNodeOfCpu(int _cpu);
+
+/**
+ * Pins the calling thread to @param{_cpus}.
+ *
+ * @return: 0 on success, else -1.
+ */
+int SetThreadAffinity(const std::vector<int> &_cpus);
+
+/**
+ * Memory allocated by the calling thread afterwards
+ * is preferably placed on NUMA node @param{_node}.
+ *
+ * @return: 0 on success, else -1.
+ */
+int SetThreadPreferredNumaNode(int _node);
+
+/**
+ * Moves the whole pages within [@param{_addr}, @param{_addr} + @param{_len})
+ * to NUMA node @param{_node}, and has those touched later placed there,
+ * for memory allocated before its user was placed, e.g. by the main thread.
+ *
+ * @return: 0 on success, else -1.
+ */
+int BindMemoryToNumaNode(void *_addr, size_t _len, int _node);
+
+}
@@ -0,0 +1,94 @@
+#include "eventcount.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <climits>
+#include <ctime>
+
+
+EventCount::EventCount()
+        : epoch_(0)
+        , waiters_(0) {
+}
+
+uint32_t EventCount::PrepareWait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_acquire);
+}
+
+void EventCount::CancelWait() {
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool EventCount::Wait(uint32_t _key, const Deadline *_deadline) {
+    bool is_timed_out = _deadline && std::chrono::steady_clock::now() >= *_deadline;
+#ifdef __linux__
+    if (!is_timed_out) {
+        timespec ts {};
+        timespec *timeout = nullptr;
+        if (_deadline) {
+            auto left = *_deadline - std::chrono::steady_clock::now();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+            ns = ns > 0 ? ns : 0;
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            timeout = &ts;
+        }
+        // Returns at once if notified since _key was read.
+        ::syscall(SYS_futex, (uint32_t *) &epoch_, FUTEX_WAIT_PRIVATE, _key,
+                  timeout, nullptr, 0);
+        is_timed_out = _deadline && std::chrono::steady_clock::now() >= *_deadline;
+    }
+#else
+    if (!is_timed_out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto is_notified = [&] {
+            return epoch_.load(std::memory_order_acquire) != _key;
+        };
+        if (_deadline) {
+            is_timed_out = !cond_.wait_until(lock, *_deadline, is_notified);
+        } else {
+            cond_.wait(lock, is_notified);
+        }
+    }
+#endif
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return !is_timed_out;
+}
+
+bool EventCount::Notify(int _n) {
+    // Pairs with the RMW in PrepareWait(), either the waiter sees the
+    // condition true on its re-check, or this sees it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+#ifdef __linux__
+    epoch_.fetch_add(1, std::memory_order_release);
+    ::syscall(SYS_futex, (uint32_t *) &epoch_, FUTEX_WAKE_PRIVATE, _n,
+              nullptr, nullptr, 0);
+#else
+    {
+        // Under the lock, so that no waiter misses it between
+        // checking the epoch and going to sleep.
+        std::lock_guard<std::mutex> lock(mutex_);
+        epoch_.fetch_add(1, std::memory_order_release);
+    }
+    if (_n == 1) {
+        cond_.notify_one();
+    } else {
+        cond_.notify_all();
+    }
+#endif
+    return true;
+}
+
+void EventCount::NotifyAll() {
+    Notify(INT_MAX);
+}
+
+uint32_t EventCount::Waiters() const {
+    return waiters_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
+
+
+/**
+ * Lets threads sleep till a condition checked without a lock, e.g. a
+ * lock-free queue being non-empty, may have turned true, by futex(2),
+ * or by a mutex and a condition variable where there is no futex.
+ *
+ * Waiter:
+ *     while (!condition()) {
+ *         uint32_t key = ec.PrepareWait();
+ *         if (condition()) { ec.CancelWait(); break; }
+ *         ec.Wait(key);
+ *     }
+ * Notifier: makes the condition true, then Notify(), which costs a
+ * syscall only if some thread is waiting.
+ */
+class EventCount {
+  public:
+    using Deadline = std::chrono::steady_clock::time_point;
+    
+    EventCount();
+    
+    EventCount(const EventCount &) = delete;
+    
+    EventCount &operator=(const EventCount &) = delete;
+    
+    /**
+     * Announces a wait, re-check the condition after.
+     *
+     * @return: key for Wait().
+     */
+    uint32_t PrepareWait();
+    
+    /**
+     * Withdraws PrepareWait() once the condition is found true.
+     */
+    void CancelWait();
+    
+    /**
+     * Sleeps unless notified since PrepareWait() returned @param{_key}.
+     *
+     * @param _deadline: nullptr: no timeout.
+     * @return: false if timed out.
+     */
+    bool Wait(uint32_t _key, const Deadline *_deadline = nullptr);
+    
+    /**
+     * Wakes up to @param{_n} waiters, call it after making the condition true.
+     *
+     * @return: false if there was none to wake.
+     */
+    bool Notify(int _n = 1);
+    
+    void NotifyAll();
+    
+    /**
+     * @return: threads between PrepareWait() and the return of
+     *          Wait() / CancelWait(), may be stale.
+     */
+    uint32_t Waiters() const;
+
+  private:
+    /* Bumped on each notification, the futex word waiters sleep on. */
+    std::atomic<uint32_t>       epoch_;
+    std::atomic<uint32_t>       waiters_;
+#ifndef __linux__
+    std::mutex                  mutex_;
+    std::condition_variable     cond_;
+#endif
+};
@@ -1,7 +1,12 @@
 #include "fileutil.h"
 #include <cerrno>
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "log.h"
 
 namespace file {
@@ -60,4 +65,69 @@ bool IsFileExist(const char *_path) {
     return ::access(_path, F_OK) == 0;
 }
 
-}
\ No newline at end of file
+
+
+CachedFile::Ptr CachedFile::Open(const std::string &_path) {
+    static std::mutex mutex;
+    static std::map<std::string, Ptr> opened;
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = opened.find(_path);
+    if (iter != opened.end()) {
+        return iter->second;
+    }
+    int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LogE("open file failed, path: %s, errno(%d): %s",
+             _path.c_str(), errno, strerror(errno))
+        return nullptr;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        LogE("not a regular file: %s", _path.c_str())
+        ::close(fd);
+        return nullptr;
+    }
+    Ptr file(new CachedFile(fd, (size_t) st.st_size, _path));
+    opened[_path] = file;
+    return file;
+}
+
+CachedFile::CachedFile(int _fd, size_t _size, std::string _path)
+        : fd_(_fd)
+        , size_(_size)
+        , path_(std::move(_path)) {
+}
+
+int CachedFile::Fd() const { return fd_; }
+
+size_t CachedFile::Size() const { return size_; }
+
+const std::string &CachedFile::Path() const { return path_; }
+
+CachedFile::~CachedFile() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+
+FileRegion::FileRegion()
+        : file(nullptr)
+        , offset(0)
+        , length(0) {
+}
+
+FileRegion::FileRegion(const CachedFile::Ptr &_file)
+        : file(_file)
+        , offset(0)
+        , length(_file ? _file->Size() : 0) {
+}
+
+void FileRegion::Reset() {
+    file = nullptr;
+    offset = 0;
+    length = 0;
+}
+
+}
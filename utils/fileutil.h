@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdio>
 #include <string>
+#include <memory>
+#include <sys/types.h>
 
 
 namespace file {
@@ -25,5 +27,53 @@ long GetFileSize(const char *_path);
 
 bool IsFileExist(const char *_path);
 
+
+/**
+ * A read-only fd kept open for the lifetime of the process,
+ * so that serving the file costs no open(2) nor any copy.
+ */
+class CachedFile {
+  public:
+    using Ptr = std::shared_ptr<CachedFile>;
+    
+    /**
+     * Opens @param{_path} on the first call, later calls share the fd.
+     *
+     * @return: nullptr on failure.
+     */
+    static Ptr Open(const std::string &_path);
+    
+    ~CachedFile();
+    
+    int Fd() const;
+    
+    /* When opened. */
+    size_t Size() const;
+    
+    const std::string &Path() const;
+    
+  private:
+    CachedFile(int _fd, size_t _size, std::string _path);
+    
+  private:
+    int                 fd_;
+    size_t              size_;
+    std::string         path_;
+};
+
+
+/* Which part of a file to send. */
+struct FileRegion {
+    FileRegion();
+    
+    explicit FileRegion(const CachedFile::Ptr &_file);
+    
+    void Reset();
+    
+    CachedFile::Ptr     file;
+    off_t               offset;
+    size_t              length;
+};
+
 }
 
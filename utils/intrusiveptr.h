@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+
+
+/**
+ * Smart pointer to an object counting its own references,
+ * i.e. T provides AddRef() and Release(), the latter deciding
+ * what to do once unreferenced, e.g. going back to a pool.
+ *
+ * Unlike std::shared_ptr, no control block is allocated.
+ */
+template<class T>
+class IntrusivePtr {
+  public:
+
+    IntrusivePtr() : ptr_(nullptr) {}
+
+    IntrusivePtr(std::nullptr_t) : ptr_(nullptr) {}
+
+    explicit IntrusivePtr(T *_ptr) : ptr_(_ptr) {
+        if (ptr_) {
+            ptr_->AddRef();
+        }
+    }
+
+    IntrusivePtr(const IntrusivePtr &_other) : ptr_(_other.ptr_) {
+        if (ptr_) {
+            ptr_->AddRef();
+        }
+    }
+
+    IntrusivePtr(IntrusivePtr &&_other) noexcept : ptr_(_other.ptr_) {
+        _other.ptr_ = nullptr;
+    }
+
+    /**
+     * From a pointer to a derived class, e.g. to the packet base.
+     */
+    template<class U>
+    IntrusivePtr(const IntrusivePtr<U> &_other) : ptr_(_other.get()) {
+        if (ptr_) {
+            ptr_->AddRef();
+        }
+    }
+
+    template<class U>
+    IntrusivePtr(IntrusivePtr<U> &&_other) noexcept : ptr_(_other.ptr_) {
+        _other.ptr_ = nullptr;
+    }
+
+    ~IntrusivePtr() {
+        if (ptr_) {
+            ptr_->Release();
+        }
+    }
+
+    IntrusivePtr &operator=(const IntrusivePtr &_other) {
+        IntrusivePtr(_other).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr &operator=(IntrusivePtr &&_other) noexcept {
+        IntrusivePtr(std::move(_other)).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr &operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    void reset() {
+        IntrusivePtr().swap(*this);
+    }
+
+    void swap(IntrusivePtr &_other) noexcept {
+        std::swap(ptr_, _other.ptr_);
+    }
+
+    T *get() const { return ptr_; }
+
+    T *operator->() const { return ptr_; }
+
+    T &operator*() const { return *ptr_; }
+
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+    bool operator==(const IntrusivePtr &_other) const { return ptr_ == _other.ptr_; }
+
+    bool operator!=(const IntrusivePtr &_other) const { return ptr_ != _other.ptr_; }
+
+    bool operator==(std::nullptr_t) const { return ptr_ == nullptr; }
+
+    bool operator!=(std::nullptr_t) const { return ptr_ != nullptr; }
+
+  private:
+    template<class U>
+    friend class IntrusivePtr;
+
+    T         * ptr_;
+};
@@ -1,6 +1,9 @@
 #pragma once
 #include <mutex>
+#include <algorithm>
 #include <deque>
+#include <atomic>
+#include <vector>
 #include <condition_variable>
 
 
@@ -21,6 +24,15 @@ class ThreadSafeDeque {
     
     bool push_back(const T &_v, bool _notify = true);
     
+    /**
+     * Pushes [@param{_first}, @param{_last}) under one lock,
+     * waking as many waiters as elements pushed.
+     *
+     * @return: elements pushed, fewer if full.
+     */
+    template<class Iter>
+    size_t push_batch(Iter _first, Iter _last, bool _notify = true);
+    
     bool pop_front(bool _wait = true, uint64_t _timeout_millis = -1);
     
     bool pop_back(bool _wait = true, uint64_t _timeout_millis = -1);
@@ -29,6 +41,22 @@ class ThreadSafeDeque {
     
     bool pop_back_to(T &_t, bool _wait = true, uint64_t _timeout_millis = -1);
     
+    /**
+     * Appends at most @param{_n} elements from the front to @param{_out}
+     * under one lock, waiting for the first one if @param{_wait}.
+     *
+     * @return: elements popped.
+     */
+    size_t pop_up_to(size_t _n, std::vector<T> &_out, bool _wait = true,
+                     uint64_t _timeout_millis = -1);
+    
+    /**
+     * Appends all the elements to @param{_out} under one lock, never waits.
+     *
+     * @return: elements popped.
+     */
+    size_t drain_all(std::vector<T> &_out);
+    
     bool front(T &_t, bool _wait = true, uint64_t _timeout_millis = -1);
     
     bool back(T &_t, bool _wait = true, uint64_t _timeout_millis = -1);
@@ -37,6 +65,12 @@ class ThreadSafeDeque {
     
     size_t size();
     
+    /**
+     * Lock-free, may be stale by the time it returns.
+     * Use it for load statistics only.
+     */
+    size_t approx_size() const;
+    
     void clear();
     
     void Terminate();
@@ -51,12 +85,14 @@ class ThreadSafeDeque {
     std::mutex                  mtx_;
     std::condition_variable     cond_;
     Container                   container_;
+    std::atomic<size_t>         approx_size_;
     bool                        terminated_;
 };
 
 template<class T, class Container>
 ThreadSafeDeque<T, Container>::ThreadSafeDeque(size_t _max_size)
         : max_size_(_max_size)
+        , approx_size_(0)
         , terminated_(false) {
 }
 
@@ -68,6 +104,7 @@ bool ThreadSafeDeque<T, Container>::push_front(const T &_v, bool _notify) {
         return false;
     }
     container_.push_front(_v);
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
     if (_notify) {
         cond_.notify_one();
     }
@@ -83,12 +120,36 @@ ThreadSafeDeque<T, Container>::push_back(const T &_v, bool _notify /*= true*/) {
         return false;
     }
     container_.push_back(_v);
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
     if (_notify) {
         cond_.notify_one();
     }
     return true;
 }
 
+template<class T, class Container>
+template<class Iter>
+size_t ThreadSafeDeque<T, Container>::push_batch(Iter _first, Iter _last,
+                                                 bool _notify /*= true*/) {
+    size_t pushed = 0;
+    {
+        LockGuard lock(mtx_);
+        for (; _first != _last && container_.size() <= max_size_; ++_first) {
+            container_.push_back(*_first);
+            ++pushed;
+        }
+        approx_size_.store(container_.size(), std::memory_order_relaxed);
+    }
+    if (_notify && pushed > 0) {
+        if (pushed == 1) {
+            cond_.notify_one();
+        } else {
+            cond_.notify_all();
+        }
+    }
+    return pushed;
+}
+
 template<class T, class Container>
 bool ThreadSafeDeque<T, Container>::pop_front(bool _wait,
                                               uint64_t _timeout_millis) {
@@ -100,6 +161,7 @@ bool ThreadSafeDeque<T, Container>::pop_front(bool _wait,
         return false;
     }
     container_.pop_front();
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
     return true;
 }
 
@@ -114,6 +176,7 @@ bool ThreadSafeDeque<T, Container>::pop_back(bool _wait,
         return false;
     }
     container_.pop_back();
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
     return true;
 }
 
@@ -132,6 +195,7 @@ ThreadSafeDeque<T, Container>::pop_front_to(T &_t,
     }
     _t = container_.front();
     container_.pop_front();
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
     return true;
 }
 
@@ -150,9 +214,36 @@ ThreadSafeDeque<T, Container>::pop_back_to(T &_t,
     }
     _t = container_.back();
     container_.pop_back();
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
     return true;
 }
 
+template<class T, class Container>
+size_t
+ThreadSafeDeque<T, Container>::pop_up_to(size_t _n, std::vector<T> &_out,
+                                         bool _wait /*= true*/,
+                                         uint64_t _timeout_millis /*= -1*/) {
+    UniqueLock lock(mtx_);
+    if (_wait) {
+        __WaitSizeGreaterThan(0, lock, _timeout_millis);
+    }
+    if (terminated_) {
+        return 0;
+    }
+    size_t n = std::min(_n, container_.size());
+    for (size_t i = 0; i < n; ++i) {
+        _out.push_back(std::move(container_.front()));
+        container_.pop_front();
+    }
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
+    return n;
+}
+
+template<class T, class Container>
+size_t ThreadSafeDeque<T, Container>::drain_all(std::vector<T> &_out) {
+    return pop_up_to(-1, _out, false);
+}
+
 template<class T, class Container>
 bool
 ThreadSafeDeque<T, Container>::front(T &_t, bool _wait /*= true*/,
@@ -206,10 +297,16 @@ size_t ThreadSafeDeque<T, Container>::size() {
     return container_.size();
 }
 
+template<class T, class Container>
+size_t ThreadSafeDeque<T, Container>::approx_size() const {
+    return approx_size_.load(std::memory_order_relaxed);
+}
+
 template<class T, class Container>
 void ThreadSafeDeque<T, Container>::clear() {
     LockGuard lock(mtx_);
     container_.clear();
+    approx_size_.store(container_.size(), std::memory_order_relaxed);
 }
 
 template<class T, class Container>
@@ -230,7 +327,7 @@ void
 ThreadSafeDeque<T, Container>::__WaitSizeGreaterThan(const size_t _than,
                                                      ThreadSafeDeque::UniqueLock &_lock,
                                                      uint64_t _timeout_millis) {
-    if (_timeout_millis == -1) {
+    if (_timeout_millis == (uint64_t) -1) {
         cond_.wait(_lock, [&, this] {
             return container_.size() > _than || terminated_;
         });
@@ -0,0 +1,410 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "eventcount.h"
+#include "cpuutil.h"
+
+
+namespace MessageQueue {
+
+enum TConcurrency {
+    kSingle = 0,    // called from one thread at a time only.
+    kMulti,
+};
+
+/**
+ * Bounded lock-free ring (Vyukov's MPMC queue), a sibling of
+ * ThreadSafeDeque with the same interface for the operations both
+ * provide, so that a queue type alias switches between them.
+ *
+ * Each cell carries a sequence number telling whether it is ready to
+ * be written or read at a given position, so producers and consumers
+ * only compete on the position they claim, and only if @param{Producers}
+ * or @param{Consumers} is kMulti, otherwise the position is just stored.
+ *
+ * Batches claim a range of positions by a single CAS, and then wait
+ * for each cell in it to be released by whoever claimed it a lap ago
+ * or to be filled by whoever claimed it, which is a matter of a store.
+ *
+ * size() is lock-free as well, being computed from the two positions.
+ * Consumers waiting for an element park on an EventCount, producers
+ * issue a syscall only if some consumer is parked.
+ */
+template<class T, TConcurrency Producers = kMulti, TConcurrency Consumers = kMulti>
+class BoundedRingQueue {
+  public:
+
+    /**
+     * @param _max_size: rounded up to a power of 2.
+     */
+    explicit BoundedRingQueue(size_t _max_size = 10240);
+
+    BoundedRingQueue(const BoundedRingQueue &) = delete;
+
+    BoundedRingQueue &operator=(const BoundedRingQueue &) = delete;
+
+    /**
+     * @return: false if full.
+     */
+    bool push_back(const T &_v, bool _notify = true);
+
+    /**
+     * Claims room for [@param{_first}, @param{_last}) at once,
+     * waking as many parked consumers as elements pushed.
+     *
+     * @return: elements pushed, fewer if full.
+     */
+    template<class Iter>
+    size_t push_batch(Iter _first, Iter _last, bool _notify = true);
+
+    bool pop_front_to(T &_t, bool _wait = true, uint64_t _timeout_millis = -1);
+
+    /**
+     * Appends at most @param{_n} elements to @param{_out}, claimed
+     * at once, waiting for the first one if @param{_wait}.
+     *
+     * @return: elements popped.
+     */
+    size_t pop_up_to(size_t _n, std::vector<T> &_out, bool _wait = true,
+                     uint64_t _timeout_millis = -1);
+
+    /**
+     * Appends all the elements to @param{_out}, never waits.
+     *
+     * @return: elements popped.
+     */
+    size_t drain_all(std::vector<T> &_out);
+
+    size_t size() const;
+
+    /**
+     * Same as size(), may be stale by the time it returns.
+     */
+    size_t approx_size() const;
+
+    size_t capacity() const;
+
+    /**
+     * Consumers only.
+     */
+    void clear();
+
+    /**
+     * Wakes all parked consumers up, pops fail from now on.
+     */
+    void Terminate();
+
+    bool IsTerminated() const;
+
+    /**
+     * Moves the cells to NUMA node @param{_node}, e.g. from the
+     * thread using the queue once it is placed, see cpu::BindMemoryToNumaNode().
+     *
+     * @return: 0 on success, else -1.
+     */
+    int BindToNumaNode(int _node);
+
+  private:
+    struct Cell {
+        std::atomic<size_t>     seq;
+        T                       value;
+    };
+
+    bool __TryPop(T &_t);
+
+    size_t __TryPopBatch(size_t _n, std::vector<T> &_out);
+
+    /**
+     * Spins till the cell of @param{_pos} carries @param{_seq}, which
+     * the thread having claimed it is about to store.
+     */
+    Cell &__AwaitCell(size_t _pos, size_t _seq);
+
+    void __NotifyPushed(size_t _n);
+
+    static size_t __RoundUpPowerOf2(size_t _n);
+
+  private:
+    static const size_t             kCacheLine = 64;
+    const size_t                    mask_;
+    std::unique_ptr<Cell[]>         cells_;
+    char                            pad0_[kCacheLine];
+    std::atomic<size_t>             tail_;      // next position to push.
+    char                            pad1_[kCacheLine - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t>             head_;      // next position to pop.
+    char                            pad2_[kCacheLine - sizeof(std::atomic<size_t>)];
+    EventCount                      non_empty_;
+    std::atomic<bool>               terminated_;
+};
+
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+BoundedRingQueue<T, Producers, Consumers>::BoundedRingQueue(size_t _max_size)
+        : mask_(__RoundUpPowerOf2(_max_size) - 1)
+        , cells_(new Cell[mask_ + 1])
+        , tail_(0)
+        , head_(0)
+        , terminated_(false) {
+    for (size_t i = 0; i <= mask_; ++i) {
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+bool BoundedRingQueue<T, Producers, Consumers>::push_back(const T &_v, bool _notify) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        auto diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (Producers == kSingle) {
+                tail_.store(pos + 1, std::memory_order_relaxed);
+                break;
+            }
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;   // the cell of a lap ago is not popped yet.
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = _v;
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    if (_notify) {
+        __NotifyPushed(1);
+    }
+    return true;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+void BoundedRingQueue<T, Producers, Consumers>::__NotifyPushed(size_t _n) {
+    non_empty_.Notify(_n > INT32_MAX ? INT32_MAX : (int) _n);
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+typename BoundedRingQueue<T, Producers, Consumers>::Cell &
+BoundedRingQueue<T, Producers, Consumers>::__AwaitCell(size_t _pos, size_t _seq) {
+    Cell &cell = cells_[_pos & mask_];
+    while (cell.seq.load(std::memory_order_acquire) != _seq) {
+        std::this_thread::yield();
+    }
+    return cell;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+template<class Iter>
+size_t BoundedRingQueue<T, Producers, Consumers>::push_batch(Iter _first, Iter _last,
+                                                             bool _notify) {
+    auto n = (size_t) std::distance(_first, _last);
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    size_t k;
+    while (true) {
+        // Positions below head_ are claimed by consumers already,
+        // so their cells are released shortly.
+        size_t head = head_.load(std::memory_order_acquire);
+        if (head > pos) {
+            pos = tail_.load(std::memory_order_relaxed);    // stale.
+            continue;
+        }
+        size_t room = mask_ + 1 - std::min(pos - head, mask_ + 1);
+        k = std::min(n, room);
+        if (k == 0) {
+            return 0;
+        }
+        if (Producers == kSingle) {
+            tail_.store(pos + k, std::memory_order_relaxed);
+            break;
+        }
+        if (tail_.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    for (size_t i = 0; i < k; ++i, ++_first) {
+        Cell &cell = __AwaitCell(pos + i, pos + i);
+        cell.value = *_first;
+        cell.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    if (_notify) {
+        __NotifyPushed(k);
+    }
+    return k;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+bool BoundedRingQueue<T, Producers, Consumers>::__TryPop(T &_t) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        auto diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (Consumers == kSingle) {
+                head_.store(pos + 1, std::memory_order_relaxed);
+                break;
+            }
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+    _t = std::move(cell->value);
+    cell->value = T();  // drops what it refers to, e.g. a reference count.
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::__TryPopBatch(size_t _n,
+                                                                std::vector<T> &_out) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    size_t k;
+    while (true) {
+        // Positions below tail_ are claimed by producers already,
+        // so their cells are filled shortly.
+        size_t tail = tail_.load(std::memory_order_acquire);
+        k = std::min(_n, tail > pos ? tail - pos : 0);
+        if (k == 0) {
+            return 0;
+        }
+        if (Consumers == kSingle) {
+            head_.store(pos + k, std::memory_order_relaxed);
+            break;
+        }
+        if (head_.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    for (size_t i = 0; i < k; ++i) {
+        Cell &cell = __AwaitCell(pos + i, pos + i + 1);
+        _out.push_back(std::move(cell.value));
+        cell.value = T();
+        cell.seq.store(pos + i + mask_ + 1, std::memory_order_release);
+    }
+    return k;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::pop_up_to(size_t _n, std::vector<T> &_out,
+                                                            bool _wait,
+                                                            uint64_t _timeout_millis) {
+    if (_n == 0 || terminated_.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    size_t n = __TryPopBatch(_n, _out);
+    if (n > 0 || !_wait) {
+        return n;
+    }
+    T t;
+    if (!pop_front_to(t, true, _timeout_millis)) {
+        return 0;
+    }
+    _out.push_back(std::move(t));
+    return 1 + __TryPopBatch(_n - 1, _out);
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::drain_all(std::vector<T> &_out) {
+    return pop_up_to(-1, _out, false);
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+bool BoundedRingQueue<T, Producers, Consumers>::pop_front_to(T &_t, bool _wait,
+                                                             uint64_t _timeout_millis) {
+    EventCount::Deadline deadline;
+    bool has_deadline = _wait && _timeout_millis != (uint64_t) -1;
+    if (has_deadline) {
+        deadline = std::chrono::steady_clock::now()
+                   + std::chrono::milliseconds(_timeout_millis);
+    }
+    while (true) {
+        if (terminated_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (__TryPop(_t)) {
+            return true;
+        }
+        if (!_wait) {
+            return false;
+        }
+        uint32_t key = non_empty_.PrepareWait();
+        if (__TryPop(_t)) {
+            non_empty_.CancelWait();
+            return true;
+        }
+        if (terminated_.load(std::memory_order_acquire)) {
+            non_empty_.CancelWait();
+            return false;
+        }
+        if (!non_empty_.Wait(key, has_deadline ? &deadline : nullptr)) {
+            return __TryPop(_t);
+        }
+    }
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::size() const {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::approx_size() const {
+    return size();
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::capacity() const {
+    return mask_ + 1;
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+void BoundedRingQueue<T, Producers, Consumers>::clear() {
+    T t;
+    while (__TryPop(t)) {
+    }
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+void BoundedRingQueue<T, Producers, Consumers>::Terminate() {
+    terminated_.store(true, std::memory_order_seq_cst);
+    non_empty_.NotifyAll();
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+bool BoundedRingQueue<T, Producers, Consumers>::IsTerminated() const {
+    return terminated_.load(std::memory_order_acquire);
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+int BoundedRingQueue<T, Producers, Consumers>::BindToNumaNode(int _node) {
+    return cpu::BindMemoryToNumaNode(cells_.get(), sizeof(Cell) * (mask_ + 1), _node);
+}
+
+template<class T, TConcurrency Producers, TConcurrency Consumers>
+size_t BoundedRingQueue<T, Producers, Consumers>::__RoundUpPowerOf2(size_t _n) {
+    size_t n = 2;
+    while (n < _n) {
+        n <<= 1;
+    }
+    return n;
+}
+
+}
@@ -0,0 +1,94 @@
+/**
+ * Checks that what AutoBuffer hands out for sending, i.e. Ptr() and
+ * Iovecs(), starts at the read cursor once DropFront() moved it, in
+ * contiguous mode as well as chained, and that RetainedSize() counts
+ * what pooled segments really hold.
+ *
+ * Usage: testautobuffer
+ */
+#include "autobuffer.h"
+#include "bufferpool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/uio.h>
+
+
+static void Expect(bool _ok, const char *_what) {
+    if (!_ok) {
+        fprintf(stderr, "FAILED: %s\n", _what);
+        exit(1);
+    }
+}
+
+/**
+ * @return: the bytes of @param{_buff} from @param{_offset} on, as gathered
+ *          from its iovecs.
+ */
+static std::string Gather(const AutoBuffer &_buff, size_t _offset) {
+    struct iovec iov[16];
+    int cnt = _buff.Iovecs(_offset, iov, 16);
+    std::string ret;
+    for (int i = 0; i < cnt; ++i) {
+        ret.append((const char *) iov[i].iov_base, iov[i].iov_len);
+    }
+    return ret;
+}
+
+static void TestContiguousDropFront() {
+    AutoBuffer buff;
+    std::string data = "GET / HTTP/1.1\r\n\r\nGET /next HTTP/1.1\r\n\r\n";
+    buff.Write(data.data(), data.size());
+
+    size_t first = strlen("GET / HTTP/1.1\r\n\r\n");
+    buff.DropFront(first);
+    Expect(buff.Length() == data.size() - first, "Length() after DropFront()");
+    Expect(memcmp(buff.Ptr(), data.data() + first, buff.Length()) == 0,
+           "Ptr() after DropFront()");
+    Expect(Gather(buff, 0) == data.substr(first), "Iovecs() after DropFront()");
+    Expect(Gather(buff, 4) == data.substr(first + 4), "Iovecs() at an offset after DropFront()");
+    Expect(Gather(buff, buff.Length()).empty(), "Iovecs() at the end");
+
+    // Appending after dropping keeps the live bytes in order.
+    buff.Write("tail", 4);
+    Expect(Gather(buff, 0) == data.substr(first) + "tail", "Iovecs() after DropFront() and Write()");
+
+    buff.DropFront(buff.Length());
+    Expect(buff.Length() == 0 && Gather(buff, 0).empty(), "Iovecs() once all dropped");
+}
+
+static void TestSegmented() {
+    AutoBuffer buff;
+    buff.SetSegmented(8);
+    std::string data = "0123456789abcdefghijklmnopqrstuvwxyz";
+    buff.Write(data.data(), data.size());
+
+    Expect(Gather(buff, 0) == data, "segmented Iovecs()");
+    Expect(Gather(buff, 11) == data.substr(11), "segmented Iovecs() at an offset");
+}
+
+static void TestSegmentedRetainedSize() {
+    BufferPool pool;
+    BufferPool::BindThread(&pool);
+    {
+        AutoBuffer buff;
+        size_t segment_size = 1000;
+        buff.SetSegmented(segment_size);
+        std::string data(segment_size + 1, 'x');
+        buff.Write(data.data(), data.size());
+        Expect(BufferPool::ClassSize(segment_size) > segment_size, "1000 not a size class");
+        Expect(buff.RetainedSize() == 2 * BufferPool::ClassSize(segment_size),
+               "RetainedSize() of pooled segments");
+    }
+    BufferPool::BindThread(nullptr);
+}
+
+
+int main() {
+    TestContiguousDropFront();
+    TestSegmented();
+    TestSegmentedRetainedSize();
+    printf("testautobuffer: passed\n");
+    return 0;
+}
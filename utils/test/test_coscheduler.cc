@@ -0,0 +1,53 @@
+/**
+ * Checks that CoScheduler::Spawn() reports a stack it could not map,
+ * running the task inline instead of crashing, and runs it as a
+ * coroutine otherwise.
+ *
+ * Usage: testcoscheduler
+ */
+#include "coroutine/coscheduler.h"
+#include <cstdio>
+#include <cstdlib>
+
+
+static void Expect(bool _ok, const char *_what) {
+    if (!_ok) {
+        fprintf(stderr, "FAILED: %s\n", _what);
+        exit(1);
+    }
+}
+
+static void TestStackNotMapped() {
+    // Beyond any address space, so that mmap(2) fails.
+    CoScheduler scheduler((size_t) 1 << 62);
+    bool is_run = false;
+    bool is_coroutine = true;
+    Expect(!scheduler.Spawn([&] {
+        is_run = true;
+        is_coroutine = CoScheduler::Current() != nullptr;
+        CoScheduler::Yield();   // acts inline.
+    }), "Spawn() with no stack mapped");
+    Expect(is_run && !is_coroutine, "task not run inline");
+    Expect(scheduler.InFlight() == 0, "inline task counted in flight");
+}
+
+static void TestSpawn() {
+    CoScheduler scheduler;
+    bool is_coroutine = false;
+    Expect(scheduler.Spawn([&] {
+        CoScheduler::Yield();
+        is_coroutine = CoScheduler::Current() != nullptr;
+    }), "Spawn()");
+    while (scheduler.InFlight() > 0) {
+        scheduler.RunReady();
+    }
+    Expect(is_coroutine, "task not run as a coroutine");
+}
+
+
+int main() {
+    TestStackNotMapped();
+    TestSpawn();
+    printf("testcoscheduler: passed\n");
+    return 0;
+}
@@ -1,13 +1,19 @@
 #include "thread.h"
 #include "log.h"
+#include "cpuutil.h"
 
 
+const int Thread::kNoNumaNode = -1;
+
 Thread::Thread()
         : thread_(nullptr)
-        , running_(false) {
+        , running_(false)
+        , numa_node_(kNoNumaNode) {
 }
 
 void Thread::Entry() {
+    __ApplyPlacement();
+    
     OnStart();
     
     running_ = true;
@@ -72,6 +78,26 @@ void Thread::HandleException(std::exception &ex) {
 
 bool Thread::IsRunning() const { return running_; }
 
+void Thread::SetCpuAffinity(const std::vector<int> &_cpus) { cpu_affinity_ = _cpus; }
+
+const std::vector<int> &Thread::CpuAffinity() const { return cpu_affinity_; }
+
+void Thread::SetNumaNode(int _node) { numa_node_ = _node; }
+
+int Thread::NumaNode() const { return numa_node_; }
+
+void Thread::__ApplyPlacement() {
+    if (!cpu_affinity_.empty()) {
+        cpu::SetThreadAffinity(cpu_affinity_);
+    }
+    if (numa_node_ != kNoNumaNode) {
+        // Memory first touched by this thread from now on is backed by
+        // this node, what was built before it started is bound by its
+        // owner, e.g. the queues of a NetThread.
+        cpu::SetThreadPreferredNumaNode(numa_node_);
+    }
+}
+
 void Thread::OnStop() {
     // implement if needed
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include <thread>
 #include <stdexcept>
+#include <vector>
 
 
 class Thread {
@@ -28,12 +29,35 @@ class Thread {
     bool IsRunning() const;
     
     std::thread::id Tid() const;
+    
+    /**
+     * Pins the thread to @param{_cpus} once it starts,
+     * call it before {@link Start()}.
+     */
+    void SetCpuAffinity(const std::vector<int> &_cpus);
+    
+    const std::vector<int> &CpuAffinity() const;
+    
+    /**
+     * Memory allocated by the thread is preferably placed on
+     * NUMA node @param{_node}, call it before {@link Start()}.
+     */
+    void SetNumaNode(int _node);
+    
+    int NumaNode() const;
 
+  private:
+    void __ApplyPlacement();
+
+  public:
+    static const int    kNoNumaNode;
   protected:
-    bool            running_;
+    bool                running_;
     
   private:
-    std::thread *   thread_;
+    std::thread       * thread_;
+    std::vector<int>    cpu_affinity_;
+    int                 numa_node_;
     
 };
 
@@ -12,6 +12,10 @@ uint64_t gettickcount() {
     return tp.time_since_epoch().count();
 }
 
+uint64_t gettickcountus() {
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
 void printcurrtime() {
     auto t = system_clock::to_time_t(system_clock::now());
     std::cout << std::put_time(std::localtime(&t), "%m-%d %H:%M:%S");
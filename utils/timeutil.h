@@ -6,6 +6,11 @@
 
 uint64_t gettickcount();
 
+/**
+ * Monotonic, in microseconds, for measuring short intervals.
+ */
+uint64_t gettickcountus();
+
 void printcurrtime();
 
 #endif //OI_SVR_TIMEUTIL_H
@@ -0,0 +1,248 @@
+#include "timingwheel.h"
+#include <utility>
+#include "timeutil.h"
+
+
+const uint64_t TimingWheel::kDefaultTickMills = 10;
+const int TimingWheel::kSlotBits = 6;
+const size_t TimingWheel::kSlotCnt = 1 << kSlotBits;
+const size_t TimingWheel::kSlotMask = kSlotCnt - 1;
+const int TimingWheel::kLevelCnt;
+// 2^24 ticks, about 46 hours with the default tick,
+// farther timers are parked at the farthest slot and re-cascaded.
+const uint64_t TimingWheel::kMaxDelta = 1ULL << (kSlotBits * kLevelCnt);
+
+
+TimingWheel::TimerNode::TimerNode()
+        : prev_(this)
+        , next_(this)
+        , expire_tick_(0)
+        , wheel_(nullptr)
+        , is_owned_(false)
+        , callback_(nullptr) {
+}
+
+TimingWheel::TimerNode::TimerNode(std::function<void()> _callback)
+        : TimerNode() {
+    callback_ = std::move(_callback);
+}
+
+TimingWheel::TimerNode::~TimerNode() {
+    if (wheel_) {
+        wheel_->Cancel(this);
+    }
+}
+
+void TimingWheel::TimerNode::SetCallback(std::function<void()> _callback) {
+    callback_ = std::move(_callback);
+}
+
+bool TimingWheel::TimerNode::IsScheduled() const { return wheel_ != nullptr; }
+
+
+TimingWheel::TimingWheel(uint64_t _tick_mills/* = kDefaultTickMills*/)
+        : tick_mills_(_tick_mills ? _tick_mills : kDefaultTickMills)
+        , curr_tick_(0)
+        , size_(0)
+        , slots_{nullptr} {
+    curr_tick_ = __TickOf(::gettickcount());
+    for (auto &level : slots_) {
+        level = new TimerNode[kSlotCnt];
+    }
+}
+
+void TimingWheel::Schedule(TimerNode *_node, uint64_t _after_mills) {
+    if (!_node) {
+        return;
+    }
+    uint64_t expire_tick = __TickOf(::gettickcount() + _after_mills + tick_mills_ - 1);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (_node->wheel_) {
+        __Unlink(_node);
+    }
+    // Ticks before curr_tick_ have been expired, fire at the next Expire().
+    _node->expire_tick_ = expire_tick < curr_tick_ ? curr_tick_ : expire_tick;
+    _node->wheel_ = this;
+    ++size_;
+    __Insert(_node);
+}
+
+void TimingWheel::RunAfter(uint64_t _after_mills, std::function<void()> _callback) {
+    auto neo = new TimerNode(std::move(_callback));
+    neo->is_owned_ = true;
+    Schedule(neo, _after_mills);
+}
+
+void TimingWheel::Cancel(TimerNode *_node) {
+    if (!_node) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (_node->wheel_ != this) {
+        return;
+    }
+    __Unlink(_node);
+    if (_node->is_owned_) {
+        delete _node;
+    }
+}
+
+size_t TimingWheel::Expire(uint64_t _now/* = 0*/) {
+    if (_now == 0) {
+        _now = ::gettickcount();
+    }
+    size_t fired = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    __Advance(__TickOf(_now));
+
+    while (expired_.next_ != &expired_) {
+        TimerNode *node = expired_.next_;
+        __Unlink(node);
+        bool is_owned = node->is_owned_;
+        // The callback may well destruct or reschedule the node.
+        std::function<void()> callback = is_owned ? std::move(node->callback_)
+                                                  : node->callback_;
+        if (is_owned) {
+            delete node;
+        }
+        lock.unlock();
+
+        if (callback) {
+            callback();
+        }
+        ++fired;
+
+        lock.lock();
+    }
+    return fired;
+}
+
+int TimingWheel::NextTimeout(uint64_t _now/* = 0*/) {
+    if (_now == 0) {
+        _now = ::gettickcount();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_ == 0) {
+        return -1;
+    }
+    if (expired_.next_ != &expired_) {
+        return 0;
+    }
+    // Up to the next cascade, a timer in the lowest level
+    // fires exactly at the tick of its slot.
+    uint64_t cascade_tick = (curr_tick_ | kSlotMask) + 1;
+    uint64_t tick = curr_tick_;
+    for (; tick < cascade_tick; ++tick) {
+        TimerNode *head = &slots_[0][tick & kSlotMask];
+        if (head->next_ != head) {
+            break;
+        }
+    }
+    uint64_t ts = tick * tick_mills_;
+    return ts <= _now ? 0 : (int) (ts - _now);
+}
+
+size_t TimingWheel::Size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
+
+void TimingWheel::__Insert(TimerNode *_node) {
+    uint64_t expire_tick = _node->expire_tick_;
+    uint64_t delta = expire_tick - curr_tick_;
+    if (delta >= kMaxDelta) {
+        // Placed at the farthest slot, re-inserted when cascaded.
+        delta = kMaxDelta - 1;
+        expire_tick = curr_tick_ + delta;
+    }
+    int level = 0;
+    while (delta >= (1ULL << (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+    size_t slot = (expire_tick >> (kSlotBits * level)) & kSlotMask;
+    __PushBack(&slots_[level][slot], _node);
+}
+
+void TimingWheel::__Unlink(TimerNode *_node) {
+    _node->prev_->next_ = _node->next_;
+    _node->next_->prev_ = _node->prev_;
+    _node->prev_ = _node->next_ = _node;
+    _node->wheel_ = nullptr;
+    --size_;
+}
+
+void TimingWheel::__PushBack(TimerNode *_head, TimerNode *_node) {
+    _node->prev_ = _head->prev_;
+    _node->next_ = _head;
+    _head->prev_->next_ = _node;
+    _head->prev_ = _node;
+}
+
+void TimingWheel::__Cascade(int _level, size_t _slot) {
+    TimerNode *head = &slots_[_level][_slot];
+    TimerNode *node = head->next_;
+    head->prev_ = head->next_ = head;
+    while (node != head) {
+        TimerNode *next = node->next_;
+        __Insert(node);
+        node = next;
+    }
+}
+
+void TimingWheel::__Advance(uint64_t _now_tick) {
+    if (size_ == 0) {
+        if (_now_tick >= curr_tick_) {
+            curr_tick_ = _now_tick + 1;
+        }
+        return;
+    }
+    while (curr_tick_ <= _now_tick) {
+        size_t idx = curr_tick_ & kSlotMask;
+        if (idx == 0) {
+            for (int level = 1; level < kLevelCnt; ++level) {
+                size_t slot = (curr_tick_ >> (kSlotBits * level)) & kSlotMask;
+                __Cascade(level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+        TimerNode *head = &slots_[0][idx];
+        TimerNode *node = head->next_;
+        head->prev_ = head->next_ = head;
+        while (node != head) {
+            TimerNode *next = node->next_;
+            if (node->expire_tick_ > curr_tick_) {
+                __Insert(node);     // parked beyond kMaxDelta.
+            } else {
+                __PushBack(&expired_, node);
+            }
+            node = next;
+        }
+        ++curr_tick_;
+    }
+}
+
+uint64_t TimingWheel::__TickOf(uint64_t _ts) const { return _ts / tick_mills_; }
+
+TimingWheel::~TimingWheel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto clear = [this] (TimerNode *_head) {
+        while (_head->next_ != _head) {
+            TimerNode *node = _head->next_;
+            __Unlink(node);
+            if (node->is_owned_) {
+                delete node;
+            }
+        }
+    };
+    for (auto &level : slots_) {
+        for (size_t i = 0; i < kSlotCnt; ++i) {
+            clear(&level[i]);
+        }
+        delete[] level, level = nullptr;
+    }
+    clear(&expired_);
+}
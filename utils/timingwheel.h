@@ -0,0 +1,121 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * Scheduling and cancelling a timer cost O(1), expiring costs
+ * O(expired) plus cascading one upper slot every 64 ticks, no matter
+ * how many timers are scheduled.
+ *
+ * Thread safe. Timers fire on the thread calling Expire(), and their
+ * callbacks may schedule or cancel any timer, including their own.
+ */
+class TimingWheel {
+  public:
+
+    /**
+     * An intrusive timer, embed it in whatever it times out.
+     */
+    class TimerNode {
+        friend class TimingWheel;
+
+      public:
+        TimerNode();
+
+        explicit TimerNode(std::function<void()> _callback);
+
+        /**
+         * Cancels itself if still scheduled.
+         */
+        ~TimerNode();
+
+        TimerNode(const TimerNode &) = delete;
+
+        TimerNode &operator=(const TimerNode &) = delete;
+
+        /**
+         * Do not call while scheduled.
+         */
+        void SetCallback(std::function<void()> _callback);
+
+        /**
+         * Not synchronised, meaningful only to the thread
+         * that schedules and expires this timer.
+         */
+        bool IsScheduled() const;
+
+      private:
+        TimerNode                 * prev_;
+        TimerNode                 * next_;
+        uint64_t                    expire_tick_;
+        TimingWheel               * wheel_;     // not null while scheduled.
+        bool                        is_owned_;  // allocated by RunAfter().
+        std::function<void()>       callback_;
+    };
+
+    explicit TimingWheel(uint64_t _tick_mills = kDefaultTickMills);
+
+    ~TimingWheel();
+
+    /**
+     * (Re)schedules @param{_node} to fire @param{_after_mills} later,
+     * rounded up to the tick.
+     */
+    void Schedule(TimerNode *_node, uint64_t _after_mills);
+
+    /**
+     * One-shot timer owned by the wheel.
+     */
+    void RunAfter(uint64_t _after_mills, std::function<void()> _callback);
+
+    void Cancel(TimerNode *_node);
+
+    /**
+     * Fires all timers expired by @param{_now}.
+     *
+     * @return: number of timers fired.
+     */
+    size_t Expire(uint64_t _now = 0);
+
+    /**
+     * @return: milliseconds until the next timer may fire,
+     *          -1 if none is scheduled, used as the epoll timeout.
+     */
+    int NextTimeout(uint64_t _now = 0);
+
+    size_t Size();
+
+    static const uint64_t       kDefaultTickMills;
+
+  private:
+    void __Insert(TimerNode *_node);
+
+    void __Unlink(TimerNode *_node);
+
+    static void __PushBack(TimerNode *_head, TimerNode *_node);
+
+    void __Cascade(int _level, size_t _slot);
+
+    void __Advance(uint64_t _now_tick);
+
+    uint64_t __TickOf(uint64_t _ts) const;
+
+  private:
+    static const int            kSlotBits;
+    static const size_t         kSlotCnt;
+    static const size_t         kSlotMask;
+    static const int            kLevelCnt = 4;
+    static const uint64_t       kMaxDelta;
+
+    uint64_t                    tick_mills_;
+    uint64_t                    curr_tick_;     // the next tick to be expired.
+    size_t                      size_;
+    TimerNode                 * slots_[kLevelCnt];
+    TimerNode                   expired_;
+    std::mutex                  mutex_;
+};
@@ -226,6 +226,20 @@ ValueLeaf *YamlDescriptor::GetLeaf(char const *_key) {
     return (ValueLeaf *) val;
 }
 
+ValueLeaf *YamlDescriptor::FindLeaf(char const *_key) {
+    assert(value->Type() == AbsValue::kObject);
+    for (auto &node : ((ValueObj *) value)->nodes) {
+        if (node->key == _key) {
+            if (node->value->Type() != AbsValue::kLeaf) {
+                LogE("key(%s) is not a leaf", _key)
+                throw NotAnYamlLeafException(_key);
+            }
+            return (ValueLeaf *) node->value;
+        }
+    }
+    return nullptr;
+}
+
 ValueArray *YamlDescriptor::GetArray(char const *_key) {
     assert(value->Type() == AbsValue::kObject);
     AbsValue *val = ((ValueObj *) value)->__Get(_key);
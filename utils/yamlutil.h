@@ -78,6 +78,13 @@ struct YamlDescriptor : public Node {
     
     ValueLeaf *GetLeaf(char const *_key);
     
+    /**
+     * Same as {@link GetLeaf()} but for optional fields.
+     *
+     * @return: nullptr if no such key.
+     */
+    ValueLeaf *FindLeaf(char const *_key);
+    
     ValueArray *GetArray(char const *_key);
     
     ValueObj *GetYmlObj(char const *_key);
@@ -1,10 +1,13 @@
 #include "webserver.h"
 #include "utils/log.h"
 #include "timeutil.h"
+#include "cpuutil.h"
 #include "http/httprequest.h"
 #include "websocketpacket.h"
 #include "netscenesvrheartbeat.pb.h"
 #include <cstring>
+#include <map>
+#include <thread>
 
 
 const char *const WebServer::ServerConfig::key_max_backlog("max_backlog");
@@ -13,6 +16,12 @@ const char *const WebServer::ServerConfig::key_reverse_proxy("reverse_proxy");
 const char *const WebServer::ServerConfig::key_ip("ip");
 const char *const WebServer::ServerConfig::key_is_send_heartbeat("send_heartbeat");
 const char *const WebServer::ServerConfig::key_heartbeat_period("heartbeat_period");
+const char *const WebServer::ServerConfig::key_worker_scheduling("worker_scheduling");
+const char *const WebServer::ServerConfig::kWorkerSchedulingStatic("static");
+const char *const WebServer::ServerConfig::kWorkerSchedulingStealing("work_stealing");
+const char *const WebServer::ServerConfig::key_worker_coroutine_cnt("worker_coroutine_cnt");
+const char *const WebServer::ServerConfig::key_coroutine_blocking_thread_cnt("coroutine_blocking_thread_cnt");
+const char *const WebServer::ServerConfig::key_coroutine_stack_kb("coroutine_stack_kb");
 const char *const WebServer::kConfigFile = "webserverconf.yml";
 const int WebServer::kDefaultHeartBeatPeriod = 60;
 
@@ -20,21 +29,40 @@ WebServer::ServerConfig::ServerConfig()
         : ServerBase::ServerConfigBase()
         , max_backlog(0)
         , worker_thread_cnt(0)
+        , is_work_stealing(false)
+        , worker_coroutine_cnt(0)
+        , coroutine_blocking_thread_cnt(0)
+        , coroutine_stack_size(SeparateStackProfile::kDefaultStackSize)
         , reverse_proxy_port(0)
         , is_send_heartbeat(false)
         , heartbeat_period(kDefaultHeartBeatPeriod) {
 }
 
 
-WebServer::WebServer() : ServerBase() {
+WebServer::WebServer()
+        : ServerBase()
+        , worker_pool_(nullptr) {
 }
 
 void WebServer::AfterConfig() {
     SetNetThreadImpl<NetThread>();
     
+    auto *config = (ServerConfig *) config_;
+    if (config->is_work_stealing) {
+        worker_pool_ = new WorkStealingPool(config->max_backlog);
+    }
+    if (config->worker_coroutine_cnt > 0 && config->coroutine_blocking_thread_cnt > 0) {
+        CoScheduler::SetBlockingThreadCnt(config->coroutine_blocking_thread_cnt);
+    }
+    if (config->worker_coroutine_cnt > 0) {
+        // Stacks beyond the coroutines ever alive at once would never be reused.
+        CoStackPool::Instance().SetMaxCached(config->worker_coroutine_cnt
+                                             * config->worker_thread_cnt);
+    }
     for (NetThreadBase *p : net_threads_) {
         auto *net_thread = (NetThread *) p;
-        net_thread->SetMaxBacklog(((ServerConfig *) config_)->max_backlog);
+        net_thread->SetMaxBacklog(config->max_backlog);
+        net_thread->SetWorkerPool(worker_pool_);
     }
     ServerBase::AfterConfig();
 }
@@ -55,29 +83,141 @@ void WebServer::SendHeartbeat() {
     std::string ba = req.SerializeAsString();
     
     auto *net_thread = ((NetThread *) net_threads_[0]);
-    auto conn = net_thread->MakeConnection(config->reverse_proxy_ip,
-                                           config->reverse_proxy_port);
-    if (!conn) {
-        LogE("reverse proxy down, give up sending heartbeat")
-        return;
+    // Connections are owned by the loop of the NetThread.
+    net_thread->RunInLoop([net_thread, config, ba]() mutable {
+        auto conn = net_thread->MakeConnection(config->reverse_proxy_ip,
+                                               config->reverse_proxy_port);
+        if (!conn) {
+            LogE("reverse proxy down, give up sending heartbeat")
+            return;
+        }
+        tcp::SendContext::Ptr send_ctx = conn->MakeSendContext();
+        http::request::Pack(config->reverse_proxy_ip, "/",
+                            nullptr, ba,
+                            send_ctx->buffer);
+        
+        net_thread->AsyncSend(send_ctx);
+        
+        LogD("pit pat")
+    });
+}
+
+WebServer::~WebServer() {
+    // Workers are joined by their NetThreads once Serve() returns.
+    delete worker_pool_, worker_pool_ = nullptr;
+}
+
+
+WebServer::WorkStealingPool::Task::Task()
+        : net_thread(nullptr) {
+}
+
+WebServer::WorkStealingPool::WorkStealingPool(size_t _queue_size)
+        : queue_size_(_queue_size)
+        , steals_(0)
+        , terminated_(false) {
+}
+
+WebServer::WorkStealingPool::~WorkStealingPool() {
+    for (TaskQueue *queue : queues_) {
+        delete queue;
     }
-    conn->MakeSendContext();
-    tcp::SendContext::Ptr send_ctx = conn->MakeSendContext();
-    http::request::Pack(config->reverse_proxy_ip, "/",
-                        nullptr, ba,
-                        send_ctx->buffer);
-    
-    NetThread::TrySendAndMarkPendingIfUndone(send_ctx);
-    
-    LogD("pit pat")
 }
 
-WebServer::~WebServer() = default;
+size_t WebServer::WorkStealingPool::AddWorker() {
+    queues_.push_back(new TaskQueue(queue_size_));
+    return queues_.size() - 1;
+}
+
+bool WebServer::WorkStealingPool::Push(size_t _idx, const Task &_task) {
+    if (!queues_[_idx]->push_back(_task, false)) {
+        return false;
+    }
+    // Whoever wakes up, the owner of the queue or a thief, takes it.
+    has_task_.Notify();
+    return true;
+}
+
+size_t WebServer::WorkStealingPool::Take(size_t _idx, size_t _n, std::vector<Task> &_out,
+                                         bool _wait /*= true*/) {
+    while (!IsTerminated()) {
+        size_t n = queues_[_idx]->pop_up_to(_n, _out, false);
+        if (n == 0) {
+            n = __Steal(_idx, _n, _out);
+        }
+        if (n > 0 || !_wait) {
+            return n;
+        }
+        uint32_t key = has_task_.PrepareWait();
+        if (__HasAny() || IsTerminated()) {
+            has_task_.CancelWait();
+            continue;
+        }
+        has_task_.Wait(key);
+    }
+    return 0;
+}
+
+size_t WebServer::WorkStealingPool::__Steal(size_t _thief, size_t _n,
+                                            std::vector<Task> &_out) {
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        TaskQueue *victim = queues_[(_thief + i) % queues_.size()];
+        size_t size = victim->size();
+        if (size == 0) {
+            continue;
+        }
+        // Half of it, so that the victim keeps busy as well.
+        size_t n = victim->pop_up_to(std::min(_n, (size + 1) / 2), _out, false);
+        if (n > 0) {
+            steals_.fetch_add(n, std::memory_order_relaxed);
+            return n;
+        }
+    }
+    return 0;
+}
+
+bool WebServer::WorkStealingPool::__HasAny() const {
+    for (TaskQueue *queue : queues_) {
+        if (queue->size() > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t WebServer::WorkStealingPool::Size(size_t _idx) const {
+    return queues_[_idx]->size();
+}
+
+uint64_t WebServer::WorkStealingPool::Steals() const {
+    return steals_.load(std::memory_order_relaxed);
+}
+
+void WebServer::WorkStealingPool::Terminate() {
+    terminated_.store(true, std::memory_order_seq_cst);
+    for (TaskQueue *queue : queues_) {
+        queue->Terminate();
+    }
+    has_task_.NotifyAll();
+}
+
+bool WebServer::WorkStealingPool::IsTerminated() const {
+    return terminated_.load(std::memory_order_acquire);
+}
+
+void WebServer::WorkStealingPool::BindToNumaNode(size_t _idx, int _node) {
+    queues_[_idx]->BindToNumaNode(_node);
+}
 
 
 WebServer::WorkerThread::WorkerThread()
         : net_thread_(nullptr)
-        , thread_seq_(__MakeWorkerThreadSeq()) {
+        , pool_(nullptr)
+        , pool_idx_(0)
+        , max_coroutines_(0)
+        , co_stack_size_(SeparateStackProfile::kDefaultStackSize)
+        , thread_seq_(__MakeWorkerThreadSeq())
+        , is_co_taking_(false) {
     
 }
 
@@ -89,39 +229,48 @@ void WebServer::WorkerThread::Run() {
     }
     LogI("Launching WorkerThread %d", thread_seq_)
     
+    if (max_coroutines_ > 0) {
+        __RunCoroutines();
+        running_ = false;
+        LogI("Worker%d terminate!", thread_seq_)
+        return;
+    }
+    
     auto recv_queue = net_thread_->GetRecvQueue();
-    auto send_queue = net_thread_->GetSendQueue();
+    std::vector<tcp::RecvContext::Ptr> recv_ctxs;
+    std::vector<WorkStealingPool::Task> tasks;
+    std::vector<tcp::SendContext::Ptr> responses;
     
     while (true) {
         
-        tcp::RecvContext::Ptr recv_ctx;
-        if (recv_queue->pop_front_to(recv_ctx)) {
-        
-            TApplicationProtocol app_proto =
-                    recv_ctx->application_packet->Protocol();
-            
-            if (app_proto == kHttp1_1 || app_proto == kWebSocket) {
-                
-                if (net_thread_->IsWorkerOverload()) {
-                    HandleOverload(recv_ctx);
-                } else {
-                    HandleImpl(recv_ctx);
-                }
-                tcp::SendContext::Ptr return_packet = recv_ctx->return_packet;
-    
-                send_queue->push_back(return_packet, false);
-        
-                if (app_proto == kWebSocket) {
-                    // ws may actively push messages to other connections.
-                    for (auto &send_ctx : recv_ctx->packets_push_others) {
-                        send_queue->push_back(send_ctx, false);
-                    }
+        if (pool_) {
+            tasks.clear();
+            if (pool_->Take(pool_idx_, kBatchSize, tasks) == 0) {
+                running_ = false;
+                break;
+            }
+            // Stolen tasks may belong to another NetThread.
+            NetThread *owner = tasks.front().net_thread;
+            for (WorkStealingPool::Task &task : tasks) {
+                if (task.net_thread != owner) {
+                    __Publish(owner, responses);
+                    owner = task.net_thread;
                 }
-                
-                net_thread_->NotifySend();
-                continue;
+                __Handle(task.recv_ctx, owner, responses);
             }
-            LogE("unknown application protocol: %d", app_proto)
+            __Publish(owner, responses);
+            continue;
+        }
+        
+        recv_ctxs.clear();
+        recv_queue->pop_up_to(kBatchSize, recv_ctxs);
+        
+        for (tcp::RecvContext::Ptr &recv_ctx : recv_ctxs) {
+            __Handle(recv_ctx, net_thread_, responses);
+        }
+        __Publish(net_thread_, responses);
+        if (!recv_ctxs.empty()) {
+            continue;
         }
         
         if (recv_queue->IsTerminated()) {
@@ -137,12 +286,133 @@ void WebServer::WorkerThread::Run() {
     LogI("Worker%d terminate!", thread_seq_)
 }
 
+/**
+ * As Run(), but each request is a coroutine, taken while fewer than
+ * max_coroutines_ are in flight. While all of them are parked, sleeps
+ * on co_wakeup_, which both the scheduler and the NetThread notify.
+ */
+void WebServer::WorkerThread::__RunCoroutines() {
+    CoScheduler scheduler(co_stack_size_, &co_wakeup_);
+    std::vector<WorkStealingPool::Task> tasks;
+    std::vector<tcp::RecvContext::Ptr> recv_ctxs;
+    // By the NetThread to send them, stolen requests may be of any.
+    std::map<NetThread *, std::vector<tcp::SendContext::Ptr>> responses;
+    bool is_terminated = false;
+    
+    while (!is_terminated || scheduler.InFlight() > 0) {
+        size_t room = max_coroutines_ - std::min(max_coroutines_, scheduler.InFlight());
+        // Sleeps for requests only if there is nothing else to do.
+        bool wait = scheduler.InFlight() == 0;
+        
+        tasks.clear();
+        if (room > 0 && !is_terminated) {
+            size_t n = std::min(room, kBatchSize);
+            if (pool_) {
+                pool_->Take(pool_idx_, n, tasks, wait);
+                is_terminated = tasks.empty() && pool_->IsTerminated();
+            } else {
+                recv_ctxs.clear();
+                net_thread_->GetRecvQueue()->pop_up_to(n, recv_ctxs, wait);
+                for (tcp::RecvContext::Ptr &recv_ctx : recv_ctxs) {
+                    tasks.emplace_back();
+                    tasks.back().recv_ctx = recv_ctx;
+                    tasks.back().net_thread = net_thread_;
+                }
+                is_terminated = tasks.empty() && net_thread_->GetRecvQueue()->IsTerminated();
+            }
+        }
+        for (WorkStealingPool::Task &task : tasks) {
+            tcp::RecvContext::Ptr recv_ctx = task.recv_ctx;
+            NetThread *owner = task.net_thread;
+            scheduler.Spawn([this, recv_ctx, owner, &responses] () mutable {
+                __Handle(recv_ctx, owner, responses[owner]);
+            });
+        }
+        
+        scheduler.RunReady();
+        for (auto &it : responses) {
+            __Publish(it.first, it.second);
+        }
+        
+        if (tasks.empty() && scheduler.InFlight() > 0) {
+            if (room > 0 && !is_terminated) {
+                is_co_taking_.store(true, std::memory_order_seq_cst);
+                scheduler.WaitReady(CoScheduler::Deadline::max(),
+                                    [this] { return __HasRequest(); });
+                is_co_taking_.store(false, std::memory_order_relaxed);
+            } else {
+                scheduler.WaitReady(CoScheduler::Deadline::max());
+            }
+        }
+    }
+}
+
+bool WebServer::WorkerThread::__HasRequest() const {
+    if (pool_) {
+        return pool_->Size(pool_idx_) > 0 || pool_->IsTerminated();
+    }
+    RecvQueue *recv_queue = net_thread_->GetRecvQueue();
+    return recv_queue->approx_size() > 0 || recv_queue->IsTerminated();
+}
+
+bool WebServer::WorkerThread::WakeForRequests() {
+    // Orders the requests queued before the load, pairs with
+    // the store before WaitReady() re-checks the queue.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!is_co_taking_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    return co_wakeup_.Notify();
+}
+
+void WebServer::WorkerThread::__Handle(tcp::RecvContext::Ptr &_recv_ctx, NetThread *_owner,
+                                       std::vector<tcp::SendContext::Ptr> &_responses) {
+    TApplicationProtocol app_proto = _recv_ctx->application_packet->Protocol();
+    
+    if (app_proto != kHttp1_1 && app_proto != kWebSocket) {
+        LogE("unknown application protocol: %d", app_proto)
+        return;
+    }
+    if (_owner->IsWorkerOverload()) {
+        HandleOverload(_recv_ctx);
+    } else {
+        HandleImpl(_recv_ctx);
+    }
+    _responses.push_back(_recv_ctx->return_packet);
+    
+    if (app_proto == kWebSocket) {
+        // ws may actively push messages to other connections.
+        for (auto &send_ctx : _recv_ctx->packets_push_others) {
+            _responses.push_back(send_ctx);
+        }
+    }
+}
+
+void WebServer::WorkerThread::__Publish(NetThread *_owner,
+                                        std::vector<tcp::SendContext::Ptr> &_responses) {
+    if (_responses.empty()) {
+        return;
+    }
+    _owner->PushSend(_responses);
+    _owner->NotifySend();
+}
+
 void WebServer::WorkerThread::BindNetThread(WebServer::NetThread *_net_thread) {
     if (_net_thread) {
         net_thread_ = _net_thread;
     }
 }
 
+void WebServer::WorkerThread::SetMaxCoroutines(size_t _n, size_t _stack_size) {
+    max_coroutines_ = _n;
+    co_stack_size_ = _stack_size;
+}
+
+void WebServer::WorkerThread::JoinPool(WorkStealingPool *_pool, size_t _idx) {
+    pool_ = _pool;
+    pool_idx_ = _idx;
+}
+
 void WebServer::WorkerThread::NotifyStop() {
     if (!net_thread_) {
         LogE("!net_thread_, notify failed")
@@ -151,6 +421,10 @@ void WebServer::WorkerThread::NotifyStop() {
     LogI("notify worker%d stop", thread_seq_)
     
     net_thread_->GetRecvQueue()->Terminate();
+    if (pool_) {
+        pool_->Terminate();
+    }
+    WakeForRequests();
 }
 
 int WebServer::WorkerThread::__MakeWorkerThreadSeq() {
@@ -163,21 +437,54 @@ int WebServer::WorkerThread::GetWorkerSeqNum() const { return thread_seq_; }
 WebServer::WorkerThread::~WorkerThread() = default;
 
 
+const size_t WebServer::WorkerThread::kBatchSize = 16;
+
 const size_t WebServer::NetThread::kDefaultMaxBacklog = 1024;
 
 WebServer::NetThread::NetThread()
         : NetThreadBase()
-        , max_backlog_(kDefaultMaxBacklog) {
+        , max_backlog_(kDefaultMaxBacklog)
+        , worker_pool_(nullptr)
+        , next_pool_queue_(0) {
     
 }
 
-bool WebServer::NetThread::IsWorkerOverload() { return recv_queue_.size() > max_backlog_ * 9 / 10; }
+bool WebServer::NetThread::IsWorkerOverload() { return __Queued() > max_backlog_ * 9 / 10; }
 
-bool WebServer::NetThread::IsWorkerFullyLoad() { return recv_queue_.size() >= max_backlog_; }
+bool WebServer::NetThread::IsWorkerFullyLoad() { return __Queued() >= max_backlog_; }
 
 size_t WebServer::NetThread::GetMaxBacklog() const { return max_backlog_; }
 
-size_t WebServer::NetThread::Backlog() { return recv_queue_.size(); }
+size_t WebServer::NetThread::Backlog() { return __Queued(); }
+
+size_t WebServer::NetThread::__Queued() const {
+    if (!worker_pool_) {
+        return recv_queue_.approx_size();
+    }
+    size_t queued = 0;
+    for (size_t idx : pool_queues_) {
+        queued += worker_pool_->Size(idx);
+    }
+    return queued;
+}
+
+void WebServer::NetThread::SetWorkerPool(WorkStealingPool *_pool) { worker_pool_ = _pool; }
+
+bool WebServer::NetThread::__PushToPool(const tcp::RecvContext::Ptr &_recv_ctx) {
+    WorkStealingPool::Task task;
+    task.recv_ctx = _recv_ctx;
+    task.net_thread = this;
+    for (size_t i = 0; i < pool_queues_.size(); ++i) {
+        size_t worker = next_pool_queue_;
+        next_pool_queue_ = (next_pool_queue_ + 1) % pool_queues_.size();
+        if (worker_pool_->Push(pool_queues_[worker], task)) {
+            // Idle workers are woken by Push, one with coroutines parked is not.
+            workers_[worker]->WakeForRequests();
+            return true;
+        }
+    }
+    return false;
+}
 
 void WebServer::NetThread::SetMaxBacklog(size_t _backlog) { max_backlog_ = _backlog; }
 
@@ -185,12 +492,17 @@ void WebServer::NetThread::NotifySend() {
     epoll_notifier_.NotifyEpoll(notification_send_);
 }
 
-bool WebServer::NetThread::CheckNotification(
-                EpollNotifier::Notification &_notification) {
-    if (__IsNotifySend(_notification)) {
-        return true;
+void WebServer::NetThread::PushSend(std::vector<tcp::SendContext::Ptr> &_send_ctxs) {
+    auto first = _send_ctxs.begin();
+    while (true) {
+        first += send_queue_.push_batch(first, _send_ctxs.end(), false);
+        if (first == _send_ctxs.end() || recv_queue_.IsTerminated()) {
+            break;     // once stopping, no one drains it any more.
+        }
+        NotifySend();
+        std::this_thread::yield();
     }
-    return false;
+    _send_ctxs.clear();
 }
 
 void WebServer::NetThread::HandleNotification(
@@ -201,11 +513,9 @@ void WebServer::NetThread::HandleNotification(
 }
 
 void WebServer::NetThread::HandleSend() {
-    tcp::SendContext::Ptr send_ctx;
-    while (send_queue_.pop_front_to(send_ctx, false)) {
-        LogD("fd(%d) doing send task", send_ctx->socket->FD())
-        TrySendAndMarkPendingIfUndone(send_ctx);
-    }
+    send_queue_.drain_all(sending_);
+    // e.g. a burst of WebSocket pushes to one connection takes one writev.
+    SendInBatch(sending_);
 }
 
 WebServer::RecvQueue *WebServer::NetThread::GetRecvQueue() { return &recv_queue_; }
@@ -216,6 +526,15 @@ void WebServer::NetThread::BindNewWorker(WebServer::WorkerThread *_worker) {
     if (_worker) {
         workers_.emplace_back(_worker);
         _worker->BindNetThread(this);
+        if (worker_pool_) {
+            size_t idx = worker_pool_->AddWorker();
+            _worker->JoinPool(worker_pool_, idx);
+            pool_queues_.push_back(idx);
+        }
+        // Workers share the NetThread's cores and memory node,
+        // so that packets handed over stay cache and NUMA local.
+        _worker->SetCpuAffinity(CpuAffinity());
+        _worker->SetNumaNode(NumaNode());
     }
 }
 
@@ -228,6 +547,14 @@ void WebServer::NetThread::OnStart() {
         LogE("call WebServer::SetWorker() to employ workers first!")
         assert(false);
     }
+    if (NumaNode() != kNoNumaNode) {
+        // Built by the main thread, so first touched on its node.
+        recv_queue_.BindToNumaNode(NumaNode());
+        send_queue_.BindToNumaNode(NumaNode());
+        for (size_t idx : pool_queues_) {
+            worker_pool_->BindToNumaNode(idx, NumaNode());
+        }
+    }
     // try launching all workers.
     for (auto & worker_thread : workers_) {
         worker_thread->Start();
@@ -240,6 +567,13 @@ void WebServer::NetThread::OnStop() {
 
 void WebServer::NetThread::__NotifyWorkersStop() {
     recv_queue_.Terminate();
+    if (worker_pool_) {
+        // Its workers may be stealing from the others, so all stop.
+        worker_pool_->Terminate();
+    }
+    for (WorkerThread *worker_thread : workers_) {
+        worker_thread->WakeForRequests();
+    }
     for (auto & worker_thread : workers_) {
         int seq = worker_thread->GetWorkerSeqNum();
         worker_thread->Join();
@@ -271,8 +605,8 @@ void WebServer::NetThread::UpgradeApplicationProtocol(tcp::ConnectionProfile *_c
                 && _conn->GetType() == tcp::kAcceptFrom) {
         LogI("fd(%d), uid: %u", fd, uid)
         
-        auto http_request = std::dynamic_pointer_cast<http::request::HttpRequest>(
-                _recv_ctx->application_packet);
+        auto *http_request = static_cast<http::request::HttpRequest *>(
+                _recv_ctx->application_packet.get());
         assert(http_request);
         http::HeaderField *headers = http_request->Headers();
         
@@ -297,8 +631,8 @@ bool WebServer::NetThread::HandleApplicationPacket(tcp::RecvContext::Ptr _recv_c
         TApplicationProtocol app_proto = _recv_ctx->application_packet->Protocol();
         
         if (app_proto == kWebSocket) {
-            auto ws_packet = std::dynamic_pointer_cast<ws::WebSocketPacket>(
-                        _recv_ctx->application_packet);
+            auto *ws_packet = static_cast<ws::WebSocketPacket *>(
+                        _recv_ctx->application_packet.get());
             uint8_t opcode = ws_packet->OpCode();
             
             
@@ -313,7 +647,18 @@ bool WebServer::NetThread::HandleApplicationPacket(tcp::RecvContext::Ptr _recv_c
             break;
         }
         
-        recv_queue_.push_back(_recv_ctx);
+        if (worker_pool_ ? !__PushToPool(_recv_ctx) : !recv_queue_.push_back(_recv_ctx)) {
+            LogE("recv queue full, drop connection directly: fd(%d), uid: %u", fd, uid)
+            break;
+        }
+        if (!worker_pool_) {
+            // As recv_queue_ wakes one idle worker, one with coroutines parked.
+            for (WorkerThread *worker_thread : workers_) {
+                if (worker_thread->WakeForRequests()) {
+                    break;
+                }
+            }
+        }
         return false;
         
     } while (false);
@@ -337,8 +682,40 @@ bool WebServer::_CustomConfig(yaml::YamlDescriptor *_desc) {
         yaml::ValueLeaf *max_backlog = _desc->GetLeaf(ServerConfig::key_max_backlog);
         max_backlog->To((int &) config->max_backlog);
     
-        yaml::ValueLeaf *worker_cnt = _desc->GetLeaf(ServerConfig::key_worker_thread_cnt);
-        worker_cnt->To((int &) config->worker_thread_cnt);
+        if (yaml::ValueLeaf *worker_cnt = _desc->FindLeaf(
+                    ServerConfig::key_worker_thread_cnt)) {
+            worker_cnt->To((int &) config->worker_thread_cnt);
+        }
+        std::string scheduling(ServerConfig::kWorkerSchedulingStatic);
+        if (yaml::ValueLeaf *leaf = _desc->FindLeaf(ServerConfig::key_worker_scheduling)) {
+            leaf->To(scheduling);
+        }
+        if (yaml::ValueLeaf *leaf = _desc->FindLeaf(ServerConfig::key_worker_coroutine_cnt)) {
+            leaf->To((int &) config->worker_coroutine_cnt);
+        }
+        if (yaml::ValueLeaf *leaf = _desc->FindLeaf(
+                    ServerConfig::key_coroutine_blocking_thread_cnt)) {
+            leaf->To((int &) config->coroutine_blocking_thread_cnt);
+        }
+        if (yaml::ValueLeaf *leaf = _desc->FindLeaf(ServerConfig::key_coroutine_stack_kb)) {
+            int stack_kb = 0;
+            leaf->To(stack_kb);
+            if (stack_kb > 0) {
+                config->coroutine_stack_size = (size_t) stack_kb * 1024;
+            }
+        }
+        if (scheduling == ServerConfig::kWorkerSchedulingStealing) {
+            config->is_work_stealing = true;
+        } else if (scheduling != ServerConfig::kWorkerSchedulingStatic) {
+            LogE("Illegal %s: %s", ServerConfig::key_worker_scheduling, scheduling.c_str())
+            return false;
+        }
+        if (config->worker_thread_cnt == 0) {
+            // Absent or 0: as many as available cpus, evenly among NetThreads.
+            size_t cpus = cpu::AvailableCpuCnt();
+            size_t per_net_thread = (cpus + config->net_thread_cnt - 1) / config->net_thread_cnt;
+            config->worker_thread_cnt = per_net_thread * config->net_thread_cnt;
+        }
     
         yaml::ValueObj *reverse_proxy = _desc->GetYmlObj(ServerConfig::key_reverse_proxy);
         reverse_proxy->GetLeaf(ServerConfig::key_ip)->To(config->reverse_proxy_ip);
@@ -351,8 +728,8 @@ bool WebServer::_CustomConfig(yaml::YamlDescriptor *_desc) {
         return false;
     }
     
-    if (config->worker_thread_cnt < 1) {
-        LogE("Illegal worker_thread_cnt: %zu", config->worker_thread_cnt)
+    if ((int) config->worker_thread_cnt < 1) {
+        LogE("Illegal worker_thread_cnt: %d", (int) config->worker_thread_cnt)
         return false;
     }
     if (config->worker_thread_cnt % config->net_thread_cnt != 0) {
@@ -361,8 +738,14 @@ bool WebServer::_CustomConfig(yaml::YamlDescriptor *_desc) {
     }
     if (config->worker_thread_cnt > 4 * config->net_thread_cnt) {
         LogW("Excessive proportion of worker_thread / net_thread "
-             "may lower performance of net_thread.")
-        // TODO CO-Routine
+             "may lower performance of net_thread, if it is for blocking "
+             "NetScenes, config %s instead.", ServerConfig::key_worker_coroutine_cnt)
+    }
+    if ((int) config->worker_coroutine_cnt < 0 || (int) config->coroutine_blocking_thread_cnt < 0) {
+        LogE("Illegal %s: %d, %s: %d", ServerConfig::key_worker_coroutine_cnt,
+             (int) config->worker_coroutine_cnt, ServerConfig::key_coroutine_blocking_thread_cnt,
+             (int) config->coroutine_blocking_thread_cnt)
+        return false;
     }
     if (config->max_backlog < 0) {
         LogE("Please config max_backlog a positive number.")
@@ -374,9 +757,12 @@ bool WebServer::_CustomConfig(yaml::YamlDescriptor *_desc) {
     }
     config->heartbeat_period *= 1000;   // ms => s
     
-    LogI("port: %d, net_thread_cnt: %zu, worker_thread_cnt: %zu, max_backlog: %zu, "
-         "reverse_proxy: [%s:%d], send_heart_beat: %d, heartbeat_period: %d",
+    LogI("port: %d, net_thread_cnt: %zu, worker_thread_cnt: %zu, work_stealing: %d, "
+         "worker_coroutine_cnt: %zu, coroutine_blocking_thread_cnt: %zu, coroutine_stack_size: %zu, "
+         "max_backlog: %zu, reverse_proxy: [%s:%d], send_heart_beat: %d, heartbeat_period: %d",
          config->port, config->net_thread_cnt, config->worker_thread_cnt,
+         config->is_work_stealing, config->worker_coroutine_cnt,
+         config->coroutine_blocking_thread_cnt, config->coroutine_stack_size,
          config->max_backlog, config->reverse_proxy_ip.c_str(), config->reverse_proxy_port,
          config->is_send_heartbeat, config->heartbeat_period)
     return true;
@@ -390,6 +776,9 @@ void WebServer::LoopingEpollWait() {
     if (((ServerConfig *) config_)->is_send_heartbeat) {
         SendHeartbeat();
     }
+    if (worker_pool_) {
+        LogI("worker pool: %lu requests stolen", worker_pool_->Steals())
+    }
 }
 
 int WebServer::EpollLoopInterval() {
@@ -3,6 +3,9 @@
 #include "networkmodel/serverbase.h"
 #include "netscenebase.h"
 #include "messagequeue.h"
+#include "ringqueue.h"
+#include "eventcount.h"
+#include "coroutine/coscheduler.h"
 #include "singleton.h"
 
 
@@ -14,6 +17,8 @@ class WebServer final : public ServerBase {
 
   public:
     
+    class WorkStealingPool;
+    
     void AfterConfig() override;
     
     const char *ConfigFile() override;
@@ -35,8 +40,20 @@ class WebServer final : public ServerBase {
         static const char *const    key_ip;
         static const char *const    key_is_send_heartbeat;
         static const char *const    key_heartbeat_period;
+        static const char *const    key_worker_scheduling;
+        static const char *const    kWorkerSchedulingStatic;
+        static const char *const    kWorkerSchedulingStealing;
+        static const char *const    key_worker_coroutine_cnt;
+        static const char *const    key_coroutine_blocking_thread_cnt;
+        static const char *const    key_coroutine_stack_kb;
         size_t                      max_backlog;
         size_t                      worker_thread_cnt;
+        /* Workers take requests of any NetThread, see WorkStealingPool. */
+        bool                        is_work_stealing;
+        /* NetScenes in flight per worker as coroutines, 0: none. */
+        size_t                      worker_coroutine_cnt;
+        size_t                      coroutine_blocking_thread_cnt;
+        size_t                      coroutine_stack_size;
         std::string                 reverse_proxy_ip;
         uint16_t                    reverse_proxy_port;
         bool                        is_send_heartbeat;
@@ -54,8 +71,34 @@ class WebServer final : public ServerBase {
         virtual void HandleOverload(tcp::RecvContext::Ptr) = 0;
     
         void BindNetThread(NetThread *_net_thread);
+        
+        /**
+         * Takes requests from queue @param{_idx} of @param{_pool}
+         * instead of the RecvQueue of the NetThread bound to.
+         */
+        void JoinPool(WorkStealingPool *_pool, size_t _idx);
+        
+        /**
+         * Runs each request as a coroutine, at most @param{_n} in flight,
+         * so that a NetScene parked in CoScheduler::Blocking() / Sleep()
+         * leaves the worker to the others. 0 (default): one by one.
+         * Call it before {@link Start()}.
+         *
+         * @param _stack_size: of each coroutine.
+         */
+        void SetMaxCoroutines(size_t _n,
+                              size_t _stack_size = SeparateStackProfile::kDefaultStackSize);
     
         void NotifyStop();
+        
+        /**
+         * Called by the NetThread after queueing requests this worker
+         * may take, wakes it if all its coroutines are parked and
+         * it has room for more.
+         *
+         * @return: false if it was not sleeping so.
+         */
+        bool WakeForRequests();
     
         int GetWorkerSeqNum() const;
         
@@ -64,16 +107,131 @@ class WebServer final : public ServerBase {
       private:
         static int __MakeWorkerThreadSeq();
         
+        /**
+         * Handles @param{_recv_ctx} of @param{_owner}, appending
+         * what is to be sent to @param{_responses}.
+         */
+        void __Handle(tcp::RecvContext::Ptr &_recv_ctx, NetThread *_owner,
+                      std::vector<tcp::SendContext::Ptr> &_responses);
+        
+        /**
+         * Hands @param{_responses} over to @param{_owner} by one push and one wakeup.
+         */
+        static void __Publish(NetThread *_owner,
+                              std::vector<tcp::SendContext::Ptr> &_responses);
+        
+        void __RunCoroutines();
+        
+        /**
+         * Lock-free, may be stale.
+         *
+         * @return: whether there are requests to take, or none ever will.
+         */
+        bool __HasRequest() const;
+        
       private:
+        /* Requests taken from the RecvQueue at once. */
+        static const size_t     kBatchSize;
         NetThread *             net_thread_;
+        WorkStealingPool *      pool_;
+        size_t                  pool_idx_;
+        size_t                  max_coroutines_;
+        size_t                  co_stack_size_;
         const int               thread_seq_;
+        /* Slept on while all coroutines are parked, notified both on a
+         * coroutine resumable and on requests queued, see WakeForRequests(). */
+        EventCount              co_wakeup_;
+        /* Sleeping on co_wakeup_ with room for more requests. */
+        std::atomic<bool>       is_co_taking_;
     };
     
     
+    /**
+     * Per-worker queues of requests, as opposed to one RecvQueue shared
+     * by the workers of a NetThread. A NetThread pushes onto the queues
+     * of its own workers in turn, and a worker finding its queue empty
+     * steals half of the queue of its first non-empty neighbour, so that
+     * connections unevenly spread over NetThreads keep all the workers
+     * busy. Responses still go back through the NetThread owning the
+     * connection.
+     *
+     * Idle workers sleep on one EventCount, woken one per request pushed.
+     */
+    class WorkStealingPool {
+      public:
+        struct Task {
+            Task();
+            
+            tcp::RecvContext::Ptr   recv_ctx;
+            NetThread             * net_thread;     // owner of the connection.
+        };
+        
+        /**
+         * @param _queue_size: requests each worker queues at most.
+         */
+        explicit WorkStealingPool(size_t _queue_size);
+        
+        ~WorkStealingPool();
+        
+        /**
+         * Call it before workers start.
+         *
+         * @return: index of the queue of the new worker.
+         */
+        size_t AddWorker();
+        
+        /**
+         * @return: false if queue @param{_idx} is full.
+         */
+        bool Push(size_t _idx, const Task &_task);
+        
+        /**
+         * Appends at most @param{_n} tasks to @param{_out}, from queue
+         * @param{_idx} first, then stolen, sleeping till there is any
+         * if @param{_wait}.
+         *
+         * @return: tasks taken, 0 once terminated.
+         */
+        size_t Take(size_t _idx, size_t _n, std::vector<Task> &_out, bool _wait = true);
+        
+        /**
+         * Lock-free, may be stale.
+         */
+        size_t Size(size_t _idx) const;
+        
+        /**
+         * @return: tasks taken from the queues of other workers, lock-free.
+         */
+        uint64_t Steals() const;
+        
+        void Terminate();
+        
+        bool IsTerminated() const;
+        
+        /**
+         * Moves queue @param{_idx} to NUMA node @param{_node}.
+         */
+        void BindToNumaNode(size_t _idx, int _node);
+      
+      private:
+        size_t __Steal(size_t _thief, size_t _n, std::vector<Task> &_out);
+        
+        bool __HasAny() const;
+        
+      private:
+        using TaskQueue = MessageQueue::BoundedRingQueue<Task>;
+        const size_t                queue_size_;
+        std::vector<TaskQueue *>    queues_;
+        EventCount                  has_task_;
+        std::atomic<uint64_t>       steals_;
+        std::atomic<bool>           terminated_;
+    };
+    
     /**
      *
      * Sets the Worker-class who handles the business logic of all request,
-     * by default one WorkerThread corresponds to one NetThread.
+     * by default one WorkerThread corresponds to one NetThread, or to all
+     * of them if worker_scheduling is work_stealing.
      *
      * The workers' lifecycle is managed by the Unixtar framework,
      * just implement WorkerThread's {@func HandleImpl} and
@@ -87,14 +245,19 @@ class WebServer final : public ServerBase {
         
         for (int i = 0; i < conf->worker_thread_cnt; ++i) {
             auto worker = new WorkerImpl(_init_args...);
+            worker->SetMaxCoroutines(conf->worker_coroutine_cnt, conf->coroutine_stack_size);
             size_t idx = i % conf->net_thread_cnt;
             auto net_thread = net_threads_[idx];
             ((NetThread *) net_thread)->BindNewWorker(worker);
         }
     }
     
-    using RecvQueue = MessageQueue::ThreadSafeDeque<tcp::RecvContext::Ptr>;
-    using SendQueue = MessageQueue::ThreadSafeDeque<tcp::SendContext::Ptr>;
+    /* Lock-free, pushed by the NetThread, popped by its workers. */
+    using RecvQueue = MessageQueue::BoundedRingQueue<tcp::RecvContext::Ptr,
+                            MessageQueue::kSingle, MessageQueue::kMulti>;
+    /* Lock-free, pushed by the workers, drained by their NetThread. */
+    using SendQueue = MessageQueue::BoundedRingQueue<tcp::SendContext::Ptr,
+                            MessageQueue::kMulti, MessageQueue::kSingle>;
     
   private:
     
@@ -111,7 +274,7 @@ class WebServer final : public ServerBase {
     
         size_t GetMaxBacklog() const;
         
-        size_t Backlog();
+        size_t Backlog() override;
     
         /**
          * @param _backlog: The maximum backlog for waiting queue (which holds
@@ -119,11 +282,19 @@ class WebServer final : public ServerBase {
          *                  processed by the WorkerThread).
          */
         void SetMaxBacklog(size_t _backlog);
+        
+        /**
+         * Queues requests onto @param{_pool} rather than recv_queue_,
+         * call it before binding workers.
+         */
+        void SetWorkerPool(WorkStealingPool *_pool);
     
+        /**
+         * Called by WorkerThreads after pushing to the SendQueue,
+         * posts made before the NetThread gets round to it are coalesced.
+         */
         void NotifySend();
         
-        bool CheckNotification(EpollNotifier::Notification &) override;
-        
         void HandleNotification(EpollNotifier::Notification &) override;
     
         void HandleSend();
@@ -144,6 +315,15 @@ class WebServer final : public ServerBase {
                                         const tcp::RecvContext::Ptr &) override;
     
         bool HandleApplicationPacket(tcp::RecvContext::Ptr) override;
+        
+        /**
+         * Called by WorkerThreads, retries till all of @param{_send_ctxs}
+         * fit into the bounded SendQueue, waking this NetThread up to
+         * drain it meanwhile, so that a response is never dropped.
+         *
+         * @param _send_ctxs: cleared once pushed.
+         */
+        void PushSend(std::vector<tcp::SendContext::Ptr> &_send_ctxs);
 
         void HandleException(std::exception &ex) override;
 
@@ -152,13 +332,29 @@ class WebServer final : public ServerBase {
         
         bool __IsNotifySend(EpollNotifier::Notification &) const;
         
+        /**
+         * Requests waiting for workers, lock-free.
+         */
+        size_t __Queued() const;
+        
+        /**
+         * Onto the queue of the next worker of this NetThread not full.
+         */
+        bool __PushToPool(const tcp::RecvContext::Ptr &_recv_ctx);
+        
       private:
         EpollNotifier::Notification         notification_send_;
         RecvQueue                           recv_queue_;
         size_t                              max_backlog_;
         static const size_t                 kDefaultMaxBacklog;
         SendQueue                           send_queue_;
-        std::list<WorkerThread *>           workers_;
+        /* Drained from send_queue_ per round, reused to save allocations. */
+        std::vector<tcp::SendContext::Ptr>  sending_;
+        std::vector<WorkerThread *>         workers_;
+        WorkStealingPool                  * worker_pool_;
+        /* Pool queues of workers_, by the same index, pushed onto in turn. */
+        std::vector<size_t>                 pool_queues_;
+        size_t                              next_pool_queue_;
         
         friend class WebServer;
     };
@@ -169,6 +365,7 @@ class WebServer final : public ServerBase {
     bool _CustomConfig(yaml::YamlDescriptor *_desc) override;
     
   private:
+    WorkStealingPool          * worker_pool_;
     static const char* const    kConfigFile;
     static const int            kDefaultHeartBeatPeriod;
 };